@@ -0,0 +1,229 @@
+// Copyright lowRISC contributors.
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+
+#include "dpi_checkpoint.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <svdpi.h>
+
+/**
+ * A region of a context's state
+ */
+struct dpi_checkpoint_region {
+  void *ptr;
+  size_t len;
+};
+
+/**
+ * A registered context
+ */
+struct dpi_checkpoint_entry {
+  // Name of the SystemVerilog scope that created the context
+  char *name;
+  void *ctx;
+  struct dpi_checkpoint_region *regions;
+  size_t num_regions;
+};
+
+/**
+ * A mapping from a context handle in the saving process to a live context
+ */
+struct dpi_checkpoint_reloc {
+  void *old_ctx;
+  void *new_ctx;
+};
+
+static struct dpi_checkpoint_entry *entries = NULL;
+static size_t num_entries = 0;
+
+static struct dpi_checkpoint_reloc *relocs = NULL;
+static size_t num_relocs = 0;
+
+static struct dpi_checkpoint_entry *find_by_ctx(void *ctx) {
+  for (size_t i = 0; i < num_entries; ++i) {
+    if (entries[i].ctx == ctx) {
+      return &entries[i];
+    }
+  }
+  return NULL;
+}
+
+static struct dpi_checkpoint_entry *find_by_name(const char *name) {
+  for (size_t i = 0; i < num_entries; ++i) {
+    if (strcmp(entries[i].name, name) == 0) {
+      return &entries[i];
+    }
+  }
+  return NULL;
+}
+
+void dpi_checkpoint_register(void *ctx, void *state, size_t state_len) {
+  assert(ctx);
+
+  struct dpi_checkpoint_entry *entry = find_by_ctx(ctx);
+  if (!entry) {
+    svScope scope = svGetScope();
+    assert(scope && "dpi_checkpoint_register must be called from a DPI call.");
+    const char *name = svGetNameFromScope(scope);
+    assert(name);
+    assert(!find_by_name(name) && "Scope already has a registered context.");
+
+    entries = (struct dpi_checkpoint_entry *)realloc(
+        entries, (num_entries + 1) * sizeof(struct dpi_checkpoint_entry));
+    assert(entries);
+
+    entry = &entries[num_entries++];
+    entry->name = strdup(name);
+    assert(entry->name);
+    entry->ctx = ctx;
+    entry->regions = NULL;
+    entry->num_regions = 0;
+  }
+
+  if (state_len == 0) {
+    return;
+  }
+
+  assert(state);
+  entry->regions = (struct dpi_checkpoint_region *)realloc(
+      entry->regions,
+      (entry->num_regions + 1) * sizeof(struct dpi_checkpoint_region));
+  assert(entry->regions);
+  entry->regions[entry->num_regions].ptr = state;
+  entry->regions[entry->num_regions].len = state_len;
+  ++entry->num_regions;
+}
+
+void dpi_checkpoint_unregister(void *ctx) {
+  struct dpi_checkpoint_entry *entry = find_by_ctx(ctx);
+  if (!entry) {
+    return;
+  }
+
+  free(entry->name);
+  free(entry->regions);
+  *entry = entries[--num_entries];
+
+  // Drop any relocations to the context, so a stale handle can't be resolved
+  // to freed memory.
+  for (size_t i = 0; i < num_relocs;) {
+    if (relocs[i].new_ctx == ctx) {
+      relocs[i] = relocs[--num_relocs];
+    } else {
+      ++i;
+    }
+  }
+}
+
+void *dpi_checkpoint_resolve(void *ctx) {
+  for (size_t i = 0; i < num_relocs; ++i) {
+    if (relocs[i].old_ctx == ctx) {
+      return relocs[i].new_ctx;
+    }
+  }
+  return ctx;
+}
+
+static void write_u64(dpi_checkpoint_write_fn write_fn, void *stream,
+                      uint64_t val) {
+  write_fn(stream, &val, sizeof val);
+}
+
+static uint64_t read_u64(dpi_checkpoint_read_fn read_fn, void *stream) {
+  uint64_t val;
+  read_fn(stream, &val, sizeof val);
+  return val;
+}
+
+void dpi_checkpoint_save(dpi_checkpoint_write_fn write_fn, void *stream) {
+  assert(write_fn);
+
+  write_u64(write_fn, stream, num_entries);
+  for (size_t i = 0; i < num_entries; ++i) {
+    const struct dpi_checkpoint_entry *entry = &entries[i];
+    size_t name_len = strlen(entry->name);
+
+    write_u64(write_fn, stream, name_len);
+    write_fn(stream, entry->name, name_len);
+    write_u64(write_fn, stream, (uintptr_t)entry->ctx);
+    write_u64(write_fn, stream, entry->num_regions);
+    for (size_t j = 0; j < entry->num_regions; ++j) {
+      write_u64(write_fn, stream, entry->regions[j].len);
+      write_fn(stream, entry->regions[j].ptr, entry->regions[j].len);
+    }
+  }
+}
+
+bool dpi_checkpoint_restore(dpi_checkpoint_read_fn read_fn, void *stream) {
+  assert(read_fn);
+
+  uint64_t saved_entries = read_u64(read_fn, stream);
+  if (saved_entries != num_entries) {
+    fprintf(stderr,
+            "DPI checkpoint: Checkpoint has %llu DPI contexts, but the "
+            "simulation has %zu.\n",
+            (unsigned long long)saved_entries, num_entries);
+    return false;
+  }
+
+  free(relocs);
+  relocs = (struct dpi_checkpoint_reloc *)calloc(
+      num_entries ? num_entries : 1, sizeof(struct dpi_checkpoint_reloc));
+  assert(relocs);
+  num_relocs = 0;
+
+  for (uint64_t i = 0; i < saved_entries; ++i) {
+    uint64_t name_len = read_u64(read_fn, stream);
+    char *name = (char *)malloc(name_len + 1);
+    assert(name);
+    read_fn(stream, name, name_len);
+    name[name_len] = '\0';
+
+    struct dpi_checkpoint_entry *entry = find_by_name(name);
+    if (!entry) {
+      fprintf(stderr,
+              "DPI checkpoint: No DPI context in the simulation matches `%s'.\n",
+              name);
+      free(name);
+      return false;
+    }
+
+    void *old_ctx = (void *)(uintptr_t)read_u64(read_fn, stream);
+
+    uint64_t num_regions = read_u64(read_fn, stream);
+    if (num_regions != entry->num_regions) {
+      fprintf(stderr,
+              "DPI checkpoint: Context for `%s' has %llu state regions in the "
+              "checkpoint, but %zu in the simulation.\n",
+              name, (unsigned long long)num_regions, entry->num_regions);
+      free(name);
+      return false;
+    }
+
+    for (size_t j = 0; j < entry->num_regions; ++j) {
+      uint64_t len = read_u64(read_fn, stream);
+      if (len != entry->regions[j].len) {
+        fprintf(stderr,
+                "DPI checkpoint: State region %zu for `%s' has length %llu in "
+                "the checkpoint, but %zu in the simulation.\n",
+                j, name, (unsigned long long)len, entry->regions[j].len);
+        free(name);
+        return false;
+      }
+      read_fn(stream, entry->regions[j].ptr, len);
+    }
+
+    relocs[num_relocs].old_ctx = old_ctx;
+    relocs[num_relocs].new_ctx = entry->ctx;
+    ++num_relocs;
+
+    free(name);
+  }
+
+  return true;
+}
@@ -0,0 +1,101 @@
+// Copyright lowRISC contributors.
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef OPENTITAN_HW_DV_DPI_COMMON_DPI_CHECKPOINT_DPI_CHECKPOINT_H_
+#define OPENTITAN_HW_DV_DPI_COMMON_DPI_CHECKPOINT_DPI_CHECKPOINT_H_
+
+/**
+ * Functions to save and restore the state of DPI model contexts
+ *
+ * DPI models allocate a context in C and hand it to SystemVerilog as a
+ * chandle. When a simulation is restored from a checkpoint, the chandles held
+ * by the model contain pointers from the process that saved the checkpoint.
+ * This registry lets the contexts created by the restoring process take over
+ * from the saved ones.
+ *
+ * A model registers its context (and the parts of it that make up its
+ * simulation state) in its create function. Every DPI function that takes a
+ * context from SystemVerilog passes it through dpi_checkpoint_resolve() before
+ * using it. File descriptors, sockets and other host resources are not part of
+ * the checkpoint: the restoring process creates its own.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * Callbacks used to write and read checkpoint data
+ *
+ * @param stream Opaque stream pointer passed to dpi_checkpoint_save() or
+ *               dpi_checkpoint_restore()
+ * @param data   Buffer to write from or read into
+ * @param len    Number of bytes to transfer
+ */
+typedef void (*dpi_checkpoint_write_fn)(void *stream, const void *data,
+                                        size_t len);
+typedef void (*dpi_checkpoint_read_fn)(void *stream, void *data, size_t len);
+
+/**
+ * Register a region of a context's state to be checkpointed
+ *
+ * This must be called from a function that was called from SystemVerilog
+ * (typically the model's create function): the calling scope is used to match
+ * up contexts between the saving and restoring processes. It may be called
+ * more than once for a context to register several regions; a region length of
+ * zero registers the context without any state.
+ *
+ * @param ctx       The context, as passed to SystemVerilog
+ * @param state     Start of the region
+ * @param state_len Length of the region in bytes
+ */
+void dpi_checkpoint_register(void *ctx, void *state, size_t state_len);
+
+/**
+ * Remove a context from the registry
+ *
+ * Call from the model's close function before freeing the context.
+ *
+ * @param ctx The context, after passing through dpi_checkpoint_resolve()
+ */
+void dpi_checkpoint_unregister(void *ctx);
+
+/**
+ * Translate a context handle received from SystemVerilog
+ *
+ * After a restore, this maps handles from the saving process to the
+ * corresponding contexts in this process. Otherwise, it returns ctx unchanged.
+ *
+ * @param ctx A context handle passed from SystemVerilog
+ * @return The context to use
+ */
+void *dpi_checkpoint_resolve(void *ctx);
+
+/**
+ * Write the state of all registered contexts
+ *
+ * @param write_fn Callback used to write the data
+ * @param stream   Passed through to write_fn
+ */
+void dpi_checkpoint_save(dpi_checkpoint_write_fn write_fn, void *stream);
+
+/**
+ * Read state written by dpi_checkpoint_save() into the registered contexts
+ *
+ * Every context in the checkpoint must have a registered counterpart with the
+ * same scope and state layout, and vice versa.
+ *
+ * @param read_fn Callback used to read the data
+ * @param stream  Passed through to read_fn
+ * @return true on success. On failure, prints a message to stderr.
+ */
+bool dpi_checkpoint_restore(dpi_checkpoint_read_fn read_fn, void *stream);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+#endif  // OPENTITAN_HW_DV_DPI_COMMON_DPI_CHECKPOINT_DPI_CHECKPOINT_H_
@@ -0,0 +1,98 @@
+// Copyright lowRISC contributors.
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+
+#include "jtag_batch.h"
+
+#include <assert.h>
+#include <string.h>
+
+static uint32_t vec_bytes(const struct jtag_batch *batch) {
+  return (batch->num_bits + 7) / 8;
+}
+
+static bool get_bit(const uint8_t *vec, uint32_t idx) {
+  return (vec[idx / 8] >> (idx % 8)) & 1;
+}
+
+void jtag_batch_reset(struct jtag_batch *batch) {
+  assert(batch);
+  batch->state = JtagBatchIdle;
+  batch->num_bits = 0;
+  batch->recv_len = 0;
+  batch->pos = 0;
+}
+
+void jtag_batch_begin(struct jtag_batch *batch) {
+  assert(batch);
+  assert(batch->state == JtagBatchIdle);
+  jtag_batch_reset(batch);
+  batch->state = JtagBatchReceiving;
+}
+
+bool jtag_batch_receive(struct jtag_batch *batch, struct tcp_server_ctx *sock) {
+  assert(batch);
+  assert(batch->state == JtagBatchReceiving);
+
+  // The 16-bit length comes first
+  while (batch->recv_len < sizeof(batch->hdr)) {
+    size_t got = tcp_server_read_block(
+        sock, (char *)&batch->hdr[batch->recv_len],
+        sizeof(batch->hdr) - batch->recv_len);
+    if (!got) {
+      return false;
+    }
+    batch->recv_len += got;
+    if (batch->recv_len == sizeof(batch->hdr)) {
+      batch->num_bits = batch->hdr[0] | ((uint32_t)batch->hdr[1] << 8);
+    }
+  }
+
+  // Then the TMS and TDI vectors
+  uint32_t msg_len = sizeof(batch->hdr) + 2 * vec_bytes(batch);
+  while (batch->recv_len < msg_len) {
+    uint32_t vec_off = batch->recv_len - sizeof(batch->hdr);
+    size_t got = tcp_server_read_block(sock, (char *)&batch->vec[vec_off],
+                                       msg_len - batch->recv_len);
+    if (!got) {
+      return false;
+    }
+    batch->recv_len += got;
+  }
+
+  memset(batch->tdo, 0, vec_bytes(batch));
+  batch->pos = 0;
+  batch->state = JtagBatchRunning;
+  return true;
+}
+
+void jtag_batch_get(const struct jtag_batch *batch, bool *tms, bool *tdi) {
+  assert(batch);
+  assert(batch->state == JtagBatchRunning);
+  assert(batch->pos < batch->num_bits);
+
+  *tms = get_bit(batch->vec, batch->pos);
+  *tdi = get_bit(&batch->vec[vec_bytes(batch)], batch->pos);
+}
+
+void jtag_batch_put_tdo(struct jtag_batch *batch, bool tdo) {
+  assert(batch);
+  assert(batch->state == JtagBatchRunning);
+  assert(batch->pos < batch->num_bits);
+
+  if (tdo) {
+    batch->tdo[batch->pos / 8] |= 1 << (batch->pos % 8);
+  }
+  ++batch->pos;
+}
+
+bool jtag_batch_done(const struct jtag_batch *batch) {
+  assert(batch);
+  return batch->state == JtagBatchRunning && batch->pos == batch->num_bits;
+}
+
+void jtag_batch_finish(struct jtag_batch *batch, struct tcp_server_ctx *sock) {
+  assert(jtag_batch_done(batch));
+  tcp_server_write_block(sock, (const char *)batch->tdo, vec_bytes(batch));
+  jtag_batch_reset(batch);
+}
@@ -0,0 +1,119 @@
+// Copyright lowRISC contributors.
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef OPENTITAN_HW_DV_DPI_COMMON_JTAG_BATCH_JTAG_BATCH_H_
+#define OPENTITAN_HW_DV_DPI_COMMON_JTAG_BATCH_JTAG_BATCH_H_
+
+/**
+ * A batched JTAG shift protocol, spoken on the same TCP port as OpenOCD's
+ * remote_bitbang protocol
+ *
+ * A remote_bitbang client sends one byte for each edge of TCK and another to
+ * read TDO. A batched client sends a whole shift sequence in one message:
+ *
+ *   'X' <n: 16 bits, little-endian> <TMS: ceil(n/8) bytes> <TDI: ceil(n/8)>
+ *
+ * Bit i of the TMS and TDI vectors (bit i % 8 of byte i / 8) gives the value
+ * for the i'th TCK cycle. 'X' isn't a remote_bitbang command, so the two
+ * protocols can be mixed freely on one connection.
+ *
+ * For each cycle, the model drives TMS and TDI with TCK low, samples TDO and
+ * then raises TCK. After the last cycle, TCK is driven low again. When all n
+ * cycles are done, the model replies with the sampled TDO values, packed in
+ * the same way as TMS and TDI (ceil(n/8) bytes).
+ *
+ * The functions below handle the message framing. The model steps through the
+ * cycles at its own pace (one cycle per simulated clock or faster).
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "tcp_server.h"
+
+/** Command byte that starts a batched shift message */
+#define JTAG_BATCH_CMD 'X'
+
+/** Maximum number of TCK cycles in a single message */
+#define JTAG_BATCH_MAX_BITS 65535
+
+#define JTAG_BATCH_MAX_BYTES ((JTAG_BATCH_MAX_BITS + 7) / 8)
+
+/**
+ * Suggested TCP server buffer size for a model that supports batching, large
+ * enough to hold a whole message in each direction.
+ */
+#define JTAG_BATCH_TCP_BUFSIZE (4 * JTAG_BATCH_MAX_BYTES)
+
+enum jtag_batch_state {
+  JtagBatchIdle,       // No message in progress
+  JtagBatchReceiving,  // Message started, but not all received yet
+  JtagBatchRunning     // Message received, cycles being run
+};
+
+struct jtag_batch {
+  enum jtag_batch_state state;
+  // Number of TCK cycles in the message
+  uint32_t num_bits;
+  // Number of bytes of the message (after the command byte) received so far
+  uint32_t recv_len;
+  // Index of the next cycle to run
+  uint32_t pos;
+  uint8_t hdr[2];
+  // TMS vector, followed by TDI vector, each ceil(num_bits/8) bytes
+  uint8_t vec[2 * JTAG_BATCH_MAX_BYTES];
+  uint8_t tdo[JTAG_BATCH_MAX_BYTES];
+};
+
+/**
+ * Reset batch to the idle state
+ */
+void jtag_batch_reset(struct jtag_batch *batch);
+
+/**
+ * Start a new message
+ *
+ * Call this when the model reads a JTAG_BATCH_CMD byte from the client.
+ */
+void jtag_batch_begin(struct jtag_batch *batch);
+
+/**
+ * Receive as much of the message as is available without blocking
+ *
+ * @return true once the whole message has been received (and batch is in the
+ *         JtagBatchRunning state)
+ */
+bool jtag_batch_receive(struct jtag_batch *batch, struct tcp_server_ctx *sock);
+
+/**
+ * Get the TMS and TDI values for the next cycle
+ *
+ * Only valid in the JtagBatchRunning state, when jtag_batch_done() is false.
+ */
+void jtag_batch_get(const struct jtag_batch *batch, bool *tms, bool *tdi);
+
+/**
+ * Record the TDO value for the current cycle and move to the next one
+ */
+void jtag_batch_put_tdo(struct jtag_batch *batch, bool tdo);
+
+/**
+ * Have all the cycles of a running message been run?
+ */
+bool jtag_batch_done(const struct jtag_batch *batch);
+
+/**
+ * Send the TDO vector for a finished message to the client and go back to the
+ * idle state
+ */
+void jtag_batch_finish(struct jtag_batch *batch, struct tcp_server_ctx *sock);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+#endif  // OPENTITAN_HW_DV_DPI_COMMON_JTAG_BATCH_JTAG_BATCH_H_
@@ -0,0 +1,710 @@
+// Copyright lowRISC contributors.
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE  // memfd_create()
+#endif
+
+#include "shm_ring.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+static const uint32_t SHM_RING_MAGIC = 0x474e5253;  // "SRNG"
+static const uint32_t SHM_RING_VERSION = 1;
+static const size_t SHM_RING_MIN_BUFSIZE = 4096;
+
+#define SHM_RING_CACHE_LINE 64
+
+// Index of each side in the shared header
+enum { SHM_RING_SERVER = 0, SHM_RING_CLIENT = 1 };
+
+/**
+ * Pointers of one single-producer, single-consumer ring
+ *
+ * As for the rings in tcp_server, the pointers run freely and are reduced
+ * modulo the size when indexing, the producer publishes wptr with a release
+ * store after writing the data and the consumer does the same for rptr. They
+ * sit on separate cache lines so the two processes don't fight over one.
+ */
+struct shm_ring_ptrs {
+  uint64_t wptr;  // Only written by the producer
+  char pad0[SHM_RING_CACHE_LINE - sizeof(uint64_t)];
+  uint64_t rptr;  // Only written by the consumer
+  char pad1[SHM_RING_CACHE_LINE - sizeof(uint64_t)];
+};
+
+/**
+ * Start of the shared memory file, followed by the data of ring[0] and then
+ * that of ring[1]
+ */
+struct shm_ring_header {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t size;  // Size of each ring, a power of two
+  // Set by each side while it might sleep on its doorbell. The other side
+  // rings the doorbell after it moves a pointer if the flag is set.
+  uint32_t sleeping[2];
+  char pad[SHM_RING_CACHE_LINE - 24];
+  // ring[SHM_RING_SERVER] carries data from the server to the client and
+  // ring[SHM_RING_CLIENT] the other way round
+  struct shm_ring_ptrs ring[2];
+};
+
+/**
+ * One side's view of a shared ring pair
+ */
+struct shm_ring {
+  struct shm_ring_header *hdr;
+  size_t map_len;
+  int side;
+  struct shm_ring_ptrs *rx;
+  struct shm_ring_ptrs *tx;
+  char *rx_buf;
+  char *tx_buf;
+  int memfd;
+  // eventfds that the server and the client sleep on
+  int doorbell[2];
+  // Connection to the other side, if this side watches it itself
+  int sock;
+  // Set once the other side has gone away
+  bool peer_gone;
+};
+
+struct shm_ring_server {
+  char *display_name;
+  char *socket_path;
+  size_t bufsize;
+  int sfd;
+  pthread_t sock_thread;
+  // Pipe used by shm_ring_server_close() to stop the socket thread
+  int wake_fds[2];
+  // Rings in use, only touched by the host thread
+  struct shm_ring *cur;
+  // Rings for a newly attached client, handed from the socket thread to the
+  // host thread. Whichever thread takes them out of here owns them.
+  struct shm_ring *next;
+};
+
+struct shm_ring_client {
+  struct shm_ring *ring;
+};
+
+static int shm_ring_memfd(const char *name) {
+#ifdef __linux__
+  return memfd_create(name, MFD_CLOEXEC);
+#else
+  (void)name;
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
+static int shm_ring_doorbell(void) {
+#ifdef __linux__
+  return eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#else
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
+static void shm_ring_free(struct shm_ring *r) {
+  if (!r) {
+    return;
+  }
+  // Keep errno from any failure that got us here
+  int saved_errno = errno;
+  if (r->hdr) {
+    munmap(r->hdr, r->map_len);
+  }
+  int fds[4] = {r->memfd, r->doorbell[0], r->doorbell[1], r->sock};
+  for (int i = 0; i < 4; ++i) {
+    if (fds[i] >= 0) {
+      close(fds[i]);
+    }
+  }
+  free(r);
+  errno = saved_errno;
+}
+
+static struct shm_ring *shm_ring_alloc(int side) {
+  struct shm_ring *r = (struct shm_ring *)calloc(1, sizeof(struct shm_ring));
+  assert(r);
+  r->side = side;
+  r->memfd = -1;
+  r->doorbell[0] = -1;
+  r->doorbell[1] = -1;
+  r->sock = -1;
+  return r;
+}
+
+/**
+ * Map r->memfd, which is r->map_len bytes long
+ */
+static bool shm_ring_map(struct shm_ring *r) {
+  void *map = mmap(NULL, r->map_len, PROT_READ | PROT_WRITE, MAP_SHARED,
+                   r->memfd, 0);
+  if (map == MAP_FAILED) {
+    return false;
+  }
+  r->hdr = (struct shm_ring_header *)map;
+  return true;
+}
+
+/**
+ * Point the rx and tx rings at the right halves of the mapping
+ */
+static void shm_ring_setup(struct shm_ring *r) {
+  char *data = (char *)r->hdr + sizeof(struct shm_ring_header);
+  int peer = !r->side;
+  r->tx = &r->hdr->ring[r->side];
+  r->rx = &r->hdr->ring[peer];
+  r->tx_buf = data + r->side * r->hdr->size;
+  r->rx_buf = data + peer * r->hdr->size;
+}
+
+/**
+ * Create a new ring pair with bufsize bytes in each direction (server side)
+ */
+static struct shm_ring *shm_ring_new(const char *name, size_t bufsize) {
+  struct shm_ring *r = shm_ring_alloc(SHM_RING_SERVER);
+  r->map_len = sizeof(struct shm_ring_header) + 2 * bufsize;
+  r->memfd = shm_ring_memfd(name);
+  r->doorbell[0] = shm_ring_doorbell();
+  r->doorbell[1] = shm_ring_doorbell();
+  if (r->memfd < 0 || r->doorbell[0] < 0 || r->doorbell[1] < 0 ||
+      ftruncate(r->memfd, r->map_len) != 0 || !shm_ring_map(r)) {
+    fprintf(stderr, "%s: Unable to create shared rings: %s (%d)\n", name,
+            strerror(errno), errno);
+    shm_ring_free(r);
+    return NULL;
+  }
+  // ftruncate() zero-fills, so only the constant fields need setting
+  r->hdr->magic = SHM_RING_MAGIC;
+  r->hdr->version = SHM_RING_VERSION;
+  r->hdr->size = bufsize;
+  shm_ring_setup(r);
+  return r;
+}
+
+/**
+ * Wake up the other side if it is sleeping
+ *
+ * Called after moving a pointer. The fence orders the pointer store before
+ * the load of the flag; it pairs with the one in shm_ring_wait(), so either
+ * the sleeper sees the new pointer or this sees the flag.
+ */
+static void shm_ring_kick(struct shm_ring *r) {
+  int peer = !r->side;
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&r->hdr->sleeping[peer], __ATOMIC_RELAXED) &&
+      __atomic_exchange_n(&r->hdr->sleeping[peer], 0, __ATOMIC_SEQ_CST)) {
+    uint64_t one = 1;
+    ssize_t rv = write(r->doorbell[peer], &one, sizeof(one));
+    (void)rv;  // The counter can't overflow, it is reset on every wake-up
+  }
+}
+
+static size_t shm_ring_rx_used(struct shm_ring *r) {
+  uint64_t wptr = __atomic_load_n(&r->rx->wptr, __ATOMIC_ACQUIRE);
+  return wptr - __atomic_load_n(&r->rx->rptr, __ATOMIC_RELAXED);
+}
+
+static size_t shm_ring_tx_space(struct shm_ring *r) {
+  uint64_t rptr = __atomic_load_n(&r->tx->rptr, __ATOMIC_ACQUIRE);
+  uint64_t wptr = __atomic_load_n(&r->tx->wptr, __ATOMIC_RELAXED);
+  return r->hdr->size - (wptr - rptr);
+}
+
+static bool shm_ring_peer_gone(struct shm_ring *r) {
+  return __atomic_load_n(&r->peer_gone, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Copy len bytes between dat and the ring data at ptr, which might wrap
+ * around the end of the ring
+ */
+static void shm_ring_copy(struct shm_ring *r, char *buf, uint64_t ptr,
+                          char *dat, size_t len, bool to_ring) {
+  size_t size = r->hdr->size;
+  size_t off = ptr & (size - 1);
+  size_t first = (size - off < len) ? size - off : len;
+  if (to_ring) {
+    memcpy(&buf[off], dat, first);
+    memcpy(buf, dat + first, len - first);
+  } else {
+    memcpy(dat, &buf[off], first);
+    memcpy(dat + first, buf, len - first);
+  }
+}
+
+static size_t shm_ring_read(struct shm_ring *r, void *dat, size_t len) {
+  size_t used = shm_ring_rx_used(r);
+  if (len > used) {
+    len = used;
+  }
+  if (!len) {
+    return 0;
+  }
+  uint64_t rptr = __atomic_load_n(&r->rx->rptr, __ATOMIC_RELAXED);
+  shm_ring_copy(r, r->rx_buf, rptr, (char *)dat, len, false);
+  __atomic_store_n(&r->rx->rptr, rptr + len, __ATOMIC_RELEASE);
+  shm_ring_kick(r);
+  return len;
+}
+
+static size_t shm_ring_write_some(struct shm_ring *r, const void *dat,
+                                  size_t len) {
+  size_t space = shm_ring_tx_space(r);
+  if (len > space) {
+    len = space;
+  }
+  if (!len) {
+    return 0;
+  }
+  uint64_t wptr = __atomic_load_n(&r->tx->wptr, __ATOMIC_RELAXED);
+  shm_ring_copy(r, r->tx_buf, wptr, (char *)dat, len, true);
+  __atomic_store_n(&r->tx->wptr, wptr + len, __ATOMIC_RELEASE);
+  shm_ring_kick(r);
+  return len;
+}
+
+static bool shm_ring_ready(struct shm_ring *r, bool for_write) {
+  return for_write ? shm_ring_tx_space(r) != 0 : shm_ring_rx_used(r) != 0;
+}
+
+static int64_t shm_ring_now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * Sleep until there is data to read (or space to write, if for_write), the
+ * other side goes away, or timeout_ms milliseconds pass (-1 for no timeout)
+ *
+ * @return true if the ring became ready
+ */
+static bool shm_ring_wait(struct shm_ring *r, bool for_write, int timeout_ms) {
+  uint32_t *sleeping = &r->hdr->sleeping[r->side];
+  int64_t deadline = shm_ring_now_ms() + timeout_ms;
+  bool ready = shm_ring_ready(r, for_write);
+  while (!ready && !shm_ring_peer_gone(r)) {
+    int wait_ms = -1;
+    if (timeout_ms >= 0) {
+      int64_t left = deadline - shm_ring_now_ms();
+      if (left <= 0) {
+        break;
+      }
+      wait_ms = (int)left;
+    }
+    __atomic_store_n(sleeping, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    ready = shm_ring_ready(r, for_write);
+    if (ready) {
+      break;
+    }
+    struct pollfd pfds[2] = {{r->doorbell[r->side], POLLIN, 0},
+                             {r->sock, POLLIN, 0}};
+    int n = poll(pfds, (r->sock >= 0) ? 2 : 1, wait_ms);
+    if (n > 0 && (pfds[0].revents & POLLIN)) {
+      uint64_t count;
+      ssize_t rv = read(r->doorbell[r->side], &count, sizeof(count));
+      (void)rv;
+    }
+    // The other side never sends anything on the socket, so it being
+    // readable means it has been closed
+    if (n > 0 && r->sock >= 0 && pfds[1].revents) {
+      __atomic_store_n(&r->peer_gone, true, __ATOMIC_RELEASE);
+    }
+    ready = shm_ring_ready(r, for_write);
+  }
+  __atomic_store_n(sleeping, 0, __ATOMIC_RELAXED);
+  return ready;
+}
+
+/**
+ * Send the memory file and the doorbells to a new client
+ */
+static bool shm_ring_send_fds(int sock, struct shm_ring *r) {
+  int fds[3] = {r->memfd, r->doorbell[0], r->doorbell[1]};
+  char byte = 0;
+  struct iovec iov = {&byte, 1};
+  union {
+    struct cmsghdr align;
+    char buf[CMSG_SPACE(sizeof(fds))];
+  } control;
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  memset(&control, 0, sizeof(control));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+  return sendmsg(sock, &msg, MSG_NOSIGNAL) == 1;
+}
+
+/**
+ * Receive the memory file and the doorbells from the server
+ */
+static bool shm_ring_recv_fds(int sock, struct shm_ring *r) {
+  int fds[3];
+  char byte;
+  struct iovec iov = {&byte, 1};
+  union {
+    struct cmsghdr align;
+    char buf[CMSG_SPACE(sizeof(fds))];
+  } control;
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+  // MSG_CMSG_CLOEXEC is Linux-specific. Elsewhere, mark the descriptors
+  // close-on-exec once they have arrived.
+#ifdef MSG_CMSG_CLOEXEC
+  int flags = MSG_CMSG_CLOEXEC;
+#else
+  int flags = 0;
+#endif
+  ssize_t rv;
+  do {
+    rv = recvmsg(sock, &msg, flags);
+  } while (rv < 0 && errno == EINTR);
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  if (rv != 1 || !cmsg || cmsg->cmsg_level != SOL_SOCKET ||
+      cmsg->cmsg_type != SCM_RIGHTS ||
+      cmsg->cmsg_len != CMSG_LEN(sizeof(fds))) {
+    return false;
+  }
+  memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+#ifndef MSG_CMSG_CLOEXEC
+  for (int i = 0; i < 3; ++i) {
+    fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+  }
+#endif
+  r->memfd = fds[0];
+  r->doorbell[0] = fds[1];
+  r->doorbell[1] = fds[2];
+  return true;
+}
+
+/**
+ * Wait for the client on cfd to go away
+ *
+ * @return false if the server is shutting down instead
+ */
+static bool server_wait_client(struct shm_ring_server *ctx, int cfd) {
+  while (true) {
+    struct pollfd pfds[2] = {{cfd, POLLIN, 0}, {ctx->wake_fds[0], POLLIN, 0}};
+    if (poll(pfds, 2, -1) < 0) {
+      continue;
+    }
+    if (pfds[1].revents) {
+      return false;
+    }
+    char buf[64];
+    ssize_t rv = read(cfd, buf, sizeof(buf));
+    if (rv == 0 || (rv < 0 && errno != EINTR && errno != EAGAIN)) {
+      return true;
+    }
+  }
+}
+
+/**
+ * Socket thread: hands out a fresh ring pair to each client that connects
+ */
+static void *server_thread(void *ctx_void) {
+  struct shm_ring_server *ctx = (struct shm_ring_server *)ctx_void;
+
+  while (true) {
+    struct pollfd pfds[2] = {{ctx->sfd, POLLIN, 0},
+                             {ctx->wake_fds[0], POLLIN, 0}};
+    if (poll(pfds, 2, -1) < 0) {
+      continue;
+    }
+    if (pfds[1].revents) {
+      break;
+    }
+    int cfd = accept(ctx->sfd, NULL, NULL);
+    if (cfd < 0) {
+      continue;
+    }
+    struct shm_ring *r = shm_ring_new(ctx->display_name, ctx->bufsize);
+    if (!r || !shm_ring_send_fds(cfd, r)) {
+      fprintf(stderr, "%s: Unable to attach client\n", ctx->display_name);
+      shm_ring_free(r);
+      close(cfd);
+      continue;
+    }
+    // The client has its own reference to the memory file now
+    close(r->memfd);
+    r->memfd = -1;
+    shm_ring_free(__atomic_exchange_n(&ctx->next, r, __ATOMIC_ACQ_REL));
+    printf("%s: Accepted client connection\n", ctx->display_name);
+
+    // The host thread only frees r once it has taken a newer ring pair from
+    // ctx->next, so r stays valid until this loop goes round again.
+    bool running = server_wait_client(ctx, cfd);
+    close(cfd);
+    __atomic_store_n(&r->peer_gone, true, __ATOMIC_RELEASE);
+    // Wake up the host thread in case it is waiting for space
+    uint64_t one = 1;
+    ssize_t rv = write(r->doorbell[SHM_RING_SERVER], &one, sizeof(one));
+    (void)rv;
+    if (!running) {
+      break;
+    }
+    printf("%s: Remote disconnected.\n", ctx->display_name);
+  }
+  return NULL;
+}
+
+/**
+ * Get the rings of the current client, picking up a newly attached one
+ */
+static struct shm_ring *server_current(struct shm_ring_server *ctx) {
+  if (__atomic_load_n(&ctx->next, __ATOMIC_RELAXED)) {
+    struct shm_ring *r = __atomic_exchange_n(
+        &ctx->next, (struct shm_ring *)NULL, __ATOMIC_ACQ_REL);
+    if (r) {
+      shm_ring_free(ctx->cur);
+      ctx->cur = r;
+    }
+  }
+  return ctx->cur;
+}
+
+static void server_free(struct shm_ring_server *ctx) {
+  // Keep errno from any failure that got us here
+  int saved_errno = errno;
+  shm_ring_free(ctx->cur);
+  shm_ring_free(ctx->next);
+  if (ctx->sfd >= 0) {
+    close(ctx->sfd);
+    unlink(ctx->socket_path);
+  }
+  for (int i = 0; i < 2; ++i) {
+    if (ctx->wake_fds[i] >= 0) {
+      close(ctx->wake_fds[i]);
+    }
+  }
+  free(ctx->display_name);
+  free(ctx->socket_path);
+  free(ctx);
+  errno = saved_errno;
+}
+
+struct shm_ring_server *shm_ring_server_create(const char *display_name,
+                                               const char *socket_path,
+                                               size_t bufsize) {
+  struct shm_ring_server *ctx =
+      (struct shm_ring_server *)calloc(1, sizeof(struct shm_ring_server));
+  assert(ctx);
+
+  ctx->display_name = strdup(display_name);
+  ctx->socket_path = strdup(socket_path);
+  assert(ctx->display_name && ctx->socket_path);
+  ctx->bufsize = SHM_RING_MIN_BUFSIZE;
+  while (ctx->bufsize < bufsize) {
+    ctx->bufsize <<= 1;
+  }
+  ctx->sfd = -1;
+  ctx->wake_fds[0] = -1;
+  ctx->wake_fds[1] = -1;
+
+  // Check the kernel can give us a memory file before listening for clients
+  struct shm_ring *probe = shm_ring_new(display_name, ctx->bufsize);
+  if (!probe) {
+    server_free(ctx);
+    return NULL;
+  }
+  shm_ring_free(probe);
+
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "%s: Socket path too long: %s\n", display_name,
+            socket_path);
+    errno = ENAMETOOLONG;
+    server_free(ctx);
+    return NULL;
+  }
+  strcpy(addr.sun_path, socket_path);
+  unlink(socket_path);
+
+  ctx->sfd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (ctx->sfd < 0 ||
+      bind(ctx->sfd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      listen(ctx->sfd, 1) != 0) {
+    fprintf(stderr, "%s: Unable to listen on %s: %s (%d)\n", display_name,
+            socket_path, strerror(errno), errno);
+    server_free(ctx);
+    return NULL;
+  }
+
+  if (pipe(ctx->wake_fds) != 0) {
+    fprintf(stderr, "%s: Unable to create wake-up pipe: %s (%d)\n",
+            display_name, strerror(errno), errno);
+    ctx->wake_fds[0] = -1;
+    ctx->wake_fds[1] = -1;
+    server_free(ctx);
+    return NULL;
+  }
+
+  int rv = pthread_create(&ctx->sock_thread, NULL, server_thread, (void *)ctx);
+  if (rv != 0) {
+    fprintf(stderr, "%s: Unable to create socket thread\n", display_name);
+    errno = rv;
+    server_free(ctx);
+    return NULL;
+  }
+  return ctx;
+}
+
+bool shm_ring_server_client_connected(struct shm_ring_server *ctx) {
+  struct shm_ring *r = server_current(ctx);
+  return r && !shm_ring_peer_gone(r);
+}
+
+size_t shm_ring_server_read(struct shm_ring_server *ctx, void *dat,
+                            size_t len) {
+  struct shm_ring *r = server_current(ctx);
+  return r ? shm_ring_read(r, dat, len) : 0;
+}
+
+void shm_ring_server_write(struct shm_ring_server *ctx, const void *dat,
+                           size_t len) {
+  const char *p = (const char *)dat;
+  while (len) {
+    struct shm_ring *r = server_current(ctx);
+    if (!r || shm_ring_peer_gone(r)) {
+      return;
+    }
+    size_t n = shm_ring_write_some(r, p, len);
+    p += n;
+    len -= n;
+    if (len) {
+      shm_ring_wait(r, true, -1);
+    }
+  }
+}
+
+void shm_ring_server_close(struct shm_ring_server *ctx) {
+  if (!ctx) {
+    return;
+  }
+  char byte = 0;
+  ssize_t rv = write(ctx->wake_fds[1], &byte, 1);
+  (void)rv;
+  pthread_join(ctx->sock_thread, NULL);
+  server_free(ctx);
+}
+
+struct shm_ring_client *shm_ring_client_connect(const char *socket_path) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "Socket path too long: %s\n", socket_path);
+    return NULL;
+  }
+  strcpy(addr.sun_path, socket_path);
+
+  struct shm_ring *r = shm_ring_alloc(SHM_RING_CLIENT);
+  r->sock = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (r->sock < 0 ||
+      connect(r->sock, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    fprintf(stderr, "Unable to connect to %s: %s (%d)\n", socket_path,
+            strerror(errno), errno);
+    shm_ring_free(r);
+    return NULL;
+  }
+  fcntl(r->sock, F_SETFD, FD_CLOEXEC);
+
+  struct stat st;
+  if (!shm_ring_recv_fds(r->sock, r) || fstat(r->memfd, &st) != 0 ||
+      (size_t)st.st_size < sizeof(struct shm_ring_header)) {
+    fprintf(stderr, "No shared rings received from %s\n", socket_path);
+    shm_ring_free(r);
+    return NULL;
+  }
+  r->map_len = st.st_size;
+  if (!shm_ring_map(r) || r->hdr->magic != SHM_RING_MAGIC ||
+      r->hdr->version != SHM_RING_VERSION ||
+      r->map_len != sizeof(struct shm_ring_header) + 2 * r->hdr->size) {
+    fprintf(stderr, "Bad shared rings received from %s\n", socket_path);
+    shm_ring_free(r);
+    return NULL;
+  }
+  shm_ring_setup(r);
+
+  struct shm_ring_client *ctx =
+      (struct shm_ring_client *)calloc(1, sizeof(struct shm_ring_client));
+  assert(ctx);
+  ctx->ring = r;
+  return ctx;
+}
+
+size_t shm_ring_client_read(struct shm_ring_client *ctx, void *dat, size_t len,
+                            int timeout_ms) {
+  struct shm_ring *r = ctx->ring;
+  size_t n = shm_ring_read(r, dat, len);
+  if (n || timeout_ms == 0 || !shm_ring_wait(r, false, timeout_ms)) {
+    return n;
+  }
+  return shm_ring_read(r, dat, len);
+}
+
+bool shm_ring_client_write(struct shm_ring_client *ctx, const void *dat,
+                           size_t len) {
+  struct shm_ring *r = ctx->ring;
+  const char *p = (const char *)dat;
+  while (len) {
+    if (shm_ring_peer_gone(r)) {
+      return false;
+    }
+    size_t n = shm_ring_write_some(r, p, len);
+    p += n;
+    len -= n;
+    if (len) {
+      shm_ring_wait(r, true, -1);
+    }
+  }
+  return true;
+}
+
+void shm_ring_client_close(struct shm_ring_client *ctx) {
+  if (!ctx) {
+    return;
+  }
+  shm_ring_free(ctx->ring);
+  free(ctx);
+}
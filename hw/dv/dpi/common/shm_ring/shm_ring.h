@@ -0,0 +1,143 @@
+// Copyright lowRISC contributors.
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef OPENTITAN_HW_DV_DPI_COMMON_SHM_RING_SHM_RING_H_
+#define OPENTITAN_HW_DV_DPI_COMMON_SHM_RING_SHM_RING_H_
+
+/**
+ * Shared-memory transport between DPI modules and host tools
+ *
+ * A DPI module that moves a lot of data (frames, captures, memory images) can
+ * offer a shared-memory ring pair instead of a pseudo-terminal or TCP socket.
+ * The simulation listens on a Unix socket. When a client connects, it is
+ * handed a memory file holding two single-producer, single-consumer rings
+ * (one for each direction) and two eventfd doorbells, one for each side to
+ * sleep on. After that, data moves by copying it into the shared mapping: no
+ * system call is made unless the other side is asleep waiting for data or for
+ * space.
+ *
+ * The Unix socket stays open while the client is attached. Each side notices
+ * the other going away by the socket being closed.
+ *
+ * The simulation side (shm_ring_server_*) never waits for data, so it can be
+ * polled from a DPI tick function. The client side (shm_ring_client_*) can
+ * wait with a timeout.
+ *
+ * This is only available on Linux, where it uses memfd_create() and eventfd().
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct shm_ring_server;
+struct shm_ring_client;
+
+/**
+ * Create a new shared-memory server instance
+ *
+ * This starts a thread that listens on a Unix socket at socket_path, removing
+ * any stale socket there first. Each client that connects gets its own rings
+ * of bufsize bytes in each direction.
+ *
+ * @param display_name C string description of server
+ * @param socket_path Path of the Unix socket to listen on
+ * @param bufsize Size of each ring in bytes, rounded up to a power of two
+ * @return A pointer to the created context struct, or NULL on error (with
+ *         errno set)
+ */
+struct shm_ring_server *shm_ring_server_create(const char *display_name,
+                                               const char *socket_path,
+                                               size_t bufsize);
+
+/**
+ * Check whether a client is attached
+ *
+ * @param ctx shm ring server context object
+ * @return true if a client is attached
+ */
+bool shm_ring_server_client_connected(struct shm_ring_server *ctx);
+
+/**
+ * Non-blocking read of up to len bytes from the attached client
+ *
+ * @param ctx shm ring server context object
+ * @param dat buffer for the bytes received
+ * @param len size of dat
+ * @return the number of bytes read (0 if there was no data or no client)
+ */
+size_t shm_ring_server_read(struct shm_ring_server *ctx, void *dat,
+                            size_t len);
+
+/**
+ * Write len bytes to the attached client
+ *
+ * If the ring fills up, this sleeps until the client has made room for the
+ * rest. Data written while no client is attached, or after the client has gone
+ * away, is dropped.
+ *
+ * @param ctx shm ring server context object
+ * @param dat bytes to send
+ * @param len number of bytes at dat
+ */
+void shm_ring_server_write(struct shm_ring_server *ctx, const void *dat,
+                           size_t len);
+
+/**
+ * Shut down the server and free all resources
+ *
+ * @param ctx shm ring server context object
+ */
+void shm_ring_server_close(struct shm_ring_server *ctx);
+
+/**
+ * Attach to a simulation's shared-memory server
+ *
+ * @param socket_path Path of the Unix socket the server listens on
+ * @return A pointer to the client context struct, or NULL on error
+ */
+struct shm_ring_client *shm_ring_client_connect(const char *socket_path);
+
+/**
+ * Read up to len bytes from the simulation
+ *
+ * @param ctx shm ring client context object
+ * @param dat buffer for the bytes received
+ * @param len size of dat
+ * @param timeout_ms Milliseconds to wait for data if there is none yet: 0 to
+ *                   return at once, -1 to wait for as long as it takes
+ * @return the number of bytes read, 0 on timeout or if the simulation has gone
+ */
+size_t shm_ring_client_read(struct shm_ring_client *ctx, void *dat, size_t len,
+                            int timeout_ms);
+
+/**
+ * Write len bytes to the simulation
+ *
+ * If the ring fills up, this sleeps until the simulation has made room for
+ * the rest.
+ *
+ * @param ctx shm ring client context object
+ * @param dat bytes to send
+ * @param len number of bytes at dat
+ * @return false if the simulation went away before all bytes were written
+ */
+bool shm_ring_client_write(struct shm_ring_client *ctx, const void *dat,
+                           size_t len);
+
+/**
+ * Detach from the simulation and free all resources
+ *
+ * @param ctx shm ring client context object
+ */
+void shm_ring_client_close(struct shm_ring_client *ctx);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+#endif  // OPENTITAN_HW_DV_DPI_COMMON_SHM_RING_SHM_RING_H_
@@ -16,17 +16,32 @@
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 /**
- * Simple buffer for passing data between TCP sockets and DPI modules
+ * Single-producer, single-consumer ring buffer for passing data between TCP
+ * sockets and DPI modules
+ *
+ * One side (the host thread or the server thread) only ever advances wptr and
+ * the other only ever advances rptr. The pointers run freely and are reduced
+ * modulo the size (a power of two) when indexing, so wptr - rptr is the number
+ * of bytes in the buffer. Each side publishes its pointer with a release store
+ * after touching the data and reads the other side's pointer with an acquire
+ * load, so no lock is needed to move data.
+ *
+ * The lock and condition variable are only used to let a producer sleep while
+ * the buffer is full: the consumer signals after it frees up space.
  */
-const int BUFSIZE_BYTE = 256;
+static const size_t TCP_SERVER_DEFAULT_BUFSIZE = 4096;
 
 struct tcp_buf {
-  unsigned int rptr;
-  unsigned int wptr;
-  char buf[BUFSIZE_BYTE];
+  size_t size;  // A power of two
+  size_t rptr;  // Only written by the consumer
+  size_t wptr;  // Only written by the producer
+  char *buf;
+  pthread_mutex_t lock;
+  pthread_cond_t not_full;
 };
 
 /**
@@ -36,56 +51,178 @@ struct tcp_server_ctx {
   // Writeable by the host thread
   char *display_name;
   uint16_t listen_port;
-  volatile bool socket_run;
+  bool socket_run;
+  bool close_client;
+  // Set by the server thread while it might sleep in select()
+  bool server_sleeping;
   // Writeable by the server thread
   tcp_buf *buf_in;
   tcp_buf *buf_out;
   int sfd;  // socket fd
   int cfd;  // client fd
   pthread_t sock_thread;
+  // Pipe used by the host thread to wake up the server thread
+  int wake_fds[2];
 };
 
-static bool tcp_buffer_is_full(struct tcp_buf *buf) {
-  if (buf->wptr >= buf->rptr) {
-    return (buf->wptr - buf->rptr) == (BUFSIZE_BYTE - 1);
-  } else {
-    return (buf->rptr - buf->wptr) == 1;
+static size_t tcp_buffer_used(struct tcp_buf *buf) {
+  size_t wptr = __atomic_load_n(&buf->wptr, __ATOMIC_ACQUIRE);
+  size_t rptr = __atomic_load_n(&buf->rptr, __ATOMIC_ACQUIRE);
+  return wptr - rptr;
+}
+
+static size_t tcp_buffer_space(struct tcp_buf *buf) {
+  return buf->size - tcp_buffer_used(buf);
+}
+
+/**
+ * Describe up to len bytes of the buffer, starting at ptr, as at most two
+ * iovecs (the region might wrap around the end of the buffer).
+ *
+ * @return the number of iovecs used
+ */
+static int tcp_buffer_iov(struct tcp_buf *buf, size_t ptr, size_t len,
+                          struct iovec iov[2]) {
+  size_t off = ptr & (buf->size - 1);
+  size_t first = buf->size - off;
+  if (first > len) {
+    first = len;
   }
+  iov[0].iov_base = &buf->buf[off];
+  iov[0].iov_len = first;
+  iov[1].iov_base = buf->buf;
+  iov[1].iov_len = len - first;
+  return (len == 0) ? 0 : (len == first) ? 1 : 2;
 }
 
-static bool tcp_buffer_is_empty(struct tcp_buf *buf) {
-  return (buf->wptr == buf->rptr);
+/**
+ * Get iovecs describing the free space in the buffer (producer side)
+ */
+static int tcp_buffer_write_iov(struct tcp_buf *buf, struct iovec iov[2]) {
+  size_t wptr = __atomic_load_n(&buf->wptr, __ATOMIC_RELAXED);
+  return tcp_buffer_iov(buf, wptr, tcp_buffer_space(buf), iov);
+}
+
+/**
+ * Get iovecs describing the data in the buffer (consumer side)
+ */
+static int tcp_buffer_read_iov(struct tcp_buf *buf, struct iovec iov[2]) {
+  size_t rptr = __atomic_load_n(&buf->rptr, __ATOMIC_RELAXED);
+  return tcp_buffer_iov(buf, rptr, tcp_buffer_used(buf), iov);
 }
 
-static void tcp_buffer_put_byte(struct tcp_buf *buf, char dat) {
-  bool done = false;
-  while (!done) {
-    if (!tcp_buffer_is_full(buf)) {
-      buf->buf[buf->wptr++] = dat;
-      buf->wptr %= BUFSIZE_BYTE;
-      done = true;
+/**
+ * Publish len bytes that the producer has written to the buffer
+ */
+static void tcp_buffer_commit_write(struct tcp_buf *buf, size_t len) {
+  size_t wptr = __atomic_load_n(&buf->wptr, __ATOMIC_RELAXED);
+  __atomic_store_n(&buf->wptr, wptr + len, __ATOMIC_RELEASE);
+}
+
+/**
+ * Release len bytes that the consumer has read from the buffer, waking up a
+ * producer that is waiting for space.
+ */
+static void tcp_buffer_commit_read(struct tcp_buf *buf, size_t len) {
+  if (len == 0) {
+    return;
+  }
+  size_t rptr = __atomic_load_n(&buf->rptr, __ATOMIC_RELAXED);
+  __atomic_store_n(&buf->rptr, rptr + len, __ATOMIC_RELEASE);
+
+  // Signal with the lock held, so that a producer which has just seen a full
+  // buffer can't miss the wake-up.
+  pthread_mutex_lock(&buf->lock);
+  pthread_cond_signal(&buf->not_full);
+  pthread_mutex_unlock(&buf->lock);
+}
+
+/**
+ * Copy up to len bytes from dat into the buffer without blocking
+ *
+ * @return the number of bytes copied
+ */
+static size_t tcp_buffer_put(struct tcp_buf *buf, const char *dat,
+                             size_t len) {
+  struct iovec iov[2];
+  int n = tcp_buffer_write_iov(buf, iov);
+  size_t done = 0;
+  for (int i = 0; i < n && done < len; ++i) {
+    size_t chunk = len - done;
+    if (chunk > iov[i].iov_len) {
+      chunk = iov[i].iov_len;
     }
+    memcpy(iov[i].iov_base, dat + done, chunk);
+    done += chunk;
   }
+  tcp_buffer_commit_write(buf, done);
+  return done;
 }
 
-static bool tcp_buffer_get_byte(struct tcp_buf *buf, char *dat) {
-  if (tcp_buffer_is_empty(buf)) {
-    return false;
+/**
+ * Copy up to len bytes from the buffer into dat without blocking
+ *
+ * @return the number of bytes copied
+ */
+static size_t tcp_buffer_get(struct tcp_buf *buf, char *dat, size_t len) {
+  struct iovec iov[2];
+  int n = tcp_buffer_read_iov(buf, iov);
+  size_t done = 0;
+  for (int i = 0; i < n && done < len; ++i) {
+    size_t chunk = len - done;
+    if (chunk > iov[i].iov_len) {
+      chunk = iov[i].iov_len;
+    }
+    memcpy(dat + done, iov[i].iov_base, chunk);
+    done += chunk;
   }
-  *dat = buf->buf[buf->rptr++];
-  buf->rptr %= BUFSIZE_BYTE;
-  return true;
+  tcp_buffer_commit_read(buf, done);
+  return done;
 }
 
-static struct tcp_buf *tcp_buffer_new(void) {
+/**
+ * Sleep until the buffer has space for at least one byte
+ */
+static void tcp_buffer_wait_space(struct tcp_buf *buf) {
+  pthread_mutex_lock(&buf->lock);
+  while (tcp_buffer_space(buf) == 0) {
+    pthread_cond_wait(&buf->not_full, &buf->lock);
+  }
+  pthread_mutex_unlock(&buf->lock);
+}
+
+static struct tcp_buf *tcp_buffer_new(size_t size) {
+  // Round the size up to a power of two, so that the free-running pointers
+  // can be reduced with a mask
+  size_t pow2_size = 16;
+  while (pow2_size < size) {
+    pow2_size *= 2;
+  }
+
   struct tcp_buf *buf_new;
   buf_new = (struct tcp_buf *)malloc(sizeof(struct tcp_buf));
+  if (!buf_new) {
+    return NULL;
+  }
+  buf_new->buf = (char *)malloc(pow2_size);
+  if (!buf_new->buf) {
+    free(buf_new);
+    return NULL;
+  }
+  buf_new->size = pow2_size;
   buf_new->rptr = 0;
   buf_new->wptr = 0;
+  pthread_mutex_init(&buf_new->lock, NULL);
+  pthread_cond_init(&buf_new->not_full, NULL);
   return buf_new;
 }
 
 static void tcp_buffer_free(struct tcp_buf **buf) {
+  if (*buf) {
+    pthread_mutex_destroy(&(*buf)->lock);
+    pthread_cond_destroy(&(*buf)->not_full);
+    free((*buf)->buf);
+  }
   free(*buf);
   *buf = NULL;
 }
@@ -222,64 +359,127 @@ static void stop(struct tcp_server_ctx *ctx) {
 }
 
 /**
- * Receive a byte from a connected client
+ * Close the client connection (server thread only)
+ *
+ * @param ctx context object
+ */
+static void client_close(struct tcp_server_ctx *ctx) {
+  assert(ctx);
+
+  if (!ctx->cfd) {
+    return;
+  }
+
+  close(ctx->cfd);
+  ctx->cfd = 0;
+}
+
+/**
+ * Receive as much data from a connected client as fits in the input buffer
  *
  * @param ctx context object
- * @param cmd byte received
- * @return true if a byte was read
  */
-static bool get_byte(struct tcp_server_ctx *ctx, char *cmd) {
+static void recv_data(struct tcp_server_ctx *ctx) {
   assert(ctx);
 
-  ssize_t num_read = read(ctx->cfd, cmd, 1);
+  struct iovec iov[2];
+  int iovcnt = tcp_buffer_write_iov(ctx->buf_in, iov);
+  if (iovcnt == 0) {
+    return;
+  }
+
+  ssize_t num_read = readv(ctx->cfd, iov, iovcnt);
 
   if (num_read == 0) {
-    return false;
+    printf("%s: Remote disconnected.\n", ctx->display_name);
+    client_close(ctx);
+    return;
   }
   if (num_read == -1) {
-    if (errno == EAGAIN || errno == EWOULDBLOCK) {
-      return false;
-    } else if (errno == EBADF) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+      return;
+    } else if (errno == EBADF || errno == ECONNRESET) {
       // Possibly client went away? Accept a new connection.
       fprintf(stderr, "%s: Client disappeared.\n", ctx->display_name);
-      tcp_server_client_close(ctx);
-      return false;
+      client_close(ctx);
+      return;
     } else {
       fprintf(stderr, "%s: Error while reading from client: %s (%d)\n",
               ctx->display_name, strerror(errno), errno);
       assert(0 && "Error reading from client");
     }
   }
-  assert(num_read == 1);
-  return true;
+
+  tcp_buffer_commit_write(ctx->buf_in, num_read);
 }
 
 /**
- * Send a byte to a connected client
+ * Send as much of the output buffer to a connected client as the socket will
+ * take without blocking
+ *
+ * This uses sendmsg (rather than writev) so that MSG_NOSIGNAL can be passed:
+ * a client that has gone away shouldn't kill the simulation with SIGPIPE.
  *
  * @param ctx context object
- * @param cmd byte to send
  */
-static void put_byte(struct tcp_server_ctx *ctx, char cmd) {
-  while (1) {
-    ssize_t num_written = send(ctx->cfd, &cmd, sizeof(cmd), MSG_NOSIGNAL);
-    if (num_written == -1) {
-      if (errno == EAGAIN || errno == EWOULDBLOCK) {
-        continue;
-      } else if (errno == EPIPE) {
-        printf("%s: Remote disconnected.\n", ctx->display_name);
-        tcp_server_client_close(ctx);
-        break;
-      } else {
-        fprintf(stderr, "%s: Error while writing to client: %s (%d)\n",
-                ctx->display_name, strerror(errno), errno);
-        assert(0 && "Error writing to client.");
-      }
-    }
-    if (num_written >= 1) {
-      break;
+static void send_data(struct tcp_server_ctx *ctx) {
+  assert(ctx);
+
+  struct iovec iov[2];
+  int iovcnt = tcp_buffer_read_iov(ctx->buf_out, iov);
+  if (iovcnt == 0) {
+    return;
+  }
+
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = iov;
+  msg.msg_iovlen = iovcnt;
+
+  ssize_t num_written = sendmsg(ctx->cfd, &msg, MSG_NOSIGNAL);
+  if (num_written == -1) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+      return;
+    } else if (errno == EPIPE || errno == ECONNRESET) {
+      printf("%s: Remote disconnected.\n", ctx->display_name);
+      client_close(ctx);
+      return;
+    } else {
+      fprintf(stderr, "%s: Error while writing to client: %s (%d)\n",
+              ctx->display_name, strerror(errno), errno);
+      assert(0 && "Error writing to client.");
     }
   }
+
+  tcp_buffer_commit_read(ctx->buf_out, num_written);
+}
+
+/**
+ * Wake up the server thread (from the host thread)
+ *
+ * @param ctx context object
+ */
+static void wake_server(struct tcp_server_ctx *ctx) {
+  char dummy = 0;
+  // If the pipe is full, the server thread has wake-ups pending anyway
+  ssize_t rv = write(ctx->wake_fds[1], &dummy, 1);
+  (void)rv;
+}
+
+/**
+ * Wake up the server thread if it is sleeping (from the host thread)
+ *
+ * Call this after changing one of the buffers. The server thread sets
+ * server_sleeping before it looks at the buffers and decides what to wait for,
+ * so either it sees the change or we see the flag.
+ *
+ * @param ctx context object
+ */
+static void wake_server_if_sleeping(struct tcp_server_ctx *ctx) {
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_exchange_n(&ctx->server_sleeping, false, __ATOMIC_SEQ_CST)) {
+    wake_server(ctx);
+  }
 }
 
 /**
@@ -291,6 +491,12 @@ static void ctx_free(struct tcp_server_ctx *ctx) {
   // Free the buffers
   tcp_buffer_free(&ctx->buf_in);
   tcp_buffer_free(&ctx->buf_out);
+  // Close the wake-up pipe
+  for (int i = 0; i < 2; ++i) {
+    if (ctx->wake_fds[i] > 0) {
+      close(ctx->wake_fds[i]);
+    }
+  }
   // Free the display name
   free(ctx->display_name);
   // Free the ctx
@@ -301,6 +507,12 @@ static void ctx_free(struct tcp_server_ctx *ctx) {
 /**
  * Thread function to create a new server instance
  *
+ * The thread sleeps in select() until there is a new connection, data from the
+ * client (and space to put it), data for the client (and space in the socket
+ * to send it) or a wake-up from the host thread. The host thread wakes it when
+ * it changes a buffer while the server thread is sleeping and when it wants to
+ * close the client connection or shut down.
+ *
  * @param ctx_void context object
  * @return Always returns NULL
  */
@@ -320,58 +532,87 @@ static void *server_create(void *ctx_void) {
   // Initialise timeout
   timeout.tv_sec = 0;
 
-  // Initialise fd_set
-
   // Start waiting for connection / data
-  char xfer_data;
-  while (ctx->socket_run) {
+  while (__atomic_load_n(&ctx->socket_run, __ATOMIC_ACQUIRE)) {
+    if (__atomic_exchange_n(&ctx->close_client, false, __ATOMIC_ACQ_REL)) {
+      client_close(ctx);
+    }
+
+    // Announce that we might sleep before looking at the buffers (see
+    // wake_server_if_sleeping)
+    __atomic_store_n(&ctx->server_sleeping, true, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
     // Initialise structure of fds
-    fd_set read_fds;
+    fd_set read_fds, write_fds;
     FD_ZERO(&read_fds);
-    if (ctx->sfd) {
+    FD_ZERO(&write_fds);
+    FD_SET(ctx->wake_fds[0], &read_fds);
+    if (ctx->sfd && !ctx->cfd) {
       FD_SET(ctx->sfd, &read_fds);
     }
     if (ctx->cfd) {
-      FD_SET(ctx->cfd, &read_fds);
+      // Only ask for client data if there's space to put it. Otherwise, a
+      // readable socket would stop us from sleeping.
+      if (tcp_buffer_space(ctx->buf_in)) {
+        FD_SET(ctx->cfd, &read_fds);
+      }
+      if (tcp_buffer_used(ctx->buf_out)) {
+        FD_SET(ctx->cfd, &write_fds);
+      }
     }
     // max fd num
     int mfd = (ctx->cfd > ctx->sfd) ? ctx->cfd : ctx->sfd;
+    if (ctx->wake_fds[0] > mfd) {
+      mfd = ctx->wake_fds[0];
+    }
 
-    // Set timeout - 50us gives good performance
-    timeout.tv_usec = 50;
+    // Set timeout. The host thread wakes us up when there's something to do,
+    // so this is just a backstop.
+    timeout.tv_usec = 10000;
 
-    // Wait for socket activity or timeout
-    rv = select(mfd + 1, &read_fds, NULL, NULL, &timeout);
+    // Wait for socket activity, a wake-up or timeout
+    rv = select(mfd + 1, &read_fds, &write_fds, NULL, &timeout);
+    __atomic_store_n(&ctx->server_sleeping, false, __ATOMIC_SEQ_CST);
 
     if (rv < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
       printf("%s: Socket read failed, port: %d\n", ctx->display_name,
              ctx->listen_port);
-      tcp_server_client_close(ctx);
+      client_close(ctx);
+      continue;
+    }
+
+    // Drain any wake-ups
+    if (FD_ISSET(ctx->wake_fds[0], &read_fds)) {
+      char drain[64];
+      while (read(ctx->wake_fds[0], drain, sizeof(drain)) > 0) {
+      }
     }
 
     // New connection
-    if (FD_ISSET(ctx->sfd, &read_fds)) {
+    if (ctx->sfd && FD_ISSET(ctx->sfd, &read_fds)) {
       client_tryaccept(ctx);
     }
 
     // New client data
-    if (FD_ISSET(ctx->cfd, &read_fds)) {
-      while (get_byte(ctx, &xfer_data)) {
-        tcp_buffer_put_byte(ctx->buf_in, xfer_data);
-      }
+    if (ctx->cfd && FD_ISSET(ctx->cfd, &read_fds)) {
+      recv_data(ctx);
     }
 
-    if (ctx->cfd != 0) {
-      while (tcp_buffer_get_byte(ctx->buf_out, &xfer_data)) {
-        put_byte(ctx, xfer_data);
-      }
+    // Data for the client. Try even if select didn't say the socket was
+    // writable, since the host may have written since we went to sleep.
+    if (ctx->cfd) {
+      send_data(ctx);
     }
   }
 
 err_cleanup_return:
 
   // Simulation done - clean up
-  tcp_server_client_close(ctx);
+  client_close(ctx);
   stop(ctx);
 
   return NULL;
@@ -379,13 +620,20 @@ err_cleanup_return:
 
 // Abstract interface functions
 tcp_server_ctx *tcp_server_create(const char *display_name, int listen_port) {
+  return tcp_server_create_with_bufsize(display_name, listen_port,
+                                        TCP_SERVER_DEFAULT_BUFSIZE);
+}
+
+tcp_server_ctx *tcp_server_create_with_bufsize(const char *display_name,
+                                               int listen_port,
+                                               size_t bufsize) {
   struct tcp_server_ctx *ctx =
       (struct tcp_server_ctx *)calloc(1, sizeof(struct tcp_server_ctx));
   assert(ctx);
 
   // Create the buffers
-  struct tcp_buf *buf_in = tcp_buffer_new();
-  struct tcp_buf *buf_out = tcp_buffer_new();
+  struct tcp_buf *buf_in = tcp_buffer_new(bufsize);
+  struct tcp_buf *buf_out = tcp_buffer_new(bufsize);
   assert(buf_in);
   assert(buf_out);
 
@@ -399,28 +647,65 @@ tcp_server_ctx *tcp_server_create(const char *display_name, int listen_port) {
   ctx->display_name = strdup(display_name);
   assert(ctx->display_name);
 
+  // Create the (non-blocking) wake-up pipe
+  if (pipe(ctx->wake_fds) != 0 ||
+      fcntl(ctx->wake_fds[0], F_SETFL, O_NONBLOCK) != 0 ||
+      fcntl(ctx->wake_fds[1], F_SETFL, O_NONBLOCK) != 0) {
+    fprintf(stderr, "%s: Unable to create wake-up pipe: %s (%d)\n",
+            ctx->display_name, strerror(errno), errno);
+    ctx_free(ctx);
+    return NULL;
+  }
+
   if (pthread_create(&ctx->sock_thread, NULL, server_create, (void *)ctx) !=
       0) {
     fprintf(stderr, "%s: Unable to create TCP socket thread\n",
             ctx->display_name);
     ctx_free(ctx);
-    free(ctx);
     return NULL;
   }
   return ctx;
 }
 
+size_t tcp_server_read_block(struct tcp_server_ctx *ctx, char *dat,
+                             size_t len) {
+  size_t num_read = tcp_buffer_get(ctx->buf_in, dat, len);
+  // The server thread stops reading from the client when the input buffer is
+  // full, so tell it there might be space again.
+  if (num_read) {
+    wake_server_if_sleeping(ctx);
+  }
+  return num_read;
+}
+
+void tcp_server_write_block(struct tcp_server_ctx *ctx, const char *dat,
+                            size_t len) {
+  while (len) {
+    size_t num_written = tcp_buffer_put(ctx->buf_out, dat, len);
+    if (num_written) {
+      wake_server_if_sleeping(ctx);
+    }
+    dat += num_written;
+    len -= num_written;
+
+    if (len) {
+      tcp_buffer_wait_space(ctx->buf_out);
+    }
+  }
+}
+
 bool tcp_server_read(struct tcp_server_ctx *ctx, char *dat) {
-  return tcp_buffer_get_byte(ctx->buf_in, dat);
+  return tcp_server_read_block(ctx, dat, 1) == 1;
 }
 
 void tcp_server_write(struct tcp_server_ctx *ctx, char dat) {
-  tcp_buffer_put_byte(ctx->buf_out, dat);
+  tcp_server_write_block(ctx, &dat, 1);
 }
 
 void tcp_server_close(struct tcp_server_ctx *ctx) {
   // Shut down the socket thread
-  ctx->socket_run = false;
+  __atomic_store_n(&ctx->socket_run, false, __ATOMIC_RELEASE);
+  wake_server(ctx);
   pthread_join(ctx->sock_thread, NULL);
   ctx_free(ctx);
 }
@@ -428,10 +713,7 @@ void tcp_server_close(struct tcp_server_ctx *ctx) {
 void tcp_server_client_close(struct tcp_server_ctx *ctx) {
   assert(ctx);
 
-  if (!ctx->cfd) {
-    return;
-  }
-
-  close(ctx->cfd);
-  ctx->cfd = 0;
+  // The server thread owns the client socket, so ask it to do the closing
+  __atomic_store_n(&ctx->close_client, true, __ATOMIC_RELEASE);
+  wake_server(ctx);
 }
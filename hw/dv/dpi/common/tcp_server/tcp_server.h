@@ -16,6 +16,7 @@
 extern "C" {
 #endif
 
+#include <stddef.h>
 #include <stdint.h>
 
 struct tcp_server_ctx;
@@ -40,6 +41,31 @@ bool tcp_server_read(struct tcp_server_ctx *ctx, char *dat);
  */
 void tcp_server_write(struct tcp_server_ctx *ctx, char dat);
 
+/**
+ * Non-blocking read of up to len bytes from a connected client
+ *
+ * @param ctx tcp server context object
+ * @param dat buffer for the bytes received
+ * @param len size of dat
+ * @return the number of bytes read (0 if there was no data)
+ */
+size_t tcp_server_read_block(struct tcp_server_ctx *ctx, char *dat,
+                             size_t len);
+
+/**
+ * Write len bytes to a connected client
+ *
+ * Like tcp_server_write, the data is internally buffered. If the buffer fills
+ * up, this sleeps until the server thread has sent enough data to the client
+ * to make room for the rest.
+ *
+ * @param ctx tcp server context object
+ * @param dat bytes to send
+ * @param len number of bytes at dat
+ */
+void tcp_server_write_block(struct tcp_server_ctx *ctx, const char *dat,
+                            size_t len);
+
 /**
  * Create a new TCP server instance
  *
@@ -49,6 +75,21 @@ void tcp_server_write(struct tcp_server_ctx *ctx, char dat);
  */
 tcp_server_ctx *tcp_server_create(const char *display_name, int listen_port);
 
+/**
+ * Create a new TCP server instance with the given buffer size
+ *
+ * This is like tcp_server_create, but sets the size of the buffers between the
+ * server thread and the host in each direction (rounded up to a power of two).
+ *
+ * @param display_name C string description of server
+ * @param listen_port On which port the server should listen
+ * @param bufsize Size of each buffer in bytes
+ * @return A pointer to the created context struct
+ */
+tcp_server_ctx *tcp_server_create_with_bufsize(const char *display_name,
+                                               int listen_port,
+                                               size_t bufsize);
+
 /**
  * Shut down the server and free all reserved memory
  *
@@ -59,6 +100,8 @@ void tcp_server_close(struct tcp_server_ctx *ctx);
 /**
  * Instruct the server to disconnect a client
  *
+ * The server thread closes the connection shortly afterwards.
+ *
  * @param ctx tcp server context object
  */
 void tcp_server_client_close(struct tcp_server_ctx *ctx);
@@ -3,6 +3,8 @@
 // SPDX-License-Identifier: Apache-2.0
 
 #include "dmidpi.h"
+#include "dpi_checkpoint.h"
+#include "jtag_batch.h"
 #include "tcp_server.h"
 
 #include <assert.h>
@@ -81,10 +83,44 @@ struct dmi_sig_values {
   uint8_t dmi_rst_n;
 };
 
+/**
+ * Direct DMI transaction interface
+ *
+ * A client connected to the direct port sends DMI requests without going
+ * through a JTAG TAP. Each request is DMIDPI_DIRECT_REQ_BYTES long:
+ *
+ *   <op: 1 byte (1 = read, 2 = write)> <addr: 1 byte> <data: 32 bits, LE>
+ *
+ * and gets a response of DMIDPI_DIRECT_RSP_BYTES:
+ *
+ *   <resp: 1 byte (the 2-bit DMI response)> <data: 32 bits, LE>
+ *
+ * Responses come back in request order. A client can send many requests
+ * without waiting for responses: up to DMIDPI_DIRECT_MAX_OUTSTANDING of them
+ * are in flight on the DMI interface at once.
+ */
+#define DMIDPI_DIRECT_REQ_BYTES 6
+#define DMIDPI_DIRECT_RSP_BYTES 5
+#define DMIDPI_DIRECT_MAX_OUTSTANDING 4
+
+struct dmi_direct_ctx {
+  struct tcp_server_ctx *sock;
+  // Partially received request
+  uint8_t req[DMIDPI_DIRECT_REQ_BYTES];
+  uint32_t req_len;
+  // Number of requests issued on the DMI interface without a response yet
+  uint32_t outstanding;
+};
+
 struct dmidpi_ctx {
   struct tcp_server_ctx *sock;
   struct jtag_ctx jtag;
   struct dmi_sig_values sig;
+  // Batched shift message in progress (not saved in checkpoints: the client
+  // connection isn't either)
+  struct jtag_batch batch;
+  // Direct DMI interface (not saved in checkpoints, for the same reason)
+  struct dmi_direct_ctx direct;
 };
 
 /**
@@ -324,6 +360,42 @@ static bool process_cmd_byte(struct dmidpi_ctx *ctx, char cmd) {
   return false;
 }
 
+/**
+ * Run as much of a batched shift message as possible
+ *
+ * There is no real TCK here, so cycles are run back to back, stopping early
+ * (like process_cmd_byte) when a command completes. Once all the cycles are
+ * done, the TDO vector is sent back to the client.
+ *
+ * @param ctx  dmidpi context object
+ * @param done set to true if a command completed
+ * @return false if the message hasn't been fully received yet
+ */
+static bool run_batch(struct dmidpi_ctx *ctx, char *done) {
+  struct jtag_batch *batch = &ctx->batch;
+
+  if (batch->state == JtagBatchReceiving &&
+      !jtag_batch_receive(batch, ctx->sock)) {
+    return false;
+  }
+
+  while (!jtag_batch_done(batch)) {
+    bool tms, tdi;
+    jtag_batch_get(batch, &tms, &tdi);
+    process_jtag_cmd(ctx, tdi, tms, false);
+    jtag_batch_put_tdo(batch, ctx->jtag.jtag_tdo);
+    if (process_jtag_cmd(ctx, tdi, tms, true)) {
+      *done = 1;
+      break;
+    }
+  }
+
+  if (jtag_batch_done(batch)) {
+    jtag_batch_finish(batch, ctx->sock);
+  }
+  return true;
+}
+
 /**
  * Process DPI inputs from the design
  *
@@ -336,7 +408,17 @@ static void process_dmi_inputs(struct dmidpi_ctx *ctx) {
   }
   // Always ready for a resp
   ctx->sig.dmi_rsp_ready = 1;
-  if (ctx->sig.dmi_rsp_valid) {
+  if (ctx->sig.dmi_rsp_valid && ctx->direct.outstanding) {
+    // Response to a direct request (the two interfaces never have requests in
+    // flight at the same time)
+    uint8_t rsp[DMIDPI_DIRECT_RSP_BYTES];
+    rsp[0] = ctx->sig.dmi_rsp_resp & 0x3;
+    for (int i = 0; i < 4; ++i) {
+      rsp[1 + i] = (ctx->sig.dmi_rsp_data >> (8 * i)) & 0xff;
+    }
+    tcp_server_write_block(ctx->direct.sock, (const char *)rsp, sizeof(rsp));
+    --ctx->direct.outstanding;
+  } else if (ctx->sig.dmi_rsp_valid) {
     ctx->jtag.dr_captured = (uint64_t)ctx->sig.dmi_rsp_data << 2;
     ctx->jtag.dr_captured |= (uint64_t)ctx->sig.dmi_rsp_resp & 0x3;
     // Clear req outstanding flag
@@ -355,32 +437,102 @@ static void update_dmi_state(struct dmidpi_ctx *ctx) {
   // read input from design
   process_dmi_inputs(ctx);
 
-  // If we are waiting for a previous transaction to complete, do not attempt
-  // a new one
-  if (ctx->jtag.dmi_outstanding) {
+  // If we are waiting for a previous transaction to complete (from either
+  // interface), do not attempt a new one
+  if (ctx->jtag.dmi_outstanding || ctx->direct.outstanding) {
     return;
   }
 
   char done = 0;
   while (!done) {
+    // finish any batched shift message before reading more commands
+    if (ctx->batch.state != JtagBatchIdle) {
+      if (!run_batch(ctx, &done)) {
+        return;
+      }
+      continue;
+    }
+
     // read a command byte
     char cmd;
     if (!tcp_server_read(ctx->sock, &cmd)) {
       return;
     }
+    if (cmd == JTAG_BATCH_CMD) {
+      jtag_batch_begin(&ctx->batch);
+      continue;
+    }
     // Process command bytes until a command completes
     done = process_cmd_byte(ctx, cmd);
   }
 }
 
-void *dmidpi_create(const char *display_name, int listen_port) {
+/**
+ * Issue the next request from the direct interface, if there is one and the
+ * DMI interface can take it
+ *
+ * @param ctx dmidpi context object
+ */
+static void update_direct_state(struct dmidpi_ctx *ctx) {
+  struct dmi_direct_ctx *direct = &ctx->direct;
+
+  if (!direct->sock || ctx->jtag.dmi_outstanding || ctx->sig.dmi_req_valid ||
+      direct->outstanding >= DMIDPI_DIRECT_MAX_OUTSTANDING) {
+    return;
+  }
+
+  direct->req_len += tcp_server_read_block(
+      direct->sock, (char *)&direct->req[direct->req_len],
+      DMIDPI_DIRECT_REQ_BYTES - direct->req_len);
+  if (direct->req_len < DMIDPI_DIRECT_REQ_BYTES) {
+    return;
+  }
+  direct->req_len = 0;
+
+  uint8_t op = direct->req[0];
+  if (op != 1 && op != 2) {
+    fprintf(stderr,
+            "DMI DPI: Protocol violation detected: unsupported direct op %d\n",
+            op);
+    exit(1);
+  }
+
+  uint32_t data = 0;
+  for (int i = 0; i < 4; ++i) {
+    data |= (uint32_t)direct->req[2 + i] << (8 * i);
+  }
+
+  ctx->sig.dmi_req_valid = 1;
+  ctx->sig.dmi_req_addr = direct->req[1] & 0x7F;
+  ctx->sig.dmi_req_op = op;
+  ctx->sig.dmi_req_data = data;
+  ++direct->outstanding;
+}
+
+void *dmidpi_create(const char *display_name, int listen_port,
+                    int direct_listen_port) {
   // Create context
   struct dmidpi_ctx *ctx =
       (struct dmidpi_ctx *)calloc(1, sizeof(struct dmidpi_ctx));
   assert(ctx);
 
   // Set up socket details
-  ctx->sock = tcp_server_create(display_name, listen_port);
+  ctx->sock = tcp_server_create_with_bufsize(display_name, listen_port,
+                                             JTAG_BATCH_TCP_BUFSIZE);
+  jtag_batch_reset(&ctx->batch);
+
+  if (direct_listen_port) {
+    char *direct_name = (char *)malloc(strlen(display_name) + 8);
+    assert(direct_name);
+    sprintf(direct_name, "%s-direct", display_name);
+    ctx->direct.sock = tcp_server_create(direct_name, direct_listen_port);
+    free(direct_name);
+
+    printf(
+        "\n"
+        "DMI: Direct DMI interface %s is listening on port %d.\n",
+        display_name, direct_listen_port);
+  }
 
   printf(
       "\n"
@@ -391,17 +543,26 @@ void *dmidpi_create(const char *display_name, int listen_port) {
       "  remote_bitbang_port %d\n",
       display_name, listen_port, listen_port);
 
+  dpi_checkpoint_register(ctx, &ctx->jtag, sizeof(ctx->jtag));
+  dpi_checkpoint_register(ctx, &ctx->sig, sizeof(ctx->sig));
+
   return (void *)ctx;
 }
 
 void dmidpi_close(void *ctx_void) {
-  struct dmidpi_ctx *ctx = (struct dmidpi_ctx *)ctx_void;
+  struct dmidpi_ctx *ctx =
+      (struct dmidpi_ctx *)dpi_checkpoint_resolve(ctx_void);
   if (!ctx) {
     return;
   }
 
-  // Shut down the server
+  dpi_checkpoint_unregister(ctx);
+
+  // Shut down the servers
   tcp_server_close(ctx->sock);
+  if (ctx->direct.sock) {
+    tcp_server_close(ctx->direct.sock);
+  }
 
   free(ctx);
 }
@@ -412,7 +573,8 @@ void dmidpi_tick(void *ctx_void, svBit *dmi_req_valid,
                  const svBit dmi_rsp_valid, svBit *dmi_rsp_ready,
                  const svBitVecVal *dmi_rsp_data,
                  const svBitVecVal *dmi_rsp_resp, svBit *dmi_rst_n) {
-  struct dmidpi_ctx *ctx = (struct dmidpi_ctx *)ctx_void;
+  struct dmidpi_ctx *ctx =
+      (struct dmidpi_ctx *)dpi_checkpoint_resolve(ctx_void);
 
   if (!ctx) {
     return;
@@ -424,6 +586,7 @@ void dmidpi_tick(void *ctx_void, svBit *dmi_req_valid,
   ctx->sig.dmi_rsp_resp = *dmi_rsp_resp;
 
   update_dmi_state(ctx);
+  update_direct_state(ctx);
 
   *dmi_req_valid = ctx->sig.dmi_req_valid;
   *dmi_req_addr = ctx->sig.dmi_req_addr;
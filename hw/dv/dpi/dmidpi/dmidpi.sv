@@ -4,7 +4,8 @@
 
 module dmidpi #(
   parameter string Name = "dmi0", // name of the interface (display only)
-  parameter int ListenPort = 44853 // TCP port to listen on
+  parameter int ListenPort = 44853, // TCP port to listen on
+  parameter int DirectListenPort = 44854 // TCP port for direct DMI requests (0: disabled)
 )(
   input  bit        clk_i,
   input  bit        rst_ni,
@@ -22,7 +23,8 @@ module dmidpi #(
 );
 
   import "DPI-C"
-  function chandle dmidpi_create(input string name, input int listen_port);
+  function chandle dmidpi_create(input string name, input int listen_port,
+                                 input int direct_listen_port);
 
   import "DPI-C"
   function void dmidpi_tick(input chandle ctx, output bit dmi_req_valid,
@@ -38,7 +40,7 @@ module dmidpi #(
   chandle ctx;
 
   initial begin
-    ctx = dmidpi_create(Name, ListenPort);
+    ctx = dmidpi_create(Name, ListenPort, DirectListenPort);
   end
 
   final begin
@@ -4,6 +4,8 @@
 
 #include "gpiodpi.h"
 
+#include "dpi_checkpoint.h"
+
 #ifdef __linux__
 #include <pty.h>
 #elif __APPLE__
@@ -27,6 +29,20 @@
 #define SET_BIT(word, bit_idx) ((word) |= (1 << (bit_idx)))
 #define CLR_BIT(word, bit_idx) ((word) &= ~(1 << (bit_idx)))
 
+#define GPIODPI_IN_BUF_SIZE 4096
+#define GPIODPI_OUT_BUF_SIZE 4096
+// Longest device-to-host record: kind, three 64-bit varints
+#define GPIODPI_MAX_RECORD (1 + 3 * 10)
+
+// A queued binary mode step
+struct gpiodpi_step {
+  uint64_t due;  // cycle to apply it at
+  uint32_t mask;
+  uint32_t value;
+  int sync;  // non-zero for a sync request, which only sends tag
+  uint32_t tag;
+};
+
 struct gpiodpi_ctx {
   // The number of pins we're driving.
   int n_bits;
@@ -40,6 +56,25 @@ struct gpiodpi_ctx {
   char dev_to_host_path[PATH_MAX];
   int host_to_dev_fifo;
   char host_to_dev_path[PATH_MAX];
+
+  // Binary mode state. The step queue and the record stream are not
+  // checkpointed, so take checkpoints while nothing is queued.
+  int binary;
+  // Bytes read from the host but not yet parsed
+  uint8_t in_buf[GPIODPI_IN_BUF_SIZE];
+  size_t in_len;
+  // Records not yet written to the host
+  uint8_t out_buf[GPIODPI_OUT_BUF_SIZE];
+  size_t out_len;
+  // Cycle of the last record, and the state the host last saw
+  uint64_t last_record_cycle;
+  uint32_t reported_data;
+  uint32_t reported_oe;
+  // Circular queue of steps, ordered by due cycle
+  struct gpiodpi_step *steps;
+  size_t steps_size;
+  size_t steps_head;
+  size_t steps_count;
 };
 
 /**
@@ -92,9 +127,24 @@ static void print_usage(char *rfifo, char *wfifo, int n_bits) {
          wfifo);
 }
 
-void *gpiodpi_create(const char *name, int n_bits) {
+/**
+ * Print out a usage message for the binary GPIO interface.
+ *
+ * @arg rfifo the path to the "read" side (w.r.t the host).
+ * @arg wfifo the path to the "write" side (w.r.t the host).
+ * @arg n_bits the number of pins supported.
+ */
+static void print_binary_usage(char *rfifo, char *wfifo, int n_bits) {
+  printf("\n");
+  printf(
+      "GPIO: FIFO pipes created at %s (read) and %s (write) for %d-bit wide "
+      "GPIO in binary mode. See gpiodpi.h for the protocol.\n",
+      rfifo, wfifo, n_bits);
+}
+
+void *gpiodpi_create(const char *name, int n_bits, int binary) {
   struct gpiodpi_ctx *ctx =
-      (struct gpiodpi_ctx *)malloc(sizeof(struct gpiodpi_ctx));
+      (struct gpiodpi_ctx *)calloc(1, sizeof(struct gpiodpi_ctx));
   assert(ctx);
 
   // n_bits > 32 requires more sophisticated handling of svBitVecVal which we
@@ -103,6 +153,7 @@ void *gpiodpi_create(const char *name, int n_bits) {
   ctx->n_bits = n_bits;
 
   ctx->driven_pin_values = 0;
+  ctx->binary = binary;
 
   char cwd_buf[PATH_MAX];
   char *cwd = getcwd(cwd_buf, sizeof(cwd_buf));
@@ -128,16 +179,83 @@ void *gpiodpi_create(const char *name, int n_bits) {
   int flags = fcntl(ctx->host_to_dev_fifo, F_GETFL, 0);
   fcntl(ctx->host_to_dev_fifo, F_SETFL, flags | O_NONBLOCK);
 
-  print_usage(ctx->dev_to_host_path, ctx->host_to_dev_path, ctx->n_bits);
+  if (binary) {
+    print_binary_usage(ctx->dev_to_host_path, ctx->host_to_dev_path,
+                       ctx->n_bits);
+  } else {
+    print_usage(ctx->dev_to_host_path, ctx->host_to_dev_path, ctx->n_bits);
+  }
+
+  dpi_checkpoint_register(ctx, &ctx->driven_pin_values,
+                          sizeof(ctx->driven_pin_values));
 
   return (void *)ctx;
 }
 
+/**
+ * Write all buffered binary mode records to the host.
+ */
+static void flush_records(struct gpiodpi_ctx *ctx) {
+  size_t done = 0;
+  while (done < ctx->out_len) {
+    ssize_t written = write(ctx->dev_to_host_fifo, ctx->out_buf + done,
+                            ctx->out_len - done);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      fprintf(stderr, "GPIO: Failed to write to %s: %s\n",
+              ctx->dev_to_host_path, strerror(errno));
+      break;
+    }
+    done += written;
+  }
+  ctx->out_len = 0;
+}
+
+static void put_varint(struct gpiodpi_ctx *ctx, uint64_t value) {
+  do {
+    uint8_t byte = value & 0x7f;
+    value >>= 7;
+    ctx->out_buf[ctx->out_len++] = byte | (value ? 0x80 : 0);
+  } while (value);
+}
+
+/**
+ * Start a binary mode record of |kind| at |cycle|.
+ */
+static void start_record(struct gpiodpi_ctx *ctx, uint8_t kind,
+                         uint64_t cycle) {
+  if (ctx->out_len + GPIODPI_MAX_RECORD > GPIODPI_OUT_BUF_SIZE) {
+    flush_records(ctx);
+  }
+  ctx->out_buf[ctx->out_len++] = kind;
+  put_varint(ctx, cycle - ctx->last_record_cycle);
+  ctx->last_record_cycle = cycle;
+}
+
 void gpiodpi_device_to_host(void *ctx_void, svBitVecVal *gpio_data,
-                            svBitVecVal *gpio_oe) {
-  struct gpiodpi_ctx *ctx = (struct gpiodpi_ctx *)ctx_void;
+                            svBitVecVal *gpio_oe, uint64_t cycle) {
+  struct gpiodpi_ctx *ctx =
+      (struct gpiodpi_ctx *)dpi_checkpoint_resolve(ctx_void);
   assert(ctx);
 
+  if (ctx->binary) {
+    uint32_t pin_mask =
+        (ctx->n_bits == 32) ? 0xffffffffu : ((1u << ctx->n_bits) - 1);
+    uint32_t data = gpio_data[0] & pin_mask;
+    uint32_t oe = gpio_oe[0] & pin_mask;
+    if (data == ctx->reported_data && oe == ctx->reported_oe) {
+      return;
+    }
+    start_record(ctx, GPIODPI_REC_EDGE, cycle);
+    put_varint(ctx, data ^ ctx->reported_data);
+    put_varint(ctx, oe ^ ctx->reported_oe);
+    ctx->reported_data = data;
+    ctx->reported_oe = oe;
+    return;
+  }
+
   // Write 0, 1, or X (when oe is not set) for each GPIO pin, in big endian
   // order (i.e., pin 0 is the last character written). Finish it with a
   // newline.
@@ -186,10 +304,140 @@ static uint32_t parse_dec(char **text) {
   return value;
 }
 
-uint32_t gpiodpi_host_to_device_tick(void *ctx_void, svBitVecVal *gpio_oe) {
-  struct gpiodpi_ctx *ctx = (struct gpiodpi_ctx *)ctx_void;
+static uint32_t get_u32(const uint8_t *p) {
+  return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+         (uint32_t)p[3] << 24;
+}
+
+/**
+ * Append a step to the queue, |delay| cycles after the last queued step or
+ * |cycle| if the queue is empty.
+ */
+static void queue_step(struct gpiodpi_ctx *ctx, uint64_t cycle, uint32_t delay,
+                       uint32_t mask, uint32_t value, int sync, uint32_t tag) {
+  if (ctx->steps_count == ctx->steps_size) {
+    size_t new_size = ctx->steps_size ? 2 * ctx->steps_size : 64;
+    struct gpiodpi_step *steps = (struct gpiodpi_step *)malloc(
+        new_size * sizeof(struct gpiodpi_step));
+    assert(steps);
+    for (size_t i = 0; i < ctx->steps_count; ++i) {
+      steps[i] = ctx->steps[(ctx->steps_head + i) % ctx->steps_size];
+    }
+    free(ctx->steps);
+    ctx->steps = steps;
+    ctx->steps_size = new_size;
+    ctx->steps_head = 0;
+  }
+  uint64_t base = cycle;
+  if (ctx->steps_count) {
+    size_t last = (ctx->steps_head + ctx->steps_count - 1) % ctx->steps_size;
+    base = ctx->steps[last].due;
+  }
+  struct gpiodpi_step *step =
+      &ctx->steps[(ctx->steps_head + ctx->steps_count) % ctx->steps_size];
+  step->due = base + delay;
+  step->mask = mask;
+  step->value = value;
+  step->sync = sync;
+  step->tag = tag;
+  ++ctx->steps_count;
+}
+
+/**
+ * Parse the complete binary mode commands in the input buffer.
+ */
+static void parse_commands(struct gpiodpi_ctx *ctx, uint64_t cycle) {
+  size_t pos = 0;
+  while (pos < ctx->in_len) {
+    const uint8_t *cmd = ctx->in_buf + pos;
+    size_t avail = ctx->in_len - pos;
+    if (cmd[0] == GPIODPI_CMD_CLEAR) {
+      ctx->steps_count = 0;
+      ctx->steps_head = 0;
+      pos += 1;
+    } else if (cmd[0] == GPIODPI_CMD_SYNC) {
+      if (avail < 5) {
+        break;
+      }
+      queue_step(ctx, cycle, 0, 0, 0, 1, get_u32(cmd + 1));
+      pos += 5;
+    } else if (cmd[0] == GPIODPI_CMD_WAVE) {
+      if (avail < 5) {
+        break;
+      }
+      // Take as many whole steps as have arrived; the rest of the command
+      // stays in the buffer with its count reduced.
+      uint32_t count = get_u32(cmd + 1);
+      uint32_t n = (avail - 5) / 12;
+      if (n > count) {
+        n = count;
+      }
+      for (uint32_t i = 0; i < n; ++i) {
+        const uint8_t *s = cmd + 5 + 12 * i;
+        queue_step(ctx, cycle, get_u32(s), get_u32(s + 4), get_u32(s + 8), 0,
+                   0);
+      }
+      if (n < count) {
+        pos += 12 * n;
+        uint32_t left = count - n;
+        ctx->in_buf[pos] = GPIODPI_CMD_WAVE;
+        for (int i = 0; i < 4; ++i) {
+          ctx->in_buf[pos + 1 + i] = left >> (8 * i);
+        }
+        break;
+      }
+      pos += 5 + 12 * n;
+    } else {
+      fprintf(stderr, "GPIO: Unknown binary command 0x%02x from host\n",
+              cmd[0]);
+      exit(1);
+    }
+  }
+  memmove(ctx->in_buf, ctx->in_buf + pos, ctx->in_len - pos);
+  ctx->in_len -= pos;
+}
+
+/**
+ * Binary mode tick: read commands, and apply the steps that are due.
+ */
+static uint32_t binary_tick(struct gpiodpi_ctx *ctx, uint64_t cycle) {
+  ssize_t read_len =
+      read(ctx->host_to_dev_fifo, ctx->in_buf + ctx->in_len,
+           GPIODPI_IN_BUF_SIZE - ctx->in_len);
+  if (read_len > 0) {
+    ctx->in_len += read_len;
+    parse_commands(ctx, cycle);
+  }
+
+  while (ctx->steps_count && ctx->steps[ctx->steps_head].due <= cycle) {
+    struct gpiodpi_step *step = &ctx->steps[ctx->steps_head];
+    if (step->sync) {
+      start_record(ctx, GPIODPI_REC_SYNC, cycle);
+      for (int i = 0; i < 4; ++i) {
+        ctx->out_buf[ctx->out_len++] = step->tag >> (8 * i);
+      }
+    } else {
+      ctx->driven_pin_values =
+          (ctx->driven_pin_values & ~step->mask) | (step->value & step->mask);
+    }
+    ctx->steps_head = (ctx->steps_head + 1) % ctx->steps_size;
+    --ctx->steps_count;
+  }
+
+  flush_records(ctx);
+  return ctx->driven_pin_values;
+}
+
+uint32_t gpiodpi_host_to_device_tick(void *ctx_void, svBitVecVal *gpio_oe,
+                                     uint64_t cycle) {
+  struct gpiodpi_ctx *ctx =
+      (struct gpiodpi_ctx *)dpi_checkpoint_resolve(ctx_void);
   assert(ctx);
 
+  if (ctx->binary) {
+    return binary_tick(ctx, cycle);
+  }
+
   char gpio_str[32 + 2];
   ssize_t read_len = read(ctx->host_to_dev_fifo, gpio_str, 32 + 1);
   if (read_len < 0) {
@@ -235,12 +483,36 @@ parse_loop_end:
   return ctx->driven_pin_values;
 }
 
+uint32_t gpiodpi_host_to_device_next(void *ctx_void, uint64_t cycle) {
+  struct gpiodpi_ctx *ctx =
+      (struct gpiodpi_ctx *)dpi_checkpoint_resolve(ctx_void);
+  assert(ctx);
+
+  if (ctx->binary && ctx->steps_count) {
+    uint64_t due = ctx->steps[ctx->steps_head].due;
+    if (due <= cycle) {
+      return 1;
+    }
+    if (due - cycle < GPIODPI_POLL_CYCLES) {
+      return due - cycle;
+    }
+  }
+  return GPIODPI_POLL_CYCLES;
+}
+
 void gpiodpi_close(void *ctx_void) {
-  struct gpiodpi_ctx *ctx = (struct gpiodpi_ctx *)ctx_void;
+  struct gpiodpi_ctx *ctx =
+      (struct gpiodpi_ctx *)dpi_checkpoint_resolve(ctx_void);
   if (ctx == NULL) {
     return;
   }
 
+  dpi_checkpoint_unregister(ctx);
+
+  if (ctx->binary) {
+    flush_records(ctx);
+  }
+
   if (close(ctx->dev_to_host_fifo) != 0) {
     printf("GPIO: Failed to close FIFO file at %s: %s\n", ctx->dev_to_host_path,
            strerror(errno));
@@ -259,5 +531,6 @@ void gpiodpi_close(void *ctx_void) {
            ctx->host_to_dev_path, strerror(errno));
   }
 
+  free(ctx->steps);
   free(ctx);
 }
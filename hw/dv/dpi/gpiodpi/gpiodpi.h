@@ -5,8 +5,43 @@
 #ifndef OPENTITAN_HW_DV_DPI_GPIODPI_GPIODPI_H_
 #define OPENTITAN_HW_DV_DPI_GPIODPI_GPIODPI_H_
 
+#include <stdint.h>
 #include <svdpi.h>
 
+/**
+ * Binary mode
+ *
+ * In binary mode the FIFOs carry cycle-stamped events rather than text, so
+ * that a host can drive and check waveforms without a round trip per change.
+ * All multi-byte fields are little endian.
+ *
+ * Host-to-device commands:
+ *  - 'W', u32 count, then count steps of {u32 delay, u32 mask, u32 value}:
+ *    queue a waveform. Each step drives the pins in mask to value, delay
+ *    cycles after the previous queued step (or after the command is read if
+ *    nothing is queued).
+ *  - 'C': drop all queued steps.
+ *  - 'S', u32 tag: send a sync record once all steps queued before it have
+ *    been applied.
+ *
+ * Device-to-host records start with a kind byte and the number of cycles
+ * since the previous record as an unsigned LEB128 varint:
+ *  - 'E', varint data_xor, varint oe_xor: pin values and output enables
+ *    changed by these bits. Both start at 0.
+ *  - 'S', u32 tag: reply to a sync command.
+ *
+ * Records are buffered and written at least every GPIODPI_POLL_CYCLES.
+ */
+#define GPIODPI_CMD_WAVE 'W'
+#define GPIODPI_CMD_CLEAR 'C'
+#define GPIODPI_CMD_SYNC 'S'
+#define GPIODPI_REC_EDGE 'E'
+#define GPIODPI_REC_SYNC 'S'
+
+// Cycles between polls of the host-to-device FIFO while no step is due. Each
+// poll performs at least one syscall, so this should be kept reasonably high.
+#define GPIODPI_POLL_CYCLES 2048
+
 extern "C" {
 
 /**
@@ -15,19 +50,22 @@ extern "C" {
  * @param name a name to use when creating the inner FIFO.
  * @param n_bits number of bits to write in each direction; this must be at
  *        most 32 bits.
+ * @param binary non-zero to use the binary protocol rather than text.
  */
-void *gpiodpi_create(const char *name, int n_bits);
+void *gpiodpi_create(const char *name, int n_bits, int binary);
 
 /**
  * Attempt to post the current GPIO state to the outside world.
  *
  * Intended to be called from SystemVerilog.
+ * @param cycle the current clock cycle, used to stamp binary mode records.
  */
 void gpiodpi_device_to_host(void *ctx_void, svBitVecVal *gpio_data,
-                            svBitVecVal *gpio_oe);
+                            svBitVecVal *gpio_oe, uint64_t cycle);
 
 /**
- * Attempt to read a GPIO command from the outside world.
+ * Attempt to read a GPIO command from the outside world, and apply any binary
+ * mode steps that are due.
  *
  * The commands from the host should be a space-separated sequence of high and
  * low commands, terminated by a newline. A high command is of the form |hXX|,
@@ -38,7 +76,18 @@ void gpiodpi_device_to_host(void *ctx_void, svBitVecVal *gpio_data,
  * Intended to be called from SystemVerilog.
  * @return the values to pull the GPIO pins to.
  */
-uint32_t gpiodpi_host_to_device_tick(void *ctx_void, svBitVecVal *gpio_oe);
+uint32_t gpiodpi_host_to_device_tick(void *ctx_void, svBitVecVal *gpio_oe,
+                                     uint64_t cycle);
+
+/**
+ * Cycles until gpiodpi_host_to_device_tick() should next be called.
+ *
+ * This is GPIODPI_POLL_CYCLES, or less when a queued binary mode step is due
+ * sooner.
+ *
+ * Intended to be called from SystemVerilog after each tick.
+ */
+uint32_t gpiodpi_host_to_device_next(void *ctx_void, uint64_t cycle);
 
 /**
  * Relinquish resources held by a GPIO DPI interface.
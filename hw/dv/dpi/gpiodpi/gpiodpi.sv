@@ -2,6 +2,10 @@
 // Licensed under the Apache License, Version 2.0, see LICENSE for details.
 // SPDX-License-Identifier: Apache-2.0
 
+// With the `GPIODPI_BINARY_<name>` plusarg the FIFOs use the binary protocol
+// described in gpiodpi.h: cycle-stamped edge records from the device, and
+// queued waveforms from the host.
+
 module gpiodpi
 #(
   parameter string NAME = "gpio0",
@@ -15,62 +19,73 @@ module gpiodpi
   input  logic [N_GPIO-1:0] gpio_en_d2p
 );
    import "DPI-C" function
-     chandle gpiodpi_create(input string name, input int n_bits);
+     chandle gpiodpi_create(input string name, input int n_bits, input int binary);
 
    import "DPI-C" function
      void gpiodpi_device_to_host(input chandle ctx, input [N_GPIO-1:0] gpio_d2p,
-                                 input [N_GPIO-1:0] gpio_en_d2p);
+                                 input [N_GPIO-1:0] gpio_en_d2p,
+                                 input longint unsigned cycle);
 
    import "DPI-C" function
      void gpiodpi_close(input chandle ctx);
 
    import "DPI-C" function
      int gpiodpi_host_to_device_tick(input chandle ctx,
-                                     input [N_GPIO-1:0] gpio_en_d2p);
+                                     input [N_GPIO-1:0] gpio_en_d2p,
+                                     input longint unsigned cycle);
+
+   import "DPI-C" function
+     int unsigned gpiodpi_host_to_device_next(input chandle ctx,
+                                              input longint unsigned cycle);
 
    chandle ctx;
+   bit binary;
 
    initial begin
-     ctx = gpiodpi_create(NAME, N_GPIO);
+     binary = $test$plusargs({"GPIODPI_BINARY_", NAME});
+     ctx = gpiodpi_create(NAME, N_GPIO, binary);
    end
 
    final begin
      gpiodpi_close(ctx);
    end
 
+   // Clock cycles since the start of the simulation, to stamp binary mode
+   // events
+   longint unsigned cycle = '0;
+   always_ff @(posedge clk_i) begin
+     cycle <= cycle + 1;
+   end
+
+   // The text protocol only reports changes of the pin values; the binary one
+   // also reports output enable changes.
    logic [N_GPIO-1:0] gpio_d2p_r;
+   logic [N_GPIO-1:0] gpio_en_d2p_r;
    always_ff @(posedge clk_i) begin
      gpio_d2p_r <= gpio_d2p;
-     if (gpio_d2p_r != gpio_d2p) begin
-       gpiodpi_device_to_host(ctx, gpio_d2p, gpio_en_d2p);
+     gpio_en_d2p_r <= gpio_en_d2p;
+     if (gpio_d2p_r != gpio_d2p || (binary && gpio_en_d2p_r != gpio_en_d2p)) begin
+       gpiodpi_device_to_host(ctx, gpio_d2p, gpio_en_d2p, cycle);
      end
    end
 
+   // gpiodpi_host_to_device_tick() is called when the counter reaches zero.
+   // gpiodpi_host_to_device_next() reloads it, with GPIODPI_POLL_CYCLES or
+   // the time to the next queued binary mode step.
+   int unsigned counter;
    logic gpio_write_pulse;
 
-   always_ff @(posedge clk_i or negedge rst_ni) begin
-     if (!rst_ni) begin
-       gpio_p2d <= '0; // default value
-     end else if (gpio_write_pulse) begin
-       gpio_p2d <= gpiodpi_host_to_device_tick(ctx, gpio_en_d2p);
-     end
-   end
-
-   // gpiodpio_host_to_device_tick() will be called every MAX_COUNT
-   // clock posedges; this should be kept reasonably high, since each
-   // tick call will perform at least one syscall.
-   localparam MAX_COUNT = 2048;
-   logic [$clog2(MAX_COUNT)-1:0] counter;
-
-   assign gpio_write_pulse = counter == MAX_COUNT -1;
+   assign gpio_write_pulse = counter == 0;
 
    always_ff @(posedge clk_i or negedge rst_ni) begin
      if (!rst_ni) begin
+       gpio_p2d <= '0; // default value
        counter <= '0;
      end else if (gpio_write_pulse) begin
-       counter <= '0;
+       gpio_p2d <= gpiodpi_host_to_device_tick(ctx, gpio_en_d2p, cycle);
+       counter <= gpiodpi_host_to_device_next(ctx, cycle) - 1;
      end else begin
-       counter <= counter + 1'b1;
+       counter <= counter - 1;
      end
    end
 
@@ -3,10 +3,13 @@
 // SPDX-License-Identifier: Apache-2.0
 
 #include "jtagdpi.h"
+#include "dpi_checkpoint.h"
+#include "jtag_batch.h"
 #include "tcp_server.h"
 
 #include <assert.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -14,7 +17,12 @@
 struct jtagdpi_ctx {
   // Server context
   struct tcp_server_ctx *sock;
-  // Signals
+  // Batched shift message in progress (not saved in checkpoints: the client
+  // connection isn't either)
+  struct jtag_batch batch;
+  // Whether the next tick of the batch is the TCK rising edge of a cycle
+  bool batch_rising;
+  // Signals (saved in checkpoints)
   uint8_t tck;
   uint8_t tms;
   uint8_t tdi;
@@ -40,6 +48,42 @@ static void reset_jtag_signals(struct jtagdpi_ctx *ctx) {
   ctx->srst_n = 1;
 }
 
+/**
+ * Run the next step of a batched shift message
+ *
+ * Each cycle takes two ticks: the first drives TMS and TDI with TCK low and
+ * the second samples TDO and raises TCK. Once all cycles are done, TCK is
+ * lowered and the TDO vector is sent back to the client.
+ */
+static void run_batch(struct jtagdpi_ctx *ctx) {
+  struct jtag_batch *batch = &ctx->batch;
+
+  if (batch->state == JtagBatchReceiving &&
+      !jtag_batch_receive(batch, ctx->sock)) {
+    return;
+  }
+
+  if (jtag_batch_done(batch)) {
+    ctx->tck = 0;
+    ctx->batch_rising = false;
+    jtag_batch_finish(batch, ctx->sock);
+    return;
+  }
+
+  if (!ctx->batch_rising) {
+    bool tms, tdi;
+    jtag_batch_get(batch, &tms, &tdi);
+    ctx->tck = 0;
+    ctx->tms = tms;
+    ctx->tdi = tdi;
+    ctx->batch_rising = true;
+  } else {
+    jtag_batch_put_tdo(batch, ctx->tdo);
+    ctx->tck = 1;
+    ctx->batch_rising = false;
+  }
+}
+
 /**
  * Update the JTAG signals in the context structure
  */
@@ -51,8 +95,17 @@ static void update_jtag_signals(struct jtagdpi_ctx *ctx) {
    * The remote_bitbang protocol implemented below is documented in the OpenOCD
    * source tree at doc/manual/jtag/drivers/remote_bitbang.txt, or online at
    * https://repo.or.cz/openocd.git/blob/HEAD:/doc/manual/jtag/drivers/remote_bitbang.txt
+   *
+   * Batched shift messages (see jtag_batch.h) can be mixed in on the same
+   * connection.
    */
 
+  // finish any batched shift message before reading more commands
+  if (ctx->batch.state != JtagBatchIdle) {
+    run_batch(ctx);
+    return;
+  }
+
   // read a command byte
   char cmd;
   if (!tcp_server_read(ctx->sock, &cmd)) {
@@ -84,6 +137,10 @@ static void update_jtag_signals(struct jtagdpi_ctx *ctx) {
   } else if (cmd == 'Q') {
     // quit (client disconnect)
     act_quit = true;
+  } else if (cmd == JTAG_BATCH_CMD) {
+    // batched shift message
+    jtag_batch_begin(&ctx->batch);
+    run_batch(ctx);
   } else {
     fprintf(stderr,
             "JTAG DPI Protocol violation detected: unsupported command %c\n",
@@ -109,10 +166,16 @@ void *jtagdpi_create(const char *display_name, int listen_port) {
   assert(ctx);
 
   // Create socket
-  ctx->sock = tcp_server_create(display_name, listen_port);
+  ctx->sock = tcp_server_create_with_bufsize(display_name, listen_port,
+                                             JTAG_BATCH_TCP_BUFSIZE);
 
+  jtag_batch_reset(&ctx->batch);
   reset_jtag_signals(ctx);
 
+  dpi_checkpoint_register(ctx, &ctx->tck,
+                          sizeof(struct jtagdpi_ctx) -
+                              offsetof(struct jtagdpi_ctx, tck));
+
   printf(
       "\n"
       "JTAG: Virtual JTAG interface %s is listening on port %d. Use\n"
@@ -126,17 +189,20 @@ void *jtagdpi_create(const char *display_name, int listen_port) {
 }
 
 void jtagdpi_close(void *ctx_void) {
-  struct jtagdpi_ctx *ctx = (struct jtagdpi_ctx *)ctx_void;
+  struct jtagdpi_ctx *ctx =
+      (struct jtagdpi_ctx *)dpi_checkpoint_resolve(ctx_void);
   if (!ctx) {
     return;
   }
+  dpi_checkpoint_unregister(ctx);
   tcp_server_close(ctx->sock);
   free(ctx);
 }
 
 void jtagdpi_tick(void *ctx_void, svBit *tck, svBit *tms, svBit *tdi,
                   svBit *trst_n, svBit *srst_n, const svBit tdo) {
-  struct jtagdpi_ctx *ctx = (struct jtagdpi_ctx *)ctx_void;
+  struct jtagdpi_ctx *ctx =
+      (struct jtagdpi_ctx *)dpi_checkpoint_resolve(ctx_void);
 
   ctx->tdo = tdo;
 
@@ -22,8 +22,32 @@ struct mon_ctx {
 
   unsigned char mobuf[MON_BUFLEN];
   unsigned char sobuf[MON_BUFLEN];
+
+  // Binary capture of the pin changes, or NULL to log them as text
+  FILE *cap_file;
 };
 
+/*
+ * Capture format, all fields little endian:
+ *
+ * Header: "SPIC", u16 version, u8 mode (CPOL << 1 | CPHA), u8 loglevel
+ * Records: u32 tick, u16 p2d, u16 d2p
+ *
+ * A record is written on each tick where p2d or d2p changes. A record with
+ * p2d of SPICAP_MODE_CHANGE sets the mode to d2p from that tick on.
+ */
+#define SPICAP_VERSION 1
+#define SPICAP_MODE_CHANGE 0xffff
+
+static void capture_record(FILE *cap_file, uint32_t tick, uint16_t p2d,
+                           uint16_t d2p) {
+  uint8_t rec[8] = {(uint8_t)tick,         (uint8_t)(tick >> 8),
+                    (uint8_t)(tick >> 16), (uint8_t)(tick >> 24),
+                    (uint8_t)p2d,          (uint8_t)(p2d >> 8),
+                    (uint8_t)d2p,          (uint8_t)(d2p >> 8)};
+  fwrite(rec, sizeof(rec), 1, cap_file);
+}
+
 void *monitor_spi_init(int mode) {
   struct mon_ctx *mon = (struct mon_ctx *)calloc(1, sizeof(struct mon_ctx));
   assert(mon);
@@ -41,6 +65,38 @@ void *monitor_spi_init(int mode) {
   return (void *)mon;
 }
 
+void monitor_spi_set_mode(void *mon_void, int mode, int tick) {
+  struct mon_ctx *mon = (struct mon_ctx *)mon_void;
+  assert(mon);
+
+  mon->cpol = (mode & 2) >> 1;
+  mon->cpha = mode & 1;
+  if (mon->cap_file) {
+    capture_record(mon->cap_file, tick, SPICAP_MODE_CHANGE, mode);
+  }
+}
+
+/**
+ * Write pin changes to a binary capture file instead of logging them as text
+ *
+ * util/dpi_capture_to_text.py replays the capture through the same logic as
+ * monitor_spi() to produce the text log.
+ *
+ * @param mon_void - monitor context structure
+ * @param cap_file - FILE * for the capture, opened for binary writing
+ * @param loglevel - log level recorded for the converter
+ */
+void monitor_spi_capture(void *mon_void, FILE *cap_file, int loglevel) {
+  struct mon_ctx *mon = (struct mon_ctx *)mon_void;
+  assert(mon);
+  mon->cap_file = cap_file;
+
+  uint8_t mode = mon->cpol << 1 | mon->cpha;
+  uint8_t hdr[8] = {'S', 'P', 'I', 'C', SPICAP_VERSION, 0, mode,
+                    (uint8_t)loglevel};
+  fwrite(hdr, sizeof(hdr), 1, cap_file);
+}
+
 /*
  * Simple drawing of a waveform vertically (line by line)
  *
@@ -171,6 +227,14 @@ void monitor_spi(void *mon_void, FILE *mon_file, int loglevel, int tick,
   int logbits = (loglevel & 0x1);
   int logpkts = (loglevel & 0x8);
 
+  if (mon->cap_file) {
+    if ((p2d != mon->prev_p2d) || (d2p != mon->prev_d2p)) {
+      capture_record(mon->cap_file, tick, p2d, d2p);
+      mon->prev_p2d = p2d;
+      mon->prev_d2p = d2p;
+    }
+    return;
+  }
   if ((tick == 1) && logbits) {
     fprintf(mon_file, "              CSB SCK MO  MI\n");
   }
@@ -12,6 +12,8 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <poll.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -19,6 +21,7 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "dpi_checkpoint.h"
 #include "spidpi.h"
 #include "verilator_sim_ctrl.h"
 
@@ -26,27 +29,253 @@
 // and resume at the first SPI packet
 // #define CONTROL_TRACE
 
-void *spidpi_create(const char *name, int mode, int loglevel) {
-  int i;
+// Make sure the frame buffer can hold len bytes
+static void ensure_frame(struct spidpi_ctx *ctx, size_t len) {
+  if (ctx->frame_size >= len) {
+    return;
+  }
+  ctx->frame = (unsigned char *)realloc(ctx->frame, len);
+  assert(ctx->frame);
+  ctx->frame_size = len;
+}
+
+// Number of data lines (1, 2 or 4) used by the frame being run
+static int lane_count(const struct spidpi_ctx *ctx) { return 1 << ctx->lanes; }
+
+// Number of bytes returned to the host at the end of the frame. A single lane
+// transfer is full duplex, so whatever the device sent during the write phase
+// is returned as well.
+static uint32_t resp_len(const struct spidpi_ctx *ctx) {
+  return ctx->lanes ? ctx->read_len : ctx->write_len + ctx->read_len;
+}
+
+// Position of bit 0 of the n-bit group idx within its byte
+static int group_shift(const struct spidpi_ctx *ctx, uint32_t idx, int n) {
+  int pos = (idx * n) & 7;
+  return ctx->msbfirst ? 8 - n - pos : pos;
+}
+
+static int get_group(const struct spidpi_ctx *ctx, const unsigned char *buf,
+                     uint32_t idx, int n) {
+  return (buf[(idx * n) >> 3] >> group_shift(ctx, idx, n)) & ((1 << n) - 1);
+}
+
+static void put_group(const struct spidpi_ctx *ctx, unsigned char *buf,
+                      uint32_t idx, int n, int val) {
+  buf[(idx * n) >> 3] |= val << group_shift(ctx, idx, n);
+}
+
+// Write all of buf to the host, waiting for the other end to make room if it
+// has to
+static void write_host(struct spidpi_ctx *ctx, const unsigned char *buf,
+                       size_t len) {
+  if (ctx->shm) {
+    shm_ring_server_write(ctx->shm, buf, len);
+    return;
+  }
+  while (len) {
+    ssize_t rv = write(ctx->host, buf, len);
+    if (rv < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN) {
+        struct pollfd pfd = {ctx->host, POLLOUT, 0};
+        poll(&pfd, 1, -1);
+        continue;
+      }
+      fprintf(stderr, "SPI: write() failed: %s\n", strerror(errno));
+      return;
+    }
+    buf += rv;
+    len -= rv;
+  }
+}
+
+// Set the SPI mode. The monitor is told too, so it captures on the right
+// edges.
+static void set_mode(struct spidpi_ctx *ctx, int mode) {
+  /* mode is CPOL << 1 | CPHA
+   * cpol = 0 --> external clock matches internal
+   * cpha = 0 --> drive on internal falling edge, capture on rising
+   */
+  int cpol = (mode >> 1) & 1;
+  int cpha = mode & 1;
+  if (cpol == ctx->cpol && cpha == ctx->cpha) {
+    return;
+  }
+  ctx->cpol = cpol;
+  ctx->cpha = cpha;
+  monitor_spi_set_mode(ctx->mon, mode, ctx->tick);
+}
+
+static void start_frame(struct spidpi_ctx *ctx) {
+  int n = lane_count(ctx);
+  ctx->ncycles = (ctx->write_len + ctx->read_len) * 8 / n + ctx->dummy;
+  ctx->edge = 0;
+  ctx->wait = 0;
+  ctx->state = SP_CSFALL;
+  memset(ctx->frame + ctx->write_len, 0, resp_len(ctx));
+#ifdef CONTROL_TRACE
+  VerilatorSimCtrl::GetInstance().TraceOn();
+#endif
+}
+
+// Take bytes from in_buf, reading the host when it is empty. Returns the
+// number of bytes available, 0 if there are none yet.
+static int fill_in_buf(struct spidpi_ctx *ctx) {
+  if (ctx->in_pos == ctx->in_len) {
+    int n = ctx->shm ? (int)shm_ring_server_read(ctx->shm, ctx->in_buf,
+                                                 SPIDPI_IN_BUF_SIZE)
+                     : read(ctx->host, ctx->in_buf, SPIDPI_IN_BUF_SIZE);
+    if (n <= 0) {
+      if (n == -1 && errno != EAGAIN) {
+        fprintf(stderr, "Read on SPI FIFO gave %s\n", strerror(errno));
+      }
+      ctx->poll_countdown = SPIDPI_IDLE_POLL_INTERVAL;
+      return 0;
+    }
+    ctx->in_pos = 0;
+    ctx->in_len = n;
+  }
+  return ctx->in_len - ctx->in_pos;
+}
+
+// Copy up to len bytes from in_buf to dst, returns the number copied
+static size_t take_input(struct spidpi_ctx *ctx, unsigned char *dst,
+                         size_t len) {
+  size_t avail = fill_in_buf(ctx);
+  if (len > avail) {
+    len = avail;
+  }
+  memcpy(dst, &ctx->in_buf[ctx->in_pos], len);
+  ctx->in_pos += len;
+  return len;
+}
+
+static uint32_t get_le(const unsigned char *p, int len) {
+  uint32_t val = 0;
+  for (int i = len - 1; i >= 0; --i) {
+    val = (val << 8) | p[i];
+  }
+  return val;
+}
+
+static void parse_header(struct spidpi_ctx *ctx) {
+  const unsigned char *hdr = ctx->hdr;
+  int flags = hdr[1];
+  int lanes = (flags & SPIDPI_FLAG_LANES_MASK) >> SPIDPI_FLAG_LANES_SHIFT;
+  uint32_t div = get_le(&hdr[2], 2);
+  uint32_t write_len = get_le(&hdr[8], 4);
+  uint32_t read_len = get_le(&hdr[12], 4);
+  if (hdr[0] != SPIDPI_FRAME_MAGIC || lanes > 2 ||
+      (flags & ~(SPIDPI_FLAG_MODE_MASK | SPIDPI_FLAG_LANES_MASK |
+                 SPIDPI_FLAG_KEEP_CS)) ||
+      div == 0 || get_le(&hdr[6], 2) != 0 || write_len > SPIDPI_MAX_FRAME ||
+      read_len > SPIDPI_MAX_FRAME - write_len) {
+    fprintf(stderr,
+            "SPI: Bad frame header (magic 0x%02x, flags 0x%02x, div %u, "
+            "write_len %u, read_len %u)\n",
+            hdr[0], flags, div, write_len, read_len);
+    exit(1);
+  }
+  ctx->lanes = lanes;
+  ctx->keep_cs = flags & SPIDPI_FLAG_KEEP_CS;
+  ctx->div = div;
+  ctx->dummy = get_le(&hdr[4], 2);
+  ctx->write_len = write_len;
+  ctx->read_len = read_len;
+  // Changing the mode while CSB is held low would corrupt the transaction,
+  // so only do it between transactions.
+  if (ctx->driving & P2D_CSB) {
+    set_mode(ctx, flags & SPIDPI_FLAG_MODE_MASK);
+  }
+  ensure_frame(ctx, write_len + resp_len(ctx));
+}
+
+// Collect the next frame from the pseudo-terminal. Returns 1 once a complete
+// frame has been received.
+static int receive_frame(struct spidpi_ctx *ctx) {
+  if (!ctx->packet_mode) {
+    ctx->frame_fill += take_input(ctx, ctx->frame + ctx->frame_fill,
+                                  MAX_TRANSACTION - ctx->frame_fill);
+    if (ctx->frame_fill < MAX_TRANSACTION) {
+      return 0;
+    }
+  } else {
+    if (ctx->hdr_len < SPIDPI_FRAME_HDR_LEN) {
+      ctx->hdr_len += take_input(ctx, ctx->hdr + ctx->hdr_len,
+                                 SPIDPI_FRAME_HDR_LEN - ctx->hdr_len);
+      if (ctx->hdr_len < SPIDPI_FRAME_HDR_LEN) {
+        return 0;
+      }
+      parse_header(ctx);
+    }
+    while (ctx->frame_fill < ctx->write_len) {
+      size_t n = take_input(ctx, ctx->frame + ctx->frame_fill,
+                            ctx->write_len - ctx->frame_fill);
+      if (!n) {
+        return 0;
+      }
+      ctx->frame_fill += n;
+    }
+    ctx->hdr_len = 0;
+  }
+  ctx->frame_fill = 0;
+  return 1;
+}
+
+// Drive the data lines for SCK cycle k of the frame
+static void drive_cycle(struct spidpi_ctx *ctx, uint32_t k) {
+  int n = lane_count(ctx);
+  uint32_t write_cycles = ctx->write_len * 8 / n;
+  int val = 0;
+  // A single lane host always drives SDI, multi-lane hosts release the lines
+  // after the write phase so the device can drive them.
+  int en = ctx->lanes ? 0 : 1;
+  if (k < write_cycles) {
+    val = get_group(ctx, ctx->frame, k, n);
+    en = (1 << n) - 1;
+  }
+  ctx->driving = (ctx->driving & (P2D_SCK | P2D_CSB)) |
+                 (val << P2D_SD_SHIFT) | (en << P2D_SD_EN_SHIFT) |
+                 ((val & 1) ? P2D_SDI : 0);
+}
+
+// Capture the data lines for SCK cycle k of the frame
+static void sample_cycle(struct spidpi_ctx *ctx, uint32_t k, int d2p) {
+  int n = lane_count(ctx);
+  uint32_t write_cycles = ctx->write_len * 8 / n;
+  unsigned char *rx = ctx->frame + ctx->write_len;
+  if (k >= write_cycles && k < write_cycles + ctx->dummy) {
+    return;
+  }
+  if (!ctx->lanes) {
+    uint32_t idx = (k < write_cycles) ? k : k - ctx->dummy;
+    put_group(ctx, rx, idx, 1, (d2p & D2P_SDO) ? 1 : 0);
+  } else if (k >= write_cycles) {
+    put_group(ctx, rx, k - write_cycles - ctx->dummy, n,
+              (d2p >> D2P_SD_SHIFT) & ((1 << n) - 1));
+  }
+}
+
+void *spidpi_create(const char *name, int mode, int loglevel, int packet_mode,
+                    int capture, const char *shm_path) {
   struct spidpi_ctx *ctx =
       (struct spidpi_ctx *)calloc(1, sizeof(struct spidpi_ctx));
   assert(ctx);
 
   ctx->loglevel = loglevel;
   ctx->mon = monitor_spi_init(mode);
+  ctx->packet_mode = packet_mode;
   ctx->tick = 0;
   ctx->msbfirst = 1;
-  ctx->nmax = MAX_TRANSACTION;
-  ctx->nin = 0;
-  ctx->nout = 0;
-  ctx->bout = 0;
   ctx->state = SP_IDLE;
-  /* mode is CPOL << 1 | CPHA
-   * cpol = 0 --> external clock matches internal
-   * cpha = 0 --> drive on internal falling edge, capture on rising
-   */
-  ctx->cpol = ((mode == 0) || (mode == 2)) ? 0 : 1;
-  ctx->cpha = ((mode == 1) || (mode == 3)) ? 1 : 0;
+  ctx->cpol = (mode >> 1) & 1;
+  ctx->cpha = mode & 1;
+  ctx->div = SPIDPI_DEFAULT_DIV;
+  ctx->write_len = MAX_TRANSACTION;
+  ensure_frame(ctx, 2 * MAX_TRANSACTION);
   /* CPOL = 1 for clock idle high */
   ctx->driving = P2D_CSB | ((ctx->cpol) ? P2D_SCK : 0);
   char cwd[PATH_MAX];
@@ -55,26 +284,56 @@ void *spidpi_create(const char *name, int mode, int loglevel) {
   assert(cwd_rv != NULL);
 
   int rv;
-  struct termios tty;
-  cfmakeraw(&tty);
+  if (shm_path[0]) {
+    // Frames go through the shared-memory rings, so no pseudo-terminal is
+    // needed
+    ctx->packet_mode = 1;
+    ctx->host = -1;
+    ctx->device = -1;
+    ctx->shm = shm_ring_server_create(name, shm_path, SPIDPI_SHM_BUFSIZE);
+    if (!ctx->shm) {
+      fprintf(stderr, "SPI: Unable to serve %s on socket `%s': %s\n", name,
+              shm_path, strerror(errno));
+      free(ctx->mon);
+      free(ctx->frame);
+      free(ctx);
+      exit(1);
+    }
+    printf(
+        "\n"
+        "SPI: Listening on %s for %s. Attach to it with e.g.\n"
+        "$ spiflash --verilator-shm=%s\n",
+        shm_path, name, shm_path);
+  } else {
+    struct termios tty;
+    cfmakeraw(&tty);
 
-  rv = openpty(&ctx->host, &ctx->device, 0, &tty, 0);
-  assert(rv != -1);
+    rv = openpty(&ctx->host, &ctx->device, 0, &tty, 0);
+    assert(rv != -1);
 
-  rv = ttyname_r(ctx->device, ctx->ptyname, 64);
-  assert(rv == 0 && "ttyname_r failed");
+    rv = ttyname_r(ctx->device, ctx->ptyname, 64);
+    assert(rv == 0 && "ttyname_r failed");
 
-  int cur_flags = fcntl(ctx->host, F_GETFL, 0);
-  assert(cur_flags != -1 && "Unable to read current flags.");
-  int new_flags = fcntl(ctx->host, F_SETFL, cur_flags | O_NONBLOCK);
-  assert(new_flags != -1 && "Unable to set FD flags");
+    int cur_flags = fcntl(ctx->host, F_GETFL, 0);
+    assert(cur_flags != -1 && "Unable to read current flags.");
+    int new_flags = fcntl(ctx->host, F_SETFL, cur_flags | O_NONBLOCK);
+    assert(new_flags != -1 && "Unable to set FD flags");
 
-  printf(
-      "\n"
-      "SPI: Created %s for %s. Connect to it with any terminal program, e.g.\n"
-      "$ screen %s\n"
-      "NOTE: a SPI transaction is run for every 4 characters entered.\n",
-      ctx->ptyname, name, ctx->ptyname);
+    if (packet_mode) {
+      printf(
+          "\n"
+          "SPI: Created %s for %s. Send packet mode frames to it.\n",
+          ctx->ptyname, name);
+    } else {
+      printf(
+          "\n"
+          "SPI: Created %s for %s. Connect to it with any terminal program, "
+          "e.g.\n"
+          "$ screen %s\n"
+          "NOTE: a SPI transaction is run for every 4 characters entered.\n",
+          ctx->ptyname, name, ctx->ptyname);
+    }
+  }
 
   rv = snprintf(ctx->mon_pathname, PATH_MAX, "%s/%s.log", cwd, name);
   assert(rv <= PATH_MAX && rv > 0);
@@ -91,11 +350,33 @@ void *spidpi_create(const char *name, int mode, int loglevel) {
       "$ tail -f %s\n",
       ctx->mon_pathname, ctx->mon_pathname);
 
+  if (capture) {
+    char cap_pathname[PATH_MAX];
+    rv = snprintf(cap_pathname, PATH_MAX, "%s/%s.spicap", cwd, name);
+    assert(rv <= PATH_MAX && rv > 0);
+    ctx->cap_file = fopen(cap_pathname, "wb");
+    if (ctx->cap_file == NULL) {
+      fprintf(stderr, "SPI: Unable to open capture file at %s: %s\n",
+              cap_pathname, strerror(errno));
+      return NULL;
+    }
+    setvbuf(ctx->cap_file, NULL, _IOFBF, 1 << 16);
+    monitor_spi_capture(ctx->mon, ctx->cap_file, loglevel);
+    printf("SPI: Capturing pins to %s\n", cap_pathname);
+  }
+
+  // The host model's state runs from tick to the end of the context. The
+  // monitor only logs, so is not saved.
+  dpi_checkpoint_register(
+      ctx, &ctx->tick,
+      sizeof(struct spidpi_ctx) - offsetof(struct spidpi_ctx, tick));
+
   return (void *)ctx;
 }
 
-char spidpi_tick(void *ctx_void, const svLogicVecVal *d2p_data) {
-  struct spidpi_ctx *ctx = (struct spidpi_ctx *)ctx_void;
+int spidpi_tick(void *ctx_void, const svLogicVecVal *d2p_data) {
+  struct spidpi_ctx *ctx =
+      (struct spidpi_ctx *)dpi_checkpoint_resolve(ctx_void);
   assert(ctx);
   int d2p = d2p_data->aval;
 
@@ -111,106 +392,87 @@ char spidpi_tick(void *ctx_void, const svLogicVecVal *d2p_data) {
   monitor_spi(ctx->mon, ctx->mon_file, ctx->loglevel, ctx->tick, ctx->driving,
               d2p);
 
-  if (ctx->state == SP_IDLE) {
-    int n = read(ctx->host, &(ctx->buf[ctx->nin]), ctx->nmax - ctx->nin);
-    if (n == -1) {
-      if (errno != EAGAIN) {
-        fprintf(stderr, "Read on SPI FIFO gave %s\n", strerror(errno));
-      }
-    } else {
-      ctx->nin += n;
-      if (ctx->nin == ctx->nmax) {
-        ctx->nout = 0;
-        ctx->nin = 0;
-        ctx->bout = ctx->msbfirst ? 0x80 : 0x01;
-        ctx->bin = ctx->msbfirst ? 0x80 : 0x01;
-        ctx->din = 0;
-        ctx->state = SP_CSFALL;
-#ifdef CONTROL_TRACE
-        VerilatorSimCtrl::GetInstance().TraceOn();
-#endif
-      }
+  if (ctx->state == SP_IDLE && ctx->poll_countdown) {
+    --ctx->poll_countdown;
+  } else if (ctx->state == SP_IDLE) {
+    if (receive_frame(ctx)) {
+      start_frame(ctx);
     }
   }
-  // SPI clock toggles every 4th tick (i.e. freq=primary_frequency/8)
-  if ((ctx->tick & 3) || (ctx->state == SP_IDLE)) {
+  // SPI clock toggles every div ticks (i.e. freq=primary_frequency/(2*div))
+  if (ctx->state == SP_IDLE || ++ctx->wait < ctx->div) {
     return ctx->driving;
   }
+  ctx->wait = 0;
 
-  // Only get here on sck edges when active
-  int internal_sck = (ctx->tick & 4) ? 1 : 0;
-  int set_sck = (internal_sck ? P2D_SCK : 0);
-  if (ctx->cpol) {
-    set_sck ^= P2D_SCK;
-  }
-
-  if (internal_sck == ctx->cpha) {
-    // host driving edge (falling for mode 0)
-    switch (ctx->state) {
-      case SP_DMOVE:
-        // SCLK low, CSB low
-        ctx->driving =
-            set_sck | (ctx->buf[ctx->nout] & ctx->bout) ? P2D_SDI : 0;
-        ctx->bout = (ctx->msbfirst) ? ctx->bout >> 1 : ctx->bout << 1;
-        if ((ctx->bout & 0xff) == 0) {
-          ctx->bout = ctx->msbfirst ? 0x80 : 0x01;
-          ctx->nout++;
-          if (ctx->nout == ctx->nmax) {
-            ctx->state = SP_LASTBIT;
-          }
+  int idle_sck = ctx->cpol ? P2D_SCK : 0;
+  switch (ctx->state) {
+    case SP_CSFALL:
+      if (ctx->driving & P2D_CSB) {
+        // Put SCK at its idle level for the frame's mode before selecting the
+        // device
+        if ((ctx->driving & P2D_SCK) != idle_sck) {
+          ctx->driving = P2D_CSB | idle_sck;
+          break;
         }
-        break;
-      case SP_LASTBIT:
+        ctx->driving = idle_sck;
+      }
+      // CSB low. The first bit must be ready before the leading edge if the
+      // device samples on it.
+      if (ctx->cpha == 0 && ctx->ncycles) {
+        drive_cycle(ctx, 0);
+      }
+      ctx->state = ctx->ncycles ? SP_DMOVE : SP_CSRISE;
+      break;
+    case SP_DMOVE: {
+      // Even edges are the leading edge of a cycle (rising for mode 0)
+      uint32_t k = ctx->edge >> 1;
+      int leading = !(ctx->edge & 1);
+      ctx->driving ^= P2D_SCK;
+      if (leading == !ctx->cpha) {
+        sample_cycle(ctx, k, d2p);
+      } else if (leading) {
+        drive_cycle(ctx, k);
+      } else if (k + 1 < ctx->ncycles) {
+        drive_cycle(ctx, k + 1);
+      }
+      if (++ctx->edge == 2 * ctx->ncycles) {
         ctx->state = SP_CSRISE;
-        // fallthrough
-      default:
-        ctx->driving = set_sck | (ctx->driving & ~P2D_SCK);
-        break;
+      }
+      break;
     }
-  } else {
-    // host other edge (rising for mode 0)
-    switch (ctx->state) {
-        // Read input data (opposite edge to sending)
-        // both DMOVE and LASTBIT states are data moving ones!
-      case SP_DMOVE:
-      case SP_LASTBIT:
-        ctx->din = ctx->din | ((d2p & D2P_SDO) ? ctx->bin : 0);
-        ctx->bin = (ctx->msbfirst) ? ctx->bin >> 1 : ctx->bin << 1;
-        if (ctx->bin == 0) {
-          int rv = write(ctx->host, &(ctx->din), 1);
-          assert(rv == 1 && "write() failed.");
-          ctx->bin = (ctx->msbfirst) ? 0x80 : 0x01;
-          ctx->din = 0;
-        }
-        ctx->driving = set_sck | (ctx->driving & ~P2D_SCK);
-        break;
-      case SP_CSFALL:
-        // CSB low, drive SDI to first bit
-        ctx->driving =
-            (set_sck | (ctx->buf[ctx->nout] & ctx->bout) ? P2D_SDI : 0);
-        ctx->state = SP_DMOVE;
-        break;
-      case SP_CSRISE:
+    case SP_CSRISE:
+      if (ctx->keep_cs) {
+        ctx->driving &= P2D_SCK | P2D_CSB;
+      } else {
         // CSB high, clock stopped
-        ctx->driving = P2D_CSB;
-        ctx->state = SP_IDLE;
-        break;
-      case SP_FINISH:
-        VerilatorSimCtrl::GetInstance().RequestStop(true);
-        break;
-      default:
-        ctx->driving = set_sck | (ctx->driving & ~P2D_SCK);
-        break;
-    }
+        ctx->driving = P2D_CSB | idle_sck;
+      }
+      write_host(ctx, ctx->frame + ctx->write_len, resp_len(ctx));
+      ctx->state = SP_IDLE;
+      break;
+    case SP_FINISH:
+      VerilatorSimCtrl::GetInstance().RequestStop(true);
+      break;
+    default:
+      break;
   }
   return ctx->driving;
 }
 
 void spidpi_close(void *ctx_void) {
-  struct spidpi_ctx *ctx = (struct spidpi_ctx *)ctx_void;
+  struct spidpi_ctx *ctx =
+      (struct spidpi_ctx *)dpi_checkpoint_resolve(ctx_void);
   if (!ctx) {
     return;
   }
+  dpi_checkpoint_unregister(ctx);
+  shm_ring_server_close(ctx->shm);
   fclose(ctx->mon_file);
+  if (ctx->cap_file) {
+    fclose(ctx->cap_file);
+  }
+  free(ctx->mon);
+  free(ctx->frame);
   free(ctx);
 }
@@ -6,58 +6,128 @@
 #define OPENTITAN_HW_DV_DPI_SPIDPI_SPIDPI_H_
 
 #include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <svdpi.h>
 
+#include "shm_ring.h"
+
 extern "C" {
 
 #define MAX_TRANSACTION 4
+// Ticks between reads of the pseudo-terminal while idle (each is a syscall)
+#define SPIDPI_IDLE_POLL_INTERVAL 64
+// Size of each shared-memory ring, when they are used
+#define SPIDPI_SHM_BUFSIZE (1 << 20)
+// Ticks between SCK edges in raw mode (i.e. SCK at primary_frequency/8)
+#define SPIDPI_DEFAULT_DIV 4
+// Size of the buffer for bytes read from the pseudo-terminal
+#define SPIDPI_IN_BUF_SIZE 4096
+// Largest write_len + read_len of a packet mode frame
+#define SPIDPI_MAX_FRAME (1 << 20)
+
+// Packet mode frame header, all fields little endian:
+//   u8  magic (SPIDPI_FRAME_MAGIC)
+//   u8  flags (SPIDPI_FLAG_*)
+//   u16 div: ticks between SCK edges, SCK frequency is primary / (2 * div)
+//   u16 dummy: SCK cycles between the write and the read phase
+//   u16 reserved, must be 0
+//   u32 write_len: bytes sent by the host
+//   u32 read_len: bytes received by the host after the dummy cycles
+// The header is followed by write_len bytes of data.
+#define SPIDPI_FRAME_MAGIC 'T'
+#define SPIDPI_FRAME_HDR_LEN 16
+// SPI mode (CPOL << 1 | CPHA)
+#define SPIDPI_FLAG_MODE_MASK 0x03
+// Number of data lines: 0 for single, 1 for dual, 2 for quad
+#define SPIDPI_FLAG_LANES_SHIFT 2
+#define SPIDPI_FLAG_LANES_MASK 0x0c
+// Leave CSB asserted at the end of the frame so the next frame continues the
+// same transaction (e.g. to switch to quad lanes after a command byte)
+#define SPIDPI_FLAG_KEEP_CS 0x10
+
 struct spidpi_ctx {
   int loglevel;
   char ptyname[64];
   int host;
   int device;
+  // Shared-memory rings used instead of the pseudo-terminal, or NULL
+  struct shm_ring_server *shm;
   FILE *mon_file;
   char mon_pathname[PATH_MAX];
   void *mon;
+  // Binary capture of the pins, or NULL when the monitor logs to mon_file
+  FILE *cap_file;
+  // Frame format on the pseudo-terminal: 0 to run a transaction for every
+  // MAX_TRANSACTION bytes, 1 for packet mode frames
+  int packet_mode;
+  // Bytes read from the pseudo-terminal but not yet used
+  unsigned char in_buf[SPIDPI_IN_BUF_SIZE];
+  int in_pos;
+  int in_len;
+  // Packet mode header being collected
+  unsigned char hdr[SPIDPI_FRAME_HDR_LEN];
+  int hdr_len;
+  // Data of the frame being run: write_len bytes to send followed by the
+  // received bytes. Not checkpointed, so take checkpoints between frames.
+  unsigned char *frame;
+  size_t frame_size;
+  size_t frame_fill;
   int tick;
   int cpol;
   int cpha;
   int msbfirst;  // shift direction
-  int nout;
-  int bout;
-  int nin;
-  int bin;
-  int din;
-  int nmax;
-  char driving;
+  // Parameters of the frame being run
+  int div;
+  int lanes;
+  int keep_cs;
+  uint32_t write_len;
+  uint32_t read_len;
+  uint32_t dummy;
+  // Total SCK cycles in the frame and next SCK edge to generate
+  uint32_t ncycles;
+  uint32_t edge;
+  // Ticks left before the next SCK edge
+  int wait;
+  int driving;
   int state;
-  char buf[MAX_TRANSACTION];
+  // Ticks left before the pty is next polled while idle
+  int poll_countdown;
 };
 
 // SPI Host States
 #define SP_IDLE    0
 #define SP_CSFALL  1
 #define SP_DMOVE   2
-#define SP_LASTBIT 3
 #define SP_CSRISE  4
 #define SP_FINISH  99
 
 // Bits in data to C
 #define D2P_SDO    0x2
 #define D2P_SDO_EN 0x1
+// All four data lines (values in bits 7:4, enables in bits 11:8). Used for
+// dual and quad transfers.
+#define D2P_SD_SHIFT 4
+#define D2P_SD_EN_SHIFT 8
 
-// Bits in char from C
+// Bits in int from C
 #define P2D_SCK    0x1
 #define P2D_CSB    0x2
 #define P2D_SDI    0x4
+// All four data lines, as for D2P_SD_SHIFT. Line 0 mirrors P2D_SDI.
+#define P2D_SD_SHIFT 4
+#define P2D_SD_EN_SHIFT 8
 
-void *spidpi_create(const char *name, int mode, int loglevel);
-char spidpi_tick(void *ctx_void, const svLogicVecVal *d2p_data);
+void *spidpi_create(const char *name, int mode, int loglevel, int packet_mode,
+                    int capture, const char *shm_path);
+int spidpi_tick(void *ctx_void, const svLogicVecVal *d2p_data);
 void spidpi_close(void *ctx_void);
 
 // monitor
 void monitor_spi(void *mon_void, FILE *mon_file, int loglevel, int tick,
                  int p2d, int d2p);
 void *monitor_spi_init(int mode);
+void monitor_spi_set_mode(void *mon_void, int mode, int tick);
+void monitor_spi_capture(void *mon_void, FILE *cap_file, int loglevel);
 }
 #endif  // OPENTITAN_HW_DV_DPI_SPIDPI_SPIDPI_H_
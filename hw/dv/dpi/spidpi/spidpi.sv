@@ -7,6 +7,24 @@
 // Bits in LOG_LEVEL sets what is output on info socket
 // 0x01 -- monitor packets
 // 0x08 -- bit level
+//
+// By default a 4-byte transaction is run for every 4 bytes written to the
+// pseudo-terminal. With the `SPIDPI_PACKET_<name>` plusarg the host sends
+// framed transactions instead (see spidpi.h), which can be of any length, use
+// dual or quad data lines and set the SPI mode and clock divider.
+//
+// The spi_device_sd_* ports carry all four data lines for dual and quad
+// transfers. Single lane transfers only use spi_device_sdi_o and
+// spi_device_sdo_i, so a testbench that only needs those can tie the
+// spi_device_sd_* inputs to 0.
+//
+// With the `SPIDPI_CAPTURE_<name>` plusarg the monitor records pin changes to
+// <name>.spicap rather than logging text to <name>.log. Convert it back to
+// text with util/dpi_capture_to_text.py.
+//
+// With `+SPIDPI_SHM_<name>=<socket path>` packet mode frames are exchanged
+// through shared-memory rings (see hw/dv/dpi/common/shm_ring) instead of the
+// pseudo-terminal, which suits tools that move a lot of data.
 
 module spidpi
   #(
@@ -20,22 +38,31 @@ module spidpi
   output logic spi_device_csb_o,
   output logic spi_device_sdi_o,
   input  logic spi_device_sdo_i,
-  input  logic spi_device_sdo_en_i
-
+  input  logic spi_device_sdo_en_i,
+  output logic [3:0] spi_device_sd_o,
+  output logic [3:0] spi_device_sd_en_o,
+  input  logic [3:0] spi_device_sd_i,
+  input  logic [3:0] spi_device_sd_en_i
 );
   import "DPI-C" function
-    chandle spidpi_create(input string name, input int mode, input int loglevel);
+    chandle spidpi_create(input string name, input int mode, input int loglevel,
+                          input int packet_mode, input int capture,
+                          input string shm_path);
 
   import "DPI-C" function
     void spidpi_close(input chandle ctx);
 
   import "DPI-C" function
-    byte spidpi_tick(input chandle ctx_void, input [1:0] d2p_data);
+    int spidpi_tick(input chandle ctx_void, input [11:0] d2p_data);
 
   chandle ctx;
+  string shm_path = "";
 
   initial begin
-    ctx = spidpi_create(NAME, MODE, LOG_LEVEL);
+    $value$plusargs({"SPIDPI_SHM_", NAME, "=%s"}, shm_path);
+    ctx = spidpi_create(NAME, MODE, LOG_LEVEL,
+                        $test$plusargs({"SPIDPI_PACKET_", NAME}),
+                        $test$plusargs({"SPIDPI_CAPTURE_", NAME}), shm_path);
   end
 
   final begin
@@ -43,16 +70,19 @@ module spidpi
   end
 
   logic       unused_rst = rst_ni;
-  logic [1:0] d2p;
-  logic       unused_dummy;
+  logic [11:0] d2p;
+  logic        unused_dummy;
 
-  assign d2p = { spi_device_sdo_i, spi_device_sdo_en_i};
+  assign d2p = { spi_device_sd_en_i, spi_device_sd_i, 2'b00,
+                 spi_device_sdo_i, spi_device_sdo_en_i};
   always_ff @(posedge clk_i) begin
-    automatic byte p2d = spidpi_tick(ctx, d2p);
+    automatic int p2d = spidpi_tick(ctx, d2p);
     spi_device_sck_o <= p2d[0];
     spi_device_csb_o <= p2d[1];
     spi_device_sdi_o <= p2d[2];
+    spi_device_sd_o <= p2d[7:4];
+    spi_device_sd_en_o <= p2d[11:8];
     // stop verilator warning
-    unused_dummy <= |p2d[7:3];
+    unused_dummy <= |{p2d[31:12], p2d[3]};
   end
 endmodule
@@ -4,6 +4,8 @@
 
 #include "uartdpi.h"
 
+#include "dpi_checkpoint.h"
+
 #ifdef __linux__
 #include <pty.h>
 #elif __APPLE__
@@ -17,13 +19,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <unistd.h>
 
-void *uartdpi_create(const char *name, const char *log_file_path) {
-  struct uartdpi_ctx *ctx =
-      (struct uartdpi_ctx *)malloc(sizeof(struct uartdpi_ctx));
-  assert(ctx);
-
+/**
+ * Create a pseudo-terminal for the host to connect to
+ */
+static void open_pty(struct uartdpi_ctx *ctx, const char *name) {
   int rv;
 
   // Initialize UART pseudo-terminal
@@ -46,6 +49,136 @@ void *uartdpi_create(const char *name, const char *log_file_path) {
       "UART: Created %s for %s. Connect to it with any terminal program, e.g.\n"
       "$ screen %s\n",
       ctx->ptyname, name, ctx->ptyname);
+}
+
+/**
+ * Create a Unix socket for the host to connect to
+ *
+ * Unlike a pty, this doesn't need a terminal and works in containers without
+ * /dev/pts, which makes it handy for CI. Any existing file at socket_path is
+ * replaced.
+ */
+static void open_socket(struct uartdpi_ctx *ctx, const char *name,
+                        const char *socket_path) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "UART: Socket path `%s' is too long.\n", socket_path);
+    exit(1);
+  }
+  strcpy(addr.sun_path, socket_path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  assert(fd != -1 && "Unable to create socket.");
+  unlink(socket_path);
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      listen(fd, 1) != 0) {
+    fprintf(stderr, "UART: Unable to listen on socket `%s': %s\n", socket_path,
+            strerror(errno));
+    exit(1);
+  }
+  int rv = fcntl(fd, F_SETFL, O_NONBLOCK);
+  assert(rv != -1 && "Unable to set FD flags");
+
+  ctx->listen_fd = fd;
+  strncpy(ctx->ptyname, socket_path, sizeof(ctx->ptyname) - 1);
+  ctx->ptyname[sizeof(ctx->ptyname) - 1] = '\0';
+
+  printf(
+      "\n"
+      "UART: Listening on Unix socket %s for %s. Connect to it with e.g.\n"
+      "$ socat - UNIX-CONNECT:%s\n",
+      socket_path, name, socket_path);
+}
+
+/**
+ * Accept a client on the Unix socket, if there is one waiting
+ */
+static void try_accept(struct uartdpi_ctx *ctx) {
+  if (ctx->listen_fd < 0 || ctx->host >= 0) {
+    return;
+  }
+  int fd = accept(ctx->listen_fd, NULL, NULL);
+  if (fd < 0) {
+    return;
+  }
+  int rv = fcntl(fd, F_SETFL, O_NONBLOCK);
+  assert(rv != -1 && "Unable to set FD flags");
+  ctx->host = fd;
+}
+
+/**
+ * Drop the connection to a Unix socket client that has gone away
+ */
+static void drop_client(struct uartdpi_ctx *ctx) {
+  if (ctx->listen_fd < 0 || ctx->host < 0) {
+    return;
+  }
+  close(ctx->host);
+  ctx->host = -1;
+}
+
+/**
+ * Send buffered output to the host and the log file
+ *
+ * If the host isn't keeping up (or there's no-one connected), output that
+ * doesn't fit is dropped rather than stalling the simulation. The log file
+ * gets everything.
+ */
+static void flush_output(struct uartdpi_ctx *ctx) {
+  if (!ctx->out_len) {
+    return;
+  }
+
+  size_t done = 0;
+  while (ctx->host >= 0 && done < ctx->out_len) {
+    ssize_t rv = (ctx->listen_fd >= 0)
+                     ? send(ctx->host, &ctx->out_buf[done],
+                            ctx->out_len - done, MSG_NOSIGNAL)
+                     : write(ctx->host, &ctx->out_buf[done],
+                             ctx->out_len - done);
+    if (rv > 0) {
+      done += rv;
+    } else if (rv < 0 && errno == EINTR) {
+      continue;
+    } else {
+      if (rv < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+        drop_client(ctx);
+      }
+      break;
+    }
+  }
+
+  if (ctx->log_file) {
+    size_t rv = fwrite(ctx->out_buf, sizeof(char), ctx->out_len, ctx->log_file);
+    assert(rv == ctx->out_len && "Write to log file failed.");
+  }
+
+  ctx->out_len = 0;
+}
+
+void *uartdpi_create(const char *name, const char *log_file_path,
+                     const char *socket_path) {
+  struct uartdpi_ctx *ctx =
+      (struct uartdpi_ctx *)malloc(sizeof(struct uartdpi_ctx));
+  assert(ctx);
+
+  int rv;
+
+  ctx->host = -1;
+  ctx->device = -1;
+  ctx->listen_fd = -1;
+  ctx->poll_countdown = 0;
+  ctx->in_pos = 0;
+  ctx->in_len = 0;
+  ctx->out_len = 0;
+
+  if (strlen(socket_path) != 0) {
+    open_socket(ctx, name, socket_path);
+  } else {
+    open_pty(ctx, name);
+  }
 
   // Open log file (if requested)
   ctx->log_file = NULL;
@@ -75,17 +208,34 @@ void *uartdpi_create(const char *name, const char *log_file_path) {
     }
   }
 
+  // The buffers only hold data on its way to or from the host, which isn't
+  // part of the simulation state
+  dpi_checkpoint_register(ctx, NULL, 0);
+
   return (void *)ctx;
 }
 
 void uartdpi_close(void *ctx_void) {
-  struct uartdpi_ctx *ctx = (struct uartdpi_ctx *)ctx_void;
+  struct uartdpi_ctx *ctx =
+      (struct uartdpi_ctx *)dpi_checkpoint_resolve(ctx_void);
   if (!ctx) {
     return;
   }
 
-  close(ctx->host);
-  close(ctx->device);
+  dpi_checkpoint_unregister(ctx);
+
+  flush_output(ctx);
+
+  if (ctx->host >= 0) {
+    close(ctx->host);
+  }
+  if (ctx->device >= 0) {
+    close(ctx->device);
+  }
+  if (ctx->listen_fd >= 0) {
+    close(ctx->listen_fd);
+    unlink(ctx->ptyname);
+  }
 
   if (ctx->log_file) {
     // Always ensure the log file is flushed (most important when writing
@@ -100,28 +250,55 @@ void uartdpi_close(void *ctx_void) {
 }
 
 int uartdpi_can_read(void *ctx_void) {
-  struct uartdpi_ctx *ctx = (struct uartdpi_ctx *)ctx_void;
+  struct uartdpi_ctx *ctx =
+      (struct uartdpi_ctx *)dpi_checkpoint_resolve(ctx_void);
+
+  if (ctx->in_pos < ctx->in_len) {
+    return 1;
+  }
+
+  if (ctx->poll_countdown) {
+    --ctx->poll_countdown;
+    return 0;
+  }
+
+  // This is also a good time to pass on any partial line of output (such as a
+  // prompt), and to look for a new client on the Unix socket.
+  flush_output(ctx);
+  try_accept(ctx);
+
+  // Read everything the host has sent in one go
+  ssize_t rv = -1;
+  if (ctx->host >= 0) {
+    rv = read(ctx->host, ctx->in_buf, sizeof(ctx->in_buf));
+    if (rv == 0) {
+      drop_client(ctx);
+    }
+  }
+  if (rv <= 0) {
+    ctx->poll_countdown = UARTDPI_IDLE_POLL_INTERVAL;
+    return 0;
+  }
 
-  int rv = read(ctx->host, &ctx->tmp_read, 1);
-  return (rv == 1);
+  ctx->in_pos = 0;
+  ctx->in_len = rv;
+  return 1;
 }
 
 char uartdpi_read(void *ctx_void) {
-  struct uartdpi_ctx *ctx = (struct uartdpi_ctx *)ctx_void;
+  struct uartdpi_ctx *ctx =
+      (struct uartdpi_ctx *)dpi_checkpoint_resolve(ctx_void);
 
-  return ctx->tmp_read;
+  assert(ctx->in_pos < ctx->in_len);
+  return ctx->in_buf[ctx->in_pos++];
 }
 
 void uartdpi_write(void *ctx_void, char c) {
-  int rv;
-
-  struct uartdpi_ctx *ctx = (struct uartdpi_ctx *)ctx_void;
-
-  rv = write(ctx->host, &c, 1);
-  assert(rv == 1 && "Write to pseudo-terminal failed.");
+  struct uartdpi_ctx *ctx =
+      (struct uartdpi_ctx *)dpi_checkpoint_resolve(ctx_void);
 
-  if (ctx->log_file) {
-    rv = fwrite(&c, sizeof(char), 1, ctx->log_file);
-    assert(rv == 1 && "Write to log file failed.");
+  ctx->out_buf[ctx->out_len++] = c;
+  if (c == '\n' || ctx->out_len == sizeof(ctx->out_buf)) {
+    flush_output(ctx);
   }
 }
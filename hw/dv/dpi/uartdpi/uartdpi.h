@@ -7,17 +7,51 @@
 
 extern "C" {
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdio.h>
 
+// Number of calls to uartdpi_can_read() between reads of the pseudo-terminal
+// while the host is idle. Each poll is a syscall and the TX path calls this
+// on every clock edge when it isn't sending a character.
+#define UARTDPI_IDLE_POLL_INTERVAL 64
+
+// Size of the buffers for data to and from the host. Output is flushed at the
+// end of each line, when the buffer fills up and when the host is polled.
+#define UARTDPI_BUF_SIZE 4096
+
 struct uartdpi_ctx {
   char ptyname[64];
+  // File descriptor used to talk to the host: the pty's host side, or a
+  // connected client of the Unix socket (-1 if there is none)
   int host;
+  // pty device side (-1 if using a Unix socket)
   int device;
-  char tmp_read;
+  // Listening Unix socket (-1 if using a pty)
+  int listen_fd;
+  // Calls to uartdpi_can_read() left before the host is next polled
+  unsigned int poll_countdown;
+  // Data read from the host that hasn't been sent to the design yet
+  char in_buf[UARTDPI_BUF_SIZE];
+  size_t in_pos;
+  size_t in_len;
+  // Data from the design that hasn't been sent to the host yet
+  char out_buf[UARTDPI_BUF_SIZE];
+  size_t out_len;
   FILE *log_file;
 };
 
-void *uartdpi_create(const char *name, const char *log_file_path);
+/**
+ * Create a UART model
+ *
+ * @param name          Name of the UART (for display purposes only)
+ * @param log_file_path Path of a file to copy UART output to, "-" for stdout
+ *                      or "" for no log file
+ * @param socket_path   Path of a Unix socket to listen on instead of creating
+ *                      a pseudo-terminal, or "" to use a pseudo-terminal
+ */
+void *uartdpi_create(const char *name, const char *log_file_path,
+                     const char *socket_path);
 void uartdpi_close(void *ctx_void);
 int uartdpi_can_read(void *ctx_void);
 char uartdpi_read(void *ctx_void);
@@ -6,6 +6,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "usbdpi.h"
 
@@ -40,7 +41,9 @@ const char *decode_pid[] = {
 #define DK 1
 #define DJ 2
 
-#define MON_BYTES_SIZE 1024
+// Bytes after the PID in the largest packet: an isochronous data packet with
+// 1023 bytes of data and a CRC16
+#define MON_BYTES_SIZE (1023 + 2)
 
 struct mon_ctx {
   int state;
@@ -54,6 +57,13 @@ struct mon_ctx {
   int sopAt;
   int lastpid;
   unsigned char bytes[MON_BYTES_SIZE + 2];
+  // Last complete packet from the device, for the host's transfer engine
+  int rx_ready;
+  int rx_pid;
+  int rx_len;
+  unsigned char rx_bytes[MON_BYTES_SIZE];
+  // Binary capture of the packets, or NULL to log them as text
+  FILE *cap_file;
 };
 
 void *monitor_usb_init() {
@@ -67,6 +77,129 @@ void *monitor_usb_init() {
   return (void *)mon;
 }
 
+/**
+ * Take the last packet received from the device
+ *
+ * @param mon_void - monitor context structure
+ * @param pid - set to the packet's PID
+ * @param buf - receives the bytes after the PID (including any CRC)
+ * @param maxlen - size of buf
+ *
+ * @return number of bytes after the PID, or -1 if no packet has been received
+ * since the last call
+ */
+int monitor_usb_rx(void *mon_void, int *pid, uint8_t *buf, int maxlen) {
+  struct mon_ctx *mon = (struct mon_ctx *)mon_void;
+  assert(mon);
+  if (!mon->rx_ready) {
+    return -1;
+  }
+  mon->rx_ready = 0;
+  *pid = mon->rx_pid;
+  int len = (mon->rx_len < maxlen) ? mon->rx_len : maxlen;
+  memcpy(buf, mon->rx_bytes, len);
+  return len;
+}
+
+// pcapng block types and the USB link type, see
+// https://www.ietf.org/archive/id/draft-tuexen-opsawg-pcapng-05.html
+#define PCAPNG_SHB 0x0a0d0d0a
+#define PCAPNG_IDB 0x00000001
+#define PCAPNG_EPB 0x00000006
+#define PCAPNG_BYTE_ORDER 0x1a2b3c4d
+#define PCAPNG_OPT_END 0
+#define PCAPNG_OPT_COMMENT 1
+#define PCAPNG_OPT_EPB_FLAGS 2
+#define PCAPNG_FLAG_INBOUND 1
+#define PCAPNG_FLAG_OUTBOUND 2
+#define LINKTYPE_USB_2_0 288
+
+static void cap_u16(FILE *f, uint16_t v) { fwrite(&v, sizeof(v), 1, f); }
+static void cap_u32(FILE *f, uint32_t v) { fwrite(&v, sizeof(v), 1, f); }
+static void cap_pad(FILE *f, int len) {
+  static const uint8_t zero[4] = {0};
+  fwrite(zero, 1, (4 - (len & 3)) & 3, f);
+}
+static int cap_padded(int len) { return (len + 3) & ~3; }
+
+/**
+ * Send packets to a binary capture file instead of logging them as text
+ *
+ * The capture is pcapng with the USB 2.0 link type, so it can be opened with
+ * Wireshark. Timestamps are the SOP tick, shown as microseconds. Each packet
+ * carries its direction (inbound is device to host) and a comment with the
+ * EOP tick. util/dpi_capture_to_text.py turns it back into the text log.
+ *
+ * Bus errors and the verbose (loglevel 0x2) state messages are still written
+ * to the text log.
+ *
+ * @param mon_void - monitor context structure
+ * @param cap_file - FILE * for the capture, opened for binary writing
+ */
+void monitor_usb_capture(void *mon_void, FILE *cap_file) {
+  struct mon_ctx *mon = (struct mon_ctx *)mon_void;
+  assert(mon);
+  mon->cap_file = cap_file;
+
+  // Section header block
+  cap_u32(cap_file, PCAPNG_SHB);
+  cap_u32(cap_file, 28);
+  cap_u32(cap_file, PCAPNG_BYTE_ORDER);
+  cap_u16(cap_file, 1);  // major version
+  cap_u16(cap_file, 0);  // minor version
+  cap_u32(cap_file, 0xffffffff);  // section length unknown
+  cap_u32(cap_file, 0xffffffff);
+  cap_u32(cap_file, 28);
+
+  // Interface description block, default (microsecond) timestamp resolution
+  cap_u32(cap_file, PCAPNG_IDB);
+  cap_u32(cap_file, 20);
+  cap_u16(cap_file, LINKTYPE_USB_2_0);
+  cap_u16(cap_file, 0);
+  cap_u32(cap_file, 0);  // no snap length
+  cap_u32(cap_file, 20);
+}
+
+/**
+ * Write the packet that has just ended to the capture
+ *
+ * The packet is the PID followed by the bytes after it (including the CRC).
+ * A packet that ended before its PID was complete is written with no data.
+ */
+static void capture_packet(struct mon_ctx *mon, int tick) {
+  FILE *f = mon->cap_file;
+  int len = (mon->state == MS_GET_BYTES) ? (mon->byte + 1) : 0;
+  char comment[16];
+  int comment_len = snprintf(comment, sizeof(comment), "eop %d", tick);
+  uint32_t block_len = 28 + cap_padded(len) + 8 + 4 +
+                       cap_padded(comment_len) + 4 + 4;
+
+  cap_u32(f, PCAPNG_EPB);
+  cap_u32(f, block_len);
+  cap_u32(f, 0);  // interface
+  cap_u32(f, 0);  // timestamp high
+  cap_u32(f, (uint32_t)mon->sopAt);
+  cap_u32(f, len);
+  cap_u32(f, len);
+  if (len) {
+    uint8_t pid = mon->lastpid;
+    fwrite(&pid, 1, 1, f);
+    fwrite(mon->bytes, 1, len - 1, f);
+    cap_pad(f, len);
+  }
+  cap_u16(f, PCAPNG_OPT_EPB_FLAGS);
+  cap_u16(f, 4);
+  cap_u32(f, (mon->driver == M_HOST) ? PCAPNG_FLAG_OUTBOUND
+                                     : PCAPNG_FLAG_INBOUND);
+  cap_u16(f, PCAPNG_OPT_COMMENT);
+  cap_u16(f, comment_len);
+  fwrite(comment, 1, comment_len, f);
+  cap_pad(f, comment_len);
+  cap_u16(f, PCAPNG_OPT_END);
+  cap_u16(f, 0);
+  cap_u32(f, block_len);
+}
+
 #define DR_SIZE 128
 static char dr[DR_SIZE];
 char *pid_2data(int pid, unsigned char d0, unsigned char d1) {
@@ -166,7 +299,17 @@ void monitor_usb(void *mon_void, FILE *mon_file, int loglevel, int tick,
     return;
   }
   if ((mon->line & 0x3f) == ((SE0 << 4) | (SE0 << 2) | (DJ << 0))) {
-    if ((log || compact) && (mon->state == MS_GET_BYTES) && (mon->byte > 0)) {
+    if ((mon->driver == M_DEVICE) && (mon->state == MS_GET_BYTES)) {
+      // Copy before logging, which rewrites non-printable bytes
+      mon->rx_ready = 1;
+      mon->rx_pid = mon->lastpid;
+      mon->rx_len = mon->byte;
+      memcpy(mon->rx_bytes, mon->bytes, mon->byte);
+    }
+    if (mon->cap_file) {
+      capture_packet(mon, tick);
+    } else if ((log || compact) && (mon->state == MS_GET_BYTES) &&
+               (mon->byte > 0)) {
       int i;
       int text = 1;
       uint32_t pkt_crc16, comp_crc16;
@@ -0,0 +1,705 @@
+// Copyright lowRISC contributors.
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+
+// USB host transfer engine
+//
+// Runs transfers queued from a script or a socket, splitting them into
+// transactions and scheduling those into frames the way a host controller
+// does: each frame starts with the periodic (isochronous and interrupt)
+// queue, which gets one transaction per frame, and uses the rest of the frame
+// for the control and bulk queue.
+//
+// Transfers are given as text lines, one per transfer:
+//   control <addr> <ep> <setup> [<data>]
+//   bulk_in|int_in|iso_in <addr> <ep> <len>
+//   bulk_out|int_out|iso_out <addr> <ep> <len> [<data>]
+//   maxpkt <bytes>
+//   wait <frames>
+// <setup> is the 8 byte setup packet in hex. Control transfers take their
+// direction and length from it; <data> is the data stage of an OUT request.
+// For other OUT transfers <data> (in hex) is repeated to make up <len> bytes,
+// and a counting pattern is sent if it is left out. maxpkt sets the maximum
+// packet size of the transfers queued after it (64 by default). Lines starting
+// with # are ignored.
+//
+// A line is reported for every completed transfer:
+//   <seq> <status> <bytes> <frames> <ticks> [<data>]
+// where status is OK, STALL or ERROR, frames and ticks are the time the
+// transfer took, and data is the received data in hex for IN transfers.
+
+#include <assert.h>
+#include <ctype.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tcp_server.h"
+#include "usbdpi.h"
+
+static const char *status_names[] = {"PENDING", "OK", "STALL", "ERROR"};
+
+static int hex_nibble(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  c = tolower(c);
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  return -1;
+}
+
+// Decode a hex string into a newly allocated buffer. Returns the number of
+// bytes, or -1 if the string is not valid hex.
+static int parse_hex(const char *str, uint8_t **out) {
+  size_t n = strlen(str);
+  if (n & 1) {
+    return -1;
+  }
+  uint8_t *buf = (uint8_t *)malloc(n / 2 + 1);
+  assert(buf);
+  for (size_t i = 0; i < n / 2; ++i) {
+    int hi = hex_nibble(str[2 * i]);
+    int lo = hex_nibble(str[2 * i + 1]);
+    if (hi < 0 || lo < 0) {
+      free(buf);
+      return -1;
+    }
+    buf[i] = hi << 4 | lo;
+  }
+  *out = buf;
+  return n / 2;
+}
+
+static int parse_num(const char *str, uint32_t max, uint32_t *val) {
+  char *end;
+  if (!str) {
+    return 0;
+  }
+  errno = 0;
+  unsigned long v = strtoul(str, &end, 0);
+  if (errno || *end || end == str || v > max) {
+    return 0;
+  }
+  *val = v;
+  return 1;
+}
+
+static void enqueue(struct usb_transfer **head, struct usb_transfer **tail,
+                    struct usb_transfer *t) {
+  t->next = NULL;
+  if (*tail) {
+    (*tail)->next = t;
+  } else {
+    *head = t;
+  }
+  *tail = t;
+}
+
+static struct usb_transfer *new_transfer(struct usbdpi_ctx *ctx,
+                                         usb_xfer_type_t type) {
+  struct usb_transfer *t =
+      (struct usb_transfer *)calloc(1, sizeof(struct usb_transfer));
+  assert(t);
+  t->seq = ctx->xfer_seq++;
+  t->type = type;
+  t->maxpkt = ctx->xfer_maxpkt;
+  t->stage = (type == kUsbXferControl) ? XFER_STAGE_SETUP : XFER_STAGE_DATA;
+  t->start_tick = -1;
+  return t;
+}
+
+// Parse one command line and queue the transfer it describes. Returns NULL on
+// success, or a description of what is wrong with the line.
+static const char *parse_command(struct usbdpi_ctx *ctx, char *line) {
+  char *save;
+  char *cmd = strtok_r(line, " \t\r\n", &save);
+  if (!cmd || cmd[0] == '#') {
+    return NULL;
+  }
+  char *args[4];
+  int nargs = 0;
+  char *arg;
+  while ((arg = strtok_r(NULL, " \t\r\n", &save))) {
+    if (nargs == 4) {
+      return "too many arguments";
+    }
+    args[nargs++] = arg;
+  }
+
+  uint32_t val;
+  if (!strcmp(cmd, "maxpkt")) {
+    if (nargs != 1 || !parse_num(args[0], 1023, &val) || !val) {
+      return "expected maxpkt <1-1023>";
+    }
+    ctx->xfer_maxpkt = val;
+    return NULL;
+  }
+  if (!strcmp(cmd, "wait")) {
+    if (nargs != 1 || !parse_num(args[0], UINT32_MAX, &val)) {
+      return "expected wait <frames>";
+    }
+    struct usb_transfer *t = new_transfer(ctx, kUsbXferWait);
+    t->len = val;
+    enqueue(&ctx->async_head, &ctx->async_tail, t);
+    return NULL;
+  }
+
+  usb_xfer_type_t type;
+  int in = 0;
+  if (!strcmp(cmd, "control")) {
+    type = kUsbXferControl;
+  } else if (!strcmp(cmd, "bulk_in") || !strcmp(cmd, "bulk_out")) {
+    type = kUsbXferBulk;
+    in = cmd[5] == 'i';
+  } else if (!strcmp(cmd, "int_in") || !strcmp(cmd, "int_out")) {
+    type = kUsbXferInterrupt;
+    in = cmd[4] == 'i';
+  } else if (!strcmp(cmd, "iso_in") || !strcmp(cmd, "iso_out")) {
+    type = kUsbXferIso;
+    in = cmd[4] == 'i';
+  } else {
+    return "unknown command";
+  }
+
+  uint32_t addr, ep;
+  if (nargs < 3 || !parse_num(args[0], 127, &addr) ||
+      !parse_num(args[1], 15, &ep)) {
+    return "expected <addr> <ep> after the transfer type";
+  }
+
+  uint8_t *data = NULL;
+  int data_len = 0;
+  if (nargs == 4) {
+    data_len = parse_hex(args[3], &data);
+    if (data_len <= 0) {
+      return "data must be a non-empty hex string";
+    }
+  }
+
+  struct usb_transfer *t = new_transfer(ctx, type);
+  t->addr = addr;
+  t->ep = ep;
+  if (type == kUsbXferControl) {
+    uint8_t *setup;
+    if (nargs > 4 || parse_hex(args[2], &setup) != 8) {
+      free(data);
+      free(t);
+      return "setup must be 8 bytes of hex";
+    }
+    memcpy(t->setup, setup, 8);
+    free(setup);
+    t->in = (t->setup[0] & 0x80) ? 1 : 0;
+    t->len = t->setup[6] | t->setup[7] << 8;
+    if ((t->in && data) || (!t->in && data_len != (int)t->len)) {
+      free(data);
+      free(t);
+      return "data must match wLength of an OUT request";
+    }
+    t->buf = data ? data : (uint8_t *)calloc(1, t->len + 1);
+    assert(t->buf);
+    enqueue(&ctx->async_head, &ctx->async_tail, t);
+    return NULL;
+  }
+
+  if (!parse_num(args[2], SEND_MAX << 16, &val) || (in && data)) {
+    free(data);
+    free(t);
+    return "expected <len> and, for OUT transfers only, <data>";
+  }
+  t->in = in;
+  t->len = val;
+  t->buf = (uint8_t *)malloc(t->len + 1);
+  assert(t->buf);
+  for (uint32_t i = 0; i < t->len && !in; ++i) {
+    t->buf[i] = data ? data[i % data_len] : (uint8_t)i;
+  }
+  free(data);
+  if (type == kUsbXferBulk) {
+    enqueue(&ctx->async_head, &ctx->async_tail, t);
+  } else {
+    enqueue(&ctx->periodic_head, &ctx->periodic_tail, t);
+  }
+  return NULL;
+}
+
+static void report(struct usbdpi_ctx *ctx, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static void report(struct usbdpi_ctx *ctx, const char *fmt, ...) {
+  char line[128];
+  va_list args;
+  va_start(args, fmt);
+  int n = vsnprintf(line, sizeof(line), fmt, args);
+  va_end(args);
+  if (n >= (int)sizeof(line)) {
+    n = sizeof(line) - 1;
+  }
+  if (ctx->xfer_sock) {
+    tcp_server_write_block(ctx->xfer_sock, line, n);
+  } else {
+    printf("[usbdpi] xfer %s", line);
+  }
+}
+
+static void report_data(struct usbdpi_ctx *ctx, const uint8_t *buf,
+                        uint32_t len) {
+  static const char hex[] = "0123456789abcdef";
+  char chunk[128];
+  size_t n = 0;
+  if (len) {
+    chunk[n++] = ' ';
+  }
+  for (uint32_t i = 0; i < len; ++i) {
+    chunk[n++] = hex[buf[i] >> 4];
+    chunk[n++] = hex[buf[i] & 0xf];
+    if (n >= sizeof(chunk) - 2) {
+      if (ctx->xfer_sock) {
+        tcp_server_write_block(ctx->xfer_sock, chunk, n);
+      } else {
+        fwrite(chunk, 1, n, stdout);
+      }
+      n = 0;
+    }
+  }
+  chunk[n++] = '\n';
+  if (ctx->xfer_sock) {
+    tcp_server_write_block(ctx->xfer_sock, chunk, n);
+  } else {
+    fwrite(chunk, 1, n, stdout);
+  }
+}
+
+// Finish the transfer at the head of its queue
+static void complete(struct usbdpi_ctx *ctx, struct usb_transfer *t,
+                     usb_xfer_status_t status) {
+  struct usb_transfer **head;
+  struct usb_transfer **tail;
+  if (t->type == kUsbXferBulk || t->type == kUsbXferControl ||
+      t->type == kUsbXferWait) {
+    head = &ctx->async_head;
+    tail = &ctx->async_tail;
+  } else {
+    head = &ctx->periodic_head;
+    tail = &ctx->periodic_tail;
+  }
+  assert(*head == t);
+  *head = t->next;
+  if (!*head) {
+    *tail = NULL;
+  }
+
+  if (t->type != kUsbXferWait) {
+    t->status = status;
+    ctx->xfer_stats.transfers++;
+    if (t->in) {
+      ctx->xfer_stats.bytes_in += t->done;
+    } else {
+      ctx->xfer_stats.bytes_out += t->done;
+    }
+    report(ctx, "%u %s %u %d %d", t->seq, status_names[status], t->done,
+           ctx->frame - t->start_frame, ctx->tick - t->start_tick);
+    report_data(ctx, t->buf, t->in ? t->done : 0);
+  }
+  free(t->buf);
+  free(t);
+}
+
+// Queue a token, optionally followed by a data packet, for sending
+static void send_token(struct usbdpi_ctx *ctx, int pid, int addr, int ep,
+                       int data_pid, const uint8_t *data, int len) {
+  int field = addr | ep << 7;
+  ctx->data[0] = pid;
+  ctx->data[1] = field & 0xff;
+  ctx->data[2] = (field >> 8) | CRC5(field, 11) << 3;
+  ctx->bytes = 3;
+  ctx->datastart = -1;
+  if (data_pid) {
+    ctx->data[3] = data_pid;
+    memcpy(&ctx->data[4], data, len);
+    add_crc16(ctx->data, 3, 4 + len);
+    ctx->bytes = 4 + len + 2;
+    ctx->datastart = 3;
+  }
+  ctx->state = ST_SYNC;
+  ctx->byte = 0;
+  ctx->bit = 1;
+}
+
+static void send_handshake(struct usbdpi_ctx *ctx, int pid) {
+  ctx->data[0] = pid;
+  ctx->bytes = 1;
+  ctx->datastart = -1;
+  ctx->state = ST_SYNC;
+  ctx->byte = 0;
+  ctx->bit = 1;
+}
+
+static int is_control(const struct usb_transfer *t) {
+  return t->type == kUsbXferControl;
+}
+
+// Direction of the transfer's next transaction
+static int xact_dir_in(const struct usb_transfer *t) {
+  switch (t->stage) {
+    case XFER_STAGE_SETUP:
+      return 0;
+    case XFER_STAGE_STATUS:
+      // Opposite to the data stage, and IN if there is no data stage
+      return !(t->in && t->len);
+    default:
+      return t->in;
+  }
+}
+
+// Length of the transfer's next data packet
+static int xact_len(const struct usb_transfer *t) {
+  switch (t->stage) {
+    case XFER_STAGE_SETUP:
+      return 8;
+    case XFER_STAGE_STATUS:
+      return 0;
+    default: {
+      uint32_t left = t->len - t->done;
+      return (left < (uint32_t)t->maxpkt) ? left : t->maxpkt;
+    }
+  }
+}
+
+static int data_pid(struct usbdpi_ctx *ctx, const struct usb_transfer *t) {
+  int toggle;
+  if (t->type == kUsbXferIso || t->stage == XFER_STAGE_SETUP) {
+    toggle = 0;
+  } else if (is_control(t)) {
+    toggle = ctx->ctrl_toggle;
+  } else {
+    toggle = ctx->toggle[xact_dir_in(t)][t->ep];
+  }
+  return toggle ? USB_PID_DATA1 : USB_PID_DATA0;
+}
+
+static void flip_toggle(struct usbdpi_ctx *ctx, const struct usb_transfer *t) {
+  if (is_control(t)) {
+    ctx->ctrl_toggle ^= 1;
+  } else if (t->type != kUsbXferIso) {
+    ctx->toggle[xact_dir_in(t)][t->ep] ^= 1;
+  }
+}
+
+// Bit times a transaction could take, for deciding whether it fits in what is
+// left of the frame
+static int xact_bits(const struct usb_transfer *t) {
+  // Bit stuffing adds up to 1 bit in 7
+  int packet_bits = (8 + 8 * (1 + xact_len(t) + 2)) * 7 / 6 + 3;
+  return 40 + packet_bits + XFER_RESP_TIMEOUT + 40;
+}
+
+// Move the transfer on after a successful transaction that moved len bytes.
+// Returns 1 if the transfer is complete.
+static int advance(struct usbdpi_ctx *ctx, struct usb_transfer *t, int len) {
+  switch (t->stage) {
+    case XFER_STAGE_SETUP:
+      ctx->ctrl_toggle = 1;
+      t->stage = t->len ? XFER_STAGE_DATA : XFER_STAGE_STATUS;
+      return 0;
+    case XFER_STAGE_STATUS:
+      return 1;
+    default:
+      t->done += len;
+      // Done when all the data has moved or the device sent a short packet.
+      // An OUT transfer of 0 bytes sends one zero length packet.
+      if (t->done >= t->len || (xact_dir_in(t) && len < t->maxpkt)) {
+        if (is_control(t)) {
+          ctx->ctrl_toggle = 1;
+          t->stage = XFER_STAGE_STATUS;
+          return 0;
+        }
+        return 1;
+      }
+      return 0;
+  }
+}
+
+static struct usb_transfer *current_transfer(struct usbdpi_ctx *ctx) {
+  if (!ctx->periodic_done && ctx->periodic_head) {
+    return ctx->periodic_head;
+  }
+  return ctx->async_head;
+}
+
+// An isochronous transfer moves one packet per frame whatever happens to it
+static void iso_packet_done(struct usbdpi_ctx *ctx, struct usb_transfer *t,
+                            int len) {
+  t->done += len;
+  t->packets++;
+  uint32_t npackets = (t->len + t->maxpkt - 1) / t->maxpkt;
+  if (t->done >= t->len || t->packets >= npackets) {
+    complete(ctx, t, kUsbXferOk);
+  }
+}
+
+// A transaction failed (timeout, bad packet). Retry it until it has failed
+// too often.
+static void xact_error(struct usbdpi_ctx *ctx, struct usb_transfer *t) {
+  ctx->xfer_stats.errors++;
+  if (t->type == kUsbXferIso) {
+    iso_packet_done(ctx, t, 0);
+  } else if (++t->errors >= XFER_MAX_ERRORS) {
+    complete(ctx, t, kUsbXferError);
+  }
+}
+
+// Handle what the device sent in response to the transaction
+static void handle_response(struct usbdpi_ctx *ctx, struct usb_transfer *t,
+                            int pid, uint8_t *buf, int len) {
+  if (pid == USB_PID_NAK) {
+    ctx->xfer_stats.naks++;
+    return;
+  }
+  if (pid == USB_PID_STALL) {
+    complete(ctx, t, kUsbXferStall);
+    return;
+  }
+  if (!ctx->xact_in) {
+    if (pid != USB_PID_ACK) {
+      xact_error(ctx, t);
+      return;
+    }
+    t->errors = 0;
+    flip_toggle(ctx, t);
+    if (advance(ctx, t, ctx->xact_len)) {
+      complete(ctx, t, kUsbXferOk);
+    }
+    return;
+  }
+
+  if ((pid != USB_PID_DATA0 && pid != USB_PID_DATA1) || len < 2 ||
+      CRC16(buf, len - 2) != (uint32_t)(buf[len - 2] | buf[len - 1] << 8)) {
+    xact_error(ctx, t);
+    return;
+  }
+  len -= 2;
+  if (t->type == kUsbXferIso) {
+    if (len > (int)(t->len - t->done)) {
+      len = t->len - t->done;
+    }
+    memcpy(t->buf + t->done, buf, len);
+    iso_packet_done(ctx, t, len);
+    return;
+  }
+  send_handshake(ctx, USB_PID_ACK);
+  ctx->xact_state = XS_ACKING;
+  // A packet with the wrong toggle is a retry of one the device thinks we
+  // missed the ACK for: acknowledge it again but drop the data.
+  if (pid != data_pid(ctx, t)) {
+    return;
+  }
+  t->errors = 0;
+  flip_toggle(ctx, t);
+  if (t->stage == XFER_STAGE_DATA) {
+    if (len > (int)(t->len - t->done)) {
+      len = t->len - t->done;
+    }
+    memcpy(t->buf + t->done, buf, len);
+  }
+  if (advance(ctx, t, len)) {
+    complete(ctx, t, kUsbXferOk);
+  }
+}
+
+// The transaction's transfer may have completed (and been freed) by now
+static void end_transaction(struct usbdpi_ctx *ctx) {
+  ctx->xact_state = XS_IDLE;
+  ctx->wait = ctx->tick_bits + XFER_PACKET_GAP;
+  // Periodic transfers get one attempt per frame
+  if (ctx->xact_periodic) {
+    ctx->periodic_done = 1;
+  }
+}
+
+// Whether a transaction can start in what is left of the frame. One that is
+// longer than a whole frame (large isochronous packets in the shortened
+// simulation frame) can only start straight after the SOF.
+static int fits_in_frame(struct usbdpi_ctx *ctx, const struct usb_transfer *t) {
+  int elapsed = ctx->tick_bits - ctx->lastframe;
+  int bits = xact_bits(t);
+  if (bits > FRAME_INTERVAL) {
+    return elapsed < XFER_RESP_TIMEOUT;
+  }
+  return elapsed + bits <= FRAME_INTERVAL;
+}
+
+static void start_transaction(struct usbdpi_ctx *ctx, struct usb_transfer *t) {
+  int in = xact_dir_in(t);
+  int len = xact_len(t);
+  if (t->start_tick < 0) {
+    t->start_tick = ctx->tick;
+    t->start_frame = ctx->frame;
+  }
+  ctx->xact_in = in;
+  ctx->xact_len = len;
+  ctx->xact_expect_resp = !(t->type == kUsbXferIso && !in);
+  ctx->xact_periodic =
+      (t->type == kUsbXferIso || t->type == kUsbXferInterrupt);
+  if (in) {
+    send_token(ctx, USB_PID_IN, t->addr, t->ep, 0, NULL, 0);
+  } else {
+    const uint8_t *data =
+        (t->stage == XFER_STAGE_SETUP) ? t->setup : t->buf + t->done;
+    send_token(ctx, t->stage == XFER_STAGE_SETUP ? USB_PID_SETUP : USB_PID_OUT,
+               t->addr, t->ep, data_pid(ctx, t), data, len);
+  }
+  ctx->xact_state = XS_SENDING;
+}
+
+void usbdpi_xfer_schedule(struct usbdpi_ctx *ctx) {
+  struct usb_transfer *t = current_transfer(ctx);
+  uint8_t rx[SEND_MAX];
+  int pid;
+  int len;
+
+  switch (ctx->xact_state) {
+    case XS_IDLE:
+      if (!t || ctx->tick_bits < ctx->wait || t->type == kUsbXferWait ||
+          !fits_in_frame(ctx, t)) {
+        return;
+      }
+      // Drop anything the device sent outside a transaction
+      monitor_usb_rx(ctx->mon, &pid, rx, sizeof(rx));
+      start_transaction(ctx, t);
+      break;
+    case XS_SENDING:
+      if (!ctx->xact_expect_resp) {
+        iso_packet_done(ctx, t, ctx->xact_len);
+        end_transaction(ctx);
+        break;
+      }
+      ctx->xact_state = XS_WAIT_RESP;
+      ctx->wait = ctx->tick_bits + XFER_RESP_TIMEOUT;
+      break;
+    case XS_WAIT_RESP:
+      len = monitor_usb_rx(ctx->mon, &pid, rx, sizeof(rx));
+      if (len >= 0) {
+        ctx->xact_state = XS_IDLE;
+        handle_response(ctx, t, pid, rx, len);
+        if (ctx->xact_state == XS_IDLE) {
+          end_transaction(ctx);
+        }
+      } else if (ctx->tick_bits >= ctx->wait) {
+        xact_error(ctx, t);
+        end_transaction(ctx);
+      }
+      break;
+    case XS_ACKING:
+      end_transaction(ctx);
+      break;
+  }
+}
+
+void usbdpi_xfer_device_driving(struct usbdpi_ctx *ctx) {
+  // Keep waiting for as long as the device is sending
+  if (ctx->xact_state == XS_WAIT_RESP &&
+      ctx->wait < ctx->tick_bits + XFER_PACKET_GAP) {
+    ctx->wait = ctx->tick_bits + XFER_PACKET_GAP;
+  }
+}
+
+// Read commands from the socket
+static void read_commands(struct usbdpi_ctx *ctx) {
+  for (;;) {
+    int space = sizeof(ctx->xfer_cmd) - 1 - ctx->xfer_cmd_len;
+    size_t n = tcp_server_read_block(ctx->xfer_sock,
+                                     &ctx->xfer_cmd[ctx->xfer_cmd_len], space);
+    if (!n) {
+      return;
+    }
+    ctx->xfer_cmd_len += n;
+    ctx->xfer_cmd[ctx->xfer_cmd_len] = '\0';
+    char *line = ctx->xfer_cmd;
+    char *eol;
+    while ((eol = strchr(line, '\n'))) {
+      *eol = '\0';
+      const char *err = parse_command(ctx, line);
+      if (err) {
+        report(ctx, "error %s\n", err);
+      }
+      line = eol + 1;
+    }
+    ctx->xfer_cmd_len -= line - ctx->xfer_cmd;
+    memmove(ctx->xfer_cmd, line, ctx->xfer_cmd_len);
+    if (ctx->xfer_cmd_len == (int)sizeof(ctx->xfer_cmd) - 1) {
+      report(ctx, "error line too long\n");
+      ctx->xfer_cmd_len = 0;
+    }
+  }
+}
+
+void usbdpi_xfer_frame(struct usbdpi_ctx *ctx) {
+  ctx->periodic_done = 0;
+  if (ctx->xfer_sock) {
+    read_commands(ctx);
+  }
+  struct usb_transfer *t = ctx->async_head;
+  if (t && t->type == kUsbXferWait && t->done++ >= t->len) {
+    complete(ctx, t, kUsbXferOk);
+  }
+}
+
+int usbdpi_xfer_init(struct usbdpi_ctx *ctx, const char *name,
+                     const char *script_path, int port) {
+  ctx->xfer_maxpkt = 64;
+  if (script_path && script_path[0]) {
+    FILE *script = fopen(script_path, "r");
+    if (!script) {
+      fprintf(stderr, "USB: Unable to open script %s: %s\n", script_path,
+              strerror(errno));
+      return 0;
+    }
+    char line[sizeof(ctx->xfer_cmd)];
+    int lineno = 0;
+    while (fgets(line, sizeof(line), script)) {
+      ++lineno;
+      const char *err = parse_command(ctx, line);
+      if (err) {
+        fprintf(stderr, "USB: %s:%d: %s\n", script_path, lineno, err);
+        fclose(script);
+        return 0;
+      }
+    }
+    fclose(script);
+    ctx->xfer_engine = 1;
+  }
+  if (port) {
+    ctx->xfer_sock = tcp_server_create(name, port);
+    ctx->xfer_engine = 1;
+  }
+  return 1;
+}
+
+void usbdpi_xfer_close(struct usbdpi_ctx *ctx) {
+  struct usb_transfer *lists[] = {ctx->async_head, ctx->periodic_head};
+  for (int i = 0; i < 2; ++i) {
+    struct usb_transfer *t = lists[i];
+    while (t) {
+      struct usb_transfer *next = t->next;
+      free(t->buf);
+      free(t);
+      t = next;
+    }
+  }
+  if (ctx->xfer_engine) {
+    printf(
+        "[usbdpi] %u transfers, %llu bytes out, %llu bytes in, %u NAKs, "
+        "%u errors in %d frames\n",
+        ctx->xfer_stats.transfers,
+        (unsigned long long)ctx->xfer_stats.bytes_out,
+        (unsigned long long)ctx->xfer_stats.bytes_in, ctx->xfer_stats.naks,
+        ctx->xfer_stats.errors, ctx->frame);
+  }
+  if (ctx->xfer_sock) {
+    tcp_server_close(ctx->xfer_sock);
+  }
+}
@@ -4,6 +4,8 @@
 
 #include "usbdpi.h"
 
+#include "dpi_checkpoint.h"
+
 #ifdef __linux__
 #include <pty.h>
 #elif __APPLE__
@@ -14,6 +16,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -38,7 +41,8 @@ static const char *hs_states[] = {
     "HS_SENDACK 8",    "HS_WAIT_PKT 9",  "HS_ACKIFDATA 10",    "HS_SENDHI 11",
     "HS_EMPTYDATA 12", "HS_WAITACK2 13", "HS_NEXTFRAME 14"};
 
-void *usbdpi_create(const char *name, int loglevel) {
+void *usbdpi_create(const char *name, int loglevel, const char *script_path,
+                    int port, int capture) {
   struct usbdpi_ctx *ctx =
       (struct usbdpi_ctx *)calloc(1, sizeof(struct usbdpi_ctx));
   assert(ctx);
@@ -73,20 +77,48 @@ void *usbdpi_create(const char *name, int loglevel) {
             ctx->mon_pathname, strerror(errno));
     return NULL;
   }
-  // more useful for tail -f
-  setlinebuf(ctx->mon_file);
+  // The monitor logs every packet, so buffer its output rather than writing
+  // each line
+  setvbuf(ctx->mon_file, NULL, _IOFBF, 1 << 16);
   printf(
       "\nUSB: Monitor output file created at %s. Works well with tail:\n"
       "$ tail -f %s\n",
       ctx->mon_pathname, ctx->mon_pathname);
 
+  if (capture) {
+    char cap_pathname[PATH_MAX];
+    rv = snprintf(cap_pathname, PATH_MAX, "%s/%s.pcapng", cwd, name);
+    assert(rv <= PATH_MAX && rv > 0);
+    ctx->cap_file = fopen(cap_pathname, "wb");
+    if (ctx->cap_file == NULL) {
+      fprintf(stderr, "USB: Unable to open capture file at %s: %s\n",
+              cap_pathname, strerror(errno));
+      return NULL;
+    }
+    setvbuf(ctx->cap_file, NULL, _IOFBF, 1 << 16);
+    monitor_usb_capture(ctx->mon, ctx->cap_file);
+    printf("USB: Capturing packets to %s\n", cap_pathname);
+  }
+
+  if (!usbdpi_xfer_init(ctx, name, script_path, port)) {
+    return NULL;
+  }
+
+  // The host model's state is bus_state and everything from retries to the
+  // end of the context. The monitor only logs, so is not saved.
+  dpi_checkpoint_register(ctx, &ctx->bus_state, sizeof(ctx->bus_state));
+  dpi_checkpoint_register(
+      ctx, &ctx->retries,
+      sizeof(struct usbdpi_ctx) - offsetof(struct usbdpi_ctx, retries));
+
   return (void *)ctx;
 }
 
 const char *decode_usb[] = {"SE0", "0-K", "1-J", "SE1"};
 
 void usbdpi_device_to_host(void *ctx_void, const svBitVecVal *usb_d2p) {
-  struct usbdpi_ctx *ctx = (struct usbdpi_ctx *)ctx_void;
+  struct usbdpi_ctx *ctx =
+      (struct usbdpi_ctx *)dpi_checkpoint_resolve(ctx_void);
   assert(ctx);
   int d2p = usb_d2p[0];
   int dp, dn;
@@ -748,7 +780,8 @@ int inv_driving(struct usbdpi_ctx *ctx, int d2p) {
 }
 
 char usbdpi_host_to_device(void *ctx_void, const svBitVecVal *usb_d2p) {
-  struct usbdpi_ctx *ctx = (struct usbdpi_ctx *)ctx_void;
+  struct usbdpi_ctx *ctx =
+      (struct usbdpi_ctx *)dpi_checkpoint_resolve(ctx_void);
   assert(ctx);
   int d2p = usb_d2p[0];
   uint32_t last_driving = ctx->driving;
@@ -789,7 +822,12 @@ char usbdpi_host_to_device(void *ctx_void, const svBitVecVal *usb_d2p) {
   }
 
   if ((ctx->tick_bits - ctx->lastframe) >= FRAME_INTERVAL) {
-    if (ctx->state != ST_IDLE) {
+    if (ctx->xfer_engine && ctx->state == ST_IDLE &&
+        ctx->xact_state != XS_IDLE) {
+      // Let the transaction finish, the scheduler should not have started it
+      // this close to the end of the frame
+      ctx->framepend = 1;
+    } else if (ctx->state != ST_IDLE) {
       if (ctx->framepend == 0) {
         printf("USB: %4x %8d error state %d at frame %d time\n", ctx->frame,
                ctx->tick, ctx->state, ctx->frame + 1);
@@ -804,7 +842,7 @@ char usbdpi_host_to_device(void *ctx_void, const svBitVecVal *usb_d2p) {
       ctx->frame++;
       ctx->lastframe = ctx->tick_bits;
 
-      if (ctx->frame >= 20 && ctx->frame < 30) {
+      if (!ctx->xfer_engine && ctx->frame >= 20 && ctx->frame < 30) {
         // Test suspend
         ctx->state = ST_IDLE;
         printf("Idle frame %d\n", ctx->frame);
@@ -819,15 +857,30 @@ char usbdpi_host_to_device(void *ctx_void, const svBitVecVal *usb_d2p) {
         ctx->data[2] =
             ((ctx->frame & 0x700) >> 8) | (CRC5(ctx->frame & 0x7ff, 11) << 3);
       }
-      printf("USB: %8d frame 0x%x CRC5 0x%x\n", ctx->tick, ctx->frame,
-             CRC5(ctx->frame, 11));
+      if (!ctx->xfer_engine) {
+        printf("USB: %8d frame 0x%x CRC5 0x%x\n", ctx->tick, ctx->frame,
+               CRC5(ctx->frame, 11));
+      }
       if (ctx->hostSt == HS_NEXTFRAME) {
         ctx->hostSt = HS_STARTFRAME;
       }
+      if (ctx->xfer_engine) {
+        usbdpi_xfer_frame(ctx);
+      }
     }
   }
   switch (ctx->state) {
+    case ST_GET:
+      if (ctx->xfer_engine) {
+        usbdpi_xfer_device_driving(ctx);
+      }
+      break;
+
     case ST_IDLE:
+      if (ctx->xfer_engine) {
+        usbdpi_xfer_schedule(ctx);
+        break;
+      }
       switch (ctx->frame) {
         case 1:
           setDeviceAddress(ctx);
@@ -935,12 +988,14 @@ char usbdpi_host_to_device(void *ctx_void, const svBitVecVal *usb_d2p) {
       if (ctx->bit == 8) {
         // Stop driving: host pulldown to SE0 unless there is a pullup on DP
         ctx->driving = set_driving(ctx, d2p, (d2p & D2P_PU) ? P2D_DP : 0);
+        // Restart the bit counter so the data packet gets a full SYNC
+        ctx->bit = 1;
         if (ctx->byte == ctx->datastart) {
-          ctx->bit = 1;
           ctx->state = ST_SYNC;
         } else {
           ctx->state = ST_IDLE;
         }
+        break;
       }
       ctx->bit <<= 1;
       break;
@@ -962,10 +1017,17 @@ char usbdpi_host_to_device(void *ctx_void, const svBitVecVal *usb_d2p) {
 }
 
 void usbdpi_close(void *ctx_void) {
-  struct usbdpi_ctx *ctx = (struct usbdpi_ctx *)ctx_void;
+  struct usbdpi_ctx *ctx =
+      (struct usbdpi_ctx *)dpi_checkpoint_resolve(ctx_void);
   if (!ctx) {
     return;
   }
+  dpi_checkpoint_unregister(ctx);
+  usbdpi_xfer_close(ctx);
   fclose(ctx->mon_file);
+  if (ctx->cap_file) {
+    fclose(ctx->cap_file);
+  }
+  free(ctx->mon);
   free(ctx);
 }
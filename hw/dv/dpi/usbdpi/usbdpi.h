@@ -92,7 +92,9 @@
 #define HS_WAITACK2 13
 #define HS_NEXTFRAME 14
 
-#define SEND_MAX 32
+// Packet buffer: a token followed by a data packet carrying up to 1023 bytes
+// (the largest full speed isochronous packet) and its CRC16
+#define SEND_MAX (3 + 1 + 1023 + 2)
 #include <stdint.h>
 
 #ifdef __cplusplus
@@ -123,12 +125,104 @@ typedef enum usbdpi_bus_state {
   kUsbBulkInAck,
 } usbdpi_bus_state_t;
 
+struct tcp_server_ctx;
+
+typedef enum usb_xfer_type {
+  kUsbXferControl,
+  kUsbXferIso,
+  kUsbXferBulk,
+  kUsbXferInterrupt,
+  // Not a transfer: idle for a number of frames
+  kUsbXferWait,
+} usb_xfer_type_t;
+
+typedef enum usb_xfer_status {
+  kUsbXferPending,
+  kUsbXferOk,
+  kUsbXferStall,
+  kUsbXferError,
+} usb_xfer_status_t;
+
+// Control transfer stages. Other transfers only have a data stage.
+#define XFER_STAGE_SETUP 0
+#define XFER_STAGE_DATA 1
+#define XFER_STAGE_STATUS 2
+
+/**
+ * A transfer queued on the transfer engine
+ */
+struct usb_transfer {
+  struct usb_transfer *next;
+  uint32_t seq;
+  usb_xfer_type_t type;
+  // Direction of the data stage
+  int in;
+  int addr;
+  int ep;
+  int maxpkt;
+  uint8_t setup[8];
+  // Data to send, or space for the data received
+  uint8_t *buf;
+  // Bytes to send, most bytes to receive, or frames to wait
+  uint32_t len;
+  // Bytes transferred so far, or frames waited
+  uint32_t done;
+  int stage;
+  // Consecutive failed transactions
+  int errors;
+  // Packets moved by an isochronous transfer
+  uint32_t packets;
+  int start_tick;
+  int start_frame;
+  usb_xfer_status_t status;
+};
+
+/**
+ * Totals kept by the transfer engine, reported when the simulation ends
+ */
+struct usb_xfer_stats {
+  uint32_t transfers;
+  uint64_t bytes_out;
+  uint64_t bytes_in;
+  uint32_t naks;
+  uint32_t errors;
+};
+
+// Transfer engine transaction states
+#define XS_IDLE 0
+#define XS_SENDING 1
+#define XS_WAIT_RESP 2
+#define XS_ACKING 3
+
+// Bit times to wait for the device to start responding to a token
+#define XFER_RESP_TIMEOUT 64
+// Bit times between the end of one packet and the host's next one
+#define XFER_PACKET_GAP 4
+// Consecutive errors on a transaction before its transfer fails
+#define XFER_MAX_ERRORS 3
+
 struct usbdpi_ctx {
   usbdpi_bus_state_t bus_state;
   int loglevel;
   FILE *mon_file;
   char mon_pathname[PATH_MAX];
   void *mon;
+  // Binary packet capture, or NULL when packets are logged to mon_file
+  FILE *cap_file;
+  // Transfer engine. Used instead of the built-in test sequence when a
+  // script or a socket supplies transfers. The queues are not checkpointed,
+  // so take checkpoints while they are empty.
+  int xfer_engine;
+  struct usb_transfer *async_head;
+  struct usb_transfer *async_tail;
+  struct usb_transfer *periodic_head;
+  struct usb_transfer *periodic_tail;
+  struct tcp_server_ctx *xfer_sock;
+  char xfer_cmd[4096];
+  int xfer_cmd_len;
+  uint32_t xfer_seq;
+  int xfer_maxpkt;
+  struct usb_xfer_stats xfer_stats;
   int retries;
   int last_pu;
   int lastrxpid;
@@ -150,9 +244,22 @@ struct usbdpi_ctx {
   int hostSt;
   uint8_t data[SEND_MAX];
   int baudrate_set_successfully;
+  // Transfer engine transaction in progress
+  int xact_state;
+  int xact_in;
+  int xact_len;
+  int xact_expect_resp;
+  int xact_periodic;
+  // Whether the periodic queue has had its transaction this frame
+  int periodic_done;
+  // Data toggles of the bulk and interrupt endpoints, indexed by direction
+  // (1 for IN) and endpoint, and of the control transfer in progress
+  uint8_t toggle[2][16];
+  int ctrl_toggle;
 };
 
-void *usbdpi_create(const char *name, int loglevel);
+void *usbdpi_create(const char *name, int loglevel, const char *script_path,
+                    int port, int capture);
 void usbdpi_device_to_host(void *ctx_void, const svBitVecVal *usb_d2p);
 char usbdpi_host_to_device(void *ctx_void, const svBitVecVal *usb_d2p);
 void usbdpi_close(void *ctx_void);
@@ -162,6 +269,17 @@ uint32_t CRC16(uint8_t *data, int bytes);
 void *monitor_usb_init(void);
 void monitor_usb(void *mon, FILE *mon_file, int log, int tick, int hdrive,
                  int p2d, int d2p, int *lastpid);
+int monitor_usb_rx(void *mon, int *pid, uint8_t *buf, int maxlen);
+void monitor_usb_capture(void *mon, FILE *cap_file);
+
+// Transfer engine
+void add_crc16(uint8_t *dp, int start, int pos);
+int usbdpi_xfer_init(struct usbdpi_ctx *ctx, const char *name,
+                     const char *script_path, int port);
+void usbdpi_xfer_frame(struct usbdpi_ctx *ctx);
+void usbdpi_xfer_schedule(struct usbdpi_ctx *ctx);
+void usbdpi_xfer_device_driving(struct usbdpi_ctx *ctx);
+void usbdpi_xfer_close(struct usbdpi_ctx *ctx);
 
 #ifdef __cplusplus
 }
@@ -8,6 +8,15 @@
 // 0x01 -- monitor_usb (packet level)
 // 0x02 -- more verbose monitor
 // 0x08 -- bit level
+//
+// By default the host runs a fixed test sequence. It runs transfers from a
+// script instead with the `USBDPI_SCRIPT_<name>=<file>` plusarg, or takes them
+// from a TCP socket with `USBDPI_PORT_<name>=<port>`. See usb_transfer.c for
+// the format.
+//
+// With the `USBDPI_CAPTURE_<name>` plusarg the monitor writes packets to
+// <name>.pcapng rather than as text to <name>.log. Convert it back to text
+// with util/dpi_capture_to_text.py.
 
 module usbdpi #(
   parameter string NAME = "usb0",
@@ -34,7 +43,9 @@ module usbdpi #(
   input  logic pullupdn_d2p
 );
   import "DPI-C" function
-    chandle usbdpi_create(input string name, input int loglevel);
+    chandle usbdpi_create(input string name, input int loglevel,
+                          input string script_path, input int port,
+                          input int capture);
 
   import "DPI-C" function
     void usbdpi_device_to_host(input chandle ctx, input bit [10:0] d2p);
@@ -46,9 +57,14 @@ module usbdpi #(
     byte usbdpi_host_to_device(input chandle ctx, input bit [10:0] d2p);
 
   chandle ctx;
+  string script_path = "";
+  int port = 0;
 
   initial begin
-    ctx = usbdpi_create(NAME, LOG_LEVEL);
+    $value$plusargs({"USBDPI_SCRIPT_", NAME, "=%s"}, script_path);
+    $value$plusargs({"USBDPI_PORT_", NAME, "=%d"}, port);
+    ctx = usbdpi_create(NAME, LOG_LEVEL, script_path, port,
+                        $test$plusargs({"USBDPI_CAPTURE_", NAME}));
     sense_p2d = 1'b0;
   end
 
@@ -32,7 +32,8 @@ class ElfError : public std::exception {
   std::string msg_;
 };
 
-// Class wrapping an open ELF file
+// Class wrapping an open ELF file. The file is memory-mapped, so data
+// returned by GetRawFile() stays valid for as long as the object exists.
 class ElfFile {
  public:
   ElfFile(const std::string &path) : path_(path) {
@@ -46,7 +47,7 @@ class ElfFile {
       throw ElfError(path, "could not open file.");
     }
 
-    ptr_ = elf_begin(fd_, ELF_C_READ, NULL);
+    ptr_ = elf_begin(fd_, ELF_C_READ_MMAP, NULL);
     if (!ptr_) {
       close(fd_);
       throw ElfError(path, elf_errmsg(-1));
@@ -79,6 +80,13 @@ class ElfFile {
     return phdrs;
   }
 
+  const uint8_t *GetRawFile(size_t *file_size) {
+    const char *file_data = elf_rawfile(ptr_, file_size);
+    if (!file_data)
+      throw ElfError(path_, elf_errmsg(-1));
+    return reinterpret_cast<const uint8_t *>(file_data);
+  }
+
   std::string path_;
   int fd_;
   Elf *ptr_;
@@ -119,16 +127,17 @@ static MemImageType DetectMemImageType(const std::string &filepath) {
   return image_type;
 }
 
-// Generate a single array of bytes representing the contents of PT_LOAD
-// segments of the ELF file. Like objcopy, this generates a single "giant
-// segment" whose first byte corresponds to the first byte of the lowest
-// addressed segment and whose last byte corresponds to the last byte of the
-// highest address.
-static std::vector<uint8_t> FlattenElfFile(const std::string &filepath) {
-  ElfFile elf(filepath);
+// Stage the contents of PT_LOAD segments of the ELF file. Like objcopy, this
+// treats the file as a single "giant segment" whose first byte corresponds to
+// the first byte of the lowest addressed segment and whose last byte
+// corresponds to the last byte of the highest address: segment offsets in the
+// result are relative to the lowest address. The staged segments are views
+// into the memory-mapped file.
+static StagedMem StageFlatElfFile(const std::string &filepath) {
+  auto elf = std::make_shared<ElfFile>(filepath);
 
-  size_t phnum = elf.GetPhdrNum();
-  const Elf32_Phdr *phdrs = elf.GetPhdrs();
+  size_t phnum = elf->GetPhdrNum();
+  const Elf32_Phdr *phdrs = elf->GetPhdrs();
 
   // To mimic what objcopy does (that is, the binary target of BFD), we need to
   // iterate over all loadable program headers, find the lowest address, and
@@ -173,15 +182,14 @@ static std::vector<uint8_t> FlattenElfFile(const std::string &filepath) {
   // If any is false, there were no segments that contributed to the
   // file. Return nothing.
   if (!any)
-    return std::vector<uint8_t>();
+    return StagedMem();
 
   // Otherwise, we know every valid byte of data has an address in the
   // range [low, high] (inclusive).
   assert(low <= high);
 
   size_t file_size;
-  const char *file_data = elf_rawfile(elf.ptr_, &file_size);
-  assert(file_data);
+  const uint8_t *file_data = elf->GetRawFile(&file_size);
 
   StagedMem ret;
 
@@ -205,21 +213,63 @@ static std::vector<uint8_t> FlattenElfFile(const std::string &filepath) {
       continue;
 
     uint32_t off = phdr.p_paddr - low;
-    std::vector<uint8_t> seg(phdr.p_filesz, 0);
-    memcpy(&seg[0], file_data + phdr.p_offset, phdr.p_filesz);
-    ret.AddSegment(off, std::move(seg));
+    ret.AddSegment(off,
+                   StagedSeg(elf, file_data + phdr.p_offset, phdr.p_filesz));
   }
 
-  return ret.GetFlat();
+  return ret;
+}
+
+// Write staged data to mem_area, starting at word offset 0 and filling any
+// gaps between segments with zeros. This has the same effect as writing the
+// result of StagedMem::GetFlat(), but avoids copying the segments if they all
+// start on a word boundary.
+static void WriteStagedFlat(const MemArea &mem_area, const StagedMem &staged,
+                            unsigned num_threads) {
+  const StagedMem::SegMap &segs = staged.GetSegs();
+  if (segs.size() == 0)
+    return;
+
+  uint32_t width_byte = mem_area.GetWidthByte();
+  uint32_t base = staged.GetBounds().first;
+
+  bool aligned = true;
+  for (const auto &pr : segs) {
+    if ((pr.first.lo - base) % width_byte) {
+      aligned = false;
+      break;
+    }
+  }
+
+  if (!aligned) {
+    mem_area.Write(0, staged.GetFlat(), num_threads);
+    return;
+  }
+
+  // The next word that hasn't been written yet
+  uint32_t next_word = 0;
+  for (const auto &pr : segs) {
+    const AddrRange<uint32_t> &rng = pr.first;
+    const StagedSeg &seg = pr.second;
+
+    uint32_t lo_word = (rng.lo - base) / width_byte;
+    if (next_word < lo_word) {
+      std::vector<uint8_t> zeros((size_t)(lo_word - next_word) * width_byte, 0);
+      mem_area.Write(next_word, zeros, num_threads);
+    }
+
+    mem_area.Write(lo_word, seg.data(), seg.size(), num_threads);
+    next_word = lo_word + (seg.size() + width_byte - 1) / width_byte;
+  }
 }
 
 // Merge seg0 and seg1, overwriting any overlapping data in seg0 with
 // that from seg1. rng0/rng1 is the base and top address of seg0/seg1,
 // respectively.
-static std::vector<uint8_t> MergeSegments(const AddrRange<uint32_t> &rng0,
-                                          std::vector<uint8_t> &&seg0,
-                                          const AddrRange<uint32_t> &rng1,
-                                          std::vector<uint8_t> &&seg1) {
+static StagedSeg MergeSegments(const AddrRange<uint32_t> &rng0,
+                               StagedSeg &&seg0,
+                               const AddrRange<uint32_t> &rng1,
+                               StagedSeg &&seg1) {
   // First, deal with the special case where seg1 completely contains
   // seg0 (since there's no copying needed at all).
   if (rng1.lo <= rng0.lo && rng0.hi <= rng1.hi) {
@@ -233,49 +283,16 @@ static std::vector<uint8_t> MergeSegments(const AddrRange<uint32_t> &rng0,
   assert(seg0.size() <= new_len);
   assert(seg1.size() <= new_len);
 
-  // We want to avoid copying if possible. The next most efficient
-  // case (after just returning seg1) is when seg0 doesn't stick out
-  // the left hand end. In this case, we can extend seg1 to the right
-  // (which might not cause a copy) and then copy just the bytes we
-  // need from seg0.
-  if (rng1.lo <= rng0.lo) {
-    assert(rng1.hi < rng0.hi);
-    assert(new_len == seg1.size() + (rng0.hi - rng1.hi));
-
-    size_t old_len = seg1.size();
-    std::vector<uint8_t> ret = std::move(seg1);
-    ret.resize(new_len);
-
-    // We know that that rng0 isn't completely contained in rng1 and
-    // that rng0 doesn't stick out of the left hand end. That means it
-    // must stick out of the right (so rng1.hi < rng0.hi). However, we
-    // also know that the two ranges overlap, so rng0.lo <= rng1.hi.
-    assert(rng0.lo <= rng1.hi);
-
-    // src_off is the index of the first byte that needs copying from
-    // seg0. Note that this is always at least 1 (because there is an
-    // actual overlap).
-    uint32_t src_off = 1 + (rng1.hi - rng0.lo);
-
-    assert(seg0.size() == src_off + (rng0.hi - rng1.hi));
-
-    memcpy(&ret[old_len], &seg0[src_off], rng0.hi - rng1.hi);
-    return ret;
-  }
-
-  // In this final case, seg0 sticks out the left hand end. That means
-  // we'll have to copy seg1 whatever happens (because we have to
-  // shuffle its elements to the right). Work by resizing seg0 and
-  // then writing seg1 where it's needed.
-  std::vector<uint8_t> ret = std::move(seg0);
-  ret.resize(new_len);
-
-  uint32_t off = rng1.lo - rng0.lo;
-  memcpy(&ret[off], &seg1[0], seg1.size());
-  return ret;
+  // Otherwise, the segments (which might be views into other buffers) need
+  // copying into a new buffer that covers both. Since the two ranges
+  // overlap, this covers the whole of the new range.
+  std::vector<uint8_t> ret(new_len);
+  memcpy(&ret[rng0.lo - new_bot], seg0.data(), seg0.size());
+  memcpy(&ret[rng1.lo - new_bot], seg1.data(), seg1.size());
+  return StagedSeg(std::move(ret));
 }
 
-void StagedMem::AddSegment(uint32_t offset, std::vector<uint8_t> &&seg) {
+void StagedMem::AddSegment(uint32_t offset, StagedSeg &&seg) {
   if (seg.empty())
     return;
 
@@ -296,14 +313,14 @@ std::vector<uint8_t> StagedMem::GetFlat() const {
 
   for (const auto &pr : segs_) {
     const AddrRange<uint32_t> &rng = pr.first;
-    const std::vector<uint8_t> &seg = pr.second;
+    const StagedSeg &seg = pr.second;
     assert(seg.size() == 1 + (rng.hi - rng.lo));
     assert(min_addr_ <= rng.lo);
 
     uint32_t off = rng.lo - min_addr_;
     assert(off + seg.size() <= ret.size());
 
-    memcpy(&ret[off], &seg[0], seg.size());
+    memcpy(&ret[off], seg.data(), seg.size());
   }
   return ret;
 }
@@ -399,7 +416,7 @@ void DpiMemUtil::LoadFileToNamedMem(bool verbose, const std::string &name,
   try {
     switch (type) {
       case kMemImageElf:
-        m.Write(0, FlattenElfFile(filepath));
+        WriteStagedFlat(m, StageFlatElfFile(filepath), preload_threads_);
         break;
       case kMemImageVmem:
         m.LoadVmem(filepath);
@@ -430,13 +447,14 @@ void DpiMemUtil::LoadElfToMemories(bool verbose, const std::string &filepath) {
 
     for (const auto &seg_pr : staged_mem.GetSegs()) {
       const AddrRange<uint32_t> &seg_rng = seg_pr.first;
-      const std::vector<uint8_t> &seg_data = seg_pr.second;
+      const StagedSeg &seg_data = seg_pr.second;
 
       assert(seg_rng.lo % mem_area.GetWidthByte() == 0);
       uint32_t lo_word = seg_rng.lo / mem_area.GetWidthByte();
 
       try {
-        mem_area.Write(lo_word, seg_data);
+        mem_area.Write(lo_word, seg_data.data(), seg_data.size(),
+                       preload_threads_);
       } catch (const SVScoped::Error &err) {
         std::ostringstream oss;
         oss << "No memory found at `" << err.scope_name_
@@ -453,17 +471,18 @@ void DpiMemUtil::StageElf(bool verbose, const std::string &path) {
   // Clear out anything that was in the staging area before
   staging_area_.clear();
 
-  ElfFile elf(path);
+  // The staged segments are views into the memory-mapped file, and each holds
+  // a reference to elf to keep the mapping alive.
+  auto elf = std::make_shared<ElfFile>(path);
 
   // Allow subclasses to get at the loaded ELF data if they need it
-  OnElfLoaded(elf.ptr_);
+  OnElfLoaded(elf->ptr_);
 
   size_t file_size;
-  const char *file_data = elf_rawfile(elf.ptr_, &file_size);
-  assert(file_data);
+  const uint8_t *file_data = elf->GetRawFile(&file_size);
 
-  size_t phnum = elf.GetPhdrNum();
-  const Elf32_Phdr *phdrs = elf.GetPhdrs();
+  size_t phnum = elf->GetPhdrNum();
+  const Elf32_Phdr *phdrs = elf->GetPhdrs();
 
   for (size_t i = 0; i < phnum; ++i) {
     const Elf32_Phdr &phdr = phdrs[i];
@@ -514,11 +533,8 @@ void DpiMemUtil::StageElf(bool verbose, const std::string &path) {
     // there isn't one, make a new empty one.
     StagedMem &staged_mem = staging_area_[name];
 
-    const char *seg_data = file_data + phdr.p_offset;
-    std::vector<uint8_t> vec(phdr.p_filesz, 0);
-    memcpy(&vec[0], seg_data, phdr.p_filesz);
-
-    staged_mem.AddSegment(local_base, std::move(vec));
+    staged_mem.AddSegment(
+        local_base, StagedSeg(elf, file_data + phdr.p_offset, phdr.p_filesz));
   }
 }
 
@@ -22,6 +22,53 @@ enum MemImageType {
   kMemImageVmem,
 };
 
+// A contiguous run of bytes staged for loading into a memory.
+//
+// This either owns its data or is a read-only view into data that is owned
+// elsewhere (typically a memory-mapped ELF file). In the latter case, the
+// owner_ pointer keeps the underlying storage alive for as long as the view
+// exists, so segments can be staged without copying them out of the file.
+class StagedSeg {
+ public:
+  // Construct a segment that owns its data
+  explicit StagedSeg(std::vector<uint8_t> &&data)
+      : vec_(std::move(data)), data_(vec_.data()), size_(vec_.size()) {}
+
+  // Construct a segment that views size bytes at data, which are kept alive
+  // by owner.
+  StagedSeg(std::shared_ptr<const void> owner, const uint8_t *data,
+            size_t size)
+      : owner_(std::move(owner)), data_(data), size_(size) {}
+
+  StagedSeg(StagedSeg &&other) noexcept { *this = std::move(other); }
+
+  StagedSeg &operator=(StagedSeg &&other) noexcept {
+    // An owned segment points into vec_, so must be re-pointed at the moved
+    // vector. A view points into memory kept alive by owner_.
+    owner_ = std::move(other.owner_);
+    vec_ = std::move(other.vec_);
+    data_ = owner_ ? other.data_ : vec_.data();
+    size_ = other.size_;
+    other.data_ = nullptr;
+    other.size_ = 0;
+    return *this;
+  }
+
+  StagedSeg(const StagedSeg &) = delete;
+  StagedSeg &operator=(const StagedSeg &) = delete;
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  const uint8_t *data() const { return data_; }
+  const uint8_t &operator[](size_t idx) const { return data_[idx]; }
+
+ private:
+  std::vector<uint8_t> vec_;
+  std::shared_ptr<const void> owner_;
+  const uint8_t *data_ = nullptr;
+  size_t size_ = 0;
+};
+
 // Staged data for a given memory area.
 //
 // This is represented as an ordered list of disjoint segments (as loaded from
@@ -33,14 +80,16 @@ class StagedMem {
  public:
   StagedMem() : min_addr_(~(uint32_t)0), max_addr_(0) {}
 
-  // Add a segment to the tracked memory
-  void AddSegment(uint32_t offset, std::vector<uint8_t> &&seg);
+  // Add a segment to the tracked memory. Where seg overlaps existing
+  // segments, its data takes precedence and the segments are merged (which
+  // copies them into a single owned buffer).
+  void AddSegment(uint32_t offset, StagedSeg &&seg);
 
   // Glob together the tracked segments, interspersing them with
   // zeros, and return as a single flat array.
   std::vector<uint8_t> GetFlat() const;
 
-  typedef RangedMap<uint32_t, std::vector<uint8_t>> SegMap;
+  typedef RangedMap<uint32_t, StagedSeg> SegMap;
 
   std::pair<uint32_t, uint32_t> GetBounds() const {
     return std::make_pair(min_addr_, max_addr_);
@@ -57,11 +106,13 @@ class StagedMem {
  *
  * These utilities require the corresponding DPI functions:
  * simutil_memload()
- * simutil_set_mem()
+ * simutil_set_mem_range()
+ * simutil_get_mem_range()
  * to be defined somewhere as SystemVerilog functions.
  */
 class DpiMemUtil {
  public:
+  DpiMemUtil() : preload_threads_(1) {}
   virtual ~DpiMemUtil() {}
 
   /**
@@ -85,6 +136,17 @@ class DpiMemUtil {
   void RegisterMemoryArea(const std::string &name, uint32_t base,
                           const MemArea *mem_area);
 
+  /**
+   * Set the maximum number of threads used to encode memory images
+   *
+   * This is passed to MemArea::Write() when loading ELF files. Encoding can be
+   * expensive for memories with ECC and scrambling, and each memory word can be
+   * encoded independently.
+   */
+  void SetPreloadThreads(unsigned num_threads) {
+    preload_threads_ = num_threads;
+  }
+
   /**
    * Guess the type of the file at |path|.
    *
@@ -159,6 +221,9 @@ class DpiMemUtil {
   std::map<std::string, StagedMem> staging_area_;
   const StagedMem empty_;
 
+  // Maximum number of threads to use when encoding memory images
+  unsigned preload_threads_;
+
   /**
    * Find the index of a memory area containing the given segment's addresses.
    * Raises a std::exception if none is found.
@@ -5,6 +5,7 @@
 #include "ecc32_mem_area.h"
 #include "secded_enc.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cstring>
 #include <stdexcept>
@@ -33,20 +34,49 @@ Ecc32MemArea::EccWords Ecc32MemArea::ReadWithIntegrity(
     uint32_t word_offset, uint32_t num_words) const {
   assert(word_offset + num_words <= num_words_);
 
-  // See MemArea::Write for an explanation for this buffer.
-  uint8_t minibuf[SV_MEM_WIDTH_BYTES];
-  memset(minibuf, 0, sizeof minibuf);
-  assert(width_byte_ <= sizeof minibuf);
+  BeginAccess();
+
+  uint32_t width_32 = width_byte_ / 4;
 
   EccWords ret;
-  ret.reserve(num_words);
+  ret.reserve((size_t)num_words * width_32);
+
+  if (HasShadow()) {
+    SyncShadow();
+
+    if (decoded_intg_versions_.size() != num_words_) {
+      decoded_intg_.assign((size_t)num_words_ * width_32, EccWord(false, 0));
+      decoded_intg_versions_.assign(num_words_, 0);
+    }
 
+    // See MemArea::Read for an explanation of the caching.
+    EccWords word;
+    for (uint32_t i = 0; i < num_words; ++i) {
+      uint32_t phys_addr = ToPhysAddr(word_offset + i);
+      auto decoded = decoded_intg_.begin() + (size_t)phys_addr * width_32;
+      uint64_t version = GetShadowVersion(phys_addr);
+      if (decoded_intg_versions_[phys_addr] != version) {
+        word.clear();
+        ReadBufferWithIntegrity(word, GetShadowWord(phys_addr),
+                                word_offset + i);
+        assert(word.size() == width_32);
+        std::copy(word.begin(), word.end(), decoded);
+        decoded_intg_versions_[phys_addr] = version;
+      }
+      ret.insert(ret.end(), decoded, decoded + width_32);
+    }
+    return ret;
+  }
+
+  MemPhysImage image(num_words);
   for (uint32_t i = 0; i < num_words; ++i) {
-    uint32_t src_word = word_offset + i;
-    uint32_t phys_addr = ToPhysAddr(src_word);
+    image.SetPhysAddr(i, ToPhysAddr(word_offset + i));
+  }
 
-    ReadToMinibuf(minibuf, phys_addr);
-    ReadBufferWithIntegrity(ret, minibuf, src_word);
+  ReadPhysImage(image);
+
+  for (uint32_t i = 0; i < num_words; ++i) {
+    ReadBufferWithIntegrity(ret, image.GetWord(i), word_offset + i);
   }
 
   return ret;
@@ -54,24 +84,23 @@ Ecc32MemArea::EccWords Ecc32MemArea::ReadWithIntegrity(
 
 void Ecc32MemArea::WriteWithIntegrity(uint32_t word_offset,
                                       const EccWords &data) const {
-  // See MemArea::Write for an explanation for this buffer.
-  uint8_t minibuf[SV_MEM_WIDTH_BYTES];
-  memset(minibuf, 0, sizeof minibuf);
-  assert(width_byte_ <= sizeof minibuf);
-
   uint32_t width_32 = width_byte_ / 4;
   uint32_t to_write = data.size() / width_32;
 
   assert((data.size() % width_32) == 0);
   assert(word_offset + to_write <= num_words_);
 
+  BeginAccess();
+
+  // See MemArea::Write for an explanation of the image.
+  MemPhysImage image(to_write);
   for (uint32_t i = 0; i < to_write; ++i) {
     uint32_t dst_word = word_offset + i;
-    uint32_t phys_addr = ToPhysAddr(dst_word);
-
-    WriteBufferWithIntegrity(minibuf, data, i * width_32, dst_word);
-    WriteFromMinibuf(phys_addr, minibuf, dst_word);
+    image.SetPhysAddr(i, ToPhysAddr(dst_word));
+    WriteBufferWithIntegrity(image.GetWord(i), data, i * width_32, dst_word);
   }
+
+  WritePhysImage(image, word_offset);
 }
 
 // Zero enough of the buffer to fill it with a word using insert_bits
@@ -154,11 +183,22 @@ static uint8_t extract_bits(const uint8_t *buf, unsigned bit_idx,
 }
 
 void Ecc32MemArea::WriteBuffer(uint8_t buf[SV_MEM_WIDTH_BYTES],
-                               const std::vector<uint8_t> &data,
+                               const uint8_t *data, size_t data_size,
                                size_t start_idx, uint32_t dst_word) const {
+  assert(start_idx < data_size);
+
+  // If the data doesn't cover the whole word, zero-extend it
+  uint8_t padded[SV_MEM_WIDTH_BYTES];
+  const uint8_t *word_data = &data[start_idx];
+  if (data_size - start_idx < width_byte_) {
+    memset(padded, 0, sizeof padded);
+    memcpy(padded, word_data, data_size - start_idx);
+    word_data = padded;
+  }
+
   zero_buffer(buf, width_byte_);
   for (uint32_t i = 0; i < width_byte_ / 4; ++i) {
-    const uint8_t *src_data = &data[start_idx + 4 * i];
+    const uint8_t *src_data = &word_data[4 * i];
     insert_word(buf, 39 * i, src_data, enc_secded_inv_39_32(src_data));
   }
 }
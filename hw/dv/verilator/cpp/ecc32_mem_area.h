@@ -54,8 +54,8 @@ class Ecc32MemArea : public MemArea {
   void WriteWithIntegrity(uint32_t word_offset, const EccWords &data) const;
 
  protected:
-  void WriteBuffer(uint8_t buf[SV_MEM_WIDTH_BYTES],
-                   const std::vector<uint8_t> &data, size_t start_idx,
+  void WriteBuffer(uint8_t buf[SV_MEM_WIDTH_BYTES], const uint8_t *data,
+                   size_t data_size, size_t start_idx,
                    uint32_t dst_word) const override;
 
   void ReadBuffer(std::vector<uint8_t> &data,
@@ -89,6 +89,14 @@ class Ecc32MemArea : public MemArea {
   virtual void WriteBufferWithIntegrity(uint8_t buf[SV_MEM_WIDTH_BYTES],
                                         const EccWords &data, size_t start_idx,
                                         uint32_t dst_word) const;
+
+ private:
+  // Cache of the words returned by ReadBufferWithIntegrity() for each physical
+  // word when there is a shadow copy of the memory (see MemArea::EnableShadow),
+  // and the shadow versions they were decoded from. These are sized on first
+  // use.
+  mutable EccWords decoded_intg_;
+  mutable std::vector<uint64_t> decoded_intg_versions_;
 };
 
 #endif  // OPENTITAN_HW_DV_VERILATOR_CPP_ECC32_MEM_AREA_H_
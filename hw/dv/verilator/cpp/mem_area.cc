@@ -7,47 +7,125 @@
 #include <algorithm>
 #include <cassert>
 #include <cstring>
+#include <exception>
 #include <sstream>
+#include <thread>
 
 #include "sv_scoped.h"
 
 // DPI exports, defined in prim_util_memload.svh
 extern "C" {
 void simutil_memload(const char *file);
-int simutil_set_mem(int index, const svBitVecVal *val);
-int simutil_get_mem(int index, svBitVecVal *val);
+int simutil_set_mem_range(int count, const int *index,
+                          const svBitVecVal *val);
+int simutil_get_mem_range(int count, const int *index, svBitVecVal *val);
+int simutil_get_mem_dirty_range(int start, svBitVecVal *dirty);
+}
+
+// Round num_words up to a whole number of DPI batches
+static size_t PaddedWords(uint32_t num_words) {
+  return ((size_t)num_words + SV_MEM_RANGE_WORDS - 1) / SV_MEM_RANGE_WORDS *
+         SV_MEM_RANGE_WORDS;
+}
+
+MemPhysImage::MemPhysImage(uint32_t num_words)
+    : num_words_(num_words),
+      phys_addrs_(PaddedWords(num_words), 0),
+      data_(PaddedWords(num_words) * SV_MEM_WIDTH_BYTES, 0) {}
+
+// Call fn(lo, hi) for disjoint ranges [lo, hi) that cover [0, num_words). If
+// num_threads is more than one and there is enough work to go round, the ranges
+// are handled on separate threads. An exception thrown by fn is re-thrown on
+// the calling thread.
+template <typename Fn>
+static void ParallelFor(uint32_t num_words, unsigned num_threads, Fn fn) {
+  // Don't bother spawning threads that won't have much to do
+  const uint32_t kMinWordsPerThread = 1024;
+  num_threads =
+      std::min(num_threads, (unsigned)(num_words / kMinWordsPerThread));
+
+  if (num_threads <= 1) {
+    fn(0, num_words);
+    return;
+  }
+
+  uint32_t chunk = (num_words + num_threads - 1) / num_threads;
+  std::vector<std::exception_ptr> errors(num_threads);
+  std::vector<std::thread> threads;
+
+  for (unsigned i = 0; i < num_threads; ++i) {
+    uint32_t lo = i * chunk;
+    uint32_t hi = std::min(num_words, lo + chunk);
+    threads.emplace_back([&fn, &errors, i, lo, hi]() {
+      try {
+        fn(lo, hi);
+      } catch (...) {
+        errors[i] = std::current_exception();
+      }
+    });
+  }
+
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+
+  for (const std::exception_ptr &error : errors) {
+    if (error)
+      std::rethrow_exception(error);
+  }
 }
 
 MemArea::MemArea(const std::string &scope, uint32_t num_words,
                  uint32_t width_byte)
-    : scope_(scope), num_words_(num_words), width_byte_(width_byte) {
+    : scope_(scope),
+      num_words_(num_words),
+      width_byte_(width_byte),
+      shadow_enabled_(false),
+      shadow_valid_(false),
+      shadow_(0),
+      shadow_version_counter_(0) {
   assert(0 < num_words);
   assert(width_byte <= SV_MEM_WIDTH_BYTES);
 }
 
-void MemArea::Write(uint32_t word_offset,
-                    const std::vector<uint8_t> &data) const {
-  // This "mini buffer" is used to transfer each write to SystemVerilog.
-  // `simutil_set_mem` takes a fixed SV_MEM_WIDTH_BITS-bit vector but it will
-  // only use the bits required for the RAM width. As an example, for a 32-bit
-  // wide RAM only elements 3:0 of `minibuf` will be written to memory. Since
-  // the simulator may still read bits from minibuf it does not use, we must
-  // use a fixed allocation of the full bit vector size to avoid an out of
-  // bounds access.
-  uint8_t minibuf[SV_MEM_WIDTH_BYTES];
-  memset(minibuf, 0, sizeof minibuf);
-  assert(width_byte_ <= sizeof minibuf);
-
-  uint32_t data_words = (data.size() + width_byte_ - 1) / width_byte_;
+void MemArea::EnableShadow() {
+  if (shadow_enabled_)
+    return;
+
+  shadow_enabled_ = true;
+  shadow_valid_ = false;
+  shadow_ = MemPhysImage(num_words_);
+  for (uint32_t i = 0; i < num_words_; ++i) {
+    shadow_.SetPhysAddr(i, i);
+  }
+  shadow_versions_.assign(num_words_, 0);
+  decoded_.assign((size_t)num_words_ * width_byte_, 0);
+  decoded_versions_.assign(num_words_, 0);
+}
+
+void MemArea::Write(uint32_t word_offset, const uint8_t *data, size_t size,
+                    unsigned num_threads) const {
+  uint32_t data_words = (size + width_byte_ - 1) / width_byte_;
   assert(word_offset + data_words <= num_words_);
 
-  for (uint32_t i = 0; i < data_words; ++i) {
-    uint32_t dst_word = word_offset + i;
-    uint32_t phys_addr = ToPhysAddr(dst_word);
+  BeginAccess();
 
-    WriteBuffer(minibuf, data, i * width_byte_, dst_word);
-    WriteFromMinibuf(phys_addr, minibuf, dst_word);
-  }
+  // Encode all of the data into physical memory words on the host side first
+  // and then pass the whole lot across to SystemVerilog. The image is
+  // zero-initialised, so WriteBuffer doesn't need to clear the bits above the
+  // memory width. Each word is encoded independently, so the encoding can be
+  // split across threads.
+  MemPhysImage image(data_words);
+  ParallelFor(data_words, num_threads, [&](uint32_t lo, uint32_t hi) {
+    for (uint32_t i = lo; i < hi; ++i) {
+      uint32_t dst_word = word_offset + i;
+      image.SetPhysAddr(i, ToPhysAddr(dst_word));
+      WriteBuffer(image.GetWord(i), data, size, (size_t)i * width_byte_,
+                  dst_word);
+    }
+  });
+
+  WritePhysImage(image, word_offset);
 }
 
 std::vector<uint8_t> MemArea::Read(uint32_t word_offset,
@@ -57,20 +135,42 @@ std::vector<uint8_t> MemArea::Read(uint32_t word_offset,
   uint32_t num_bytes = width_byte_ * num_words;
   assert(num_words <= num_bytes);
 
-  // See Write for an explanation for this buffer.
-  uint8_t minibuf[SV_MEM_WIDTH_BYTES];
-  memset(minibuf, 0, sizeof minibuf);
-  assert(width_byte_ <= sizeof minibuf);
+  BeginAccess();
 
   std::vector<uint8_t> ret;
   ret.reserve(num_bytes);
 
+  if (HasShadow()) {
+    SyncShadow();
+
+    // Decode each word from the shadow copy, unless it hasn't changed since
+    // the last time we decoded it.
+    std::vector<uint8_t> word;
+    for (uint32_t i = 0; i < num_words; ++i) {
+      uint32_t phys_addr = ToPhysAddr(word_offset + i);
+      uint8_t *decoded = &decoded_[(size_t)phys_addr * width_byte_];
+      uint64_t version = GetShadowVersion(phys_addr);
+      if (decoded_versions_[phys_addr] != version) {
+        word.clear();
+        ReadBuffer(word, GetShadowWord(phys_addr), word_offset + i);
+        assert(word.size() == width_byte_);
+        std::copy(word.begin(), word.end(), decoded);
+        decoded_versions_[phys_addr] = version;
+      }
+      ret.insert(ret.end(), decoded, decoded + width_byte_);
+    }
+    return ret;
+  }
+
+  MemPhysImage image(num_words);
   for (uint32_t i = 0; i < num_words; ++i) {
-    uint32_t src_word = word_offset + i;
-    uint32_t phys_addr = ToPhysAddr(src_word);
+    image.SetPhysAddr(i, ToPhysAddr(word_offset + i));
+  }
+
+  ReadPhysImage(image);
 
-    ReadToMinibuf(minibuf, phys_addr);
-    ReadBuffer(ret, minibuf, src_word);
+  for (uint32_t i = 0; i < num_words; ++i) {
+    ReadBuffer(ret, image.GetWord(i), word_offset + i);
   }
 
   return ret;
@@ -80,12 +180,16 @@ void MemArea::LoadVmem(const std::string &path) const {
   SVScoped scoped(scope_.c_str());
   // TODO: Add error handling.
   simutil_memload(path.c_str());
+
+  // This doesn't go through the design's write ports, so the shadow copy (if
+  // any) must be re-read from scratch.
+  shadow_valid_ = false;
 }
 
-void MemArea::WriteBuffer(uint8_t buf[SV_MEM_WIDTH_BYTES],
-                          const std::vector<uint8_t> &data, size_t start_idx,
+void MemArea::WriteBuffer(uint8_t buf[SV_MEM_WIDTH_BYTES], const uint8_t *data,
+                          size_t data_size, size_t start_idx,
                           uint32_t dst_word) const {
-  size_t words_left = data.size() - start_idx;
+  size_t words_left = data_size - start_idx;
   size_t to_copy = std::min(words_left, (size_t)width_byte_);
   if (to_copy < width_byte_) {
     memset(buf, 0, SV_MEM_WIDTH_BYTES);
@@ -101,23 +205,117 @@ void MemArea::ReadBuffer(std::vector<uint8_t> &data,
               std::back_inserter(data));
 }
 
-void MemArea::ReadToMinibuf(uint8_t *minibuf, uint32_t phys_addr) const {
+void MemArea::ReadPhysImage(MemPhysImage &image) const {
+  if (image.num_words_ == 0)
+    return;
+
   SVScoped scoped(scope_);
-  if (!simutil_get_mem(phys_addr, (svBitVecVal *)minibuf)) {
-    std::ostringstream oss;
-    oss << "Could not read memory word at physical index 0x" << std::hex
-        << phys_addr << ".";
-    throw std::runtime_error(oss.str());
+  for (uint32_t done = 0; done < image.num_words_;
+       done += SV_MEM_RANGE_WORDS) {
+    int count = std::min(image.num_words_ - done, (uint32_t)SV_MEM_RANGE_WORDS);
+    int got = simutil_get_mem_range(
+        count, &image.phys_addrs_[done],
+        (svBitVecVal *)&image.data_[(size_t)done * SV_MEM_WIDTH_BYTES]);
+    if (got != count) {
+      std::ostringstream oss;
+      oss << "Could not read memory word at physical index 0x" << std::hex
+          << image.phys_addrs_[done + got] << ".";
+      throw std::runtime_error(oss.str());
+    }
   }
 }
 
-void MemArea::WriteFromMinibuf(uint32_t phys_addr, const uint8_t *minibuf,
-                               uint32_t dst_word) const {
+void MemArea::WritePhysImage(const MemPhysImage &image,
+                             uint32_t word_offset) const {
+  if (image.num_words_ == 0)
+    return;
+
   SVScoped scoped(scope_);
-  if (!simutil_set_mem(phys_addr, (const svBitVecVal *)minibuf)) {
-    std::ostringstream oss;
-    oss << "Could not set memory at byte offset 0x" << std::hex
-        << dst_word * width_byte_ << ".";
-    throw std::runtime_error(oss.str());
+  for (uint32_t done = 0; done < image.num_words_;
+       done += SV_MEM_RANGE_WORDS) {
+    int count = std::min(image.num_words_ - done, (uint32_t)SV_MEM_RANGE_WORDS);
+    int put = simutil_set_mem_range(
+        count, &image.phys_addrs_[done],
+        (const svBitVecVal *)&image.data_[(size_t)done * SV_MEM_WIDTH_BYTES]);
+    if (put != count) {
+      std::ostringstream oss;
+      oss << "Could not set memory at byte offset 0x" << std::hex
+          << (word_offset + done + put) * width_byte_ << ".";
+      throw std::runtime_error(oss.str());
+    }
+  }
+
+  // Keep the shadow copy in step with the memory
+  if (shadow_valid_) {
+    for (uint32_t i = 0; i < image.num_words_; ++i) {
+      uint32_t phys_addr = image.phys_addrs_[i];
+      memcpy(shadow_.GetWord(phys_addr), image.GetWord(i), SV_MEM_WIDTH_BYTES);
+      BumpShadowVersion(phys_addr);
+    }
+  }
+}
+
+std::vector<int> MemArea::GetDirtyWords() const {
+  std::vector<int> dirty_words;
+  svBitVecVal dirty[SV_MEM_RANGE_WORDS];
+
+  SVScoped scoped(scope_);
+  for (uint32_t start = 0; start < num_words_;
+       start += SV_MEM_DIRTY_RANGE_WORDS) {
+    int count =
+        std::min(num_words_ - start, (uint32_t)SV_MEM_DIRTY_RANGE_WORDS);
+    int got = simutil_get_mem_dirty_range(start, dirty);
+    if (got != count) {
+      std::ostringstream oss;
+      oss << "Could not read dirty bits for memory at scope " << scope_
+          << " from word 0x" << std::hex << start << ".";
+      throw std::runtime_error(oss.str());
+    }
+
+    for (int i = 0; i < count; i += 32) {
+      for (uint32_t bits = dirty[i / 32]; bits; bits &= bits - 1) {
+        dirty_words.push_back(start + i + __builtin_ctz(bits));
+      }
+    }
+  }
+
+  return dirty_words;
+}
+
+void MemArea::SyncShadow() const {
+  assert(shadow_enabled_);
+
+  // Collect the dirty bits first. On the first call, this enables dirty
+  // tracking, so no write by the design after the full read below is missed.
+  std::vector<int> dirty_words = GetDirtyWords();
+
+  if (!shadow_valid_) {
+    ReadPhysImage(shadow_);
+    for (uint32_t i = 0; i < num_words_; ++i) {
+      BumpShadowVersion(i);
+    }
+    shadow_valid_ = true;
+    return;
+  }
+
+  if (dirty_words.empty())
+    return;
+
+  MemPhysImage image(dirty_words.size());
+  for (uint32_t i = 0; i < dirty_words.size(); ++i) {
+    image.SetPhysAddr(i, dirty_words[i]);
+  }
+  ReadPhysImage(image);
+
+  for (uint32_t i = 0; i < dirty_words.size(); ++i) {
+    memcpy(shadow_.GetWord(dirty_words[i]), image.GetWord(i),
+           SV_MEM_WIDTH_BYTES);
+    BumpShadowVersion(dirty_words[i]);
+  }
+}
+
+void MemArea::InvalidateShadowDecoding() const {
+  for (uint32_t i = 0; i < shadow_versions_.size(); ++i) {
+    BumpShadowVersion(i);
   }
 }
@@ -18,6 +18,58 @@
 // using the svBitVecVal type, we have to round up to the next 32-bit word.
 #define SV_MEM_WIDTH_BYTES (4 * ((SV_MEM_WIDTH_BITS + 31) / 32))
 
+// This is the number of memory words that are passed between C++ and
+// SystemVerilog by a single call to simutil_set_mem_range or
+// simutil_get_mem_range. It must match the array sizes used in
+// prim_util_memload.svh.
+#define SV_MEM_RANGE_WORDS 256
+
+// This is the number of memory words whose dirty bits are returned by a single
+// call to simutil_get_mem_dirty_range (a bitmap of SV_MEM_RANGE_WORDS 32-bit
+// words).
+#define SV_MEM_DIRTY_RANGE_WORDS (32 * SV_MEM_RANGE_WORDS)
+
+/**
+ * A host-side image of some physical memory words
+ *
+ * This holds a list of physical word indices together with the physical bits
+ * for each word (SV_MEM_WIDTH_BYTES each, in the format used by
+ * simutil_set_mem). It is used to batch up transfers to and from the
+ * simulated memory, so that each DPI call moves SV_MEM_RANGE_WORDS words
+ * rather than one.
+ *
+ * The DPI functions take fixed-size arrays and the simulator may touch every
+ * element, even those past the requested count, so the backing storage is
+ * padded to a multiple of SV_MEM_RANGE_WORDS words.
+ */
+class MemPhysImage {
+ public:
+  explicit MemPhysImage(uint32_t num_words);
+
+  uint32_t GetNumWords() const { return num_words_; }
+
+  /** Get the physical bits for the idx'th word of the image */
+  uint8_t *GetWord(uint32_t idx) {
+    return &data_[(size_t)idx * SV_MEM_WIDTH_BYTES];
+  }
+  const uint8_t *GetWord(uint32_t idx) const {
+    return &data_[(size_t)idx * SV_MEM_WIDTH_BYTES];
+  }
+
+  /** Set the physical index in the memory of the idx'th word of the image */
+  void SetPhysAddr(uint32_t idx, uint32_t phys_addr) {
+    phys_addrs_[idx] = phys_addr;
+  }
+  uint32_t GetPhysAddr(uint32_t idx) const { return phys_addrs_[idx]; }
+
+ private:
+  friend class MemArea;
+
+  uint32_t num_words_;
+  std::vector<int> phys_addrs_;
+  std::vector<uint8_t> data_;
+};
+
 /**
  * A "memory area", representing a memory in the simulated design.
  */
@@ -27,8 +79,8 @@ class MemArea {
    *
    * @param scope  The SystemVerilog scope where the instantiated memory can be
    *               found. This needs to support the DPI-C interfaces \c
-   *               simutil_memload and \c simutil_set_mem (used for vmem and
-   *               ELF files, respectively).
+   *               simutil_memload and \c simutil_set_mem_range (used for
+   *               vmem and ELF files, respectively).
    *
    * @param size   The size of the memory in bytes (must be positive and a
    *               multiple of \p width_byte)
@@ -42,18 +94,37 @@ class MemArea {
   /** Write data to this memory area at the given word offset
    *
    * This assumes that the result will fit in the memory. If the scope cannot
-   * be set, this throws an SVScoped::Error. If a call to \c simutil_set_mem
-   * fails, this throws a \c std::runtime_error.
+   * be set, this throws an SVScoped::Error. If a call to \c
+   * simutil_set_mem_range fails, this throws a \c std::runtime_error.
+   *
+   * The data is encoded into a host-side image of the physical memory words
+   * before being passed to the simulator in batches (see WritePhysImage()).
+   * Encoding doesn't touch the simulation, so it can be split across several
+   * threads for large images.
    *
    * @param word_offset The offset, in words, of the first word that should be
    *                    written.
    *
-   * @param data        The data that should be written. If the length is not a
+   * @param data        The data that should be written.
+   *
+   * @param size        The number of bytes at \p data. If this is not a
    *                    multiple of \p width_byte, the last word will be
    *                    zero-extended.
+   *
+   * @param num_threads The maximum number of threads to use to encode the
+   *                    data.
+   */
+  virtual void Write(uint32_t word_offset, const uint8_t *data, size_t size,
+                     unsigned num_threads = 1) const;
+
+  /** Write data to this memory area at the given word offset
+   *
+   * This is equivalent to the pointer-based Write() above.
    */
-  virtual void Write(uint32_t word_offset,
-                     const std::vector<uint8_t> &data) const;
+  void Write(uint32_t word_offset, const std::vector<uint8_t> &data,
+             unsigned num_threads = 1) const {
+    Write(word_offset, data.data(), data.size(), num_threads);
+  }
 
   /** Read data from this memory area, starting at the given offset.
    *
@@ -61,7 +132,7 @@ class MemArea {
    * memory. Returns a vector with <tt>num_words * width_byte_</tt> elements.
    *
    * If the scope cannot be set, this throws an SVScoped::Error. If a call to
-   * simutil_get_mem fails, this throws a std::runtime_error.
+   * simutil_get_mem_range fails, this throws a std::runtime_error.
    *
    * @param word_offset The offset, in words, of the first word that should be
    *                    written.
@@ -74,6 +145,23 @@ class MemArea {
   /** Use \c simutil_memload to load a vmem file into the memory */
   virtual void LoadVmem(const std::string &path) const;
 
+  /** Keep a host-side shadow copy of the memory
+   *
+   * With a shadow copy, reads are served from host memory. Before each read,
+   * a single call to \c simutil_get_mem_dirty_range per 8192 words asks the
+   * design which words its write ports have changed, and only those words are
+   * read over DPI. Decoding (removing ECC bits, descrambling) is cached per
+   * word too, so repeated reads of an unchanged memory are nearly free. Writes
+   * through this object update the shadow as well as the memory.
+   *
+   * This needs the memory's write ports to call \c simutil_mark_dirty (as
+   * prim_generic_ram_1p and prim_generic_ram_2p do). Changes made behind the
+   * design's back in any other way (such as with \c $readmemh from
+   * SystemVerilog, or by restoring a checkpoint) are not seen. The shadow is
+   * filled by the first read and dropped by LoadVmem().
+   */
+  void EnableShadow();
+
   const std::string &GetScope() const { return scope_; }
   uint32_t GetSizeWords() const { return num_words_; }
   uint32_t GetSizeBytes() const { return num_words_ * width_byte_; }
@@ -85,6 +173,16 @@ class MemArea {
   uint32_t num_words_;   ///< Size of the memory area in words
   uint32_t width_byte_;  ///< Size of each word in bytes
 
+  /** Prepare for an access to the memory
+   *
+   * This is called once at the start of each read or write, before any calls
+   * to ToPhysAddr(), WriteBuffer() or ReadBuffer() (or their integrity
+   * variants). Those functions may run on several threads at once, so they
+   * must not call into the simulation. A memory that needs design state to
+   * encode or decode words (such as a scrambling key) should read it here.
+   */
+  virtual void BeginAccess() const {}
+
   /** Write to buf with the data that should be copied to the physical memory
    * for a single memory word.
    *
@@ -95,11 +193,13 @@ class MemArea {
    *
    * @param buf       Destination buffer
    * @param data      A large buffer that contains the data to be written
+   * @param data_size The number of bytes at \p data. If the word at \p
+   *                  start_idx runs off the end, it is zero-extended.
    * @param start_idx An offset into \p data for the start of the memory word
    * @param dst_word  Logical address of the location being written
    */
-  virtual void WriteBuffer(uint8_t buf[SV_MEM_WIDTH_BYTES],
-                           const std::vector<uint8_t> &data, size_t start_idx,
+  virtual void WriteBuffer(uint8_t buf[SV_MEM_WIDTH_BYTES], const uint8_t *data,
+                           size_t data_size, size_t start_idx,
                            uint32_t dst_word) const;
 
   /** Extract the logical memory contents corresponding to the physical
@@ -131,20 +231,78 @@ class MemArea {
     return logical_addr;
   }
 
-  /** Read the memory word at phys_addr into minibuf
+  /** Read the physical words listed in \p image from the memory
    *
-   * minibuf should be at least SV_MEM_WIDTH_BYTES in size. See the
-   * implementation of MemArea::Write() for the details.
+   * This fills in the data for every word of \p image, using the physical
+   * indices that have been set with MemPhysImage::SetPhysAddr(). The words
+   * are fetched with calls to \c simutil_get_mem_range, all made from
+   * within a single SV scope.
    */
-  void ReadToMinibuf(uint8_t *minibuf, uint32_t phys_addr) const;
+  void ReadPhysImage(MemPhysImage &image) const;
 
-  /** Write from minibuf to the memory word at phys_addr
+  /** Write the physical words in \p image to the memory
+   *
+   * This is the counterpart of ReadPhysImage(), using calls to \c
+   * simutil_set_mem_range.
+   *
+   * @param image       Image to write
    *
-   * minibuf should be at least SV_MEM_WIDTH_BYTES in size. See the
-   * implementation of MemArea::Write() for the details.
+   * @param word_offset Logical address of the first word in the image (only
+   *                    used for error messages)
    */
-  void WriteFromMinibuf(uint32_t phys_addr, const uint8_t *minibuf,
-                        uint32_t dst_word) const;
+  void WritePhysImage(const MemPhysImage &image, uint32_t word_offset) const;
+
+  /** Is there a host-side shadow copy of the memory? */
+  bool HasShadow() const { return shadow_enabled_; }
+
+  /** Bring the shadow copy up to date with the memory
+   *
+   * This must only be called if HasShadow() is true, after BeginAccess().
+   */
+  void SyncShadow() const;
+
+  /** Get the shadow copy of the physical word at \p phys_addr */
+  const uint8_t *GetShadowWord(uint32_t phys_addr) const {
+    return shadow_.GetWord(phys_addr);
+  }
+
+  /** Get a number that changes whenever the shadow word at \p phys_addr (or
+   * the way it decodes) changes. This is never zero, so zero can be used to
+   * mean "not decoded yet".
+   */
+  uint64_t GetShadowVersion(uint32_t phys_addr) const {
+    return shadow_versions_[phys_addr];
+  }
+
+  /** Mark every word of the shadow as changed
+   *
+   * Call this when something that affects decoding (such as a scrambling
+   * key) has changed, so that cached decodings aren't used again.
+   */
+  void InvalidateShadowDecoding() const;
+
+ private:
+  /** Get the physical indices of words written by the design since the last
+   * call, using \c simutil_get_mem_dirty_range. The first call enables dirty
+   * tracking in the design.
+   */
+  std::vector<int> GetDirtyWords() const;
+
+  /** Note that the shadow word at \p phys_addr has changed */
+  void BumpShadowVersion(uint32_t phys_addr) const {
+    shadow_versions_[phys_addr] = ++shadow_version_counter_;
+  }
+
+  bool shadow_enabled_;
+  mutable bool shadow_valid_;
+  mutable MemPhysImage shadow_;  ///< Indexed by physical address
+  mutable std::vector<uint64_t> shadow_versions_;
+  mutable uint64_t shadow_version_counter_;
+
+  // Cache of the logical data for each physical word, as appended by
+  // ReadBuffer(), and the shadow versions it was decoded from.
+  mutable std::vector<uint8_t> decoded_;
+  mutable std::vector<uint64_t> decoded_versions_;
 };
 
 #endif  // OPENTITAN_HW_DV_VERILATOR_CPP_MEM_AREA_H_
@@ -17,32 +17,26 @@
 static const uint32_t kScrMaxNonceWidth = 320;
 static const uint32_t kScrMaxNonceWidthByte = (kScrMaxNonceWidth + 7) / 8;
 
-// Functions to convert from integer address to/from a little-endian vector of
-// bytes, addr_width is given in bits
-static std::vector<uint8_t> AddrIntToBytes(uint32_t addr, uint32_t addr_width) {
-  uint32_t addr_width_bytes = (addr_width + 7) / 8;
-  std::vector<uint8_t> addr_bytes(addr_width_bytes);
-
-  for (uint32_t i = 0; i < addr_width_bytes; ++i) {
-    addr_bytes[i] = addr & 0xff;
-    addr >>= 8;
+// Functions to convert between a little-endian array of bytes and the 64-bit
+// words used by the allocation-free scrambling functions. BytesToWords fills
+// all num_words words of its output, zero-extending the bytes.
+static void BytesToWords(uint64_t *words, uint32_t num_words,
+                         const uint8_t *bytes, uint32_t num_bytes) {
+  assert(num_bytes <= 8 * num_words);
+
+  std::fill_n(words, num_words, 0);
+  for (uint32_t i = 0; i < num_bytes; ++i) {
+    words[i / 8] |= (uint64_t)bytes[i] << (8 * (i % 8));
   }
-
-  return addr_bytes;
 }
 
-static uint32_t AddrBytesToInt(const std::vector<uint8_t> &addr) {
-  assert(addr.size() <= 4);
-
-  uint32_t addr_out = 0;
-  int cur_shift = 0;
+static void WordsToBytes(uint8_t *bytes, uint32_t num_bytes,
+                         const uint64_t words[kScrMaxWidthWords]) {
+  assert(num_bytes <= 8 * kScrMaxWidthWords);
 
-  for (uint8_t byte : addr) {
-    addr_out |= ((uint32_t)byte << cur_shift);
-    cur_shift += 8;
+  for (uint32_t i = 0; i < num_bytes; ++i) {
+    bytes[i] = (words[i / 8] >> (8 * (i % 8))) & 0xff;
   }
-
-  return addr_out;
 }
 
 // Converts svBitVecVal (bit[m:n] SV type) into a byte vector
@@ -121,7 +115,8 @@ ScrambledEcc32MemArea::ScrambledEcc32MemArea(const std::string &scope,
           SVScoped::join_sv_scopes(
               scope, "u_prim_ram_1p_adv.u_mem.gen_generic.u_impl_generic"),
           size, width_32),
-      scr_scope_(scope) {
+      scr_scope_(scope),
+      have_scr_key_(false) {
   addr_width_ = vbits(size);
   repeat_keystream_ = repeat_keystream;
 }
@@ -150,36 +145,67 @@ uint32_t ScrambledEcc32MemArea::GetNonceWidthByte() const {
   return GetPrinceReplications() * 8;
 }
 
+void ScrambledEcc32MemArea::BeginAccess() const {
+  // The key and nonce can change at runtime (when the memory is re-keyed), so
+  // read them afresh for each access.
+  std::vector<uint8_t> key = GetScrambleKey();
+  std::vector<uint8_t> nonce = GetScrambleNonce();
+
+  uint64_t old_key[kScrKeyWords], old_nonce[kScrMaxWidthWords];
+  std::copy_n(scr_key_, kScrKeyWords, old_key);
+  std::copy_n(scr_nonce_, kScrMaxWidthWords, old_nonce);
+
+  BytesToWords(scr_key_, kScrKeyWords, &key[0], key.size());
+  BytesToWords(scr_nonce_, kScrMaxWidthWords, &nonce[0], nonce.size());
+
+  // If the memory has been re-keyed, words in any shadow copy decode (and map
+  // to logical addresses) differently, so cached decodings are stale.
+  bool changed =
+      !have_scr_key_ ||
+      !std::equal(old_key, old_key + kScrKeyWords, scr_key_) ||
+      !std::equal(old_nonce, old_nonce + kScrMaxWidthWords, scr_nonce_);
+  have_scr_key_ = true;
+  if (changed && HasShadow()) {
+    InvalidateShadowDecoding();
+  }
+}
+
 void ScrambledEcc32MemArea::WriteBuffer(uint8_t buf[SV_MEM_WIDTH_BYTES],
-                                        const std::vector<uint8_t> &data,
+                                        const uint8_t *data, size_t data_size,
                                         size_t start_idx,
                                         uint32_t dst_word) const {
   // Compute integrity
-  Ecc32MemArea::WriteBuffer(buf, data, start_idx, dst_word);
+  Ecc32MemArea::WriteBuffer(buf, data, data_size, start_idx, dst_word);
   ScrambleBuffer(buf, dst_word);
 }
 
-std::vector<uint8_t> ScrambledEcc32MemArea::ReadUnscrambled(
+void ScrambledEcc32MemArea::ReadUnscrambled(
+    uint8_t unscrambled[SV_MEM_WIDTH_BYTES],
     const uint8_t buf[SV_MEM_WIDTH_BYTES], uint32_t src_word) const {
-  std::vector<uint8_t> scrambled_data(buf, buf + GetPhysWidthByte());
-  return scramble_decrypt_data(
-      scrambled_data, GetPhysWidth(), 39, AddrIntToBytes(src_word, addr_width_),
-      addr_width_, GetScrambleNonce(), GetScrambleKey(), repeat_keystream_);
+  uint64_t data[kScrMaxWidthWords];
+  BytesToWords(data, kScrMaxWidthWords, buf, GetPhysWidthByte());
+
+  scramble_decrypt_data_u64(data, GetPhysWidth(), 39, src_word, addr_width_,
+                            scr_nonce_, scr_key_, repeat_keystream_);
+
+  WordsToBytes(unscrambled, GetPhysWidthByte(), data);
 }
 
 void ScrambledEcc32MemArea::ReadBuffer(std::vector<uint8_t> &data,
                                        const uint8_t buf[SV_MEM_WIDTH_BYTES],
                                        uint32_t src_word) const {
-  std::vector<uint8_t> unscrambled_data = ReadUnscrambled(buf, src_word);
+  uint8_t unscrambled_data[SV_MEM_WIDTH_BYTES];
+  ReadUnscrambled(unscrambled_data, buf, src_word);
   // Strip integrity to give final result
-  Ecc32MemArea::ReadBuffer(data, &unscrambled_data[0], src_word);
+  Ecc32MemArea::ReadBuffer(data, unscrambled_data, src_word);
 }
 
 void ScrambledEcc32MemArea::ReadBufferWithIntegrity(
     EccWords &data, const uint8_t buf[SV_MEM_WIDTH_BYTES],
     uint32_t src_word) const {
-  std::vector<uint8_t> unscrambled_data = ReadUnscrambled(buf, src_word);
-  Ecc32MemArea::ReadBufferWithIntegrity(data, &unscrambled_data[0], src_word);
+  uint8_t unscrambled_data[SV_MEM_WIDTH_BYTES];
+  ReadUnscrambled(unscrambled_data, buf, src_word);
+  Ecc32MemArea::ReadBufferWithIntegrity(data, unscrambled_data, src_word);
 }
 
 void ScrambledEcc32MemArea::WriteBufferWithIntegrity(
@@ -191,20 +217,19 @@ void ScrambledEcc32MemArea::WriteBufferWithIntegrity(
 
 void ScrambledEcc32MemArea::ScrambleBuffer(uint8_t buf[SV_MEM_WIDTH_BYTES],
                                            uint32_t dst_word) const {
-  std::vector<uint8_t> scramble_buf(buf, buf + GetPhysWidthByte());
+  uint64_t data[kScrMaxWidthWords];
+  BytesToWords(data, kScrMaxWidthWords, buf, GetPhysWidthByte());
 
   // Scramble data with integrity
-  scramble_buf = scramble_encrypt_data(
-      scramble_buf, GetPhysWidth(), 39, AddrIntToBytes(dst_word, addr_width_),
-      addr_width_, GetScrambleNonce(), GetScrambleKey(), repeat_keystream_);
+  scramble_encrypt_data_u64(data, GetPhysWidth(), 39, dst_word, addr_width_,
+                            scr_nonce_, scr_key_, repeat_keystream_);
 
   // Copy scrambled data to write buffer
-  std::copy(scramble_buf.begin(), scramble_buf.end(), &buf[0]);
+  WordsToBytes(buf, GetPhysWidthByte(), data);
 }
 
 uint32_t ScrambledEcc32MemArea::ToPhysAddr(uint32_t logical_addr) const {
   // Scramble logical address to get physical address
-  return AddrBytesToInt(scramble_addr(AddrIntToBytes(logical_addr, addr_width_),
-                                      addr_width_, GetScrambleNonce(),
-                                      GetNonceWidth()));
+  return scramble_addr_u64(logical_addr, addr_width_, scr_nonce_,
+                           GetNonceWidth());
 }
@@ -8,6 +8,7 @@
 #include <vector>
 
 #include "ecc32_mem_area.h"
+#include "scramble_model.h"
 
 /**
  * A memory that implements scrambling over a 32-bit ECC integrity protection
@@ -33,12 +34,15 @@ class ScrambledEcc32MemArea : public Ecc32MemArea {
                         uint32_t width_32, bool repeat_keystream = true);
 
  private:
-  void WriteBuffer(uint8_t buf[SV_MEM_WIDTH_BYTES],
-                   const std::vector<uint8_t> &data, size_t start_idx,
+  void BeginAccess() const override;
+
+  void WriteBuffer(uint8_t buf[SV_MEM_WIDTH_BYTES], const uint8_t *data,
+                   size_t data_size, size_t start_idx,
                    uint32_t dst_word) const override;
 
-  std::vector<uint8_t> ReadUnscrambled(const uint8_t buf[SV_MEM_WIDTH_BYTES],
-                                       uint32_t src_word) const;
+  void ReadUnscrambled(uint8_t unscrambled[SV_MEM_WIDTH_BYTES],
+                       const uint8_t buf[SV_MEM_WIDTH_BYTES],
+                       uint32_t src_word) const;
 
   void ReadBuffer(std::vector<uint8_t> &data,
                   const uint8_t buf[SV_MEM_WIDTH_BYTES],
@@ -68,6 +72,12 @@ class ScrambledEcc32MemArea : public Ecc32MemArea {
   std::string scr_scope_;
   uint32_t addr_width_;
   bool repeat_keystream_;
+
+  // Scrambling key and nonce, read from the design by BeginAccess() so that
+  // words can be scrambled or descrambled without calling into the simulation
+  mutable uint64_t scr_key_[kScrKeyWords];
+  mutable uint64_t scr_nonce_[kScrMaxWidthWords];
+  mutable bool have_scr_key_;
 };
 
 #endif  // OPENTITAN_HW_DV_VERILATOR_CPP_SCRAMBLED_ECC32_MEM_AREA_H_
@@ -13,16 +13,9 @@
 #include <string>
 #include <vector>
 
-namespace {
-// An instruction to load the file at filepath to the memory called name. If
-// name is the empty string then type must be kMemImageElf and this is an
-// instruction to load an ELF file, picking memories by LMA.
-struct LoadArg {
-  std::string name;
-  std::string filepath;
-  MemImageType type;
-};
-}  // namespace
+#include "verilator_sim_ctrl.h"
+
+typedef VerilatorMemUtil::LoadArg LoadArg;
 
 // Parse a meminit command-line argument. This should be of the form
 // mem_area,file[,type]. Throw a std::runtime_error if something looks wrong.
@@ -84,11 +77,13 @@ static void PrintHelp() {
                "  Show help\n\n";
 }
 
-VerilatorMemUtil::VerilatorMemUtil() : allocation_(new DpiMemUtil()) {
+VerilatorMemUtil::VerilatorMemUtil()
+    : allocation_(new DpiMemUtil()), verbose_(false) {
   mem_util_ = allocation_.get();
 }
 
-VerilatorMemUtil::VerilatorMemUtil(DpiMemUtil *mem_util) : mem_util_(mem_util) {
+VerilatorMemUtil::VerilatorMemUtil(DpiMemUtil *mem_util)
+    : mem_util_(mem_util), verbose_(false) {
   assert(mem_util);
 }
 
@@ -105,8 +100,8 @@ bool VerilatorMemUtil::ParseCLIArguments(int argc, char **argv,
       {"help", no_argument, nullptr, 'h'},
       {nullptr, no_argument, nullptr, 0}};
 
-  std::vector<LoadArg> load_args;
-  bool verbose = false;
+  load_args_.clear();
+  verbose_ = false;
 
   // Reset the command parsing index in-case other utils have already parsed
   // some arguments
@@ -125,19 +120,19 @@ bool VerilatorMemUtil::ParseCLIArguments(int argc, char **argv,
       case 1:
         break;
       case 'r':
-        load_args.push_back(
+        load_args_.push_back(
             {.name = "rom", .filepath = optarg, .type = kMemImageUnknown});
         break;
       case 'm':
-        load_args.push_back(
+        load_args_.push_back(
             {.name = "ram", .filepath = optarg, .type = kMemImageUnknown});
         break;
       case 'f':
-        load_args.push_back(
+        load_args_.push_back(
             {.name = "flash", .filepath = optarg, .type = kMemImageUnknown});
         break;
       case 'o':
-        load_args.push_back(
+        load_args_.push_back(
             {.name = "otp", .filepath = optarg, .type = kMemImageUnknown});
         break;
       case 'l':
@@ -149,17 +144,17 @@ bool VerilatorMemUtil::ParseCLIArguments(int argc, char **argv,
 
         // --meminit / -l
         try {
-          load_args.emplace_back(ParseMemArg(optarg));
+          load_args_.emplace_back(ParseMemArg(optarg));
         } catch (const std::runtime_error &err) {
           std::cerr << "ERROR: " << err.what() << std::endl;
           return false;
         }
         break;
       case 'V':
-        verbose = true;
+        verbose_ = true;
         break;
       case 'E':
-        load_args.push_back(
+        load_args_.push_back(
             {.name = "", .filepath = optarg, .type = kMemImageElf});
         break;
       case 'h':
@@ -175,20 +170,40 @@ bool VerilatorMemUtil::ParseCLIArguments(int argc, char **argv,
     }
   }
 
-  for (const LoadArg &arg : load_args) {
-    try {
-      if (!arg.name.empty()) {
-        mem_util_->LoadFileToNamedMem(verbose, arg.name, arg.filepath,
-                                      arg.type);
-      } else {
-        assert(arg.type == kMemImageElf);
-        mem_util_->LoadElfToMemories(verbose, arg.filepath);
-      }
-    } catch (const std::exception &err) {
-      std::cerr << "ERROR: " << err.what() << std::endl;
-      return false;
-    }
+  // VerilatorSimCtrl has already parsed its own arguments by now
+  const VerilatorSimCtrl &simctrl = VerilatorSimCtrl::GetInstance();
+  mem_util_->SetPreloadThreads(simctrl.GetPreloadThreads());
+
+  // Restoring a checkpoint would overwrite the loaded data, so wait until
+  // RestoreCheckpoint() is called.
+  if (simctrl.IsRestoringCheckpoint()) {
+    return true;
+  }
+
+  try {
+    LoadFiles();
+  } catch (const std::exception &err) {
+    std::cerr << "ERROR: " << err.what() << std::endl;
+    return false;
   }
 
   return true;
 }
+
+void VerilatorMemUtil::RestoreCheckpoint(VerilatedDeserialize & /* os */) {
+  // SaveCheckpoint() writes nothing: memory contents are part of the model
+  // state, which has already been restored. All that's left is to apply the
+  // loads from this run's command line on top.
+  LoadFiles();
+}
+
+void VerilatorMemUtil::LoadFiles() const {
+  for (const LoadArg &arg : load_args_) {
+    if (!arg.name.empty()) {
+      mem_util_->LoadFileToNamedMem(verbose_, arg.name, arg.filepath, arg.type);
+    } else {
+      assert(arg.type == kMemImageElf);
+      mem_util_->LoadElfToMemories(verbose_, arg.filepath);
+    }
+  }
+}
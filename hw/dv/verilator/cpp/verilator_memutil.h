@@ -9,12 +9,23 @@
 //
 
 #include <memory>
+#include <string>
+#include <vector>
 
 #include "dpi_memutil.h"
 #include "sim_ctrl_extension.h"
 
 class VerilatorMemUtil : public SimCtrlExtension {
  public:
+  // An instruction to load the file at filepath to the memory called name. If
+  // name is the empty string then type must be kMemImageElf and this is an
+  // instruction to load an ELF file, picking memories by LMA.
+  struct LoadArg {
+    std::string name;
+    std::string filepath;
+    MemImageType type;
+  };
+
   // No-argument constructor makes a VerilatorMemUtil. Single-argument
   // constructor wraps its mem_util argument (but does not take ownership).
   VerilatorMemUtil();
@@ -23,6 +34,17 @@ class VerilatorMemUtil : public SimCtrlExtension {
   // Declared in SimCtrlExtension
   bool ParseCLIArguments(int argc, char **argv, bool &exit_app) override;
 
+  // Nothing of ours is stored in a checkpoint, so this doesn't read from os.
+  // It performs the (deferred) --meminit and --load-elf loads from the
+  // command line, overwriting the memory contents from the checkpoint.
+  void RestoreCheckpoint(VerilatedDeserialize &os) override;
+
+  // Memory loads all happen before the simulation runs, so this never needs
+  // to be called on a clock edge.
+  unsigned long GetNextWakeup(unsigned long sim_time) override {
+    return kNoWakeup;
+  }
+
   // Get underlying DpiMemUtil object
   DpiMemUtil *GetUnderlying() { return mem_util_; }
 
@@ -33,8 +55,16 @@ class VerilatorMemUtil : public SimCtrlExtension {
   }
 
  private:
+  // Perform the loads in load_args_, throwing a std::runtime_error on failure
+  void LoadFiles() const;
+
   DpiMemUtil *mem_util_;
   std::unique_ptr<DpiMemUtil> allocation_;
+
+  // Loads requested on the command line. When the simulation starts from a
+  // checkpoint, these are deferred until the checkpoint has been restored.
+  std::vector<LoadArg> load_args_;
+  bool verbose_;
 };
 
 #endif  // OPENTITAN_HW_DV_VERILATOR_CPP_VERILATOR_MEMUTIL_H_
@@ -0,0 +1,134 @@
+// Copyright lowRISC contributors.
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+
+#include <cerrno>
+#include <cstdlib>
+#include <getopt.h>
+#include <iostream>
+
+#include "Vsimctrl_bench.h"
+#include "sim_ctrl_extension.h"
+#include "verilated_toplevel.h"
+#include "verilator_sim_ctrl.h"
+
+// Parse a non-negative integer argument, with the same rules as the options
+// of VerilatorSimCtrl: digits only (in any base that strtoul detects), with
+// nothing before or after them.
+static bool ParseUlArg(unsigned long *value, const char *name,
+                       const char *text) {
+  if (!('0' <= text[0] && text[0] <= '9')) {
+    std::cerr << "ERROR: Bad format for " << name << " argument: `" << text
+              << "' is not an unsigned integer.\n";
+    return false;
+  }
+
+  char *end;
+  errno = 0;
+  *value = strtoul(text, &end, 0);
+  if (*end) {
+    std::cerr << "ERROR: Bad format for " << name << " argument: `" << text
+              << "' is not an unsigned integer.\n";
+    return false;
+  }
+  if (errno == ERANGE) {
+    std::cerr << "ERROR: Bad format for " << name << " argument: `" << text
+              << "' is too big.\n";
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Extension that asks to be called every N cycles and checks the counter in
+ * the toplevel when it is, so that the cost of waking up extensions shows up
+ * in the benchmark.
+ */
+class SimCtrlBench : public SimCtrlExtension {
+ public:
+  SimCtrlBench(simctrl_bench *top)
+      : top_(top), wakeup_cycles_(1), calls_(0), last_count_(0) {}
+
+  bool ParseCLIArguments(int argc, char **argv, bool &exit_app) override {
+    const struct option long_options[] = {
+        {"bench-wakeup-cycles", required_argument, nullptr, 'w'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, no_argument, nullptr, 0}};
+
+    // Reset the command parsing index in-case other utils have already parsed
+    // some arguments
+    optind = 1;
+    while (1) {
+      int c = getopt_long(argc, argv, "-h", long_options, nullptr);
+      if (c == -1) {
+        break;
+      }
+
+      switch (c) {
+        case 0:
+        case 1:
+          break;
+        case 'w':
+          if (!ParseUlArg(&wakeup_cycles_, "bench-wakeup-cycles", optarg)) {
+            exit_app = true;
+            return false;
+          }
+          break;
+        case 'h':
+          std::cout << "Benchmark options:\n\n"
+                       "--bench-wakeup-cycles=N\n"
+                       "  Wake up the benchmark extension every N cycles. 0 "
+                       "means never.\n"
+                       "  Default: 1.\n\n";
+          break;
+      }
+    }
+
+    return true;
+  }
+
+  void OnClock(unsigned long sim_time) override {
+    ++calls_;
+
+    // The counter only ever goes up (except in reset), so this catches cycles
+    // that were skipped or evaluated twice.
+    if (top_->count_o < last_count_ && top_->rst_ni) {
+      std::cerr << "ERROR: Counter went backwards at time " << sim_time
+                << std::endl;
+      VerilatorSimCtrl::GetInstance().RequestStop(false);
+    }
+    last_count_ = top_->count_o;
+  }
+
+  unsigned long GetNextWakeup(unsigned long sim_time) override {
+    return wakeup_cycles_ ? sim_time + 2 * wakeup_cycles_ : kNoWakeup;
+  }
+
+  void PostExec() override {
+    std::cout << "Benchmark extension called " << calls_ << " times; counter "
+              << "reached " << top_->count_o << "." << std::endl;
+  }
+
+ private:
+  simctrl_bench *top_;
+  unsigned long wakeup_cycles_;
+  unsigned long calls_;
+  uint32_t last_count_;
+};
+
+int main(int argc, char **argv) {
+  simctrl_bench top;
+
+  VerilatorSimCtrl &simctrl = VerilatorSimCtrl::GetInstance();
+  simctrl.SetTop(&top, &top.clk_i, &top.rst_ni,
+                 VerilatorSimCtrlFlags::ResetPolarityNegative);
+
+  SimCtrlBench bench(&top);
+  simctrl.RegisterExtension(&bench);
+
+  std::cout << "Simulation harness benchmark" << std::endl
+            << "============================" << std::endl
+            << std::endl;
+
+  return simctrl.Exec(argc, argv).first;
+}
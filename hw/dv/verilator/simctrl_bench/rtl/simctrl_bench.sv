@@ -0,0 +1,22 @@
+// Copyright lowRISC contributors.
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+//
+// Trivial toplevel for measuring the overhead of the simulation harness
+
+module simctrl_bench (
+  input  logic        clk_i,
+  input  logic        rst_ni,
+
+  output logic [31:0] count_o
+);
+
+  always_ff @(posedge clk_i or negedge rst_ni) begin
+    if (!rst_ni) begin
+      count_o <= '0;
+    end else begin
+      count_o <= count_o + 32'd1;
+    end
+  end
+
+endmodule
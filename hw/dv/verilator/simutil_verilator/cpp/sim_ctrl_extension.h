@@ -5,8 +5,20 @@
 #ifndef OPENTITAN_HW_DV_VERILATOR_SIMUTIL_VERILATOR_CPP_SIM_CTRL_EXTENSION_H_
 #define OPENTITAN_HW_DV_VERILATOR_SIMUTIL_VERILATOR_CPP_SIM_CTRL_EXTENSION_H_
 
+#include <climits>
+
+// Defined in verilated_save.h, which is only usable in models built with
+// Verilator's --savable option.
+class VerilatedSerialize;
+class VerilatedDeserialize;
+
 class SimCtrlExtension {
  public:
+  /**
+   * Wake-up time meaning "only when the wake-up fd is readable"
+   */
+  static constexpr unsigned long kNoWakeup = ULONG_MAX;
+
   virtual ~SimCtrlExtension() = default;
 
   /**
@@ -36,13 +48,69 @@ class SimCtrlExtension {
 
   /**
    * Function to be called every clock cycle
+   *
+   * This is always called from the main simulation thread, between calls to
+   * the model's eval(), so it doesn't race with the model even if that was
+   * built with Verilator's --threads option. An implementation that shares
+   * state with threads of its own (or with a signal handler) must still do
+   * its own synchronisation.
    */
   virtual void OnClock(unsigned long sim_time) {}
 
+  /**
+   * Get the time at which OnClock() next needs to be called
+   *
+   * This is called once before the simulation starts and then after every
+   * call to OnClock(). OnClock() won't be called again until the first rising
+   * clock edge at or after the returned time (in the same units as sim_time),
+   * or until the fd returned by GetWakeupFd() becomes readable.
+   *
+   * The default asks to be called on every rising clock edge. Extensions that
+   * only need to do something occasionally should override this, because the
+   * simulation doesn't need to visit them at all while they are asleep.
+   *
+   * @param sim_time The current simulation time
+   * @return The time of the next wake-up or kNoWakeup
+   */
+  virtual unsigned long GetNextWakeup(unsigned long sim_time) {
+    return sim_time;
+  }
+
+  /**
+   * Get a file descriptor that should wake up this extension
+   *
+   * This is called once before the simulation starts. If the result is not
+   * negative, the simulation watches the fd for readability (batched, every
+   * few cycles) and calls OnClock() on the next rising clock edge after it
+   * becomes readable, whatever GetNextWakeup() returned. The extension must
+   * consume the data in OnClock() or it will be woken up again.
+   *
+   * @return The file descriptor, or -1 if there isn't one
+   */
+  virtual int GetWakeupFd() { return -1; }
+
   /**
    * Function to be called after executing the simulation
    */
   virtual void PostExec() {}
+
+  /**
+   * Function to be called when saving a checkpoint
+   *
+   * Extensions with state that affects the simulation should write it to os.
+   * This is called after the state of the model has been written.
+   */
+  virtual void SaveCheckpoint(VerilatedSerialize &os) {}
+
+  /**
+   * Function to be called when restoring a checkpoint
+   *
+   * This must read back exactly what SaveCheckpoint() wrote. It is called
+   * after the state of the model has been restored, so it is also the place
+   * to apply changes on top of the checkpoint, such as loading new memory
+   * images. Report errors by throwing a std::runtime_error.
+   */
+  virtual void RestoreCheckpoint(VerilatedDeserialize &os) {}
 };
 
 #endif  // OPENTITAN_HW_DV_VERILATOR_SIMUTIL_VERILATOR_CPP_SIM_CTRL_EXTENSION_H_
@@ -10,6 +10,12 @@
 #endif
 
 #include <verilated.h>
+#ifdef VM_SAVABLE
+#include <verilated_save.h>
+#else
+class VerilatedSerialize;
+class VerilatedDeserialize;
+#endif
 
 #define STR(s) #s
 #define STR_AND_EXPAND(s) STR(s)
@@ -32,7 +38,8 @@
 #endif
 
 // VM_TRACE_FMT_FST must be set by the user when calling Verilator with
-// --trace-fst. VM_TRACE is set by Verilator itself.
+// --trace-fst. VM_TRACE is set by Verilator itself. Similarly, VM_SAVABLE
+// must be set by the user when calling Verilator with --savable.
 #if VM_TRACE == 1
 #ifdef VM_TRACE_FMT_FST
 #include "verilated_fst_c.h"
@@ -122,6 +129,8 @@ class VerilatedToplevel {
   virtual void final() = 0;
   virtual const char *name() const = 0;
   virtual void trace(VerilatedTracer &tfp, int levels, int options) = 0;
+  virtual void save(VerilatedSerialize &os) = 0;
+  virtual void restore(VerilatedDeserialize &os) = 0;
 
   /**
    * Get the Verilator-generated device under test
@@ -148,6 +157,20 @@ class TOPLEVEL_NAME : public VERILATED_TOPLEVEL_NAME, public VerilatedToplevel {
                                    levels, options);
 #else
     assert(0 && "Tracing not enabled.");
+#endif
+  }
+  void save(VerilatedSerialize &os) {
+#ifdef VM_SAVABLE
+    os << static_cast<VERILATED_TOPLEVEL_NAME &>(*this);
+#else
+    assert(0 && "Checkpointing not enabled.");
+#endif
+  }
+  void restore(VerilatedDeserialize &os) {
+#ifdef VM_SAVABLE
+    os >> static_cast<VERILATED_TOPLEVEL_NAME &>(*this);
+#else
+    assert(0 && "Checkpointing not enabled.");
 #endif
   }
 };
@@ -4,17 +4,44 @@
 
 #include "verilator_sim_ctrl.h"
 
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <dirent.h>
+#include <fstream>
 #include <getopt.h>
+#include <iomanip>
 #include <iostream>
+#include <sched.h>
 #include <signal.h>
+#include <sstream>
+#include <stdexcept>
 #include <sys/stat.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+#include <thread>
+#include <unistd.h>
 #include <verilated.h>
+#include <verilated_syms.h>
+
+#include "dpi_checkpoint.h"
 
 // This is defined by Verilator and passed through the command line
 #ifndef VM_TRACE
 #define VM_TRACE 0
 #endif
 
+// This must be defined by the user when calling Verilator with --savable.
+// Verilator only builds its save/restore support for such models, so nothing
+// from verilated_save.h may be used without it.
+#ifdef VM_SAVABLE
+#include <verilated_save.h>
+#define CHECKPOINT_POSSIBLE true
+#else
+#define CHECKPOINT_POSSIBLE false
+#endif
+
 /**
  * Get the current simulation time
  *
@@ -106,10 +133,55 @@ static bool read_ul_arg(unsigned long *arg_val, const char *arg_name,
   return true;
 }
 
+// Parse a list of CPUs such as "0-3,8" into cpus.
+static bool read_cpu_list_arg(std::vector<int> *cpus, const char *arg_name,
+                              const char *arg_text) {
+  assert(cpus && arg_name && arg_text);
+
+  cpus->clear();
+  const char *pos = arg_text;
+  while (true) {
+    char *end;
+    if (!(('0' <= *pos) && (*pos <= '9')))
+      break;
+    unsigned long lo = strtoul(pos, &end, 10);
+    unsigned long hi = lo;
+    if (*end == '-') {
+      pos = end + 1;
+      if (!(('0' <= *pos) && (*pos <= '9')))
+        break;
+      hi = strtoul(pos, &end, 10);
+    }
+    if (hi < lo || hi >= CPU_SETSIZE)
+      break;
+    for (unsigned long cpu = lo; cpu <= hi; ++cpu) {
+      cpus->push_back(cpu);
+    }
+
+    if (*end == '\0')
+      return true;
+    if (*end != ',')
+      break;
+    pos = end + 1;
+  }
+
+  std::cerr << "ERROR: Bad format for " << arg_name << " argument: `"
+            << arg_text << "' is not a list of CPUs (like `0-3,8').\n";
+  return false;
+}
+
 bool VerilatorSimCtrl::ParseCommandArgs(int argc, char **argv, bool &exit_app) {
   const struct option long_options[] = {
       {"term-after-cycles", required_argument, nullptr, 'c'},
       {"trace", no_argument, nullptr, 't'},
+      {"preload-threads", required_argument, nullptr, 'p'},
+      {"save-checkpoint-at-cycle", required_argument, nullptr, 'S'},
+      {"restore-checkpoint", required_argument, nullptr, 'R'},
+      {"cpu-affinity", required_argument, nullptr, 'A'},
+      {"extension-poll-interval", required_argument, nullptr, 'P'},
+      {"fast-run-cycles", required_argument, nullptr, 'F'},
+      {"trace-window", required_argument, nullptr, 'W'},
+      {"trace-trigger", required_argument, nullptr, 'T'},
       {"help", no_argument, nullptr, 'h'},
       {nullptr, no_argument, nullptr, 0}};
 
@@ -141,6 +213,85 @@ bool VerilatorSimCtrl::ParseCommandArgs(int argc, char **argv, bool &exit_app) {
           return false;
         }
         break;
+      case 'p': {
+        unsigned long num_threads;
+        if (!read_ul_arg(&num_threads, "preload-threads", optarg)) {
+          exit_app = true;
+          return false;
+        }
+        // Zero means "one thread per CPU"
+        if (num_threads == 0) {
+          num_threads = std::thread::hardware_concurrency();
+        }
+        preload_threads_ = std::max(1ul, num_threads);
+        break;
+      }
+      case 'S':
+        if (!checkpoint_possible_) {
+          std::cerr << "ERROR: Checkpointing has not been enabled at compile "
+                       "time."
+                    << std::endl;
+          exit_app = true;
+          return false;
+        }
+        if (!read_ul_arg(&save_checkpoint_cycle_, "save-checkpoint-at-cycle",
+                         optarg)) {
+          exit_app = true;
+          return false;
+        }
+        save_checkpoint_ = true;
+        break;
+      case 'R':
+        if (!checkpoint_possible_) {
+          std::cerr << "ERROR: Checkpointing has not been enabled at compile "
+                       "time."
+                    << std::endl;
+          exit_app = true;
+          return false;
+        }
+        restore_checkpoint_path_ = optarg;
+        break;
+      case 'A':
+        if (!read_cpu_list_arg(&cpu_affinity_, "cpu-affinity", optarg)) {
+          exit_app = true;
+          return false;
+        }
+        break;
+      case 'P':
+        if (!read_ul_arg(&poll_interval_cycles_, "extension-poll-interval",
+                         optarg)) {
+          exit_app = true;
+          return false;
+        }
+        poll_interval_cycles_ = std::max(1ul, poll_interval_cycles_);
+        break;
+      case 'F':
+        if (!read_ul_arg(&fast_run_cycles_, "fast-run-cycles", optarg)) {
+          exit_app = true;
+          return false;
+        }
+        break;
+      case 'W':
+        if (!tracing_possible_) {
+          std::cerr << "ERROR: Tracing has not been enabled at compile time."
+                    << std::endl;
+          exit_app = true;
+          return false;
+        }
+        if (!read_ul_arg(&trace_window_cycles_, "trace-window", optarg)) {
+          exit_app = true;
+          return false;
+        }
+        if (trace_window_cycles_) {
+          TraceOn();
+        }
+        break;
+      case 'T':
+        if (!ParseTraceTriggers(optarg)) {
+          exit_app = true;
+          return false;
+        }
+        break;
       case 'h':
         PrintHelp();
         exit_app = true;
@@ -193,8 +344,9 @@ void VerilatorSimCtrl::RunSimulation() {
   }
   // Print simulation speed info
   PrintStatistics();
-  // Print helper message for tracing
-  if (TracingEverEnabled()) {
+  // Print helper message for tracing (the trace window prints its own when it
+  // is written)
+  if (TracingEverEnabled() && !TraceWindowEnabled()) {
     std::cout << std::endl
               << "You can view the simulation traces by calling" << std::endl
               << "$ gtkwave " << GetTraceFileName() << std::endl;
@@ -214,8 +366,22 @@ void VerilatorSimCtrl::SetTimeout(unsigned int cycles) {
 }
 
 void VerilatorSimCtrl::RequestStop(bool simulation_success) {
+  if (!simulation_success) {
+    simulation_success_ = false;
+  }
   request_stop_ = true;
-  simulation_success_ &= simulation_success;
+}
+
+void VerilatorSimCtrl::TriggerTraceWindow(const char *reason) {
+  if (!(trace_triggers_ & kTraceTriggerDpi)) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(trace_trigger_mutex_);
+  if (!trace_window_triggered_) {
+    trace_trigger_reason_ = reason;
+    trace_window_triggered_ = true;
+  }
 }
 
 void VerilatorSimCtrl::RegisterExtension(SimCtrlExtension *ext) {
@@ -229,12 +395,26 @@ VerilatorSimCtrl::VerilatorSimCtrl()
       tracing_enabled_changed_(false),
       tracing_ever_enabled_(false),
       tracing_possible_(VM_TRACE),
+      checkpoint_possible_(CHECKPOINT_POSSIBLE),
+      save_checkpoint_(false),
+      save_checkpoint_cycle_(0),
+      restored_time_(0),
       initial_reset_delay_cycles_(2),
       reset_duration_cycles_(2),
       request_stop_(false),
       simulation_success_(true),
+      trace_window_cycles_(0),
+      trace_triggers_(0),
+      trace_segment_start_(0),
+      trace_window_written_(false),
+      trace_window_triggered_(false),
       tracer_(VerilatedTracer()),
-      term_after_cycles_(0) {}
+      term_after_cycles_(0),
+      preload_threads_(1),
+      next_wakeup_(0),
+      epoll_fd_(-1),
+      poll_interval_cycles_(100),
+      fast_run_cycles_(0) {}
 
 void VerilatorSimCtrl::RegisterSignalHandler() {
   struct sigaction sigIntHandler;
@@ -270,8 +450,47 @@ void VerilatorSimCtrl::PrintHelp() const {
     std::cout << "-t|--trace\n"
                  "  Write a trace file from the start\n\n";
   }
+  if (tracing_possible_) {
+    std::cout << "--trace-window=N\n"
+                 "  Instead of writing a full trace, keep at least the last N\n"
+                 "  cycles and write them out only when a trigger fires.\n\n"
+                 "--trace-trigger=LIST\n"
+                 "  Comma-separated list of events that write out the trace\n"
+                 "  window: fail (the simulation fails), finish ($finish),\n"
+                 "  assert (an assertion fails or Verilator stops with a\n"
+                 "  fatal error), dpi (simutil_trace_trigger() is called\n"
+                 "  from the design) or signal:SCOPE.NAME=VALUE (the public\n"
+                 "  signal NAME in SCOPE has the given value).\n"
+                 "  Default: fail,assert,dpi.\n\n";
+  }
   std::cout << "-c|--term-after-cycles=N\n"
                "  Terminate simulation after N cycles. 0 means no timeout.\n\n"
+               "--preload-threads=N\n"
+               "  Use up to N threads to prepare memory images before the\n"
+               "  simulation starts. 0 means one thread per CPU. Default: 1.\n\n";
+  if (checkpoint_possible_) {
+    std::cout << "--save-checkpoint-at-cycle=N\n"
+                 "  Save the state of the simulation at the start of cycle N\n"
+                 "  to "
+              << GetCheckpointFileName()
+              << "\n\n"
+                 "--restore-checkpoint=FILE\n"
+                 "  Start the simulation from the state saved in FILE. Memory\n"
+                 "  images given on the command line are loaded on top.\n\n";
+  }
+  std::cout << "--cpu-affinity=LIST\n"
+               "  Pin the threads of the simulation to the CPUs in LIST (e.g.\n"
+               "  0-3,8), one CPU per thread in creation order, starting with\n"
+               "  the main thread. Useful for models built with Verilator's\n"
+               "  --threads option.\n\n"
+               "--extension-poll-interval=N\n"
+               "  Check the file descriptors that simulation extensions wait\n"
+               "  on every N cycles. Default: 100.\n\n"
+               "--fast-run-cycles=K\n"
+               "  Evaluate up to K cycles at a time, checking for stop\n"
+               "  requests and trace changes only between batches. Batches\n"
+               "  end early for extension wake-ups. 0 disables batching.\n"
+               "  Default: 0.\n\n"
                "-h|--help\n"
                "  Show help\n\n"
                "All arguments are passed to the design and can be used "
@@ -299,13 +518,17 @@ bool VerilatorSimCtrl::TraceOff() {
 }
 
 void VerilatorSimCtrl::PrintStatistics() const {
-  double speed_hz = time_ / 2 / (GetExecutionTimeMs() / 1000.0);
+  unsigned long cycles = (time_ - restored_time_) / 2;
+  double speed_hz = cycles / (GetExecutionTimeMs() / 1000.0);
   double speed_khz = speed_hz / 1000.0;
 
   std::cout << std::endl
             << "Simulation statistics" << std::endl
-            << "=====================" << std::endl
-            << "Executed cycles:  " << time_ / 2 << std::endl
+            << "=====================" << std::endl;
+  if (restored_time_) {
+    std::cout << "Restored at cycle: " << restored_time_ / 2 << std::endl;
+  }
+  std::cout << "Executed cycles:  " << cycles << std::endl
             << "Wallclock time:   " << GetExecutionTimeMs() / 1000.0 << " s"
             << std::endl
             << "Simulation speed: " << speed_hz << " cycles/s "
@@ -315,6 +538,110 @@ void VerilatorSimCtrl::PrintStatistics() const {
   if (tracing_enabled_ && FileSize(GetTraceFileName(), trace_size_byte)) {
     std::cout << "Trace file size:  " << trace_size_byte << " B" << std::endl;
   }
+
+  PrintThreadStatistics();
+}
+
+// Get the IDs of the threads in this process, starting with the main thread
+// and then in order of ID (which is normally creation order).
+static std::vector<int> GetThreadIds() {
+  std::vector<int> tids;
+#ifdef __linux__
+  DIR *dir = opendir("/proc/self/task");
+  if (!dir) {
+    return tids;
+  }
+  while (struct dirent *ent = readdir(dir)) {
+    if (ent->d_name[0] != '.') {
+      tids.push_back(atoi(ent->d_name));
+    }
+  }
+  closedir(dir);
+
+  int main_tid = getpid();
+  std::sort(tids.begin(), tids.end(), [main_tid](int a, int b) {
+    return (a == main_tid) || (b != main_tid && a < b);
+  });
+#endif
+  return tids;
+}
+
+std::vector<VerilatorSimCtrl::ThreadCpuTime>
+VerilatorSimCtrl::GetThreadCpuTimes() {
+  std::vector<ThreadCpuTime> times;
+  for (int tid : GetThreadIds()) {
+    std::string task_dir = "/proc/self/task/" + std::to_string(tid);
+
+    // The first field of schedstat is the time spent on the CPU in ns
+    unsigned long long cpu_time_ns;
+    std::ifstream schedstat(task_dir + "/schedstat");
+    if (!(schedstat >> cpu_time_ns)) {
+      continue;
+    }
+
+    std::string name;
+    std::ifstream comm(task_dir + "/comm");
+    std::getline(comm, name);
+
+    times.push_back({tid, name, cpu_time_ns});
+  }
+  return times;
+}
+
+void VerilatorSimCtrl::PrintThreadStatistics() const {
+  if (thread_times_end_.empty()) {
+    return;
+  }
+
+  double wallclock_s = GetExecutionTimeMs() / 1000.0;
+
+  std::cout << "Thread CPU time:" << std::endl;
+  for (const ThreadCpuTime &end : thread_times_end_) {
+    // Threads that started during the run have no entry at the beginning
+    unsigned long long begin_ns = 0;
+    for (const ThreadCpuTime &begin : thread_times_begin_) {
+      if (begin.tid == end.tid) {
+        begin_ns = begin.cpu_time_ns;
+        break;
+      }
+    }
+
+    double cpu_s = (end.cpu_time_ns - begin_ns) / 1e9;
+    std::cout << "  " << std::setw(7) << end.tid << " " << std::left
+              << std::setw(16) << end.name << std::right << cpu_s << " s";
+    if (wallclock_s > 0) {
+      std::cout << " (" << std::fixed << std::setprecision(1)
+                << 100.0 * cpu_s / wallclock_s << "%)" << std::defaultfloat
+                << std::setprecision(6);
+    }
+    std::cout << std::endl;
+  }
+}
+
+void VerilatorSimCtrl::SetThreadAffinity() const {
+  if (cpu_affinity_.empty()) {
+    return;
+  }
+
+#ifdef __linux__
+  std::vector<int> tids = GetThreadIds();
+  for (size_t i = 0; i < tids.size(); ++i) {
+    int cpu = cpu_affinity_[i % cpu_affinity_.size()];
+
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    CPU_SET(cpu, &cpu_set);
+    if (sched_setaffinity(tids[i], sizeof(cpu_set), &cpu_set) != 0) {
+      std::cerr << "WARNING: Unable to pin thread " << tids[i] << " to CPU "
+                << cpu << ": " << strerror(errno) << std::endl;
+    }
+  }
+  std::cout << "Pinned " << tids.size() << " threads to "
+            << cpu_affinity_.size() << " CPUs." << std::endl;
+#else
+  std::cerr << "WARNING: --cpu-affinity is not supported on this host."
+            << std::endl;
+#endif
 }
 
 const char *VerilatorSimCtrl::GetTraceFileName() const {
@@ -325,6 +652,242 @@ const char *VerilatorSimCtrl::GetTraceFileName() const {
 #endif
 }
 
+const char *VerilatorSimCtrl::GetCheckpointFileName() const {
+  return "sim.ckpt";
+}
+
+#if CHECKPOINT_POSSIBLE
+static void CheckpointWrite(void *stream, const void *data, size_t len) {
+  static_cast<VerilatedSerialize *>(stream)->write(data, len);
+}
+
+static void CheckpointRead(void *stream, void *data, size_t len) {
+  static_cast<VerilatedDeserialize *>(stream)->read(data, len);
+}
+#endif
+
+void VerilatorSimCtrl::SaveCheckpoint() {
+#if CHECKPOINT_POSSIBLE
+  VerilatedSave os;
+  os.open(GetCheckpointFileName());
+  if (!os.isOpen()) {
+    std::ostringstream oss;
+    oss << "Cannot open checkpoint file `" << GetCheckpointFileName()
+        << "' for writing.";
+    throw std::runtime_error(oss.str());
+  }
+
+  top_->save(os);
+
+  uint64_t time = time_;
+  uint64_t success = simulation_success_;
+  uint64_t num_extensions = extension_array_.size();
+  os << time << success << num_extensions;
+  for (auto it = extension_array_.begin(); it != extension_array_.end(); ++it) {
+    (*it)->SaveCheckpoint(os);
+  }
+
+  dpi_checkpoint_save(CheckpointWrite, &os);
+  os.close();
+
+  std::cout << "Saved checkpoint at cycle " << time_ / 2 << " to "
+            << GetCheckpointFileName() << std::endl;
+#else
+  throw std::runtime_error(
+      "Checkpointing has not been enabled at compile time.");
+#endif
+}
+
+void VerilatorSimCtrl::RestoreCheckpoint() {
+#if CHECKPOINT_POSSIBLE
+  VerilatedRestore os;
+  os.open(restore_checkpoint_path_.c_str());
+  if (!os.isOpen()) {
+    std::ostringstream oss;
+    oss << "Cannot open checkpoint file `" << restore_checkpoint_path_
+        << "'.";
+    throw std::runtime_error(oss.str());
+  }
+
+  top_->restore(os);
+
+  uint64_t time, success, num_extensions;
+  os >> time >> success >> num_extensions;
+  if (num_extensions != extension_array_.size()) {
+    std::ostringstream oss;
+    oss << "Checkpoint `" << restore_checkpoint_path_ << "' was saved with "
+        << num_extensions << " simulation extensions, but "
+        << extension_array_.size() << " are registered.";
+    throw std::runtime_error(oss.str());
+  }
+  time_ = time;
+  restored_time_ = time;
+  simulation_success_ = success;
+
+  for (auto it = extension_array_.begin(); it != extension_array_.end(); ++it) {
+    (*it)->RestoreCheckpoint(os);
+  }
+
+  if (!dpi_checkpoint_restore(CheckpointRead, &os)) {
+    std::ostringstream oss;
+    oss << "Cannot restore DPI model state from checkpoint `"
+        << restore_checkpoint_path_ << "'.";
+    throw std::runtime_error(oss.str());
+  }
+  os.close();
+
+  std::cout << "Restored checkpoint from " << restore_checkpoint_path_
+            << " at cycle " << time_ / 2 << "." << std::endl;
+#else
+  throw std::runtime_error(
+      "Checkpointing has not been enabled at compile time.");
+#endif
+}
+
+unsigned long VerilatorSimCtrl::GetFastRunEnd(
+    unsigned long start_reset_time, unsigned long end_reset_time) const {
+  if (!fast_run_cycles_ || tracing_enabled_ || tracing_enabled_changed_) {
+    return time_;
+  }
+
+  unsigned long end = time_ + 2 * fast_run_cycles_;
+  auto stop_before = [this, &end](unsigned long event_time) {
+    if (event_time >= time_) {
+      end = std::min(end, event_time);
+    }
+  };
+
+  // Reset is set or unset for both half cycles of the relevant cycle, so the
+  // batch must also not start in the second half.
+  stop_before(start_reset_time);
+  stop_before(end_reset_time);
+  if (time_ / 2 == start_reset_time / 2 || time_ / 2 == end_reset_time / 2) {
+    return time_;
+  }
+
+  // An extension that is already due stops batching until it's been called
+  if (next_wakeup_ <= time_) {
+    return time_;
+  }
+  stop_before(next_wakeup_);
+
+  // Extension fds are polled on both half cycles of every poll_interval_cycles_
+  // cycles (only one of which is a rising edge).
+  if (epoll_fd_ >= 0) {
+    unsigned long cycle = time_ / 2;
+    if (cycle % poll_interval_cycles_ == 0) {
+      return time_;
+    }
+    unsigned long next_poll_cycle =
+        (cycle / poll_interval_cycles_ + 1) * poll_interval_cycles_;
+    stop_before(2 * next_poll_cycle);
+  }
+
+  if (save_checkpoint_) {
+    stop_before(2 * save_checkpoint_cycle_);
+  }
+  if (term_after_cycles_) {
+    stop_before(2 * term_after_cycles_);
+  }
+
+  return end;
+}
+
+void VerilatorSimCtrl::ScheduleExtensions() {
+  schedule_.clear();
+  next_wakeup_ = SimCtrlExtension::kNoWakeup;
+
+  for (size_t i = 0; i < extension_array_.size(); ++i) {
+    SimCtrlExtension *ext = extension_array_[i];
+    unsigned long wakeup_time = ext->GetNextWakeup(time_);
+    schedule_.push_back({ext, wakeup_time});
+    next_wakeup_ = std::min(next_wakeup_, wakeup_time);
+
+    int fd = ext->GetWakeupFd();
+    if (fd < 0) {
+      continue;
+    }
+
+#ifdef __linux__
+    if (epoll_fd_ < 0) {
+      epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+      if (epoll_fd_ < 0) {
+        std::ostringstream oss;
+        oss << "Unable to create epoll instance: " << strerror(errno);
+        throw std::runtime_error(oss.str());
+      }
+    }
+
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.u64 = i;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event) != 0) {
+      std::ostringstream oss;
+      oss << "Unable to watch fd " << fd << " of a simulation extension: "
+          << strerror(errno);
+      throw std::runtime_error(oss.str());
+    }
+#else
+    // Without epoll, fall back to waking the extension on every clock edge.
+    schedule_.back().wakeup_time = time_;
+    next_wakeup_ = time_;
+#endif
+  }
+}
+
+void VerilatorSimCtrl::RunExtensions() {
+  if (epoll_fd_ >= 0 && (time_ / 2) % poll_interval_cycles_ == 0) {
+    PollExtensionFds();
+  }
+
+  if (time_ < next_wakeup_) {
+    return;
+  }
+
+  // Visit the extensions in registration order, so that those woken up in the
+  // same cycle are called in the same order as they would be without
+  // scheduling.
+  next_wakeup_ = SimCtrlExtension::kNoWakeup;
+  for (ScheduledExtension &sched : schedule_) {
+    if (time_ >= sched.wakeup_time) {
+      sched.ext->OnClock(time_);
+      sched.wakeup_time = sched.ext->GetNextWakeup(time_);
+    }
+    next_wakeup_ = std::min(next_wakeup_, sched.wakeup_time);
+  }
+}
+
+void VerilatorSimCtrl::PollExtensionFds() {
+#ifdef __linux__
+  const int kMaxEvents = 16;
+  struct epoll_event events[kMaxEvents];
+
+  int num_events = epoll_wait(epoll_fd_, events, kMaxEvents, 0);
+  if (num_events < 0) {
+    if (errno != EINTR) {
+      std::cerr << "ERROR: Waiting for simulation extension fds failed: "
+                << strerror(errno) << std::endl;
+      RequestStop(false);
+    }
+    return;
+  }
+
+  for (int i = 0; i < num_events; ++i) {
+    assert(events[i].data.u64 < schedule_.size());
+    schedule_[events[i].data.u64].wakeup_time = time_;
+    next_wakeup_ = time_;
+  }
+#endif
+}
+
+void VerilatorSimCtrl::UnscheduleExtensions() {
+  if (epoll_fd_ >= 0) {
+    close(epoll_fd_);
+    epoll_fd_ = -1;
+  }
+  schedule_.clear();
+}
+
 void VerilatorSimCtrl::Run() {
   assert(top_ && "Use SetTop() first.");
 
@@ -337,39 +900,103 @@ void VerilatorSimCtrl::Run() {
   // Evaluate all initial blocks, including the DPI setup routines
   top_->eval();
 
+  if (TraceWindowEnabled()) {
+    if (!trace_triggers_ && trace_signal_specs_.empty()) {
+      trace_triggers_ = kTraceTriggerFail | kTraceTriggerAssert |
+                        kTraceTriggerDpi;
+    }
+    try {
+      ResolveTraceSignalTriggers();
+    } catch (const std::exception &err) {
+      std::cerr << "ERROR: " << err.what() << std::endl;
+      RequestStop(false);
+    }
+    if (trace_triggers_ & kTraceTriggerAssert) {
+      Verilated::addFlushCb(TraceWindowFlushCallback, this);
+    }
+  }
+
+  // Restoring a checkpoint overwrites the state set up by the initial blocks,
+  // except for the DPI model contexts (which are matched up with the saved
+  // ones).
+  bool restored = false;
+  if (IsRestoringCheckpoint()) {
+    try {
+      RestoreCheckpoint();
+      restored = true;
+    } catch (const std::exception &err) {
+      std::cerr << "ERROR: " << err.what() << std::endl;
+      RequestStop(false);
+    }
+  }
+
+  // Verilator's worker threads and any threads started by DPI models in their
+  // initial blocks exist by now.
+  SetThreadAffinity();
+
   std::cout << std::endl
             << "Simulation running, end by pressing CTRL-c." << std::endl;
 
+  try {
+    ScheduleExtensions();
+  } catch (const std::exception &err) {
+    std::cerr << "ERROR: " << err.what() << std::endl;
+    RequestStop(false);
+  }
+
+  thread_times_begin_ = GetThreadCpuTimes();
   time_begin_ = std::chrono::steady_clock::now();
-  UnsetReset();
+  if (!restored) {
+    UnsetReset();
+  }
   Trace();
 
   unsigned long start_reset_cycle_ = initial_reset_delay_cycles_;
   unsigned long end_reset_cycle_ = start_reset_cycle_ + reset_duration_cycles_;
+  unsigned long start_reset_time = 2 * start_reset_cycle_;
+  unsigned long end_reset_time = 2 * end_reset_cycle_;
+
+  while (!request_stop_) {
+    if (save_checkpoint_ && (time_ == 2 * save_checkpoint_cycle_)) {
+      try {
+        SaveCheckpoint();
+      } catch (const std::exception &err) {
+        std::cerr << "ERROR: " << err.what() << std::endl;
+        RequestStop(false);
+        break;
+      }
+    }
 
-  while (1) {
-    unsigned long cycle_ = time_ / 2;
+    unsigned long fast_run_end =
+        GetFastRunEnd(start_reset_time, end_reset_time);
+    if (fast_run_end > time_) {
+      // Nothing else can happen until fast_run_end, except for $finish.
+      while (time_ < fast_run_end && !Verilated::gotFinish()) {
+        *sig_clk_ = !*sig_clk_;
+        top_->eval();
+        time_++;
+      }
+    } else {
+      unsigned long cycle_ = time_ / 2;
 
-    if (cycle_ == start_reset_cycle_) {
-      SetReset();
-    } else if (cycle_ == end_reset_cycle_) {
-      UnsetReset();
-    }
+      if (cycle_ == start_reset_cycle_) {
+        SetReset();
+      } else if (cycle_ == end_reset_cycle_) {
+        UnsetReset();
+      }
 
-    *sig_clk_ = !*sig_clk_;
+      *sig_clk_ = !*sig_clk_;
 
-    // Call all extension on-clock methods
-    if (*sig_clk_) {
-      for (auto it = extension_array_.begin(); it != extension_array_.end();
-           ++it) {
-        (*it)->OnClock(time_);
+      // Call the on-clock methods of the extensions that are due
+      if (*sig_clk_) {
+        RunExtensions();
       }
-    }
 
-    top_->eval();
-    time_++;
+      top_->eval();
+      time_++;
 
-    Trace();
+      Trace();
+    }
 
     if (request_stop_) {
       std::cout << "Received stop request, shutting down simulation."
@@ -388,10 +1015,29 @@ void VerilatorSimCtrl::Run() {
     }
   }
 
-  top_->final();
   time_end_ = std::chrono::steady_clock::now();
+  thread_times_end_ = GetThreadCpuTimes();
+  UnscheduleExtensions();
+
+  if (TraceWindowEnabled()) {
+    if (trace_triggers_ & kTraceTriggerAssert) {
+      Verilated::removeFlushCb(TraceWindowFlushCallback, this);
+    }
+    if (!trace_window_written_) {
+      if ((trace_triggers_ & kTraceTriggerFail) && !simulation_success_) {
+        WriteTraceWindow("a simulation failure");
+      } else if ((trace_triggers_ & kTraceTriggerFinish) &&
+                 Verilated::gotFinish()) {
+        WriteTraceWindow("$finish");
+      } else {
+        DiscardTraceWindow();
+      }
+    }
+  }
 
-  if (TracingEverEnabled()) {
+  top_->final();
+
+  if (TracingEverEnabled() && tracer_.isOpen()) {
     tracer_.close();
   }
 }
@@ -454,10 +1100,220 @@ void VerilatorSimCtrl::Trace() {
   }
 
   if (!tracer_.isOpen()) {
-    tracer_.open(GetTraceFileName());
-    std::cout << "Writing simulation traces to " << GetTraceFileName()
-              << std::endl;
+    if (TraceWindowEnabled()) {
+      tracer_.open(GetTraceSegmentFileName(1, true).c_str());
+      trace_segment_start_ = time_;
+      std::cout << "Recording the last " << trace_window_cycles_
+                << " cycles of simulation traces" << std::endl;
+    } else {
+      tracer_.open(GetTraceFileName());
+      std::cout << "Writing simulation traces to " << GetTraceFileName()
+                << std::endl;
+    }
+  } else if (TraceWindowEnabled()) {
+    RotateTraceSegments();
   }
 
   tracer_.dump(GetTime());
+
+  if (TraceWindowEnabled()) {
+    CheckTraceTriggers();
+  }
+}
+
+bool VerilatorSimCtrl::ParseTraceTriggers(const char *arg_text) {
+  trace_triggers_ = 0;
+  trace_signal_specs_.clear();
+
+  std::istringstream iss(arg_text);
+  std::string trigger;
+  while (std::getline(iss, trigger, ',')) {
+    if (trigger == "fail") {
+      trace_triggers_ |= kTraceTriggerFail;
+    } else if (trigger == "finish") {
+      trace_triggers_ |= kTraceTriggerFinish;
+    } else if (trigger == "assert") {
+      trace_triggers_ |= kTraceTriggerAssert;
+    } else if (trigger == "dpi") {
+      trace_triggers_ |= kTraceTriggerDpi;
+    } else if (trigger.compare(0, 7, "signal:") == 0 &&
+               trigger.find('=') != std::string::npos) {
+      trace_signal_specs_.push_back(trigger.substr(7));
+    } else {
+      std::cerr << "ERROR: Unknown trace trigger `" << trigger
+                << "' in trace-trigger argument." << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+void VerilatorSimCtrl::ResolveTraceSignalTriggers() {
+  trace_signal_triggers_.clear();
+
+  for (const std::string &spec : trace_signal_specs_) {
+    size_t eq_pos = spec.find('=');
+    std::string path = spec.substr(0, eq_pos);
+    std::string value_str = spec.substr(eq_pos + 1);
+
+    size_t dot_pos = path.rfind('.');
+    if (dot_pos == std::string::npos) {
+      std::ostringstream oss;
+      oss << "Trace trigger signal `" << path
+          << "' is not of the form SCOPE.NAME.";
+      throw std::runtime_error(oss.str());
+    }
+    std::string scope_name = path.substr(0, dot_pos);
+    std::string var_name = path.substr(dot_pos + 1);
+
+    const VerilatedScope *scope = Verilated::scopeFind(scope_name.c_str());
+    const VerilatedVar *var =
+        scope ? scope->varFind(var_name.c_str()) : nullptr;
+    if (!var) {
+      std::ostringstream oss;
+      oss << "No public signal `" << path
+          << "' for trace trigger (is the model built with --public-flat-rw?)";
+      throw std::runtime_error(oss.str());
+    }
+
+    size_t size;
+    switch (var->vltype()) {
+      case VLVT_UINT8:
+        size = 1;
+        break;
+      case VLVT_UINT16:
+        size = 2;
+        break;
+      case VLVT_UINT32:
+        size = 4;
+        break;
+      case VLVT_UINT64:
+        size = 8;
+        break;
+      default: {
+        std::ostringstream oss;
+        oss << "Trace trigger signal `" << path
+            << "' is not a vector of at most 64 bits.";
+        throw std::runtime_error(oss.str());
+      }
+    }
+
+    char *end;
+    uint64_t value = strtoull(value_str.c_str(), &end, 0);
+    if (value_str.empty() || *end != '\0') {
+      std::ostringstream oss;
+      oss << "Bad value `" << value_str << "' for trace trigger signal `"
+          << path << "'.";
+      throw std::runtime_error(oss.str());
+    }
+
+    trace_signal_triggers_.push_back({spec, var->datap(), size, value});
+  }
+}
+
+std::string VerilatorSimCtrl::GetTraceSegmentFileName(int idx,
+                                                      bool temporary) const {
+  // Insert the segment index before the extension: sim.fst -> sim.0.fst
+  std::string name = GetTraceFileName();
+  size_t dot_pos = name.rfind('.');
+  name.insert(dot_pos, "." + std::to_string(idx));
+  if (temporary) {
+    name += ".tmp";
+  }
+  return name;
+}
+
+void VerilatorSimCtrl::RotateTraceSegments() {
+  if (time_ - trace_segment_start_ < 2 * trace_window_cycles_) {
+    return;
+  }
+
+  // The current segment becomes the older one, replacing the segment before
+  // it. Closing the tracer flushes it, and opening it again starts the new
+  // segment with the value of every signal.
+  tracer_.close();
+  std::string older = GetTraceSegmentFileName(0, true);
+  std::string newer = GetTraceSegmentFileName(1, true);
+  if (std::rename(newer.c_str(), older.c_str()) != 0) {
+    std::cerr << "WARNING: Unable to rename " << newer << " to " << older
+              << ": " << strerror(errno) << std::endl;
+  }
+  tracer_.open(newer.c_str());
+  trace_segment_start_ = time_;
+}
+
+void VerilatorSimCtrl::CheckTraceTriggers() {
+  if (trace_window_written_) {
+    return;
+  }
+
+  if (trace_window_triggered_) {
+    std::string reason;
+    {
+      std::lock_guard<std::mutex> lock(trace_trigger_mutex_);
+      reason = trace_trigger_reason_;
+    }
+    WriteTraceWindow(reason);
+    return;
+  }
+
+  for (const TraceSignalTrigger &trigger : trace_signal_triggers_) {
+    // Verilator stores signals of up to 64 bits as native integers
+    uint64_t value = 0;
+    memcpy(&value, trigger.datap, trigger.size);
+    if (value == trigger.value) {
+      WriteTraceWindow("signal " + trigger.spec);
+      return;
+    }
+  }
+}
+
+void VerilatorSimCtrl::WriteTraceWindow(const std::string &reason) {
+  tracer_.close();
+  trace_window_written_ = true;
+
+  std::cout << std::endl
+            << "Trace window triggered by " << reason << " at cycle "
+            << time_ / 2 << "." << std::endl
+            << "You can view the simulation traces by calling" << std::endl;
+
+  // The older segment is missing if the trigger fired in the first window
+  for (int idx = 0; idx < 2; ++idx) {
+    std::string tmp_name = GetTraceSegmentFileName(idx, true);
+    std::string name = GetTraceSegmentFileName(idx, false);
+    if (std::rename(tmp_name.c_str(), name.c_str()) == 0) {
+      std::cout << "$ gtkwave " << name << std::endl;
+    }
+  }
+
+  TraceOff();
+}
+
+void VerilatorSimCtrl::DiscardTraceWindow() {
+  if (tracer_.isOpen()) {
+    tracer_.close();
+  }
+  for (int idx = 0; idx < 2; ++idx) {
+    std::remove(GetTraceSegmentFileName(idx, true).c_str());
+  }
+  std::cout << "No trace window trigger fired, so no traces were written."
+            << std::endl;
+}
+
+void VerilatorSimCtrl::TraceWindowFlushCallback(void *datap) {
+  VerilatorSimCtrl *simctrl = static_cast<VerilatorSimCtrl *>(datap);
+
+  // Verilator also runs flush callbacks for $fflush, but only a $stop (which
+  // is what a failing assertion calls) or a fatal error sets gotFinish first.
+  // The process ends after these, so write the window straight away.
+  if (!Verilated::gotFinish() || simctrl->trace_window_written_) {
+    return;
+  }
+  simctrl->WriteTraceWindow("an assertion failure or fatal error");
+}
+
+// Imported by designs that want to write out the trace window themselves, for
+// example when software reports that a test has failed.
+extern "C" void simutil_trace_trigger(const char *reason) {
+  VerilatorSimCtrl::GetInstance().TriggerTraceWindow(reason);
 }
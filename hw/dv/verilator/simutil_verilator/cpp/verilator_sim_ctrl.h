@@ -5,7 +5,9 @@
 #ifndef OPENTITAN_HW_DV_VERILATOR_SIMUTIL_VERILATOR_CPP_VERILATOR_SIM_CTRL_H_
 #define OPENTITAN_HW_DV_VERILATOR_SIMUTIL_VERILATOR_CPP_VERILATOR_SIM_CTRL_H_
 
+#include <atomic>
 #include <chrono>
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -106,11 +108,44 @@ class VerilatorSimCtrl {
    */
   void SetTimeout(unsigned int cycles);
 
+  /**
+   * Get the number of threads to use when preparing memory images
+   *
+   * This is set with the --preload-threads command-line argument and is
+   * always at least 1.
+   */
+  unsigned int GetPreloadThreads() const { return preload_threads_; }
+
+  /**
+   * Will the simulation start from a checkpoint?
+   *
+   * This is set with the --restore-checkpoint command-line argument.
+   * Extensions can use it to defer work that the restored state would
+   * overwrite until their RestoreCheckpoint() method is called.
+   */
+  bool IsRestoringCheckpoint() const {
+    return !restore_checkpoint_path_.empty();
+  }
+
   /**
    * Request the simulation to stop
+   *
+   * This is safe to call from any thread (including Verilator's eval threads
+   * in a multi-threaded model) and from signal handlers.
    */
   void RequestStop(bool simulation_success);
 
+  /**
+   * Fire the trace window trigger
+   *
+   * If the simulation is recording a trace window (see --trace-window), the
+   * window is written to disk at the end of the current cycle. This is safe to
+   * call from any thread, including from DPI functions during eval().
+   *
+   * @param reason Description of the trigger, printed to stdout
+   */
+  void TriggerTraceWindow(const char *reason);
+
   /**
    * Register an extension to be called automatically
    */
@@ -131,16 +166,77 @@ class VerilatorSimCtrl {
   bool tracing_enabled_changed_;
   bool tracing_ever_enabled_;
   bool tracing_possible_;
+  bool checkpoint_possible_;
+  bool save_checkpoint_;
+  unsigned long save_checkpoint_cycle_;
+  std::string restore_checkpoint_path_;
+  unsigned long restored_time_;
   unsigned int initial_reset_delay_cycles_;
   unsigned int reset_duration_cycles_;
-  volatile unsigned int request_stop_;
-  volatile bool simulation_success_;
+  std::atomic<bool> request_stop_;
+  std::atomic<bool> simulation_success_;
   std::chrono::steady_clock::time_point time_begin_;
   std::chrono::steady_clock::time_point time_end_;
+  std::vector<int> cpu_affinity_;
+
+  /**
+   * CPU time used by a thread of the simulation process
+   */
+  struct ThreadCpuTime {
+    int tid;
+    std::string name;
+    unsigned long long cpu_time_ns;
+  };
+  std::vector<ThreadCpuTime> thread_times_begin_;
+  std::vector<ThreadCpuTime> thread_times_end_;
+
+  /**
+   * Events that write out the trace window
+   */
+  enum TraceTrigger {
+    kTraceTriggerFail = 1 << 0,
+    kTraceTriggerFinish = 1 << 1,
+    kTraceTriggerAssert = 1 << 2,
+    kTraceTriggerDpi = 1 << 3,
+  };
+
+  /**
+   * Trigger on a public signal of the model having a given value
+   */
+  struct TraceSignalTrigger {
+    std::string spec;
+    const void *datap;
+    size_t size;
+    uint64_t value;
+  };
+
+  unsigned long trace_window_cycles_;
+  unsigned int trace_triggers_;
+  std::vector<std::string> trace_signal_specs_;
+  std::vector<TraceSignalTrigger> trace_signal_triggers_;
+  unsigned long trace_segment_start_;
+  bool trace_window_written_;
+  std::atomic<bool> trace_window_triggered_;
+  std::mutex trace_trigger_mutex_;
+  std::string trace_trigger_reason_;
   VerilatedTracer tracer_;
   unsigned long term_after_cycles_;
+  unsigned int preload_threads_;
   std::vector<SimCtrlExtension *> extension_array_;
 
+  /**
+   * Scheduling state for a registered extension
+   */
+  struct ScheduledExtension {
+    SimCtrlExtension *ext;
+    unsigned long wakeup_time;
+  };
+  std::vector<ScheduledExtension> schedule_;
+  unsigned long next_wakeup_;
+  int epoll_fd_;
+  unsigned long poll_interval_cycles_;
+  unsigned long fast_run_cycles_;
+
   /**
    * Default constructor
    *
@@ -204,11 +300,154 @@ class VerilatorSimCtrl {
    */
   void PrintStatistics() const;
 
+  /**
+   * Print the CPU time used by each thread during the simulation run
+   *
+   * For a model built with Verilator's --threads option, this shows how well
+   * the evaluation is spread across the worker threads.
+   */
+  void PrintThreadStatistics() const;
+
+  /**
+   * Get the CPU time used so far by each thread of the simulation process
+   *
+   * Returns an empty vector if this isn't supported on the host.
+   */
+  static std::vector<ThreadCpuTime> GetThreadCpuTimes();
+
+  /**
+   * Pin the threads of the simulation process to the CPUs in cpu_affinity_
+   *
+   * Threads are assigned CPUs in creation order, starting with the main
+   * thread, and wrap around if there are more threads than CPUs.
+   */
+  void SetThreadAffinity() const;
+
+  /**
+   * Get the end time of the next batch of cycles in fast-run mode
+   *
+   * A batch runs with no per-cycle bookkeeping, so it stops before anything
+   * that the main loop would need to handle: reset changes, extension
+   * wake-ups and fd polls, saving a checkpoint or the cycle limit. Tracing
+   * disables batching altogether.
+   *
+   * @param start_reset_time Time at which reset is asserted
+   * @param end_reset_time Time at which reset is released
+   * @return The end time of the batch, which is time_ if the next half cycle
+   *         must be run by the main loop
+   */
+  unsigned long GetFastRunEnd(unsigned long start_reset_time,
+                              unsigned long end_reset_time) const;
+
+  /**
+   * Set up the wake-up times and fd watches of the registered extensions
+   */
+  void ScheduleExtensions();
+
+  /**
+   * Call OnClock() on the extensions that are due at the current time
+   *
+   * This is called on every rising clock edge, so it has to be cheap when no
+   * extension is due.
+   */
+  void RunExtensions();
+
+  /**
+   * Wake up the extensions whose wake-up fd is readable
+   */
+  void PollExtensionFds();
+
+  /**
+   * Close the fd watches set up by ScheduleExtensions()
+   */
+  void UnscheduleExtensions();
+
+  /**
+   * Is the simulation recording a trace window rather than a full trace?
+   */
+  bool TraceWindowEnabled() const { return trace_window_cycles_ != 0; }
+
+  /**
+   * Parse a comma-separated list of trace triggers into trace_triggers_ and
+   * trace_signal_specs_
+   *
+   * @return true on success. On failure, prints an error to stderr.
+   */
+  bool ParseTraceTriggers(const char *arg_text);
+
+  /**
+   * Look up the signals named by trace_signal_specs_ in the model
+   *
+   * Throws a std::runtime_error if a signal can't be found.
+   */
+  void ResolveTraceSignalTriggers();
+
+  /**
+   * Get the file name of segment idx of the trace window
+   *
+   * Segment 0 is the older of the two. While recording, segments are written
+   * to temporary files, which are renamed when the window is written out.
+   */
+  std::string GetTraceSegmentFileName(int idx, bool temporary) const;
+
+  /**
+   * Start a new trace segment if the current one is full
+   *
+   * Two segments of trace_window_cycles_ cycles are kept, so the last
+   * trace_window_cycles_ cycles are always covered.
+   */
+  void RotateTraceSegments();
+
+  /**
+   * Check the trace triggers, writing out the trace window if one has fired
+   */
+  void CheckTraceTriggers();
+
+  /**
+   * Keep the recorded trace window on disk
+   *
+   * @param reason Description of the trigger, printed to stdout
+   */
+  void WriteTraceWindow(const std::string &reason);
+
+  /**
+   * Delete the temporary files of a trace window that was never written out
+   */
+  void DiscardTraceWindow();
+
+  /**
+   * Verilator flush callback, used to catch assertion failures and fatal
+   * errors (which end the process without returning to the main loop)
+   */
+  static void TraceWindowFlushCallback(void *datap);
+
   /**
    * Get the file name of the trace file
    */
   const char *GetTraceFileName() const;
 
+  /**
+   * Get the file name that checkpoints are saved to
+   */
+  const char *GetCheckpointFileName() const;
+
+  /**
+   * Save the state of the simulation to a checkpoint file
+   *
+   * This covers the model, the simulation time, all registered extensions and
+   * all DPI model contexts. Throws a std::runtime_error on failure.
+   */
+  void SaveCheckpoint();
+
+  /**
+   * Restore the state of the simulation from a checkpoint file
+   *
+   * Must be called after the model's initial blocks have been evaluated (so
+   * that the DPI model contexts exist). Throws a std::runtime_error on
+   * failure.
+   */
+  void RestoreCheckpoint();
+
   /**
    * Run the main loop of the simulation
    *
@@ -26,6 +26,11 @@ OtbnMemUtil::OtbnMemUtil(const std::string &top_scope)
   RegisterMemoryArea("dmem", 0x8000, &dmem_);
 }
 
+void OtbnMemUtil::EnableShadows() {
+  imem_.EnableShadow();
+  dmem_.EnableShadow();
+}
+
 void OtbnMemUtil::LoadElf(const std::string &elf_path) {
   LoadElfToMemories(false, elf_path);
 }
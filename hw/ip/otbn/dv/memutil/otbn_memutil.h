@@ -25,6 +25,14 @@ class OtbnMemUtil : public DpiMemUtil {
   // If something goes wrong, throws a std::exception.
   void LoadElf(const std::string &elf_path);
 
+  // Keep host-side shadow copies of IMEM and DMEM (see
+  // MemArea::EnableShadow). Only call this if, after the first read through
+  // this object, nothing writes to the memories except the design's write
+  // ports and this object: in particular, not in an environment that uses
+  // SystemVerilog backdoor writes. Reading a shadow consumes the design's
+  // dirty bits, so at most one object per memory may have shadows enabled.
+  void EnableShadows();
+
   // Get access to the segments currently staged for imem/dmem
   const StagedMem::SegMap &GetSegs(bool is_imem) const;
 
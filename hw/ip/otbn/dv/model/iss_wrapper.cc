@@ -4,6 +4,7 @@
 
 #include "iss_wrapper.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cstring>
 #include <fcntl.h>
@@ -235,30 +236,60 @@ static void read_ext_reg(const std::string &reg_name,
   }
 }
 
-// A specialized version of read_ext_reg that updates a boolean flag
-// (assuming that the ISS will always signal the register as having
-// value 0 or 1). Prints a message to stderr and returns false on
-// error.
-static bool read_ext_flag(const std::string &reg_name,
-                          const std::vector<std::string> &lines, bool *dest) {
-  assert(dest);
-
-  uint32_t dest32 = *dest ? 1 : 0;
-  read_ext_reg(reg_name, lines, &dest32);
+// The names of the registers that ISSWrapper mirrors (indexed by MirroredReg,
+// which also gives the order of their bits in the flags byte of a step_n cycle
+// record).
+static const char *const mirrored_reg_names[kNumMirroredRegs] = {
+    "STATUS", "INSN_CNT", "ERR_BITS", "STOP_PC", "RND_REQ", "WIPE_START"};
+
+// Flag in a step_n cycle record that says trace lines follow
+static const uint8_t kCycleHasTrace = 0x80;
+
+// Read the maximum number of cycles to run in one step_n command from the
+// OTBN_ISS_MAX_BATCH environment variable, defaulting to 1.
+static uint32_t get_max_batch() {
+  const char *batch_str = getenv("OTBN_ISS_MAX_BATCH");
+  if (!batch_str)
+    return 1;
+
+  unsigned long batch = strtoul(batch_str, nullptr, 0);
+  if (batch == 0 || batch > UINT32_MAX) {
+    std::cerr << "WARNING: Ignoring invalid OTBN_ISS_MAX_BATCH value `"
+              << batch_str << "'.\n";
+    return 1;
+  }
+  return batch;
+}
 
-  if (dest32 > 1) {
-    std::cerr << "ERROR: Unexpected update to " << reg_name << " with value 0x"
-              << std::hex << dest32 << std::dec
-              << " when we expected a boolean flag.";
+// Return true if the OTBN_ISS environment variable asks for the native ISS.
+// The default (and the value "python") runs the Python ISS as a subprocess.
+static bool use_native_iss() {
+  const char *iss_str = getenv("OTBN_ISS");
+  if (!iss_str || strcmp(iss_str, "python") == 0)
     return false;
-  }
+  if (strcmp(iss_str, "native") == 0)
+    return true;
 
-  *dest = dest32 != 0;
-  return true;
+  std::cerr << "WARNING: Ignoring unknown OTBN_ISS value `" << iss_str
+            << "' (expected `python' or `native').\n";
+  return false;
 }
 
 ISSWrapper::ISSWrapper(bool enable_secure_wipe)
-    : tmpdir(new TmpDir()), enable_secure_wipe(enable_secure_wipe) {
+    : child_pid(-1),
+      child_write_file(nullptr),
+      child_read_file(nullptr),
+      tmpdir(new TmpDir()),
+      enable_secure_wipe(enable_secure_wipe),
+      max_batch_(get_max_batch()),
+      warned_run_ahead_(false) {
+  // The native ISS runs in-process. We still need the temporary directory,
+  // which OtbnModel uses to pass memory contents to the ISS.
+  if (use_native_iss()) {
+    native_.reset(new OtbnIss());
+    return;
+  }
+
   std::string model_path(find_otbn_model());
 
   // We want two pipes: one for writing to the child process, and the other for
@@ -330,6 +361,9 @@ ISSWrapper::ISSWrapper(bool enable_secure_wipe)
 }
 
 ISSWrapper::~ISSWrapper() {
+  if (child_pid == -1)
+    return;
+
   // Stop the child process if it's still running. No need to be nice: we'll
   // just send a SIGKILL. Also, no need to check whether it's running first: we
   // can just fire off the signal and ignore whether it worked or not.
@@ -344,12 +378,22 @@ ISSWrapper::~ISSWrapper() {
 }
 
 void ISSWrapper::load_d(const std::string &path) {
+  if (native_) {
+    native_->load_d(path);
+    return;
+  }
+
   std::ostringstream oss;
   oss << "load_d " << path << "\n";
   run_command(oss.str(), nullptr);
 }
 
 void ISSWrapper::load_i(const std::string &path) {
+  if (native_) {
+    native_->load_i(path);
+    return;
+  }
+
   std::ostringstream oss;
   oss << "load_i " << path << "\n";
   run_command(oss.str(), nullptr);
@@ -357,6 +401,11 @@ void ISSWrapper::load_i(const std::string &path) {
 
 void ISSWrapper::add_loop_warp(uint32_t addr, uint32_t from_cnt,
                                uint32_t to_cnt) {
+  if (native_) {
+    native_->add_loop_warp(addr, from_cnt, to_cnt);
+    return;
+  }
+
   std::ostringstream oss;
   oss << "add_loop_warp 0x" << std::hex << addr << std::dec << " " << from_cnt
       << " " << to_cnt << "\n";
@@ -364,16 +413,35 @@ void ISSWrapper::add_loop_warp(uint32_t addr, uint32_t from_cnt,
 }
 
 void ISSWrapper::clear_loop_warps() {
+  if (native_) {
+    native_->clear_loop_warps();
+    return;
+  }
+
   run_command("clear_loop_warps\n", nullptr);
 }
 
 void ISSWrapper::dump_d(const std::string &path) const {
+  if (native_) {
+    native_->dump_d(path);
+    return;
+  }
+
   std::ostringstream oss;
   oss << "dump_d " << path << "\n";
   run_command(oss.str(), nullptr);
 }
 
 void ISSWrapper::start() {
+  // The ISS always stops a step_n batch when it stops running, so there
+  // shouldn't be anything pending here. Drop it if so.
+  pending_cycles_.clear();
+
+  if (native_) {
+    native_->start(enable_secure_wipe);
+    return;
+  }
+
   std::ostringstream oss;
   oss << "configure " << (int)enable_secure_wipe << "\n";
 
@@ -382,22 +450,54 @@ void ISSWrapper::start() {
 }
 
 void ISSWrapper::edn_rnd_cdc_done() {
+  if (native_) {
+    native_->edn_rnd_cdc_done();
+    return;
+  }
+
+  note_async_input("edn_rnd_cdc_done");
   run_command("edn_rnd_cdc_done\n", nullptr);
 }
 
 void ISSWrapper::edn_urnd_cdc_done() {
+  if (native_) {
+    native_->edn_urnd_cdc_done();
+    return;
+  }
+
+  note_async_input("edn_urnd_cdc_done");
   run_command("edn_urnd_cdc_done\n", nullptr);
 }
 
-void ISSWrapper::edn_flush() { run_command("edn_flush\n", nullptr); }
+void ISSWrapper::edn_flush() {
+  if (native_) {
+    native_->edn_flush();
+    return;
+  }
+
+  note_async_input("edn_flush");
+  run_command("edn_flush\n", nullptr);
+}
 
 void ISSWrapper::edn_rnd_step(uint32_t edn_rnd_data) {
+  if (native_) {
+    native_->edn_rnd_step(edn_rnd_data);
+    return;
+  }
+
+  note_async_input("edn_rnd_step");
   std::ostringstream oss;
   oss << "edn_rnd_step " << std::hex << "0x" << edn_rnd_data << "\n";
   run_command(oss.str(), nullptr);
 }
 
 void ISSWrapper::edn_urnd_step(uint32_t edn_urnd_data) {
+  if (native_) {
+    native_->edn_urnd_step(edn_urnd_data);
+    return;
+  }
+
+  note_async_input("edn_urnd_step");
   std::ostringstream oss;
   oss << "edn_urnd_step " << std::hex << "0x" << edn_urnd_data << "\n";
   run_command(oss.str(), nullptr);
@@ -406,6 +506,13 @@ void ISSWrapper::edn_urnd_step(uint32_t edn_urnd_data) {
 void ISSWrapper::set_keymgr_value(const std::array<uint32_t, 12> &key0_arr,
                                   const std::array<uint32_t, 12> &key1_arr,
                                   bool valid) {
+  if (native_) {
+    native_->set_keymgr_value(key0_arr, key1_arr, valid);
+    return;
+  }
+
+  note_async_input("set_keymgr_value");
+
   std::ostringstream oss;
 
   oss << "set_keymgr_value 0x" << std::hex << std::setfill('0');
@@ -422,48 +529,85 @@ void ISSWrapper::set_keymgr_value(const std::array<uint32_t, 12> &key0_arr,
 }
 
 int ISSWrapper::step(bool gen_trace) {
-  std::vector<std::string> lines;
+  IssCycle cycle;
+  if (native_) {
+    native_->step(gen_trace, &cycle);
+  } else {
+    if (pending_cycles_.empty())
+      fetch_cycles();
+
+    cycle = std::move(pending_cycles_.front());
+    pending_cycles_.pop_front();
+  }
 
-  run_command("step\n", &lines);
-  if (gen_trace && lines.size()) {
-    if (!OtbnTraceChecker::get().OnIssTrace(lines)) {
+  if (gen_trace && cycle.trace.size()) {
+    if (!OtbnTraceChecker::get().OnIssTrace(cycle.trace)) {
       return -1;
     }
   }
 
-  // Try to read STATUS, which is written when execution ends. Execution has
-  // finished if status_ is either 0 (IDLE) or 0xff (LOCKED)
+  // The flags are single-bit registers, so shouldn't see any other values
+  for (int reg : {kMirRndReq, kMirWipeStart}) {
+    if (((cycle.updates >> reg) & 1) && cycle.values[reg] > 1) {
+      std::cerr << "ERROR: Unexpected update to " << mirrored_reg_names[reg]
+                << " with value 0x" << std::hex << cycle.values[reg]
+                << std::dec << " when we expected a boolean flag.";
+      return -1;
+    }
+  }
+
+  uint32_t *dests[kNumMirroredRegs] = {
+      &mirrored_.status, &mirrored_.insn_cnt, &mirrored_.err_bits,
+      &mirrored_.stop_pc, nullptr, nullptr};
+  bool *flag_dests[kNumMirroredRegs] = {nullptr, nullptr, nullptr,
+                                        nullptr, &mirrored_.rnd_req,
+                                        &mirrored_.wipe_start};
+
+  // Execution has finished if STATUS is either 0 (IDLE) or 0xff (LOCKED).
+  // INSN_CNT, ERR_BITS and STOP_PC plus the flags might be updated on any
+  // cycle: some of them only change around the end of an operation but the
+  // precise timing is slightly fiddly, so it's easiest to just allow updates
+  // whenever they arrive.
   bool was_stopped = mirrored_.stopped();
-  read_ext_reg("STATUS", lines, &mirrored_.status);
+  for (int reg = 0; reg < kNumMirroredRegs; ++reg) {
+    if (!((cycle.updates >> reg) & 1))
+      continue;
+    if (dests[reg])
+      *dests[reg] = cycle.values[reg];
+    else
+      *flag_dests[reg] = cycle.values[reg] != 0;
+  }
   bool is_stopped = mirrored_.stopped();
   bool done = is_stopped && !was_stopped;
 
-  // Also try to read INSN_CNT, ERR_BITS and STOP_PC plus some associated
-  // flags. Some of these flags only get updated around the end of an operation
-  // but the precise timing is slightly fiddly, so it's easiest to just allow
-  // updates whenever they arrive.
-  read_ext_reg("INSN_CNT", lines, &mirrored_.insn_cnt);
-  read_ext_reg("ERR_BITS", lines, &mirrored_.err_bits);
-  read_ext_reg("STOP_PC", lines, &mirrored_.stop_pc);
-
-  if (!read_ext_flag("RND_REQ", lines, &mirrored_.rnd_req))
-    return -1;
-  if (!read_ext_flag("WIPE_START", lines, &mirrored_.wipe_start))
-    return -1;
-
   return done ? 1 : 0;
 }
 
 void ISSWrapper::invalidate_imem() {
+  if (native_) {
+    native_->invalidate_imem();
+    return;
+  }
+
+  note_async_input("invalidate_imem");
   run_command("invalidate_imem\n", nullptr);
 }
 
 void ISSWrapper::invalidate_dmem() {
+  if (native_) {
+    native_->invalidate_dmem();
+    return;
+  }
+
+  note_async_input("invalidate_dmem");
   run_command("invalidate_dmem\n", nullptr);
 }
 
 uint32_t ISSWrapper::step_crc(const std::array<uint8_t, 6> &item,
                               uint32_t state) const {
+  if (native_)
+    return OtbnIss::step_crc(item, state);
+
   std::vector<std::string> lines;
 
   std::ostringstream oss;
@@ -482,7 +626,14 @@ void ISSWrapper::reset(bool gen_trace) {
   if (gen_trace)
     OtbnTraceChecker::get().Flush();
 
-  run_command("reset\n", nullptr);
+  // Forget any cycles that the ISS ran ahead: they were from before the reset
+  pending_cycles_.clear();
+
+  if (native_) {
+    native_.reset(new OtbnIss());
+  } else {
+    run_command("reset\n", nullptr);
+  }
 
   // Zero our mirror of INSN_CNT. We'll get the corresponding zero value from
   // the ISS one cycle *after* start, but clearing it here avoids a glitch
@@ -497,6 +648,12 @@ void ISSWrapper::reset(bool gen_trace) {
 }
 
 void ISSWrapper::send_lc_escalation() {
+  if (native_) {
+    native_->send_lc_escalation();
+    return;
+  }
+
+  note_async_input("send_lc_escalation");
   run_command("send_lc_escalation\n", nullptr);
 }
 
@@ -504,6 +661,15 @@ void ISSWrapper::get_regs(std::array<uint32_t, 32> *gprs,
                           std::array<u256_t, 32> *wdrs) {
   assert(gprs && wdrs);
 
+  if (native_) {
+    for (int i = 0; i < 32; ++i) {
+      (*gprs)[i] = native_->peek_gpr(i);
+      const OtbnIss::u256_t &wdr = native_->peek_wdr(i);
+      std::copy(wdr.begin(), wdr.end(), (*wdrs)[i].words);
+    }
+    return;
+  }
+
   std::vector<std::string> lines;
   run_command("print_regs\n", &lines);
 
@@ -582,6 +748,9 @@ void ISSWrapper::get_regs(std::array<uint32_t, 32> *gprs,
 }
 
 std::vector<uint32_t> ISSWrapper::get_call_stack() {
+  if (native_)
+    return native_->get_call_stack();
+
   std::vector<std::string> lines;
   run_command("print_call_stack\n", &lines);
 
@@ -685,3 +854,80 @@ void ISSWrapper::run_command(const std::string &cmd,
     throw std::runtime_error(oss.str());
   }
 }
+
+void ISSWrapper::read_child_bytes(void *dst, size_t len) const {
+  if (fread(dst, 1, len, child_read_file) != len) {
+    throw std::runtime_error("Failed to read step_n response: EOF from ISS.");
+  }
+}
+
+// Decode a little-endian integer of len bytes
+static uint32_t get_le(const uint8_t *buf, size_t len) {
+  uint32_t ret = 0;
+  for (size_t i = 0; i < len; ++i) {
+    ret |= (uint32_t)buf[i] << (8 * i);
+  }
+  return ret;
+}
+
+void ISSWrapper::fetch_cycles() {
+  std::ostringstream oss;
+  oss << "step_n " << max_batch_ << "\n";
+  fputs(oss.str().c_str(), child_write_file);
+  fflush(child_write_file);
+
+  // The response is a binary frame (described in stepped.py) followed by the
+  // usual ".\n" line.
+  uint8_t buf[4];
+  read_child_bytes(buf, 4);
+  uint32_t num_cycles = get_le(buf, 4);
+  if (num_cycles == 0 || num_cycles > max_batch_) {
+    std::ostringstream err;
+    err << "ISS returned " << num_cycles << " cycles from step_n "
+        << max_batch_ << ".";
+    throw std::runtime_error(err.str());
+  }
+
+  for (uint32_t i = 0; i < num_cycles; ++i) {
+    IssCycle cycle;
+    uint8_t flags;
+    read_child_bytes(&flags, 1);
+    cycle.updates = flags & ((1 << kNumMirroredRegs) - 1);
+    for (int reg = 0; reg < kNumMirroredRegs; ++reg) {
+      if ((flags >> reg) & 1) {
+        read_child_bytes(buf, 4);
+        cycle.values[reg] = get_le(buf, 4);
+      }
+    }
+
+    if (flags & kCycleHasTrace) {
+      read_child_bytes(buf, 2);
+      unsigned num_lines = get_le(buf, 2);
+      cycle.trace.resize(num_lines);
+      for (std::string &line : cycle.trace) {
+        read_child_bytes(buf, 2);
+        line.resize(get_le(buf, 2));
+        if (!line.empty()) {
+          read_child_bytes(&line[0], line.size());
+        }
+      }
+    }
+
+    pending_cycles_.push_back(std::move(cycle));
+  }
+
+  if (!read_child_response(nullptr)) {
+    throw std::runtime_error("Failed to run command 'step_n': EOF from ISS.");
+  }
+}
+
+void ISSWrapper::note_async_input(const char *what) {
+  if (pending_cycles_.empty() || warned_run_ahead_)
+    return;
+
+  std::cerr << "WARNING: " << what << " arrived while the ISS had run "
+            << pending_cycles_.size()
+            << " cycle(s) ahead of the RTL, so it will take effect late. "
+               "Set OTBN_ISS_MAX_BATCH=1 to step the ISS in lockstep.\n";
+  warned_run_ahead_ = true;
+}
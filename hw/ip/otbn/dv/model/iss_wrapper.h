@@ -7,11 +7,14 @@
 #include <array>
 #include <cstdint>
 #include <cstdio>
+#include <deque>
 #include <memory>
 #include <string>
 #include <unistd.h>
 #include <vector>
 
+#include "otbn_iss.h"
+
 // Forward declaration (the implementation is private in iss_wrapper.cc)
 struct TmpDir;
 
@@ -47,7 +50,13 @@ class MirroredRegs {
   bool stopped() const { return status == 0 || status == 0xff; }
 };
 
-// An object wrapping the ISS subprocess.
+// An object wrapping the ISS.
+//
+// By default, this runs the Python ISS (stepped.py) as a subprocess. If the
+// OTBN_ISS environment variable is set to "native", it uses the C++ port of
+// the ISS in otbn_iss.h instead. That runs in-process, a cycle at a time, so
+// OTBN_ISS_MAX_BATCH has no effect and inputs from the testbench always take
+// effect on time.
 struct ISSWrapper {
   // A 256-bit unsigned integer value, stored in "LSB order". Thus, words[0]
   // contains the LSB and words[7] contains the MSB.
@@ -102,6 +111,11 @@ struct ISSWrapper {
   // If gen_trace is true, pass trace data to the (singleton) OtbnTraceChecker
   // object.
   //
+  // The ISS is asked to run up to OTBN_ISS_MAX_BATCH cycles at a time (1 if
+  // the environment variable isn't set), stopping early at anything the RTL
+  // side needs to see or answer (an EDN request, a STATUS change or the start
+  // of a secure wipe). The cycles it returns are handed out one per call.
+  //
   // The return code describes the state of the simulation. It is 1 if the
   // simulation just stopped (on ECALL or an architectural error); it is 0 if
   // the simulation is still running. It is -1 if something went wrong (such as
@@ -154,6 +168,25 @@ struct ISSWrapper {
   // response, raise a runtime_error.
   void run_command(const std::string &cmd, std::vector<std::string> *dst) const;
 
+  // One cycle of ISS output, as returned by the step_n command
+  typedef OtbnIssCycle IssCycle;
+
+  // Read exactly len bytes from the child. Raise a runtime_error on EOF.
+  void read_child_bytes(void *dst, size_t len) const;
+
+  // Run a step_n command and append the cycles it returns to
+  // pending_cycles_
+  void fetch_cycles();
+
+  // Called when the testbench sends an input that might arrive at any time.
+  // If the ISS has already run ahead of the RTL, the input takes effect late,
+  // so print a warning (once).
+  void note_async_input(const char *what);
+
+  // The native ISS, if OTBN_ISS=native. If this is set, there is no child
+  // process (child_pid is -1 and the FILE pointers are null).
+  std::unique_ptr<OtbnIss> native_;
+
   pid_t child_pid;
   FILE *child_write_file;
   FILE *child_read_file;
@@ -165,6 +198,15 @@ struct ISSWrapper {
 
   // Mirrored copies of registers
   MirroredRegs mirrored_;
+
+  // Cycles that the ISS has run but that haven't been returned by step() yet
+  std::deque<IssCycle> pending_cycles_;
+
+  // The most cycles to ask for in one step_n command
+  uint32_t max_batch_;
+
+  // Set once we've warned about an input arriving while running ahead
+  bool warned_run_ahead_;
 };
 
 #endif  // OPENTITAN_HW_IP_OTBN_DV_MODEL_ISS_WRAPPER_H_
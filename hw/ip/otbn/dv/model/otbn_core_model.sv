@@ -25,7 +25,12 @@ module otbn_core_model
   parameter string DesignScope = "",
 
   // Enable internal secure wipe
-  parameter bit SecWipeEn  = 1'b0
+  parameter bit SecWipeEn  = 1'b0,
+
+  // Keep host-side copies of IMEM and DMEM, which makes the end-of-operation checks much faster.
+  // Only set this if, once the simulation is running, nothing writes to the memories except the
+  // design itself and the model (in particular, no SystemVerilog backdoor writes).
+  parameter bit MemShadowEn = 1'b0
 )(
   input  logic               clk_i,
   input  logic               clk_edn_i,
@@ -61,7 +66,7 @@ module otbn_core_model
   // Create and destroy an object through which we can talk to the ISS.
   chandle model_handle;
   initial begin
-    model_handle = otbn_model_init(MemScope, DesignScope, SecWipeEn);
+    model_handle = otbn_model_init(MemScope, DesignScope, SecWipeEn, MemShadowEn);
     assert(model_handle != null);
   end
   final begin
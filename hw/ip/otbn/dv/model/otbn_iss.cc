@@ -0,0 +1,2551 @@
+// Copyright lowRISC contributors.
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+
+#include "otbn_iss.h"
+
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+
+typedef OtbnIss::u256_t u256_t;
+
+namespace {
+
+// Memory sizes, from otbn.hjson. DMEM is twice the size of the window that is
+// visible over the bus.
+const uint32_t kImemSizeBytes = 4096;
+const uint32_t kDmemSizeWords = 1024;
+
+// The number of cycles spent in the 'WIPE' state (see _WIPE_CYCLES in
+// state.py)
+const int kWipeCycles = 98;
+
+// Bits in the ERR_BITS register (see ErrBits in constants.py)
+const uint32_t kErrBadDataAddr = 1u << 0;
+const uint32_t kErrBadInsnAddr = 1u << 1;
+const uint32_t kErrCallStack = 1u << 2;
+const uint32_t kErrIllegalInsn = 1u << 3;
+const uint32_t kErrLoop = 1u << 4;
+const uint32_t kErrKeyInvalid = 1u << 5;
+const uint32_t kErrImemIntgViolation = 1u << 16;
+const uint32_t kErrDmemIntgViolation = 1u << 17;
+const uint32_t kErrLifecycleEscalation = 1u << 22;
+
+// Values of the STATUS register
+const uint32_t kStatusIdle = 0x00;
+const uint32_t kStatusBusyExecute = 0x01;
+const uint32_t kStatusLocked = 0xff;
+
+// CSR indices
+const uint32_t kCsrFg0 = 0x7c0;
+const uint32_t kCsrFg1 = 0x7c1;
+const uint32_t kCsrFlags = 0x7c8;
+const uint32_t kCsrMod0 = 0x7d0;
+const uint32_t kCsrMod7 = 0x7d7;
+const uint32_t kCsrRndPrefetch = 0x7d8;
+const uint32_t kCsrRnd = 0xfc0;
+const uint32_t kCsrUrnd = 0xfc1;
+
+// WSR indices
+const uint32_t kWsrMod = 0;
+const uint32_t kWsrRnd = 1;
+const uint32_t kWsrUrnd = 2;
+const uint32_t kWsrAcc = 3;
+const uint32_t kWsrKeyS0L = 4;
+const uint32_t kWsrKeyS1H = 7;
+
+// The depth of the call stack and the loop stack
+const size_t kCallStackDepth = 8;
+const size_t kLoopStackDepth = 8;
+
+enum Op {
+  kOpAdd,
+  kOpAddi,
+  kOpLui,
+  kOpSub,
+  kOpSll,
+  kOpSlli,
+  kOpSrl,
+  kOpSrli,
+  kOpSra,
+  kOpSrai,
+  kOpAnd,
+  kOpAndi,
+  kOpOr,
+  kOpOri,
+  kOpXor,
+  kOpXori,
+  kOpLw,
+  kOpSw,
+  kOpBeq,
+  kOpBne,
+  kOpJal,
+  kOpJalr,
+  kOpCsrrs,
+  kOpCsrrw,
+  kOpEcall,
+  kOpLoop,
+  kOpLoopi,
+  kOpBnAdd,
+  kOpBnAddc,
+  kOpBnAddi,
+  kOpBnAddm,
+  kOpBnMulqacc,
+  kOpBnMulqaccWo,
+  kOpBnMulqaccSo,
+  kOpBnSub,
+  kOpBnSubb,
+  kOpBnSubi,
+  kOpBnSubm,
+  kOpBnAnd,
+  kOpBnOr,
+  kOpBnNot,
+  kOpBnXor,
+  kOpBnRshi,
+  kOpBnSel,
+  kOpBnCmp,
+  kOpBnCmpb,
+  kOpBnLid,
+  kOpBnSid,
+  kOpBnMov,
+  kOpBnMovr,
+  kOpBnWsrr,
+  kOpBnWsrw,
+  kNumOps,
+
+  // A word that doesn't decode (IllegalInsn in decode.py)
+  kOpIllegal = kNumOps,
+  // No instruction data at all (EmptyInsn in decode.py)
+  kOpEmpty
+};
+
+// The masks for each instruction, as computed by InsnsFile in insn_yaml.py
+// from insns.yml. A word encodes an instruction if it has no bits set from m0
+// and all the bits set from m1.
+struct InsnMasks {
+  const char *mnemonic;
+  uint32_t m0, m1;
+};
+
+const InsnMasks insn_masks[kNumOps] = {
+    {"add", 0xfe00704c, 0x00000033},
+    {"addi", 0x0000706c, 0x00000013},
+    {"lui", 0x00000048, 0x00000037},
+    {"sub", 0xbe00704c, 0x40000033},
+    {"sll", 0xfe00604c, 0x00001033},
+    {"slli", 0xfe00606c, 0x00001013},
+    {"srl", 0xfe00204c, 0x00005033},
+    {"srli", 0xfe00206c, 0x00005013},
+    {"sra", 0xbe00204c, 0x40005033},
+    {"srai", 0xbe00206c, 0x40005013},
+    {"and", 0xfe00004c, 0x00007033},
+    {"andi", 0x0000006c, 0x00007013},
+    {"or", 0xfe00104c, 0x00006033},
+    {"ori", 0x0000106c, 0x00006013},
+    {"xor", 0xfe00304c, 0x00004033},
+    {"xori", 0x0000306c, 0x00004013},
+    {"lw", 0x0000507c, 0x00002003},
+    {"sw", 0x0000505c, 0x00002023},
+    {"beq", 0x0000701c, 0x00000063},
+    {"bne", 0x0000601c, 0x00001063},
+    {"jal", 0x00000010, 0x0000006f},
+    {"jalr", 0x00007018, 0x00000067},
+    {"csrrs", 0x0000500c, 0x00002073},
+    {"csrrw", 0x0000600c, 0x00001073},
+    {"ecall", 0xffffff8c, 0x00000073},
+    {"loop", 0x00007004, 0x0000007b},
+    {"loopi", 0x00006004, 0x0000107b},
+    {"bn.add", 0x00007054, 0x0000002b},
+    {"bn.addc", 0x00005054, 0x0000202b},
+    {"bn.addi", 0x40003054, 0x0000402b},
+    {"bn.addm", 0x40002054, 0x0000502b},
+    {"bn.mulqacc", 0x60000044, 0x0000003b},
+    {"bn.mulqacc.wo", 0x40000044, 0x2000003b},
+    {"bn.mulqacc.so", 0x00000044, 0x4000003b},
+    {"bn.sub", 0x00006054, 0x0000102b},
+    {"bn.subb", 0x00004054, 0x0000302b},
+    {"bn.subi", 0x00003054, 0x4000402b},
+    {"bn.subm", 0x00002054, 0x4000502b},
+    {"bn.and", 0x00005004, 0x0000207b},
+    {"bn.or", 0x00003004, 0x0000407b},
+    {"bn.not", 0x00002004, 0x0000507b},
+    {"bn.xor", 0x00001004, 0x0000607b},
+    {"bn.rshi", 0x00000004, 0x0000307b},
+    {"bn.sel", 0x00007074, 0x0000000b},
+    {"bn.cmp", 0x00006074, 0x0000100b},
+    {"bn.cmpb", 0x00004074, 0x0000300b},
+    {"bn.lid", 0x00003074, 0x0000400b},
+    {"bn.sid", 0x00002074, 0x0000500b},
+    {"bn.mov", 0x80001074, 0x0000600b},
+    {"bn.movr", 0x00001074, 0x8000600b},
+    {"bn.wsrr", 0x80000074, 0x0000700b},
+    {"bn.wsrw", 0x00000074, 0x8000700b},
+};
+
+// Extract bits hi:lo of word
+uint32_t get_bits(uint32_t word, unsigned hi, unsigned lo) {
+  assert(hi >= lo && hi - lo < 31);
+  return (word >> lo) & ((1u << (hi - lo + 1)) - 1);
+}
+
+// Sign-extend the bottom width bits of value
+uint32_t sign_extend(uint32_t value, unsigned width) {
+  uint32_t sign = 1u << (width - 1);
+  value &= (sign << 1) - 1;
+  return (value ^ sign) - sign;
+}
+
+u256_t u256_zero() {
+  u256_t ret;
+  ret.fill(0);
+  return ret;
+}
+
+u256_t u256_from_u32(uint32_t value) {
+  u256_t ret = u256_zero();
+  ret[0] = value;
+  return ret;
+}
+
+bool u256_is_zero(const u256_t &value) {
+  for (uint32_t word : value) {
+    if (word)
+      return false;
+  }
+  return true;
+}
+
+bool u256_bit(const u256_t &value, unsigned bit) {
+  return (value[bit / 32] >> (bit % 32)) & 1;
+}
+
+// Compare two values, returning a negative, zero or positive number (like
+// memcmp).
+int u256_cmp(const u256_t &a, const u256_t &b) {
+  for (int i = 7; i >= 0; --i) {
+    if (a[i] != b[i])
+      return a[i] < b[i] ? -1 : 1;
+  }
+  return 0;
+}
+
+// Set *dst = a + b + carry_in (mod 2^256), returning the carry out
+bool u256_add(u256_t *dst, const u256_t &a, const u256_t &b, bool carry_in) {
+  uint64_t carry = carry_in;
+  for (int i = 0; i < 8; ++i) {
+    uint64_t sum = (uint64_t)a[i] + b[i] + carry;
+    (*dst)[i] = (uint32_t)sum;
+    carry = sum >> 32;
+  }
+  return carry != 0;
+}
+
+// Set *dst = a - b - borrow_in (mod 2^256), returning the borrow out (which
+// is bit 256 of the infinite-precision result, as seen by the Python ISS).
+bool u256_sub(u256_t *dst, const u256_t &a, const u256_t &b, bool borrow_in) {
+  uint64_t borrow = borrow_in;
+  for (int i = 0; i < 8; ++i) {
+    uint64_t diff = (uint64_t)a[i] - b[i] - borrow;
+    (*dst)[i] = (uint32_t)diff;
+    borrow = diff >> 63;
+  }
+  return borrow != 0;
+}
+
+u256_t u256_shl(const u256_t &value, unsigned shift) {
+  assert(shift < 256);
+  unsigned words = shift / 32, bits = shift % 32;
+  u256_t ret = u256_zero();
+  for (unsigned i = words; i < 8; ++i) {
+    uint32_t lo = value[i - words];
+    uint32_t below = (bits && i > words) ? value[i - words - 1] : 0;
+    ret[i] = (lo << bits) | (bits ? below >> (32 - bits) : 0);
+  }
+  return ret;
+}
+
+u256_t u256_shr(const u256_t &value, unsigned shift) {
+  assert(shift < 256);
+  unsigned words = shift / 32, bits = shift % 32;
+  u256_t ret = u256_zero();
+  for (unsigned i = 0; i + words < 8; ++i) {
+    uint32_t hi = value[i + words];
+    uint32_t above = (bits && i + words + 1 < 8) ? value[i + words + 1] : 0;
+    ret[i] = (hi >> bits) | (bits ? above << (32 - bits) : 0);
+  }
+  return ret;
+}
+
+// Shift left (shift_type = 0) or right (shift_type = 1) by a number of bytes
+// (see logical_byte_shift in isa.py)
+u256_t logical_byte_shift(const u256_t &value, unsigned shift_type,
+                          unsigned shift_bytes) {
+  return shift_type ? u256_shr(value, 8 * shift_bytes)
+                    : u256_shl(value, 8 * shift_bytes);
+}
+
+uint64_t extract_quarter_word(const u256_t &value, unsigned qwsel) {
+  return ((uint64_t)value[2 * qwsel + 1] << 32) | value[2 * qwsel];
+}
+
+// Multiply two 64-bit numbers, writing the 128-bit product to dst (LSB first)
+void mul_64x64(uint64_t a, uint64_t b, uint32_t dst[4]) {
+  uint64_t a_lo = (uint32_t)a, a_hi = a >> 32;
+  uint64_t b_lo = (uint32_t)b, b_hi = b >> 32;
+
+  uint64_t p0 = a_lo * b_lo;
+  uint64_t p1 = a_lo * b_hi;
+  uint64_t p2 = a_hi * b_lo;
+  uint64_t p3 = a_hi * b_hi;
+
+  uint64_t mid = (p0 >> 32) + (uint32_t)p1 + (uint32_t)p2;
+  uint64_t top = p3 + (p1 >> 32) + (p2 >> 32) + (mid >> 32);
+
+  dst[0] = (uint32_t)p0;
+  dst[1] = (uint32_t)mid;
+  dst[2] = (uint32_t)top;
+  dst[3] = (uint32_t)(top >> 32);
+}
+
+uint64_t rol64(uint64_t value, unsigned shift) {
+  return (value << shift) | (value >> (64 - shift));
+}
+
+// Render a 256-bit value in the format used for RTL traces (see
+// Trace.hex_value)
+std::string hex_u256(const u256_t &value) {
+  char buf[2 + 8 * 9];
+  char *p = buf;
+  p += snprintf(p, sizeof buf, "0x");
+  for (int i = 7; i >= 0; --i) {
+    p += snprintf(p, buf + sizeof buf - p, i == 7 ? "%08x" : "_%08x",
+                  value[i]);
+  }
+  return std::string(buf);
+}
+
+// Read a file in the 5-byte format used to pass memory contents to the ISS
+// (a validity byte followed by a little-endian 32-bit word). Writes the words
+// to *words and validity flags to *valid.
+void read_5byte_file(const std::string &path, std::vector<uint32_t> *words,
+                     std::vector<bool> *valid) {
+  std::ifstream is(path, std::ios::binary);
+  if (!is) {
+    std::ostringstream oss;
+    oss << "Cannot open `" << path << "' for reading.";
+    throw std::runtime_error(oss.str());
+  }
+
+  std::vector<uint8_t> data((std::istreambuf_iterator<char>(is)),
+                            std::istreambuf_iterator<char>());
+  if (data.size() % 5) {
+    std::ostringstream oss;
+    oss << "Trying to load " << data.size() << " bytes of data from `" << path
+        << "', which is not a multiple of 5.";
+    throw std::runtime_error(oss.str());
+  }
+
+  words->clear();
+  valid->clear();
+  for (size_t i = 0; i < data.size() / 5; ++i) {
+    const uint8_t *rec = &data[5 * i];
+    if (rec[0] > 1) {
+      std::ostringstream oss;
+      oss << "The validity byte for 32-bit word " << i << " at `" << path
+          << "' is " << (int)rec[0] << ", not 0 or 1.";
+      throw std::runtime_error(oss.str());
+    }
+    valid->push_back(rec[0] == 1);
+    words->push_back((uint32_t)rec[1] | ((uint32_t)rec[2] << 8) |
+                     ((uint32_t)rec[3] << 16) | ((uint32_t)rec[4] << 24));
+  }
+}
+
+}  // namespace
+
+// The changes seen in a cycle (the result of OTBNState.changes(), digested into
+// what the stepped interface needs)
+struct OtbnIss::CycleChanges {
+  CycleChanges() : any(false), any_rtl(false), updates(0) {}
+
+  // Record a change to an external register. mirror is the corresponding
+  // MirroredReg or -1 if it isn't mirrored.
+  void add_ext(int mirror, uint32_t value) {
+    any = true;
+    any_rtl = true;
+    if (mirror >= 0) {
+      updates |= 1 << mirror;
+      values[mirror] = value;
+    }
+  }
+
+  // True if there were any changes at all
+  bool any;
+  // True if any change had an RTL trace line (including the "! otbn..." lines
+  // for external registers, which don't appear in lines)
+  bool any_rtl;
+  uint8_t updates;
+  uint32_t values[kNumMirroredRegs];
+  // RTL trace lines for the changes (only filled in if gen_trace_ is set)
+  std::vector<std::string> lines;
+};
+
+OtbnIss::OtbnIss()
+    : has_next_insn_(false),
+      next_insn_(empty_insn()),
+      insn_in_progress_(false),
+      exec_stage_(0),
+      exec_load_ok_(false),
+      exec_u32_(0),
+      exec_wrd_(0),
+      exec_u256_(u256_zero()),
+      gprs_pending_(0),
+      x1_saw_read_(false),
+      x1_has_next_(false),
+      x1_next_(0),
+      call_stack_err_(false),
+      wdrs_pending_(0),
+      flags_dirty_(false),
+      mod_(u256_zero()),
+      mod_next_(u256_zero()),
+      mod_has_next_(false),
+      acc_(u256_zero()),
+      acc_next_(u256_zero()),
+      acc_has_next_(false),
+      rnd_has_value_(false),
+      rnd_value_(u256_zero()),
+      rnd_value_read_(false),
+      rnd_pending_request_(false),
+      rnd_req_high_(false),
+      urnd_has_next_(false),
+      urnd_next_(u256_zero()),
+      urnd_has_value_(false),
+      urnd_value_(u256_zero()),
+      urnd_running_(false),
+      pc_(0),
+      has_pc_next_override_(false),
+      pc_next_override_(0),
+      dmem_(kDmemSizeWords, 0),
+      dmem_valid_(kDmemSizeWords, false),
+      loop_err_(false),
+      loop_pop_on_commit_(false),
+      loop_trace_(0),
+      ext_dirty_(0),
+      fsm_state_(kFsmIdle),
+      next_fsm_state_(kFsmIdle),
+      err_bits_(0),
+      pending_halt_(false),
+      injected_err_bits_(0),
+      rnd_256b_counter_(0),
+      urnd_256b_counter_(0),
+      rnd_set_flag_(false),
+      rnd_cdc_pending_(false),
+      urnd_cdc_pending_(false),
+      rnd_cdc_counter_(0),
+      urnd_cdc_counter_(0),
+      rnd_256b_(u256_zero()),
+      urnd_64b_(0),
+      time_to_imem_invalidation_(-1),
+      invalidated_imem_(false),
+      secure_wipe_enabled_(false),
+      wipe_cycles_(-1),
+      gen_trace_(false) {
+  memset(gprs_, 0, sizeof gprs_);
+  memset(gprs_next_, 0, sizeof gprs_next_);
+  for (int i = 0; i < 32; ++i) {
+    wdrs_[i] = u256_zero();
+    wdrs_next_[i] = u256_zero();
+  }
+
+  for (FlagGroup &grp : flags_) {
+    grp.cur = FlagReg{false, false, false, false};
+    grp.has_new = false;
+    grp.next = grp.cur;
+  }
+
+  // The default URND seed (see URNDWSR in wsr.py)
+  static const uint64_t urnd_seed[4] = {
+      0x84ddfadaf7e1134dULL, 0x70aa1c59de6197ffULL, 0x25a4fe335d095f1eULL,
+      0x2cba89acbe4a07e9ULL};
+  memset(urnd_state_, 0, sizeof urnd_state_);
+  memcpy(urnd_state_[0], urnd_seed, sizeof urnd_seed);
+  memset(urnd_256b_, 0, sizeof urnd_256b_);
+
+  for (int i = 0; i < 2; ++i) {
+    key_valid_[i] = false;
+    memset(key_value_[i], 0, sizeof key_value_[i]);
+    key_changed_[i] = false;
+  }
+
+  struct {
+    uint32_t mask;
+    bool double_flopped;
+    int mirror;
+  } ext_desc[kNumExtRegs] = {
+      {0x1, false, -1},                     // INTR_STATE
+      {0xff, true, kMirStatus},             // STATUS
+      {0x00ff003f, false, kMirErrBits},     // ERR_BITS
+      {0xffffffff, false, kMirInsnCnt},     // INSN_CNT
+      {0xffffffff, true, kMirStopPc},       // STOP_PC (simulation only)
+      {0xffffffff, false, kMirWipeStart}};  // WIPE_START (simulation only)
+  for (int i = 0; i < kNumExtRegs; ++i) {
+    ExtReg &reg = ext_regs_[i];
+    reg.mask = ext_desc[i].mask;
+    reg.double_flopped = ext_desc[i].double_flopped;
+    reg.mirror = ext_desc[i].mirror;
+    reg.value = 0;
+    reg.next_value = 0;
+  }
+}
+
+void OtbnIss::load_d(const std::string &path) {
+  std::vector<uint32_t> words;
+  std::vector<bool> valid;
+  read_5byte_file(path, &words, &valid);
+
+  if (words.size() > kDmemSizeWords) {
+    std::ostringstream oss;
+    oss << "Trying to load " << 4 * words.size()
+        << " bytes of data, but DMEM is only " << 4 * kDmemSizeWords
+        << " bytes long.";
+    throw std::runtime_error(oss.str());
+  }
+
+  for (size_t i = 0; i < words.size(); ++i) {
+    dmem_[i] = valid[i] ? words[i] : 0;
+    dmem_valid_[i] = valid[i];
+  }
+}
+
+void OtbnIss::load_i(const std::string &path) {
+  std::vector<uint32_t> words;
+  std::vector<bool> valid;
+  read_5byte_file(path, &words, &valid);
+
+  program_.clear();
+  program_.reserve(words.size());
+  for (size_t i = 0; i < words.size(); ++i) {
+    program_.push_back(valid[i] ? decode(4 * i, words[i]) : empty_insn());
+  }
+
+  time_to_imem_invalidation_ = -1;
+  invalidated_imem_ = false;
+}
+
+void OtbnIss::dump_d(const std::string &path) const {
+  std::ofstream os(path, std::ios::binary);
+  if (!os) {
+    std::ostringstream oss;
+    oss << "Cannot open `" << path << "' for writing.";
+    throw std::runtime_error(oss.str());
+  }
+
+  for (uint32_t i = 0; i < kDmemSizeWords; ++i) {
+    // If there's a pending store, apply it. This matches the RTL, where we
+    // only observe the memory after that store has landed.
+    bool valid = dmem_valid_[i];
+    uint32_t word = dmem_[i];
+    auto it = dmem_pending_.find(i);
+    if (it != dmem_pending_.end()) {
+      valid = true;
+      word = it->second;
+    }
+    if (!valid)
+      word = 0;
+
+    char rec[5] = {(char)valid, (char)word, (char)(word >> 8),
+                   (char)(word >> 16), (char)(word >> 24)};
+    os.write(rec, sizeof rec);
+  }
+
+  if (!os) {
+    std::ostringstream oss;
+    oss << "Failed to write DMEM contents to `" << path << "'.";
+    throw std::runtime_error(oss.str());
+  }
+}
+
+void OtbnIss::add_loop_warp(uint32_t addr, uint32_t from_cnt,
+                            uint32_t to_cnt) {
+  loop_warps_[addr][from_cnt] = to_cnt;
+}
+
+void OtbnIss::clear_loop_warps() { loop_warps_.clear(); }
+
+void OtbnIss::start(bool enable_secure_wipe) {
+  // Commit any pending changes to external registers (this is done by the
+  // start command in stepped.py)
+  ext_commit();
+
+  has_next_insn_ = false;
+  insn_in_progress_ = false;
+
+  ext_write(kExtStatus, kStatusBusyExecute);
+  pending_halt_ = false;
+  err_bits_ = 0;
+
+  fsm_state_ = kFsmPreExec;
+  next_fsm_state_ = kFsmPreExec;
+
+  pc_ = 0;
+
+  // Reset CSRs, WSRs, loop stack and call stack. RND, URND's state and the
+  // sideloaded keys persist across operations.
+  for (FlagGroup &grp : flags_) {
+    grp.cur = FlagReg{false, false, false, false};
+    grp.has_new = false;
+  }
+  flags_dirty_ = false;
+
+  mod_ = u256_zero();
+  mod_has_next_ = false;
+  acc_ = u256_zero();
+  acc_has_next_ = false;
+  urnd_running_ = false;
+
+  loop_stack_.clear();
+  loop_err_ = false;
+  loop_pop_on_commit_ = false;
+  loop_trace_ = 0;
+
+  call_stack_.clear();
+  x1_saw_read_ = false;
+
+  secure_wipe_enabled_ = enable_secure_wipe;
+}
+
+void OtbnIss::step(bool gen_trace, OtbnIssCycle *cycle) {
+  assert(cycle);
+
+  uint32_t pc = pc_;
+  bool was_wiping = wiping() && secure_wipe_enabled_;
+
+  gen_trace_ = gen_trace;
+  CycleChanges chg;
+  Insn retired;
+  bool has_retired = step_sim(&retired, &chg);
+
+  cycle->updates = chg.updates;
+  memcpy(cycle->values, chg.values, sizeof cycle->values);
+  cycle->trace.clear();
+
+  if (!gen_trace)
+    return;
+
+  // Pick a header line, as in _step_cycle in stepped.py
+  if (has_retired) {
+    char buf[64];
+    if (retired.has_bits) {
+      snprintf(buf, sizeof buf, "E PC: 0x%08x, insn: 0x%08x", pc, retired.raw);
+      cycle->trace.push_back(buf);
+      snprintf(buf, sizeof buf, "# @0x%08x: %s", pc,
+               retired.op == kOpIllegal ? "dummy-insn"
+                                        : insn_masks[retired.op].mnemonic);
+      cycle->trace.push_back(buf);
+    } else {
+      snprintf(buf, sizeof buf, "E PC: 0x%08x, insn: ??", pc);
+      cycle->trace.push_back(buf);
+      snprintf(buf, sizeof buf, "# @0x%08x: ??", pc);
+      cycle->trace.push_back(buf);
+    }
+  } else if (was_wiping) {
+    // The trailing space matches the RTL tracer
+    cycle->trace.push_back(wiping() ? "U " : "V ");
+  } else if (running() || (chg.any && !secure_wipe_enabled_)) {
+    cycle->trace.push_back("STALL");
+  } else if (chg.any_rtl) {
+    // Traced changes without an instruction in flight (such as dropping a RND
+    // request after the end of an operation). Use STALL for these too.
+    cycle->trace.push_back("STALL");
+  }
+
+  if (!cycle->trace.empty()) {
+    cycle->trace.insert(cycle->trace.end(), chg.lines.begin(),
+                        chg.lines.end());
+  }
+}
+
+void OtbnIss::edn_flush() {
+  rnd_256b_ = u256_zero();
+  rnd_cdc_pending_ = false;
+  rnd_cdc_counter_ = 0;
+  rnd_256b_counter_ = 0;
+
+  urnd_64b_ = 0;
+  memset(urnd_256b_, 0, sizeof urnd_256b_);
+  urnd_256b_counter_ = 0;
+  urnd_cdc_pending_ = false;
+  urnd_cdc_counter_ = 0;
+}
+
+void OtbnIss::edn_rnd_step(uint32_t edn_rnd_data) {
+  // There should not be a pending RND result before an EDN step.
+  if (rnd_cdc_pending_)
+    throw std::runtime_error("EDN RND step with a pending RND result.");
+
+  // Collect 32b packages in a 256b variable
+  rnd_256b_[rnd_256b_counter_] |= edn_rnd_data;
+
+  if (rnd_256b_counter_ == 7) {
+    // Reset the 32b package counter and wait until receiving done signal
+    // from RTL
+    rnd_256b_counter_ = 0;
+    rnd_cdc_pending_ = true;
+  } else {
+    ++rnd_256b_counter_;
+  }
+}
+
+void OtbnIss::edn_urnd_step(uint32_t edn_urnd_data) {
+  // There should not be a pending URND result before an EDN step.
+  if (urnd_cdc_pending_)
+    throw std::runtime_error("EDN URND step with a pending URND result.");
+
+  // Collect 32b packages in a 64b array of 4 elements
+  urnd_64b_ |= (uint64_t)edn_urnd_data << (32 * (urnd_256b_counter_ % 2));
+  if (urnd_256b_counter_ % 2) {
+    urnd_256b_[urnd_256b_counter_ / 2] = urnd_64b_;
+    urnd_64b_ = 0;
+  }
+
+  if (urnd_256b_counter_ == 7) {
+    urnd_256b_counter_ = 0;
+    urnd_cdc_pending_ = true;
+  } else {
+    ++urnd_256b_counter_;
+  }
+}
+
+void OtbnIss::edn_rnd_cdc_done() {
+  // The synchronisation of the data should not take more than 5 cycles
+  if (rnd_cdc_counter_ >= 6)
+    throw std::runtime_error("RND CDC took too long.");
+
+  rnd_set_flag_ = true;
+}
+
+void OtbnIss::edn_urnd_cdc_done() {
+  if (urnd_cdc_counter_ >= 6)
+    throw std::runtime_error("URND CDC took too long.");
+
+  // Seed URND and start it running
+  urnd_running_ = true;
+  memcpy(urnd_state_[0], urnd_256b_, sizeof urnd_256b_);
+
+  memset(urnd_256b_, 0, sizeof urnd_256b_);
+  urnd_cdc_pending_ = false;
+  urnd_cdc_counter_ = 0;
+}
+
+void OtbnIss::set_keymgr_value(const std::array<uint32_t, 12> &key0,
+                               const std::array<uint32_t, 12> &key1,
+                               bool valid) {
+  // Unlike WSR writes, this takes effect immediately (modelling the
+  // combinatorial path from the sideload keys to the WSR file). The change is
+  // still reported until the next commit.
+  const std::array<uint32_t, 12> *keys[2] = {&key0, &key1};
+  for (int i = 0; i < 2; ++i) {
+    key_valid_[i] = valid;
+    for (int j = 0; j < 12; ++j) {
+      key_value_[i][j] = valid ? (*keys[i])[j] : 0;
+    }
+    key_changed_[i] = true;
+  }
+}
+
+void OtbnIss::invalidate_imem() {
+  // The RTL's prefetch stage has a copy of the next instruction, so this
+  // takes effect after two commits.
+  time_to_imem_invalidation_ = 2;
+}
+
+void OtbnIss::invalidate_dmem() {
+  dmem_valid_.assign(kDmemSizeWords, false);
+}
+
+void OtbnIss::send_lc_escalation() {
+  injected_err_bits_ |= kErrLifecycleEscalation;
+}
+
+uint32_t OtbnIss::peek_gpr(unsigned idx) const {
+  assert(idx < 32);
+  // x0 is always zero. x1 is modelled by the call stack and reads as zero
+  // here, like print_regs in stepped.py.
+  return idx < 2 ? 0 : gprs_[idx];
+}
+
+const u256_t &OtbnIss::peek_wdr(unsigned idx) const {
+  assert(idx < 32);
+  return wdrs_[idx];
+}
+
+uint32_t OtbnIss::step_crc(const std::array<uint8_t, 6> &item,
+                           uint32_t state) {
+  // A bitwise CRC-32, matching zlib's crc32 (and binascii.crc32 in Python)
+  uint32_t crc = ~state;
+  for (uint8_t byte : item) {
+    crc ^= byte;
+    for (int i = 0; i < 8; ++i) {
+      crc = (crc >> 1) ^ (0xedb88320u & (0u - (crc & 1)));
+    }
+  }
+  return ~crc;
+}
+
+OtbnIss::Insn OtbnIss::empty_insn() {
+  Insn insn;
+  memset(&insn, 0, sizeof insn);
+  insn.has_bits = false;
+  insn.op = kOpEmpty;
+  return insn;
+}
+
+OtbnIss::Insn OtbnIss::decode(uint32_t pc, uint32_t word) {
+  Insn insn;
+  memset(&insn, 0, sizeof insn);
+  insn.raw = word;
+  insn.has_bits = true;
+  insn.op = kOpIllegal;
+
+  for (int op = 0; op < kNumOps; ++op) {
+    const InsnMasks &masks = insn_masks[op];
+    if ((word & masks.m0) || (~word & masks.m1))
+      continue;
+    insn.op = op;
+    break;
+  }
+
+  uint32_t rd = get_bits(word, 11, 7);
+  uint32_t rs1 = get_bits(word, 19, 15);
+  uint32_t rs2 = get_bits(word, 24, 20);
+  uint32_t i_imm = get_bits(word, 31, 20);
+
+  switch (insn.op) {
+    case kOpAdd:
+    case kOpSub:
+    case kOpSll:
+    case kOpSrl:
+    case kOpSra:
+    case kOpAnd:
+    case kOpOr:
+    case kOpXor:
+    case kOpBnAddm:
+    case kOpBnSubm:
+      insn.rd = rd;
+      insn.rs1 = rs1;
+      insn.rs2 = rs2;
+      break;
+
+    case kOpAddi:
+    case kOpAndi:
+    case kOpOri:
+    case kOpXori:
+    case kOpLw:
+    case kOpJalr:
+      insn.rd = rd;
+      insn.rs1 = rs1;
+      insn.imm = sign_extend(i_imm, 12);
+      break;
+
+    case kOpSlli:
+    case kOpSrli:
+    case kOpSrai:
+      insn.rd = rd;
+      insn.rs1 = rs1;
+      insn.imm = rs2;
+      break;
+
+    case kOpLui:
+      insn.rd = rd;
+      insn.imm = get_bits(word, 31, 12);
+      break;
+
+    case kOpSw:
+      insn.rs1 = rs1;
+      insn.rs2 = rs2;
+      insn.imm = sign_extend((get_bits(word, 31, 25) << 5) | rd, 12);
+      break;
+
+    case kOpBeq:
+    case kOpBne: {
+      uint32_t imm = (get_bits(word, 31, 31) << 11) |
+                     (get_bits(word, 7, 7) << 10) |
+                     (get_bits(word, 30, 25) << 4) | get_bits(word, 11, 8);
+      insn.rs1 = rs1;
+      insn.rs2 = rs2;
+      insn.imm = pc + (sign_extend(imm, 12) << 1);
+      break;
+    }
+
+    case kOpJal: {
+      uint32_t imm = (get_bits(word, 31, 31) << 19) |
+                     (get_bits(word, 19, 12) << 11) |
+                     (get_bits(word, 20, 20) << 10) | get_bits(word, 30, 21);
+      insn.rd = rd;
+      insn.imm = pc + (sign_extend(imm, 20) << 1);
+      break;
+    }
+
+    case kOpCsrrs:
+    case kOpCsrrw:
+      insn.rd = rd;
+      insn.rs1 = rs1;
+      insn.imm = i_imm;
+      break;
+
+    case kOpLoop:
+      insn.rs1 = rs1;
+      insn.imm = i_imm + 1;
+      break;
+
+    case kOpLoopi:
+      insn.imm = (rs1 << 5) | rd;
+      insn.imm2 = i_imm + 1;
+      break;
+
+    case kOpBnAdd:
+    case kOpBnAddc:
+    case kOpBnSub:
+    case kOpBnSubb:
+    case kOpBnAnd:
+    case kOpBnOr:
+    case kOpBnXor:
+    case kOpBnCmp:
+    case kOpBnCmpb:
+      // BN.CMP and BN.CMPB have no destination register
+      insn.rd = (insn.op == kOpBnCmp || insn.op == kOpBnCmpb) ? 0 : rd;
+      insn.rs1 = rs1;
+      insn.rs2 = rs2;
+      insn.shift_type = get_bits(word, 30, 30);
+      insn.shift_bytes = get_bits(word, 29, 25);
+      insn.flag_group = get_bits(word, 31, 31);
+      break;
+
+    case kOpBnNot:
+      insn.rd = rd;
+      insn.rs1 = rs2;
+      insn.shift_type = get_bits(word, 30, 30);
+      insn.shift_bytes = get_bits(word, 29, 25);
+      insn.flag_group = get_bits(word, 31, 31);
+      break;
+
+    case kOpBnAddi:
+    case kOpBnSubi:
+      insn.rd = rd;
+      insn.rs1 = rs1;
+      insn.imm = get_bits(word, 29, 20);
+      insn.flag_group = get_bits(word, 31, 31);
+      break;
+
+    case kOpBnMulqacc:
+    case kOpBnMulqaccWo:
+    case kOpBnMulqaccSo:
+      insn.rs1 = rs1;
+      insn.rs2 = rs2;
+      insn.zero_acc = get_bits(word, 12, 12);
+      insn.qwsel1 = get_bits(word, 26, 25);
+      insn.qwsel2 = get_bits(word, 28, 27);
+      insn.acc_shift = get_bits(word, 14, 13);
+      // Plain BN.MULQACC only writes ACC
+      if (insn.op != kOpBnMulqacc) {
+        insn.rd = rd;
+        insn.flag_group = get_bits(word, 31, 31);
+      }
+      if (insn.op == kOpBnMulqaccSo)
+        insn.hwsel = get_bits(word, 29, 29);
+      break;
+
+    case kOpBnRshi:
+      insn.rd = rd;
+      insn.rs1 = rs1;
+      insn.rs2 = rs2;
+      insn.imm = (get_bits(word, 31, 25) << 1) | get_bits(word, 14, 14);
+      break;
+
+    case kOpBnSel:
+      insn.rd = rd;
+      insn.rs1 = rs1;
+      insn.rs2 = rs2;
+      insn.flag = get_bits(word, 26, 25);
+      insn.flag_group = get_bits(word, 31, 31);
+      break;
+
+    case kOpBnLid:
+    case kOpBnSid: {
+      uint32_t imm = (get_bits(word, 11, 9) << 7) | get_bits(word, 31, 25);
+      // For BN.LID, rs2 is grd. For BN.SID, it is grs2.
+      insn.rs1 = rs1;
+      insn.rs2 = rs2;
+      insn.imm = sign_extend(imm, 10) << 5;
+      insn.inc1 = get_bits(word, 8, 8);
+      insn.inc2 = get_bits(word, 7, 7);
+      break;
+    }
+
+    case kOpBnMov:
+      insn.rd = rd;
+      insn.rs1 = rs1;
+      break;
+
+    case kOpBnMovr:
+      insn.rd = rs2;
+      insn.rs1 = rs1;
+      insn.inc1 = get_bits(word, 9, 9);
+      insn.inc2 = get_bits(word, 7, 7);
+      break;
+
+    case kOpBnWsrr:
+      insn.rd = rd;
+      insn.imm = get_bits(word, 27, 20);
+      break;
+
+    case kOpBnWsrw:
+      insn.rs1 = rs1;
+      insn.imm = get_bits(word, 27, 20);
+      break;
+
+    default:
+      // ECALL and illegal instructions have no operands
+      break;
+  }
+
+  return insn;
+}
+
+static bool affects_control(uint8_t op) {
+  switch (op) {
+    case kOpBeq:
+    case kOpBne:
+    case kOpJal:
+    case kOpJalr:
+    case kOpLoop:
+    case kOpLoopi:
+      return true;
+    default:
+      return false;
+  }
+}
+
+static bool has_fetch_stall(uint8_t op) {
+  switch (op) {
+    case kOpBeq:
+    case kOpBne:
+    case kOpJal:
+    case kOpJalr:
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool OtbnIss::step_sim(Insn *retired, CycleChanges *chg) {
+  // EXEC handles injected errors itself (after running the instruction, so
+  // that we get a trace entry for it before it gets shot down).
+  if (fsm_state_ == kFsmExec)
+    return step_exec(retired, chg);
+
+  take_injected_err_bits();
+
+  switch (fsm_state_) {
+    case kFsmIdle:
+    case kFsmLocked:
+      step_idle(chg);
+      break;
+    case kFsmPreExec:
+      step_pre_exec(chg);
+      break;
+    case kFsmFetchWait:
+      step_fetch_wait(chg);
+      break;
+    case kFsmWipingGood:
+    case kFsmWipingBad:
+      step_wiping(chg);
+      break;
+    default:
+      assert(0);
+  }
+  return false;
+}
+
+void OtbnIss::step_idle(CycleChanges *chg) {
+  if (pending_halt_) {
+    // We've reached the end of the run because of some error. Register it
+    // on the next cycle.
+    stop();
+  }
+  collect_changes(chg);
+  commit(true);
+}
+
+void OtbnIss::step_pre_exec(CycleChanges *chg) {
+  // Wait for a URND seed, then switch to FETCH_WAIT
+  if (urnd_running_)
+    next_fsm_state_ = kFsmFetchWait;
+
+  on_stall(false, chg);
+
+  // Zero INSN_CNT the cycle after we are told to start
+  if (ext_regs_[kExtInsnCnt].value != 0)
+    ext_write(kExtInsnCnt, 0);
+}
+
+void OtbnIss::step_fetch_wait(CycleChanges *chg) {
+  // A single cycle while we fetch our first instruction
+  urnd_step();
+  next_fsm_state_ = kFsmExec;
+  on_stall(false, chg);
+}
+
+bool OtbnIss::step_exec(Insn *retired, CycleChanges *chg) {
+  urnd_step();
+
+  if (!has_next_insn_) {
+    take_injected_err_bits();
+    on_stall(true, chg);
+    return false;
+  }
+
+  Insn insn = next_insn_;
+
+  // If the fetch failed, throw away any partially executed instruction so
+  // that we start executing the (bogus) instruction immediately.
+  if (!insn.has_bits)
+    insn_in_progress_ = false;
+
+  if (!insn_in_progress_) {
+    // This is the first cycle for an instruction
+    pre_insn(affects_control(insn.op));
+    exec_stage_ = 0;
+  }
+
+  bool stalled = execute(insn);
+  insn_in_progress_ = stalled;
+
+  // Handle any pending injected error. This has to run after we've executed
+  // any instruction, to ensure we get a trace entry for that instruction
+  // before it gets shot down.
+  take_injected_err_bits();
+
+  if (!stalled) {
+    on_retire(insn, chg);
+    *retired = insn;
+    return true;
+  }
+
+  on_stall(false, chg);
+  return false;
+}
+
+void OtbnIss::step_wiping(CycleChanges *chg) {
+  if (wipe_cycles_ <= 0)
+    throw std::runtime_error("Stepping a wipe with no cycles left.");
+  --wipe_cycles_;
+
+  // Clear the WIPE_START register if it was set
+  if (ext_regs_[kExtWipeStart].value)
+    ext_write(kExtWipeStart, 0);
+
+  bool is_good = fsm_state_ == kFsmWipingGood;
+
+  // Wipe all registers and set STATUS on the penultimate cycle.
+  if (wipe_cycles_ == 1) {
+    ext_write(kExtStatus, is_good ? kStatusIdle : kStatusLocked);
+    wipe();
+  }
+
+  // On the final cycle, set the next state to IDLE or LOCKED. If switching to
+  // LOCKED, zero INSN_CNT too.
+  if (wipe_cycles_ == 0) {
+    next_fsm_state_ = is_good ? kFsmIdle : kFsmLocked;
+    if (!is_good)
+      ext_write(kExtInsnCnt, 0);
+  }
+
+  on_stall(false, chg);
+}
+
+void OtbnIss::on_stall(bool fetch_next, CycleChanges *chg) {
+  if (pending_halt_) {
+    // We've reached the end of the run because of some error. Register it
+    // on the next cycle.
+    stop();
+  }
+
+  collect_changes(chg);
+  commit(true);
+  if (fetch_next)
+    fetch();
+}
+
+void OtbnIss::on_retire(const Insn &insn, CycleChanges *chg) {
+  post_insn();
+
+  bool halting = pending_halt_;
+  if (halting) {
+    // We've reached the end of the run (either because of an ECALL
+    // instruction or an error).
+    stop();
+  }
+
+  collect_changes(chg);
+  commit(false);
+
+  // Fetch the next instruction unless we're done or this instruction has a
+  // fetch stall (in which case we inject a single cycle stall).
+  if (halting || has_fetch_stall(insn.op)) {
+    has_next_insn_ = false;
+  } else {
+    fetch();
+  }
+}
+
+void OtbnIss::fetch() {
+  uint32_t word_pc = pc_ >> 2;
+  if (word_pc >= program_.size()) {
+    std::ostringstream oss;
+    oss << "Trying to execute instruction at address 0x" << std::hex << pc_
+        << ", but the program is only 0x" << 4 * program_.size()
+        << " bytes (" << std::dec << program_.size()
+        << " instructions) long. Since there are no architectural contents "
+           "of the memory here, we have to stop.";
+    throw std::runtime_error(oss.str());
+  }
+
+  has_next_insn_ = true;
+  next_insn_ = invalidated_imem_ ? empty_insn() : program_[word_pc];
+}
+
+bool OtbnIss::execute(const Insn &insn) {
+  switch (insn.op) {
+    case kOpAdd:
+    case kOpSub:
+    case kOpSll:
+    case kOpSrl:
+    case kOpSra:
+    case kOpAnd:
+    case kOpOr:
+    case kOpXor: {
+      uint32_t a = read_gpr(insn.rs1);
+      uint32_t b = read_gpr(insn.rs2);
+      if (call_stack_err_) {
+        stop_at_end_of_cycle(kErrCallStack);
+        return false;
+      }
+
+      uint32_t result;
+      switch (insn.op) {
+        case kOpAdd:
+          result = a + b;
+          break;
+        case kOpSub:
+          result = a - b;
+          break;
+        case kOpSll:
+          result = a << (b & 0x1f);
+          break;
+        case kOpSrl:
+          result = a >> (b & 0x1f);
+          break;
+        case kOpSra:
+          result = (uint32_t)((int32_t)a >> (b & 0x1f));
+          break;
+        case kOpAnd:
+          result = a & b;
+          break;
+        case kOpOr:
+          result = a | b;
+          break;
+        default:
+          result = a ^ b;
+          break;
+      }
+      write_gpr(insn.rd, result);
+      return false;
+    }
+
+    case kOpAddi:
+    case kOpSlli:
+    case kOpSrli:
+    case kOpSrai:
+    case kOpAndi:
+    case kOpOri:
+    case kOpXori: {
+      uint32_t a = read_gpr(insn.rs1);
+      if (call_stack_err_) {
+        stop_at_end_of_cycle(kErrCallStack);
+        return false;
+      }
+
+      uint32_t result;
+      switch (insn.op) {
+        case kOpAddi:
+          result = a + insn.imm;
+          break;
+        case kOpSlli:
+          result = a << insn.imm;
+          break;
+        case kOpSrli:
+          result = a >> insn.imm;
+          break;
+        case kOpSrai:
+          result = (uint32_t)((int32_t)a >> insn.imm);
+          break;
+        case kOpAndi:
+          result = a & insn.imm;
+          break;
+        case kOpOri:
+          result = a | insn.imm;
+          break;
+        default:
+          result = a ^ insn.imm;
+          break;
+      }
+      write_gpr(insn.rd, result);
+      return false;
+    }
+
+    case kOpLui:
+      write_gpr(insn.rd, insn.imm << 12);
+      return false;
+
+    case kOpLw:
+      // LW executes over two cycles. On the first cycle, we read the base
+      // address, compute the load address and check it for correctness, then
+      // perform the load itself. On the second cycle, we write the result to
+      // the destination register.
+      if (exec_stage_ == 0) {
+        uint32_t base = read_gpr(insn.rs1);
+        if (call_stack_err_) {
+          stop_at_end_of_cycle(kErrCallStack);
+          return false;
+        }
+
+        uint32_t addr = base + insn.imm;
+        if (!is_valid_32b_addr(addr)) {
+          stop_at_end_of_cycle(kErrBadDataAddr);
+          return false;
+        }
+
+        exec_load_ok_ = load_u32(addr, &exec_u32_);
+        exec_stage_ = 1;
+        return true;
+      }
+
+      if (!exec_load_ok_) {
+        stop_at_end_of_cycle(kErrDmemIntgViolation);
+        return false;
+      }
+      write_gpr(insn.rd, exec_u32_);
+      return false;
+
+    case kOpSw: {
+      uint32_t base = read_gpr(insn.rs1);
+      uint32_t addr = base + insn.imm;
+      uint32_t value = read_gpr(insn.rs2);
+
+      bool bad_grs1 = call_stack_err_ && insn.rs1 == 1;
+      bool saw_err = false;
+
+      if (call_stack_err_) {
+        stop_at_end_of_cycle(kErrCallStack);
+        saw_err = true;
+      }
+      if (!is_valid_32b_addr(addr) && !bad_grs1) {
+        stop_at_end_of_cycle(kErrBadDataAddr);
+        saw_err = true;
+      }
+      if (saw_err)
+        return false;
+
+      dmem_trace_.push_back(DmemStore{addr, false, u256_from_u32(value)});
+      return false;
+    }
+
+    case kOpBeq:
+    case kOpBne: {
+      uint32_t a = read_gpr(insn.rs1);
+      uint32_t b = read_gpr(insn.rs2);
+      if (call_stack_err_) {
+        stop_at_end_of_cycle(kErrCallStack);
+        return false;
+      }
+
+      bool taken = (insn.op == kOpBeq) ? (a == b) : (a != b);
+      if (taken) {
+        if (!is_pc_valid(insn.imm)) {
+          stop_at_end_of_cycle(kErrBadInsnAddr);
+        } else {
+          set_next_pc(insn.imm);
+        }
+      }
+      return false;
+    }
+
+    case kOpJal:
+      write_gpr(insn.rd, pc_ + 4);
+      if (!is_pc_valid(insn.imm)) {
+        stop_at_end_of_cycle(kErrBadInsnAddr);
+      } else {
+        set_next_pc(insn.imm);
+      }
+      return false;
+
+    case kOpJalr: {
+      uint32_t a = read_gpr(insn.rs1);
+      if (call_stack_err_) {
+        stop_at_end_of_cycle(kErrCallStack);
+        return false;
+      }
+
+      write_gpr(insn.rd, pc_ + 4);
+
+      uint32_t next_pc = a + insn.imm;
+      if (!is_pc_valid(next_pc)) {
+        stop_at_end_of_cycle(kErrBadInsnAddr);
+      } else {
+        set_next_pc(next_pc);
+      }
+      return false;
+    }
+
+    case kOpCsrrs:
+    case kOpCsrrw: {
+      bool is_csrrs = insn.op == kOpCsrrs;
+      if (exec_stage_ == 0) {
+        if (!is_csr_valid(insn.imm)) {
+          // Invalid CSR index. Stop with an illegal instruction error.
+          stop_at_end_of_cycle(kErrIllegalInsn);
+          return false;
+        }
+
+        // For CSRRS, these are the bits to set. For CSRRW, it's the value
+        // to write.
+        exec_u32_ = read_gpr(insn.rs1);
+        if (call_stack_err_) {
+          stop_at_end_of_cycle(kErrCallStack);
+          return false;
+        }
+        exec_stage_ = 1;
+      }
+
+      // A read from RND. If a RND value is not available, request it and
+      // stall for a cycle. CSRRW only reads the CSR if grd is nonzero.
+      bool reads_csr = is_csrrs || insn.rd != 0;
+      if (insn.imm == kCsrRnd && reads_csr && !rnd_request_value())
+        return true;
+
+      if (is_csrrs) {
+        uint32_t old_val = read_csr(insn.imm);
+        write_gpr(insn.rd, old_val);
+        if (insn.rs1 != 0)
+          write_csr(insn.imm, old_val | exec_u32_);
+      } else {
+        if (insn.rd != 0) {
+          uint32_t old_val = read_csr(insn.imm);
+          write_gpr(insn.rd, old_val);
+        }
+        write_csr(insn.imm, exec_u32_);
+      }
+      return false;
+    }
+
+    case kOpEcall:
+      // Set INTR_STATE.done and STATUS, reflecting the fact we've stopped.
+      stop_at_end_of_cycle(0);
+      return false;
+
+    case kOpLoop: {
+      uint32_t num_iters = read_gpr(insn.rs1);
+      if (call_stack_err_) {
+        stop_at_end_of_cycle(kErrCallStack);
+        return false;
+      }
+
+      if (num_iters == 0) {
+        stop_at_end_of_cycle(kErrLoop);
+      } else {
+        loop_start(num_iters, insn.imm);
+      }
+      return false;
+    }
+
+    case kOpLoopi:
+      if (insn.imm == 0) {
+        stop_at_end_of_cycle(kErrLoop);
+      } else {
+        loop_start(insn.imm, insn.imm2);
+      }
+      return false;
+
+    case kOpBnAdd:
+    case kOpBnAddc:
+    case kOpBnSub:
+    case kOpBnSubb:
+    case kOpBnCmp:
+    case kOpBnCmpb: {
+      const u256_t &a = wdrs_[insn.rs1];
+      u256_t b = logical_byte_shift(wdrs_[insn.rs2], insn.shift_type,
+                                    insn.shift_bytes);
+      bool flag_c = flags_[insn.flag_group].cur.c;
+
+      u256_t result;
+      bool carry;
+      switch (insn.op) {
+        case kOpBnAdd:
+          carry = u256_add(&result, a, b, false);
+          break;
+        case kOpBnAddc:
+          carry = u256_add(&result, a, b, flag_c);
+          break;
+        case kOpBnSub:
+        case kOpBnCmp:
+          carry = u256_sub(&result, a, b, false);
+          break;
+        default:
+          carry = u256_sub(&result, a, b, flag_c);
+          break;
+      }
+
+      if (insn.op != kOpBnCmp && insn.op != kOpBnCmpb)
+        write_wdr(insn.rd, result);
+      set_flags(insn.flag_group,
+                FlagReg{carry, u256_bit(result, 255), u256_bit(result, 0),
+                        u256_is_zero(result)});
+      return false;
+    }
+
+    case kOpBnAddi:
+    case kOpBnSubi: {
+      u256_t result;
+      bool carry =
+          (insn.op == kOpBnAddi)
+              ? u256_add(&result, wdrs_[insn.rs1], u256_from_u32(insn.imm),
+                         false)
+              : u256_sub(&result, wdrs_[insn.rs1], u256_from_u32(insn.imm),
+                         false);
+      write_wdr(insn.rd, result);
+      set_flags(insn.flag_group,
+                FlagReg{carry, u256_bit(result, 255), u256_bit(result, 0),
+                        u256_is_zero(result)});
+      return false;
+    }
+
+    case kOpBnAddm: {
+      u256_t result;
+      bool carry = u256_add(&result, wdrs_[insn.rs1], wdrs_[insn.rs2], false);
+      if (carry || u256_cmp(result, mod_) >= 0)
+        u256_sub(&result, result, mod_, false);
+      write_wdr(insn.rd, result);
+      return false;
+    }
+
+    case kOpBnSubm: {
+      u256_t result;
+      bool borrow = u256_sub(&result, wdrs_[insn.rs1], wdrs_[insn.rs2], false);
+      if (borrow)
+        u256_add(&result, result, mod_, false);
+      write_wdr(insn.rd, result);
+      return false;
+    }
+
+    case kOpBnMulqacc:
+    case kOpBnMulqaccWo:
+    case kOpBnMulqaccSo: {
+      uint32_t product[4];
+      mul_64x64(extract_quarter_word(wdrs_[insn.rs1], insn.qwsel1),
+                extract_quarter_word(wdrs_[insn.rs2], insn.qwsel2), product);
+
+      // Shift the product left by 64 * acc_shift bits, truncating to 256 bits
+      u256_t shifted = u256_zero();
+      for (unsigned i = 0; i < 4 && 2 * insn.acc_shift + i < 8; ++i) {
+        shifted[2 * insn.acc_shift + i] = product[i];
+      }
+
+      u256_t acc = insn.zero_acc ? u256_zero() : acc_;
+      u256_add(&acc, acc, shifted, false);
+
+      if (insn.op == kOpBnMulqacc) {
+        acc_next_ = acc;
+        acc_has_next_ = true;
+      } else if (insn.op == kOpBnMulqaccWo) {
+        write_wdr(insn.rd, acc);
+        acc_next_ = acc;
+        acc_has_next_ = true;
+        set_mlz_flags(insn.flag_group, acc);
+      } else {
+        // Shift out the low half of the result into the chosen half of wrd
+        // and write back the high half to ACC.
+        u256_t new_wrd = wdrs_[insn.rd];
+        bool lo_zero = true;
+        for (int i = 0; i < 4; ++i) {
+          new_wrd[4 * insn.hwsel + i] = acc[i];
+          lo_zero = lo_zero && !acc[i];
+        }
+        write_wdr(insn.rd, new_wrd);
+
+        u256_t hi_part = u256_zero();
+        for (int i = 0; i < 4; ++i) {
+          hi_part[i] = acc[4 + i];
+        }
+        acc_next_ = hi_part;
+        acc_has_next_ = true;
+
+        FlagReg flags = flags_[insn.flag_group].cur;
+        if (insn.hwsel) {
+          flags.m = (acc[3] >> 31) & 1;
+          flags.z = flags.z && lo_zero;
+        } else {
+          flags.l = acc[0] & 1;
+          flags.z = lo_zero;
+        }
+        set_flags(insn.flag_group, flags);
+      }
+      return false;
+    }
+
+    case kOpBnAnd:
+    case kOpBnOr:
+    case kOpBnXor:
+    case kOpBnNot: {
+      u256_t b = logical_byte_shift(
+          insn.op == kOpBnNot ? wdrs_[insn.rs1] : wdrs_[insn.rs2],
+          insn.shift_type, insn.shift_bytes);
+      const u256_t &a = wdrs_[insn.rs1];
+
+      u256_t result;
+      for (int i = 0; i < 8; ++i) {
+        switch (insn.op) {
+          case kOpBnAnd:
+            result[i] = a[i] & b[i];
+            break;
+          case kOpBnOr:
+            result[i] = a[i] | b[i];
+            break;
+          case kOpBnXor:
+            result[i] = a[i] ^ b[i];
+            break;
+          default:
+            result[i] = ~b[i];
+            break;
+        }
+      }
+      write_wdr(insn.rd, result);
+      set_mlz_flags(insn.flag_group, result);
+      return false;
+    }
+
+    case kOpBnRshi: {
+      // Take bits [imm + 255:imm] of the 512-bit concatenation {wrs1, wrs2}
+      uint32_t cat[16];
+      for (int i = 0; i < 8; ++i) {
+        cat[i] = wdrs_[insn.rs2][i];
+        cat[8 + i] = wdrs_[insn.rs1][i];
+      }
+      unsigned words = insn.imm / 32, bits = insn.imm % 32;
+      u256_t result;
+      for (unsigned i = 0; i < 8; ++i) {
+        uint32_t lo = cat[words + i];
+        uint32_t hi = (words + i + 1 < 16) ? cat[words + i + 1] : 0;
+        result[i] = bits ? ((lo >> bits) | (hi << (32 - bits))) : lo;
+      }
+      write_wdr(insn.rd, result);
+      return false;
+    }
+
+    case kOpBnSel: {
+      const FlagReg &flags = flags_[insn.flag_group].cur;
+      bool flag_vals[4] = {flags.c, flags.m, flags.l, flags.z};
+      unsigned wrs = flag_vals[insn.flag] ? insn.rs1 : insn.rs2;
+      write_wdr(insn.rd, wdrs_[wrs]);
+      return false;
+    }
+
+    case kOpBnLid:
+      // BN.LID executes over two cycles. On the first cycle, we read the base
+      // address, compute the load address and check it for correctness,
+      // increment any GPRs, then perform the load itself. On the second
+      // cycle, update the WDR with the result.
+      if (exec_stage_ == 0) {
+        unsigned grd = insn.rs2;
+        if (insn.inc1 && insn.inc2) {
+          stop_at_end_of_cycle(kErrIllegalInsn);
+          return false;
+        }
+
+        uint32_t grs1_val = read_gpr(insn.rs1);
+        uint32_t addr = grs1_val + insn.imm;
+        uint32_t grd_val = read_gpr(grd);
+
+        bool bad_grs1 = call_stack_err_ && insn.rs1 == 1;
+        bool bad_grd = call_stack_err_ && grd == 1;
+        bool saw_err = false;
+
+        if (call_stack_err_) {
+          stop_at_end_of_cycle(kErrCallStack);
+          saw_err = true;
+        }
+        if (grd_val > 31 && !bad_grd) {
+          stop_at_end_of_cycle(kErrIllegalInsn);
+          saw_err = true;
+        }
+        if (!is_valid_256b_addr(addr) && !bad_grs1) {
+          stop_at_end_of_cycle(kErrBadDataAddr);
+          saw_err = true;
+        }
+        if (saw_err)
+          return false;
+
+        exec_wrd_ = grd_val & 0x1f;
+        exec_load_ok_ = load_u256(addr, &exec_u256_);
+
+        if (insn.inc2)
+          write_gpr(grd, grd_val + 1);
+        if (insn.inc1)
+          write_gpr(insn.rs1, grs1_val + 32);
+
+        exec_stage_ = 1;
+        return true;
+      }
+
+      if (!exec_load_ok_) {
+        stop_at_end_of_cycle(kErrDmemIntgViolation);
+        return false;
+      }
+      write_wdr(exec_wrd_, exec_u256_);
+      return false;
+
+    case kOpBnSid: {
+      unsigned grs2 = insn.rs2;
+      if (insn.inc1 && insn.inc2) {
+        stop_at_end_of_cycle(kErrIllegalInsn);
+        return false;
+      }
+
+      uint32_t grs1_val = read_gpr(insn.rs1);
+      uint32_t addr = grs1_val + insn.imm;
+      uint32_t grs2_val = read_gpr(grs2);
+
+      bool bad_grs1 = call_stack_err_ && insn.rs1 == 1;
+      bool bad_grs2 = call_stack_err_ && grs2 == 1;
+      bool saw_err = false;
+
+      if (call_stack_err_) {
+        stop_at_end_of_cycle(kErrCallStack);
+        saw_err = true;
+      }
+      if (grs2_val > 31 && !bad_grs2) {
+        stop_at_end_of_cycle(kErrIllegalInsn);
+        saw_err = true;
+      }
+      if (!is_valid_256b_addr(addr) && !bad_grs1) {
+        stop_at_end_of_cycle(kErrBadDataAddr);
+        saw_err = true;
+      }
+      if (saw_err)
+        return false;
+
+      dmem_trace_.push_back(DmemStore{addr, true, wdrs_[grs2_val & 0x1f]});
+
+      if (insn.inc1)
+        write_gpr(insn.rs1, grs1_val + 32);
+      if (insn.inc2)
+        write_gpr(grs2, grs2_val + 1);
+      return false;
+    }
+
+    case kOpBnMov:
+      write_wdr(insn.rd, wdrs_[insn.rs1]);
+      return false;
+
+    case kOpBnMovr: {
+      if (insn.inc1 && insn.inc2) {
+        stop_at_end_of_cycle(kErrIllegalInsn);
+        return false;
+      }
+
+      uint32_t grd_val = read_gpr(insn.rd);
+      uint32_t grs_val = read_gpr(insn.rs1);
+
+      bool bad_grs = call_stack_err_ && insn.rs1 == 1;
+      bool bad_grd = call_stack_err_ && insn.rd == 1;
+      bool saw_err = false;
+
+      if (call_stack_err_) {
+        stop_at_end_of_cycle(kErrCallStack);
+        saw_err = true;
+      }
+      if (grd_val > 31 && !bad_grd) {
+        stop_at_end_of_cycle(kErrIllegalInsn);
+        saw_err = true;
+      }
+      if (grs_val > 31 && !bad_grs) {
+        stop_at_end_of_cycle(kErrIllegalInsn);
+        saw_err = true;
+      }
+      if (saw_err)
+        return false;
+
+      write_wdr(grd_val & 0x1f, wdrs_[grs_val & 0x1f]);
+
+      if (insn.inc2)
+        write_gpr(insn.rd, grd_val + 1);
+      if (insn.inc1)
+        write_gpr(insn.rs1, grs_val + 1);
+      return false;
+    }
+
+    case kOpBnWsrr:
+      if (exec_stage_ == 0) {
+        if (insn.imm > kWsrKeyS1H) {
+          // Invalid WSR index. Stop with an illegal instruction error.
+          stop_at_end_of_cycle(kErrIllegalInsn);
+          return false;
+        }
+        exec_stage_ = 1;
+      }
+
+      // A read from RND. If a RND value is not available, request it and
+      // stall for a cycle.
+      if (insn.imm == kWsrRnd && !rnd_request_value())
+        return true;
+
+      // A sideload key register might not have a value (if keymgr hasn't
+      // provided us with one). If not, fail with a KEY_INVALID error.
+      if (!wsr_has_value(insn.imm)) {
+        stop_at_end_of_cycle(kErrKeyInvalid);
+        return false;
+      }
+
+      write_wdr(insn.rd, read_wsr(insn.imm));
+      return false;
+
+    case kOpBnWsrw:
+      write_wsr(insn.imm, wdrs_[insn.rs1]);
+      return false;
+
+    case kOpIllegal:
+      stop_at_end_of_cycle(kErrIllegalInsn);
+      return false;
+
+    case kOpEmpty:
+      stop_at_end_of_cycle(kErrImemIntgViolation);
+      return false;
+
+    default:
+      assert(0);
+      return false;
+  }
+}
+
+bool OtbnIss::running() const {
+  return fsm_state_ != kFsmIdle && fsm_state_ != kFsmLocked;
+}
+
+bool OtbnIss::wiping() const {
+  return fsm_state_ == kFsmWipingGood || fsm_state_ == kFsmWipingBad;
+}
+
+bool OtbnIss::is_pc_valid(uint32_t pc) const {
+  return (pc & 3) == 0 && pc < kImemSizeBytes;
+}
+
+uint32_t OtbnIss::get_next_pc() const {
+  return has_pc_next_override_ ? pc_next_override_ : pc_ + 4;
+}
+
+void OtbnIss::set_next_pc(uint32_t pc) {
+  if (!is_pc_valid(pc)) {
+    std::ostringstream oss;
+    oss << "Setting an invalid next PC: 0x" << std::hex << pc << ".";
+    throw std::runtime_error(oss.str());
+  }
+  has_pc_next_override_ = true;
+  pc_next_override_ = pc;
+}
+
+void OtbnIss::stop_at_end_of_cycle(uint32_t err_bits) {
+  err_bits_ |= err_bits;
+  pending_halt_ = true;
+}
+
+void OtbnIss::take_injected_err_bits() {
+  if (injected_err_bits_ != 0) {
+    stop_at_end_of_cycle(injected_err_bits_);
+    injected_err_bits_ = 0;
+  }
+}
+
+void OtbnIss::pre_insn(bool affects_control) {
+  // Check for branch instructions at the end of a loop body
+  if (!loop_stack_.empty() && pc_ == loop_stack_.back().last_addr &&
+      affects_control) {
+    loop_err_ = true;
+  }
+}
+
+void OtbnIss::post_insn() {
+  ExtReg &insn_cnt = ext_regs_[kExtInsnCnt];
+  ext_write(kExtInsnCnt,
+            insn_cnt.value == UINT32_MAX ? insn_cnt.value : insn_cnt.value + 1);
+
+  loop_step();
+
+  // Check for a push onto a full call stack
+  if (x1_has_next_ && !x1_saw_read_ && call_stack_.size() == kCallStackDepth)
+    call_stack_err_ = true;
+
+  err_bits_ |= (call_stack_err_ ? kErrCallStack : 0) |
+               (loop_err_ ? kErrLoop : 0);
+  if (err_bits_)
+    pending_halt_ = true;
+
+  // Check that the next PC is valid, but only if we're not stopping anyway.
+  // Jumps and branches to invalid addresses are handled by the instructions
+  // themselves.
+  if (!is_pc_valid(get_next_pc()) && !pending_halt_) {
+    err_bits_ |= kErrBadInsnAddr;
+    pending_halt_ = true;
+  }
+}
+
+void OtbnIss::stop() {
+  // If the current instruction has caused an error, abort all its pending
+  // changes, including changes to external registers.
+  if (err_bits_)
+    abort();
+
+  // Set the 'done' interrupt
+  ext_set_bits(kExtIntrState, 1);
+
+  bool should_lock = (err_bits_ >> 16) != 0;
+
+  if (!secure_wipe_enabled_)
+    ext_write(kExtStatus, should_lock ? kStatusLocked : kStatusIdle);
+
+  ext_write(kExtErrBits, err_bits_);
+  ext_write(kExtStopPc, pc_);
+
+  // Set WIPE_START if we were running. This tells the C++ model that this is
+  // a good time to check DMEM. It is cleared again on the next cycle.
+  if (fsm_state_ == kFsmFetchWait || fsm_state_ == kFsmExec)
+    ext_write(kExtWipeStart, 1);
+
+  next_fsm_state_ = should_lock ? kFsmWipingBad : kFsmWipingGood;
+  wipe_cycles_ = secure_wipe_enabled_ ? kWipeCycles : 1;
+
+  pending_halt_ = false;
+}
+
+void OtbnIss::commit(bool sim_stalled) {
+  if (time_to_imem_invalidation_ > 0) {
+    if (--time_to_imem_invalidation_ == 0) {
+      invalidated_imem_ = true;
+      time_to_imem_invalidation_ = -1;
+    }
+  }
+
+  // If we've processed the RND data, set the register. This is done here
+  // rather than in edn_rnd_cdc_done() to get the timing of stalls right.
+  rnd_reg_set();
+
+  // Count how long we've been waiting for RND / URND to cross the CDC
+  if (rnd_cdc_pending_)
+    ++rnd_cdc_counter_;
+  if (urnd_cdc_pending_)
+    ++urnd_cdc_counter_;
+
+  FsmState old_state = fsm_state_;
+  fsm_state_ = next_fsm_state_;
+  ext_commit();
+
+  // URND also commits in "idle-ish" states (FETCH_WAIT)
+  if (urnd_has_next_) {
+    urnd_value_ = urnd_next_;
+    urnd_has_value_ = true;
+  }
+
+  if (old_state != kFsmExec && old_state != kFsmWipingGood &&
+      old_state != kFsmWipingBad)
+    return;
+
+  commit_gprs();
+
+  // If we're stalled, the rest of the architectural state only commits when
+  // we finish our stall cycles.
+  if (sim_stalled)
+    return;
+
+  commit_dmem();
+  pc_ = get_next_pc();
+  has_pc_next_override_ = false;
+  loop_commit();
+
+  // WSRs
+  if (mod_has_next_) {
+    mod_ = mod_next_;
+    mod_has_next_ = false;
+  }
+  if (rnd_value_read_)
+    rnd_has_value_ = false;
+  rnd_value_read_ = false;
+  if (acc_has_next_) {
+    acc_ = acc_next_;
+    acc_has_next_ = false;
+  }
+  key_changed_[0] = key_changed_[1] = false;
+
+  // Flags
+  if (flags_dirty_) {
+    for (FlagGroup &grp : flags_) {
+      if (grp.has_new)
+        grp.cur = grp.next;
+      grp.has_new = false;
+    }
+    flags_dirty_ = false;
+  }
+
+  // WDRs
+  for (int i = 0; i < 32; ++i) {
+    if ((wdrs_pending_ >> i) & 1)
+      wdrs_[i] = wdrs_next_[i];
+  }
+  wdrs_pending_ = 0;
+}
+
+void OtbnIss::abort() {
+  abort_gprs();
+  has_pc_next_override_ = false;
+  dmem_trace_.clear();
+  loop_trace_ = 0;
+  loop_err_ = false;
+  ext_abort();
+
+  // WSRs. Note that aborting URND leaves a zero pending value (as in
+  // URNDWSR.abort) and changes to the sideloaded keys are committed even
+  // when an instruction is aborted.
+  mod_has_next_ = false;
+  urnd_next_ = u256_zero();
+  urnd_has_next_ = true;
+  acc_has_next_ = false;
+  key_changed_[0] = key_changed_[1] = false;
+
+  if (flags_dirty_) {
+    flags_[0].has_new = false;
+    flags_[1].has_new = false;
+    flags_dirty_ = false;
+  }
+
+  wdrs_pending_ = 0;
+}
+
+void OtbnIss::wipe() {
+  if (!secure_wipe_enabled_)
+    return;
+
+  call_stack_.clear();
+  x1_saw_read_ = false;
+  for (unsigned i = 2; i < 32; ++i) {
+    write_gpr(i, 0);
+  }
+  for (unsigned i = 0; i < 32; ++i) {
+    write_wdr(i, u256_zero());
+  }
+  mod_next_ = u256_zero();
+  mod_has_next_ = true;
+  acc_next_ = u256_zero();
+  acc_has_next_ = true;
+  write_flags(0);
+}
+
+void OtbnIss::collect_changes(CycleChanges *chg) {
+  char buf[64];
+
+  // GPRs (including pushes onto the call stack)
+  for (int i = 0; i < 32; ++i) {
+    if (!((gprs_pending_ >> i) & 1))
+      continue;
+    chg->any = chg->any_rtl = true;
+    if (gen_trace_) {
+      snprintf(buf, sizeof buf, "> x%02d: 0x%08x", i,
+               i == 1 ? x1_next_ : gprs_next_[i]);
+      chg->lines.push_back(buf);
+    }
+  }
+
+  // Explicit PC updates, stores and loop changes are untraced
+  if (has_pc_next_override_ || !dmem_trace_.empty() || loop_trace_)
+    chg->any = true;
+
+  // External registers
+  if (ext_dirty_) {
+    for (const ExtReg &reg : ext_regs_) {
+      for (uint32_t value : reg.trace) {
+        chg->add_ext(reg.mirror, value);
+      }
+    }
+  }
+
+  // WSRs. We don't trace the value of RND, but we do trace the modelled EDN
+  // request.
+  if (mod_has_next_) {
+    chg->any = chg->any_rtl = true;
+    if (gen_trace_)
+      chg->lines.push_back("> MOD: " + hex_u256(mod_next_));
+  }
+  if (rnd_req_high_ && rnd_has_value_) {
+    rnd_req_high_ = false;
+    chg->add_ext(kMirRndReq, 0);
+  } else if (rnd_pending_request_ && !rnd_req_high_) {
+    rnd_req_high_ = true;
+    chg->add_ext(kMirRndReq, 1);
+  }
+  if (acc_has_next_) {
+    chg->any = chg->any_rtl = true;
+    if (gen_trace_)
+      chg->lines.push_back("> ACC: " + hex_u256(acc_next_));
+  }
+  if (key_changed_[0] || key_changed_[1])
+    chg->any = true;
+
+  // Flags
+  for (int fg = 0; fg < 2; ++fg) {
+    const FlagGroup &grp = flags_[fg];
+    if (!grp.has_new)
+      continue;
+    chg->any = chg->any_rtl = true;
+    if (gen_trace_) {
+      snprintf(buf, sizeof buf, "> FLAGS%d: {C: %d, M: %d, L: %d, Z: %d}", fg,
+               grp.next.c, grp.next.m, grp.next.l, grp.next.z);
+      chg->lines.push_back(buf);
+    }
+  }
+
+  // WDRs
+  for (int i = 0; i < 32; ++i) {
+    if (!((wdrs_pending_ >> i) & 1))
+      continue;
+    chg->any = chg->any_rtl = true;
+    if (gen_trace_) {
+      snprintf(buf, sizeof buf, "> w%02d: ", i);
+      chg->lines.push_back(buf + hex_u256(wdrs_next_[i]));
+    }
+  }
+}
+
+uint32_t OtbnIss::read_gpr(unsigned idx) {
+  assert(idx < 32);
+  if (idx == 0)
+    return 0;
+
+  if (idx == 1) {
+    // Reading x1 pops from the call stack (on commit). Reading an empty call
+    // stack is an error.
+    if (call_stack_.empty()) {
+      call_stack_err_ = true;
+      return 0;
+    }
+    x1_saw_read_ = true;
+    return call_stack_.back();
+  }
+
+  return gprs_[idx];
+}
+
+void OtbnIss::write_gpr(unsigned idx, uint32_t value) {
+  assert(idx < 32);
+  if (idx == 0)
+    return;
+
+  if (idx == 1) {
+    x1_next_ = value;
+    x1_has_next_ = true;
+  } else {
+    gprs_next_[idx] = value;
+  }
+  gprs_pending_ |= 1u << idx;
+}
+
+void OtbnIss::commit_gprs() {
+  for (int i = 2; i < 32; ++i) {
+    if ((gprs_pending_ >> i) & 1)
+      gprs_[i] = gprs_next_[i];
+  }
+  gprs_pending_ = 0;
+
+  if (call_stack_err_)
+    throw std::runtime_error("Committing GPRs with a call stack error.");
+
+  if (x1_saw_read_) {
+    assert(!call_stack_.empty());
+    call_stack_.pop_back();
+    x1_saw_read_ = false;
+  }
+
+  if (x1_has_next_) {
+    // We should already have checked that we won't overflow the call stack
+    // in post_insn().
+    if (call_stack_.size() > kCallStackDepth)
+      throw std::runtime_error("Call stack overflow on commit.");
+    call_stack_.push_back(x1_next_);
+    x1_has_next_ = false;
+  }
+}
+
+void OtbnIss::abort_gprs() {
+  gprs_pending_ = 0;
+  x1_saw_read_ = false;
+  x1_has_next_ = false;
+  call_stack_err_ = false;
+}
+
+void OtbnIss::write_wdr(unsigned idx, const u256_t &value) {
+  assert(idx < 32);
+  wdrs_next_[idx] = value;
+  wdrs_pending_ |= 1u << idx;
+}
+
+void OtbnIss::set_flags(unsigned fg, const FlagReg &flags) {
+  assert(fg < 2);
+  flags_dirty_ = true;
+  flags_[fg].next = flags;
+  flags_[fg].has_new = true;
+}
+
+void OtbnIss::set_mlz_flags(unsigned fg, const u256_t &result) {
+  assert(fg < 2);
+  set_flags(fg, FlagReg{flags_[fg].cur.c, u256_bit(result, 255),
+                        u256_bit(result, 0), u256_is_zero(result)});
+}
+
+uint32_t OtbnIss::read_flags() const {
+  uint32_t ret = 0;
+  for (int fg = 0; fg < 2; ++fg) {
+    const FlagReg &f = flags_[fg].cur;
+    ret |= ((f.z << 3) | (f.l << 2) | (f.m << 1) | (f.c << 0)) << (4 * fg);
+  }
+  return ret;
+}
+
+void OtbnIss::write_flags(uint32_t value) {
+  flags_dirty_ = true;
+  for (int fg = 0; fg < 2; ++fg) {
+    uint32_t bits = value >> (4 * fg);
+    flags_[fg].next = FlagReg{(bits & 1) != 0, (bits & 2) != 0,
+                              (bits & 4) != 0, (bits & 8) != 0};
+    flags_[fg].has_new = true;
+  }
+}
+
+bool OtbnIss::is_csr_valid(uint32_t idx) {
+  return idx == kCsrFg0 || idx == kCsrFg1 || idx == kCsrFlags ||
+         (kCsrMod0 <= idx && idx <= kCsrMod7) || idx == kCsrRndPrefetch ||
+         idx == kCsrRnd || idx == kCsrUrnd;
+}
+
+uint32_t OtbnIss::read_csr(uint32_t idx) {
+  if (idx == kCsrFg0 || idx == kCsrFg1)
+    return (read_flags() >> (4 * (idx - kCsrFg0))) & 0xf;
+  if (idx == kCsrFlags)
+    return read_flags();
+  if (kCsrMod0 <= idx && idx <= kCsrMod7)
+    return mod_[idx - kCsrMod0];
+  if (idx == kCsrRndPrefetch)
+    return 0;
+  if (idx == kCsrRnd)
+    return read_rnd()[0];
+  if (idx == kCsrUrnd) {
+    if (!urnd_has_value_)
+      throw std::runtime_error("Reading URND before it has a value.");
+    return urnd_value_[0];
+  }
+
+  std::ostringstream oss;
+  oss << "Unknown CSR index: 0x" << std::hex << idx;
+  throw std::runtime_error(oss.str());
+}
+
+void OtbnIss::write_csr(uint32_t idx, uint32_t value) {
+  if (idx == kCsrFg0 || idx == kCsrFg1) {
+    unsigned shift = 4 * (idx - kCsrFg0);
+    write_flags((read_flags() & ~(0xfu << shift)) | ((value & 0xf) << shift));
+    return;
+  }
+  if (idx == kCsrFlags) {
+    write_flags(value);
+    return;
+  }
+  if (kCsrMod0 <= idx && idx <= kCsrMod7) {
+    // Read, modify, write
+    mod_next_ = mod_;
+    mod_next_[idx - kCsrMod0] = value;
+    mod_has_next_ = true;
+    return;
+  }
+  if (idx == kCsrRndPrefetch) {
+    rnd_request_value();
+    return;
+  }
+  if (idx == kCsrRnd || idx == kCsrUrnd) {
+    // RND and URND ignore writes
+    return;
+  }
+
+  std::ostringstream oss;
+  oss << "Unknown CSR index: 0x" << std::hex << idx;
+  throw std::runtime_error(oss.str());
+}
+
+bool OtbnIss::rnd_request_value() {
+  if (rnd_has_value_)
+    return true;
+
+  rnd_pending_request_ = true;
+  return false;
+}
+
+const u256_t &OtbnIss::read_rnd() {
+  if (!rnd_has_value_)
+    throw std::runtime_error("Reading RND before it has a value.");
+
+  rnd_value_read_ = true;
+  return rnd_value_;
+}
+
+bool OtbnIss::wsr_has_value(uint32_t idx) const {
+  if (idx >= kWsrKeyS0L)
+    return key_valid_[(idx - kWsrKeyS0L) / 2];
+  return true;
+}
+
+u256_t OtbnIss::read_wsr(uint32_t idx) {
+  switch (idx) {
+    case kWsrMod:
+      return mod_;
+    case kWsrRnd:
+      return read_rnd();
+    case kWsrUrnd:
+      if (!urnd_has_value_)
+        throw std::runtime_error("Reading URND before it has a value.");
+      return urnd_value_;
+    case kWsrAcc:
+      return acc_;
+    default: {
+      // A sideloaded key: KeySnL is bits 255:0 and KeySnH is bits 383:256
+      assert(kWsrKeyS0L <= idx && idx <= kWsrKeyS1H);
+      const uint32_t *key = key_value_[(idx - kWsrKeyS0L) / 2];
+      bool high = (idx - kWsrKeyS0L) & 1;
+      u256_t ret = u256_zero();
+      for (int i = 0; i < (high ? 4 : 8); ++i) {
+        ret[i] = key[(high ? 8 : 0) + i];
+      }
+      return ret;
+    }
+  }
+}
+
+void OtbnIss::write_wsr(uint32_t idx, const u256_t &value) {
+  switch (idx) {
+    case kWsrMod:
+      mod_next_ = value;
+      mod_has_next_ = true;
+      break;
+    case kWsrAcc:
+      acc_next_ = value;
+      acc_has_next_ = true;
+      break;
+    default:
+      // RND, URND and the key registers ignore writes
+      if (idx > kWsrKeyS1H) {
+        std::ostringstream oss;
+        oss << "Unknown WSR index: 0x" << std::hex << idx;
+        throw std::runtime_error(oss.str());
+      }
+      break;
+  }
+}
+
+void OtbnIss::urnd_step() {
+  if (!urnd_running_)
+    return;
+
+  // Four rounds of the xoshiro256++ state update (see URNDWSR.step)
+  for (int i = 0; i < 4; ++i) {
+    const uint64_t *st = urnd_state_[i];
+    uint64_t *nxt = urnd_state_[i + 1];
+
+    uint64_t a = st[3], b = st[2], c = st[1], d = st[0];
+    nxt[3] = a ^ b ^ d;
+    nxt[2] = a ^ b ^ c;
+    nxt[1] = a ^ (b << 17) ^ c;
+    nxt[0] = rol64(d, 45) ^ rol64(b, 45);
+
+    uint64_t out = rol64(st[3] + st[0], 23) + st[3];
+    urnd_next_[2 * i] = (uint32_t)out;
+    urnd_next_[2 * i + 1] = (uint32_t)(out >> 32);
+  }
+  urnd_has_next_ = true;
+  memcpy(urnd_state_[0], urnd_state_[4], sizeof urnd_state_[0]);
+}
+
+void OtbnIss::rnd_reg_set() {
+  if (!rnd_set_flag_)
+    return;
+
+  rnd_value_ = rnd_256b_;
+  rnd_has_value_ = true;
+  rnd_pending_request_ = false;
+
+  rnd_256b_ = u256_zero();
+  rnd_cdc_pending_ = false;
+  rnd_set_flag_ = false;
+  rnd_cdc_counter_ = 0;
+}
+
+void OtbnIss::ext_write(int reg_idx, uint32_t value) {
+  ExtReg &reg = ext_regs_[reg_idx];
+  reg.next_value = value & reg.mask;
+  (reg.double_flopped ? reg.next_trace : reg.trace).push_back(reg.next_value);
+  ext_dirty_ = 2;
+}
+
+void OtbnIss::ext_set_bits(int reg_idx, uint32_t value) {
+  ExtReg &reg = ext_regs_[reg_idx];
+  reg.next_value |= value & reg.mask;
+  (reg.double_flopped ? reg.next_trace : reg.trace).push_back(reg.next_value);
+  ext_dirty_ = 2;
+}
+
+void OtbnIss::ext_commit() {
+  // There can only be pending changes if ext_dirty_ is positive. A write to a
+  // double-flopped register appears in the trace after one commit.
+  if (ext_dirty_ <= 0)
+    return;
+
+  for (ExtReg &reg : ext_regs_) {
+    reg.value = reg.next_value;
+    reg.trace.swap(reg.next_trace);
+    reg.next_trace.clear();
+  }
+  --ext_dirty_;
+}
+
+void OtbnIss::ext_abort() {
+  for (ExtReg &reg : ext_regs_) {
+    reg.next_value = reg.value;
+    reg.trace.clear();
+    reg.next_trace.clear();
+  }
+  ext_dirty_ = 0;
+}
+
+bool OtbnIss::is_valid_32b_addr(uint32_t addr) const {
+  return (addr & 3) == 0 && ((uint64_t)addr + 3) / 4 < kDmemSizeWords;
+}
+
+bool OtbnIss::is_valid_256b_addr(uint32_t addr) const {
+  return (addr & 31) == 0 && addr / 4 < kDmemSizeWords;
+}
+
+bool OtbnIss::load_u32(uint32_t addr, uint32_t *value) const {
+  uint32_t idx = addr / 4;
+
+  // Handle "read under write" hazards properly
+  auto it = dmem_pending_.find(idx);
+  if (it != dmem_pending_.end()) {
+    *value = it->second;
+    return true;
+  }
+
+  *value = dmem_[idx];
+  return dmem_valid_[idx];
+}
+
+bool OtbnIss::load_u256(uint32_t addr, u256_t *value) const {
+  for (int i = 0; i < 8; ++i) {
+    if (!load_u32(addr + 4 * i, &(*value)[i]))
+      return false;
+  }
+  return true;
+}
+
+void OtbnIss::commit_dmem() {
+  // Stores land in two steps: a store from this cycle moves to
+  // dmem_pending_, and stores from the previous cycle land in memory.
+  for (const auto &pr : dmem_pending_) {
+    dmem_[pr.first] = pr.second;
+    dmem_valid_[pr.first] = true;
+  }
+  dmem_pending_.clear();
+
+  for (const DmemStore &store : dmem_trace_) {
+    uint32_t idx = store.addr / 4;
+    for (int i = 0; i < (store.is_wide ? 8 : 1); ++i) {
+      dmem_pending_[idx + i] = store.value[i];
+    }
+  }
+  dmem_trace_.clear();
+}
+
+void OtbnIss::loop_start(uint32_t iterations, uint32_t bodysize) {
+  if (loop_stack_.size() == kLoopStackDepth)
+    loop_err_ = true;
+
+  uint32_t start_addr = pc_ + 4;
+  ++loop_trace_;
+  loop_stack_.push_back(LoopLevel{iterations, iterations - 1, start_addr,
+                                  start_addr + 4 * bodysize - 4});
+}
+
+void OtbnIss::loop_step() {
+  loop_pop_on_commit_ = false;
+  if (loop_stack_.empty())
+    return;
+
+  LoopLevel &top = loop_stack_.back();
+
+  // Apply any loop warp for the current iteration count of the innermost loop
+  auto warps = loop_warps_.find(pc_);
+  if (warps != loop_warps_.end()) {
+    uint32_t cur_iter_count = top.loop_count - (1 + top.restarts_left);
+    auto warp = warps->second.find(cur_iter_count);
+    if (warp != warps->second.end()) {
+      uint32_t new_iter_count = warp->second;
+      if (new_iter_count < cur_iter_count ||
+          (uint64_t)new_iter_count + 1 > top.loop_count) {
+        std::ostringstream oss;
+        oss << "Invalid loop warp at 0x" << std::hex << pc_ << std::dec
+            << " from " << cur_iter_count << " to " << new_iter_count
+            << " (loop count: " << top.loop_count << ").";
+        throw std::runtime_error(oss.str());
+      }
+      top.restarts_left = top.loop_count - new_iter_count - 1;
+    }
+  }
+
+  if (pc_ != top.last_addr)
+    return;
+
+  ++loop_trace_;
+  if (!top.restarts_left) {
+    loop_pop_on_commit_ = true;
+  } else {
+    --top.restarts_left;
+    set_next_pc(top.start_addr);
+  }
+}
+
+void OtbnIss::loop_commit() {
+  if (loop_err_)
+    throw std::runtime_error("Committing the loop stack with an error.");
+
+  if (loop_pop_on_commit_) {
+    loop_stack_.pop_back();
+    loop_pop_on_commit_ = false;
+  }
+  loop_trace_ = 0;
+}
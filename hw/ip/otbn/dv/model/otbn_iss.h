@@ -0,0 +1,380 @@
+// Copyright lowRISC contributors.
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+#ifndef OPENTITAN_HW_IP_OTBN_DV_MODEL_OTBN_ISS_H_
+#define OPENTITAN_HW_IP_OTBN_DV_MODEL_OTBN_ISS_H_
+
+#include <array>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+// The external registers that ISSWrapper mirrors, in the order of their bits in
+// the updates mask of an OtbnIssCycle (see _MIRRORED_REGS in stepped.py).
+enum MirroredReg {
+  kMirStatus,
+  kMirInsnCnt,
+  kMirErrBits,
+  kMirStopPc,
+  kMirRndReq,
+  kMirWipeStart,
+  kNumMirroredRegs
+};
+
+// One cycle of ISS output. This is what the Python ISS returns for each cycle
+// of a step_n command, and what OtbnIss::step() fills in.
+struct OtbnIssCycle {
+  // Bit i is set if mirrored register i (see MirroredReg) changed in this
+  // cycle. Its new value is then in values[i].
+  uint8_t updates;
+  uint32_t values[kNumMirroredRegs];
+  // Trace lines for OtbnTraceChecker (empty if nothing happened)
+  std::vector<std::string> trace;
+};
+
+// A native C++ instruction set simulator for OTBN.
+//
+// This is a cycle-accurate port of the Python ISS in hw/ip/otbn/dv/otbnsim
+// (OTBNSim and OTBNState, together with the register, memory and loop models
+// they use). It implements the same commands as stepped.py and generates the
+// same trace lines for OtbnTraceChecker, so ISSWrapper can use it in place of
+// the Python subprocess. Keep the two models in step: a change of behaviour in
+// the Python ISS needs a matching change here.
+//
+// Errors that would make the Python ISS fail (such as malformed memory files
+// or fetching past the end of the loaded program) are reported by throwing a
+// std::runtime_error.
+class OtbnIss {
+ public:
+  // A 256-bit unsigned value, LSB first (words[0] holds bits 31:0)
+  typedef std::array<uint32_t, 8> u256_t;
+
+  OtbnIss();
+
+  // Load new contents of DMEM / IMEM from a file in the 5-byte format written
+  // by OtbnModel (a validity byte, then a little-endian 32-bit word)
+  void load_d(const std::string &path);
+  void load_i(const std::string &path);
+
+  // Dump the contents of DMEM to a file in the same format
+  void dump_d(const std::string &path) const;
+
+  // Add or clear loop warps (see LoopWarps in sim.py)
+  void add_loop_warp(uint32_t addr, uint32_t from_cnt, uint32_t to_cnt);
+  void clear_loop_warps();
+
+  // Jump to address zero and start running
+  void start(bool enable_secure_wipe);
+
+  // Run a single cycle, filling in *cycle. If gen_trace is false, leave
+  // cycle->trace empty (the updates to mirrored registers are always filled
+  // in).
+  void step(bool gen_trace, OtbnIssCycle *cycle);
+
+  // EDN interface (see the corresponding methods of ISSWrapper)
+  void edn_flush();
+  void edn_rnd_step(uint32_t edn_rnd_data);
+  void edn_urnd_step(uint32_t edn_urnd_data);
+  void edn_rnd_cdc_done();
+  void edn_urnd_cdc_done();
+
+  // Set the sideloaded keys from keymgr. Each key is 384 bits, LSB first.
+  void set_keymgr_value(const std::array<uint32_t, 12> &key0,
+                        const std::array<uint32_t, 12> &key1, bool valid);
+
+  // Mark IMEM / DMEM as having invalid integrity bits
+  void invalidate_imem();
+  void invalidate_dmem();
+
+  // React to lc_escalate_en_i going high
+  void send_lc_escalation();
+
+  // Backdoor reads of architectural state. As with print_regs in stepped.py,
+  // x1 reads as zero: use get_call_stack() to see its contents.
+  uint32_t peek_gpr(unsigned idx) const;
+  const u256_t &peek_wdr(unsigned idx) const;
+
+  // The call stack, bottom first
+  const std::vector<uint32_t> &get_call_stack() const { return call_stack_; }
+
+  // Step a CRC-32 (as computed by zlib) over 48 bits of data
+  static uint32_t step_crc(const std::array<uint8_t, 6> &item, uint32_t state);
+
+ private:
+  // States of the internal start/stop FSM (see FsmState in state.py)
+  enum FsmState {
+    kFsmIdle,
+    kFsmPreExec,
+    kFsmFetchWait,
+    kFsmExec,
+    kFsmWipingGood,
+    kFsmWipingBad,
+    kFsmLocked
+  };
+
+  // A decoded instruction. Operand fields are shared between instruction
+  // formats: for example, rd is grd for base instructions and wrd for bignum
+  // instructions.
+  struct Insn {
+    uint32_t raw;
+    // False if there was no valid instruction data (an "EmptyInsn")
+    bool has_bits;
+    uint8_t op;
+    uint8_t rd, rs1, rs2;
+    // An immediate, offset, CSR or WSR index. For branches and jumps this is
+    // the absolute target address.
+    uint32_t imm;
+    // The second immediate of LOOPI (bodysize)
+    uint32_t imm2;
+    uint8_t flag_group;
+    uint8_t shift_type, shift_bytes;
+    uint8_t zero_acc, qwsel1, qwsel2, acc_shift, hwsel;
+    uint8_t flag;
+    // grs1_inc / grs_inc and grd_inc / grs2_inc for BN.LID, BN.SID and
+    // BN.MOVR
+    uint8_t inc1, inc2;
+  };
+
+  struct FlagReg {
+    bool c, m, l, z;
+  };
+
+  struct FlagGroup {
+    FlagReg cur;
+    bool has_new;
+    FlagReg next;
+  };
+
+  struct LoopLevel {
+    uint32_t loop_count;
+    uint32_t restarts_left;
+    uint32_t start_addr;
+    uint32_t last_addr;
+  };
+
+  // An external register, modelling RGReg in ext_regs.py. We only model the
+  // registers that the ISS itself writes.
+  struct ExtReg {
+    uint32_t mask;
+    bool double_flopped;
+    int mirror;
+    uint32_t value;
+    uint32_t next_value;
+    std::vector<uint32_t> trace;
+    std::vector<uint32_t> next_trace;
+  };
+
+  enum ExtRegIdx {
+    kExtIntrState,
+    kExtStatus,
+    kExtErrBits,
+    kExtInsnCnt,
+    kExtStopPc,
+    kExtWipeStart,
+    kNumExtRegs
+  };
+
+  struct DmemStore {
+    uint32_t addr;
+    bool is_wide;
+    u256_t value;
+  };
+
+  struct CycleChanges;
+
+  static Insn decode(uint32_t pc, uint32_t word);
+  static Insn empty_insn();
+
+  // The per-state steppers from sim.py. Each returns true if an instruction
+  // retired, in which case it is copied to *retired.
+  bool step_sim(Insn *retired, CycleChanges *chg);
+  void step_idle(CycleChanges *chg);
+  void step_pre_exec(CycleChanges *chg);
+  void step_fetch_wait(CycleChanges *chg);
+  bool step_exec(Insn *retired, CycleChanges *chg);
+  void step_wiping(CycleChanges *chg);
+  void on_stall(bool fetch_next, CycleChanges *chg);
+  void on_retire(const Insn &insn, CycleChanges *chg);
+  void fetch();
+
+  // Run one cycle of an instruction. Returns true if the instruction stalled
+  // and needs more cycles.
+  bool execute(const Insn &insn);
+
+  // State-level operations (see OTBNState)
+  bool running() const;
+  bool wiping() const;
+  bool is_pc_valid(uint32_t pc) const;
+  uint32_t get_next_pc() const;
+  void set_next_pc(uint32_t pc);
+  void stop_at_end_of_cycle(uint32_t err_bits);
+  void take_injected_err_bits();
+  void pre_insn(bool affects_control);
+  void post_insn();
+  void stop();
+  void commit(bool sim_stalled);
+  void abort();
+  void wipe();
+  void collect_changes(CycleChanges *chg);
+
+  // GPRs and the call stack
+  uint32_t read_gpr(unsigned idx);
+  void write_gpr(unsigned idx, uint32_t value);
+  void commit_gprs();
+  void abort_gprs();
+
+  // WDRs
+  void write_wdr(unsigned idx, const u256_t &value);
+
+  // Flags
+  void set_flags(unsigned fg, const FlagReg &flags);
+  void set_mlz_flags(unsigned fg, const u256_t &result);
+  uint32_t read_flags() const;
+  void write_flags(uint32_t value);
+
+  // CSRs and WSRs
+  static bool is_csr_valid(uint32_t idx);
+  uint32_t read_csr(uint32_t idx);
+  void write_csr(uint32_t idx, uint32_t value);
+  bool rnd_request_value();
+  const u256_t &read_rnd();
+  bool wsr_has_value(uint32_t idx) const;
+  u256_t read_wsr(uint32_t idx);
+  void write_wsr(uint32_t idx, const u256_t &value);
+  void urnd_step();
+  void rnd_reg_set();
+
+  // External registers
+  void ext_write(int reg, uint32_t value);
+  void ext_set_bits(int reg, uint32_t value);
+  void ext_commit();
+  void ext_abort();
+
+  // DMEM
+  bool is_valid_32b_addr(uint32_t addr) const;
+  bool is_valid_256b_addr(uint32_t addr) const;
+  bool load_u32(uint32_t addr, uint32_t *value) const;
+  bool load_u256(uint32_t addr, u256_t *value) const;
+  void commit_dmem();
+
+  // Loop stack
+  void loop_start(uint32_t iterations, uint32_t bodysize);
+  void loop_step();
+  void loop_commit();
+
+  // The loaded program and loop warps
+  std::vector<Insn> program_;
+  std::map<uint32_t, std::map<uint32_t, uint32_t>> loop_warps_;
+
+  // The next instruction to execute (if has_next_insn_) and whether we're
+  // part way through a multi-cycle instruction
+  bool has_next_insn_;
+  Insn next_insn_;
+  bool insn_in_progress_;
+  // Per-instruction state that lives across stall cycles (the locals of the
+  // generators in insn.py)
+  int exec_stage_;
+  bool exec_load_ok_;
+  uint32_t exec_u32_;
+  unsigned exec_wrd_;
+  u256_t exec_u256_;
+
+  // GPRs. x1 is modelled by the call stack (see gpr.py)
+  uint32_t gprs_[32];
+  uint32_t gprs_next_[32];
+  uint32_t gprs_pending_;
+  std::vector<uint32_t> call_stack_;
+  bool x1_saw_read_;
+  bool x1_has_next_;
+  uint32_t x1_next_;
+  bool call_stack_err_;
+
+  // WDRs
+  u256_t wdrs_[32];
+  u256_t wdrs_next_[32];
+  uint32_t wdrs_pending_;
+
+  // Flags (the FG0 and FG1 CSRs)
+  FlagGroup flags_[2];
+  bool flags_dirty_;
+
+  // MOD and ACC WSRs (DumbWSR)
+  u256_t mod_, mod_next_;
+  bool mod_has_next_;
+  u256_t acc_, acc_next_;
+  bool acc_has_next_;
+
+  // The RND WSR (RandWSR)
+  bool rnd_has_value_;
+  u256_t rnd_value_;
+  bool rnd_value_read_;
+  bool rnd_pending_request_;
+  bool rnd_req_high_;
+
+  // The URND WSR (URNDWSR)
+  uint64_t urnd_state_[5][4];
+  bool urnd_has_next_;
+  u256_t urnd_next_;
+  bool urnd_has_value_;
+  u256_t urnd_value_;
+  bool urnd_running_;
+
+  // Sideloaded keys
+  bool key_valid_[2];
+  uint32_t key_value_[2][12];
+  bool key_changed_[2];
+
+  // PC
+  uint32_t pc_;
+  bool has_pc_next_override_;
+  uint32_t pc_next_override_;
+
+  // DMEM, together with stores from this cycle (which appear in the trace) and
+  // stores from the previous cycle (which will land on the next commit)
+  std::vector<uint32_t> dmem_;
+  std::vector<bool> dmem_valid_;
+  std::vector<DmemStore> dmem_trace_;
+  std::map<uint32_t, uint32_t> dmem_pending_;
+
+  // Loop stack
+  std::vector<LoopLevel> loop_stack_;
+  bool loop_err_;
+  bool loop_pop_on_commit_;
+  unsigned loop_trace_;
+
+  // External registers
+  ExtReg ext_regs_[kNumExtRegs];
+  int ext_dirty_;
+
+  FsmState fsm_state_;
+  FsmState next_fsm_state_;
+  uint32_t err_bits_;
+  bool pending_halt_;
+  uint32_t injected_err_bits_;
+
+  // EDN state
+  unsigned rnd_256b_counter_;
+  unsigned urnd_256b_counter_;
+  bool rnd_set_flag_;
+  bool rnd_cdc_pending_;
+  bool urnd_cdc_pending_;
+  unsigned rnd_cdc_counter_;
+  unsigned urnd_cdc_counter_;
+  u256_t rnd_256b_;
+  uint64_t urnd_256b_[4];
+  uint64_t urnd_64b_;
+
+  // IMEM invalidation (see _time_to_imem_invalidation in state.py). Negative
+  // if no invalidation is pending.
+  int time_to_imem_invalidation_;
+  bool invalidated_imem_;
+
+  bool secure_wipe_enabled_;
+  int wipe_cycles_;
+
+  // Set while stepping: do we need to render trace lines?
+  bool gen_trace_;
+};
+
+#endif  // OPENTITAN_HW_IP_OTBN_DV_MODEL_OTBN_ISS_H_
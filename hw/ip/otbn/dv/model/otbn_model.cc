@@ -179,11 +179,15 @@ static std::vector<T> get_stack(const std::string &stack_scope) {
 }
 
 OtbnModel::OtbnModel(const std::string &mem_scope,
-                     const std::string &design_scope, bool enable_secure_wipe)
+                     const std::string &design_scope, bool enable_secure_wipe,
+                     bool enable_mem_shadow)
     : mem_util_(mem_scope),
       design_scope_(design_scope),
       enable_secure_wipe_(enable_secure_wipe) {
   assert(mem_scope.size() && design_scope.size());
+  if (enable_mem_shadow) {
+    mem_util_.EnableShadows();
+  }
 }
 
 OtbnModel::~OtbnModel() {}
@@ -681,10 +685,12 @@ bool OtbnModel::check_call_stack(ISSWrapper &iss) const {
 }
 
 OtbnModel *otbn_model_init(const char *mem_scope, const char *design_scope,
-                           int enable_secure_wipe) {
+                           int enable_secure_wipe, int enable_mem_shadow) {
   assert(mem_scope && design_scope);
   assert(enable_secure_wipe == 0 || enable_secure_wipe == 1);
-  return new OtbnModel(mem_scope, design_scope, enable_secure_wipe != 0);
+  assert(enable_mem_shadow == 0 || enable_mem_shadow == 1);
+  return new OtbnModel(mem_scope, design_scope, enable_secure_wipe != 0,
+                       enable_mem_shadow != 0);
 }
 
 void otbn_model_destroy(OtbnModel *model) { delete model; }
@@ -16,8 +16,10 @@ struct ISSWrapper;
 
 class OtbnModel {
  public:
+  // If enable_mem_shadow is true, keep host-side copies of IMEM and DMEM (see
+  // OtbnMemUtil::EnableShadows for when that is safe).
   OtbnModel(const std::string &mem_scope, const std::string &design_scope,
-            bool enable_secure_wipe);
+            bool enable_secure_wipe, bool enable_mem_shadow);
   ~OtbnModel();
 
   // Replace any current loop warps with those from memutil. Returns 0
@@ -40,7 +40,7 @@ OtbnTraceChecker &OtbnTraceChecker::get() {
   return *trace_checker;
 }
 
-void OtbnTraceChecker::AcceptTraceString(const std::string &trace,
+void OtbnTraceChecker::AcceptTraceRecord(const OtbnTraceRecord &record,
                                          unsigned int cycle_count) {
   assert(!(rtl_pending_ && iss_pending_));
 
@@ -49,10 +49,7 @@ void OtbnTraceChecker::AcceptTraceString(const std::string &trace,
 
   done_ = false;
   OtbnTraceEntry trace_entry;
-  if (!trace_entry.from_rtl_trace(trace)) {
-    seen_err_ = true;
-    return;
-  }
+  trace_entry.from_rtl_trace(record);
   if (trace_entry.trace_type() == OtbnTraceEntry::Invalid) {
     std::cerr << "ERROR: Invalid RTL trace entry with invalid header:\n";
     trace_entry.print("  ", std::cerr);
@@ -50,9 +50,9 @@ class OtbnTraceChecker : public OtbnTraceListener {
   // Get the singleton object
   static OtbnTraceChecker &get();
 
-  // Take a trace entry from the wrapped RTL. Any mismatch error is stored
+  // Take a trace record from the wrapped RTL. Any mismatch error is stored
   // until the next call to an API function that can respond with the error.
-  void AcceptTraceString(const std::string &trace,
+  void AcceptTraceRecord(const OtbnTraceRecord &record,
                          unsigned int cycle_count) override;
 
   // Take a trace entry from the wrapped ISS.
@@ -5,77 +5,199 @@
 #include "otbn_trace_entry.h"
 
 #include <cassert>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
 #include <iostream>
 #include <regex>
-#include <sstream>
 
-bool OtbnTraceBodyLine::fill_from_string(const std::string &src,
-                                         const std::string &line) {
-  // A valid line matches the following regex
-  std::regex re("(.) ([^:]+): (.+)");
-  std::smatch match;
+// Register writes are stored in a flat array of "write slots". The GPRs come
+// first, followed by the WDRs, the ISPRs (indexed by otbn_pkg::ispr_e) and
+// finally the flag groups.
+static const unsigned kNumGprs = 32;
+static const unsigned kNumWdrs = 32;
+static const unsigned kNumIsprs = 9;
+static const unsigned kNumFlagGroups = 2;
 
-  if (!std::regex_match(line, match, re)) {
-    std::cerr << "OTBN trace body line from " << src
-              << " does not have expected format. Saw: `" << line << "'.\n";
-    return false;
+static const unsigned kWdrSlot0 = kNumGprs;
+static const unsigned kIsprSlot0 = kWdrSlot0 + kNumWdrs;
+static const unsigned kFlagsSlot0 = kIsprSlot0 + kNumIsprs;
+static_assert(kFlagsSlot0 + kNumFlagGroups == OtbnTraceEntry::kNumWriteSlots,
+              "Mismatch between kNumWriteSlots and register counts");
+
+// Find the write slot for a register. Returns false if idx is out of range
+// or loc isn't a register.
+static bool get_write_slot(OtbnTraceItem::Loc loc, unsigned idx,
+                           unsigned *slot) {
+  switch (loc) {
+    case OtbnTraceItem::Gpr:
+      *slot = idx;
+      return idx < kNumGprs;
+    case OtbnTraceItem::Wdr:
+      *slot = kWdrSlot0 + idx;
+      return idx < kNumWdrs;
+    case OtbnTraceItem::Ispr:
+      *slot = kIsprSlot0 + idx;
+      return idx < kNumIsprs;
+    case OtbnTraceItem::Flags:
+      *slot = kFlagsSlot0 + idx;
+      return idx < kNumFlagGroups;
+    default:
+      return false;
   }
+}
 
-  assert(match.size() == 4);
+// The inverse of get_write_slot
+static void get_slot_loc(unsigned slot, OtbnTraceItem::Loc *loc,
+                         unsigned *idx) {
+  assert(slot < OtbnTraceEntry::kNumWriteSlots);
+  if (slot < kWdrSlot0) {
+    *loc = OtbnTraceItem::Gpr;
+    *idx = slot;
+  } else if (slot < kIsprSlot0) {
+    *loc = OtbnTraceItem::Wdr;
+    *idx = slot - kWdrSlot0;
+  } else if (slot < kFlagsSlot0) {
+    *loc = OtbnTraceItem::Ispr;
+    *idx = slot - kIsprSlot0;
+  } else {
+    *loc = OtbnTraceItem::Flags;
+    *idx = slot - kFlagsSlot0;
+  }
+}
 
-  raw_ = line;
-  type_ = match[1].str()[0];
-  loc_ = match[2].str();
-  value_ = match[3].str();
-  return true;
+static unsigned loc_num_words(OtbnTraceItem::Loc loc) {
+  return (loc == OtbnTraceItem::Gpr || loc == OtbnTraceItem::Flags)
+             ? 1
+             : kOtbnTraceWlenWords;
 }
 
-bool OtbnTraceBodyLine::operator==(const OtbnTraceBodyLine &other) const {
-  return raw_ == other.raw_;
+static OtbnTraceEntry::trace_type_t hdr_to_trace_type(
+    OtbnTraceHeader::Type type) {
+  switch (type) {
+    case OtbnTraceHeader::Stall:
+      return OtbnTraceEntry::Stall;
+    case OtbnTraceHeader::Exec:
+      return OtbnTraceEntry::Exec;
+    case OtbnTraceHeader::WipeInProgress:
+      return OtbnTraceEntry::WipeInProgress;
+    case OtbnTraceHeader::WipeComplete:
+      return OtbnTraceEntry::WipeComplete;
+    default:
+      return OtbnTraceEntry::Invalid;
+  }
 }
 
-bool OtbnTraceEntry::from_rtl_trace(const std::string &trace) {
-  size_t eol = trace.find('\n');
-  hdr_ = trace.substr(0, eol);
-  trace_type_ = hdr_to_trace_type(hdr_);
+OtbnTraceEntry::OtbnTraceEntry() : trace_type_(Invalid), has_pc_(false) {
+  hdr_.type = OtbnTraceHeader::None;
+  hdr_.fetch_err = false;
+  hdr_.pc = 0;
+  hdr_.insn = 0;
+}
 
-  while (eol != std::string::npos) {
-    size_t bol = eol + 1;
-    eol = trace.find('\n', bol);
-    size_t line_len =
-        (eol == std::string::npos) ? std::string::npos : eol - bol;
-    std::string line = trace.substr(bol, line_len);
+void OtbnTraceEntry::from_rtl_trace(const OtbnTraceRecord &record) {
+  // A well-formed record has exactly one header. If we have an instruction
+  // header, use that.
+  hdr_ = (record.insn.type != OtbnTraceHeader::None) ? record.insn
+                                                     : record.wipe;
+  has_pc_ = true;
+  trace_type_ = hdr_to_trace_type(hdr_.type);
 
-    // We're only interested in register writes
-    if (!(line.size() > 0 && line[0] == '>'))
+  // We're only interested in register writes
+  written_.reset();
+  for (unsigned i = 0; i < record.num_items; ++i) {
+    const OtbnTraceItem &item = record.items[i];
+    if (item.kind != OtbnTraceItem::RegWrite)
       continue;
 
-    OtbnTraceBodyLine parsed_line;
-    if (!parsed_line.fill_from_string("RTL", line)) {
-      return false;
-    }
-    writes_[parsed_line.get_loc()] = parsed_line;
+    add_write(item.loc, item.idx, item.num_words, item.data);
   }
-  return true;
+}
+
+void OtbnTraceEntry::add_write(OtbnTraceItem::Loc loc, unsigned idx,
+                               unsigned num_words, const uint32_t *data) {
+  unsigned slot;
+  bool good_slot = get_write_slot(loc, idx, &slot);
+  assert(good_slot);
+  (void)good_slot;
+
+  assert(num_words <= kOtbnTraceWlenWords);
+  uint32_t *dst = write_values_[slot];
+  memcpy(dst, data, num_words * sizeof(uint32_t));
+  memset(dst + num_words, 0,
+         (kOtbnTraceWlenWords - num_words) * sizeof(uint32_t));
+  written_.set(slot);
 }
 
 bool OtbnTraceEntry::operator==(const OtbnTraceEntry &other) const {
-  return hdr_ == other.hdr_ && writes_ == other.writes_;
+  if (trace_type_ != other.trace_type_)
+    return false;
+
+  if (trace_type_ == Stall || trace_type_ == Exec) {
+    if (has_pc_ != other.has_pc_)
+      return false;
+    if (has_pc_ &&
+        (hdr_.pc != other.hdr_.pc || hdr_.fetch_err != other.hdr_.fetch_err ||
+         (!hdr_.fetch_err && hdr_.insn != other.hdr_.insn)))
+      return false;
+  }
+
+  if (written_ != other.written_)
+    return false;
+
+  for (unsigned slot = 0; slot < kNumWriteSlots; ++slot) {
+    if (written_[slot] &&
+        0 != memcmp(write_values_[slot], other.write_values_[slot],
+                    sizeof write_values_[slot]))
+      return false;
+  }
+  return true;
 }
 
 void OtbnTraceEntry::print(const std::string &indent, std::ostream &os) const {
-  os << indent << hdr_ << "\n";
-  for (const auto &pr : writes_) {
-    os << indent << pr.second.get_string() << "\n";
+  os << indent;
+  if (trace_type_ == Invalid) {
+    os << "(no header)";
+  } else if (!has_pc_) {
+    os << "STALL";
+  } else {
+    hdr_.Print(os);
+  }
+  os << "\n";
+
+  for (unsigned slot = 0; slot < kNumWriteSlots; ++slot) {
+    if (!written_[slot])
+      continue;
+
+    OtbnTraceItem item;
+    OtbnTraceItem::Loc loc;
+    unsigned idx;
+    get_slot_loc(slot, &loc, &idx);
+    item.kind = OtbnTraceItem::RegWrite;
+    item.loc = loc;
+    item.idx = idx;
+    item.num_words = loc_num_words(loc);
+    item.bad_mask = false;
+    item.addr = 0;
+    memcpy(item.data, write_values_[slot], sizeof item.data);
+
+    os << indent;
+    item.Print(os);
+    os << "\n";
   }
 }
 
 void OtbnTraceEntry::take_writes(const OtbnTraceEntry &other) {
-  if (!other.writes_.empty()) {
-    for (const auto &pr : other.writes_) {
-      writes_[pr.first] = pr.second;
+  if (other.written_.none())
+    return;
+
+  for (unsigned slot = 0; slot < kNumWriteSlots; ++slot) {
+    if (other.written_[slot]) {
+      memcpy(write_values_[slot], other.write_values_[slot],
+             sizeof write_values_[slot]);
     }
   }
+  written_ |= other.written_;
 }
 
 bool OtbnTraceEntry::is_compatible(const OtbnTraceEntry &prev) const {
@@ -99,15 +221,10 @@ bool OtbnTraceEntry::is_compatible(const OtbnTraceEntry &prev) const {
   // and that's fine. So the rule is:
   //
   //   - Check the types are compatible (S then S or E; U then U or V)
-  //   - Compare the two lines from character 1 onwards.
-  //   - If they match: accept.
-  //   - Otherwise, if the second line has no '?' then reject.
-  //   - If there is a '?' and they match up to that point, accept.
-  //   - Otherwise: reject
-  //
-  // (This wrongly accepts some malformed examples, but that's fine: it's just
-  // meant as a quick check to make sure our trace machinery isn't dropping
-  // entries)
+  //   - For instructions, check the PCs match.
+  //   - If the second entry has a fetch error: accept.
+  //   - Otherwise, accept if neither entry has a fetch error and the
+  //     instruction words match.
   bool matching_types;
   switch (prev.trace_type()) {
     case Stall:
@@ -123,16 +240,17 @@ bool OtbnTraceEntry::is_compatible(const OtbnTraceEntry &prev) const {
   if (!matching_types)
     return false;
 
-  bool exact_match =
-      0 == hdr_.compare(1, std::string::npos, prev.hdr_, 1, std::string::npos);
-  if (exact_match)
+  // Wipe headers have no other information
+  if (trace_type_ == WipeInProgress || trace_type_ == WipeComplete)
     return true;
 
-  size_t first_qm = hdr_.find('?', 1);
-  if (first_qm == std::string::npos)
+  if (hdr_.pc != prev.hdr_.pc)
     return false;
 
-  return 0 == hdr_.compare(1, first_qm - 1, prev.hdr_, 1, first_qm - 1);
+  if (hdr_.fetch_err)
+    return true;
+
+  return !prev.hdr_.fetch_err && hdr_.insn == prev.hdr_.insn;
 }
 
 bool OtbnTraceEntry::is_partial() const {
@@ -145,24 +263,150 @@ bool OtbnTraceEntry::is_final() const {
           (trace_type_ == OtbnTraceEntry::WipeComplete));
 }
 
-OtbnTraceEntry::trace_type_t OtbnTraceEntry::hdr_to_trace_type(
-    const std::string &hdr) {
-  if (hdr.empty()) {
-    return Invalid;
+// Parse a hex value of the form 0x0123abcd or 0x0123abcd_4567cdef_... into
+// the num_words words at out (least significant word first). Returns false if
+// the string isn't of the expected form or the value doesn't fit.
+static bool parse_hex_words(const std::string &str, unsigned num_words,
+                            uint32_t *out) {
+  if (str.size() < 3 || str.compare(0, 2, "0x") != 0)
+    return false;
+
+  memset(out, 0, num_words * sizeof(uint32_t));
+  unsigned num_digits = 0;
+  for (size_t i = 2; i < str.size(); ++i) {
+    char c = str[i];
+    if (c == '_')
+      continue;
+    if (!isxdigit((unsigned char)c))
+      return false;
+    if (++num_digits > 8 * num_words)
+      return false;
+
+    uint32_t digit =
+        isdigit((unsigned char)c) ? c - '0' : (tolower(c) - 'a' + 10);
+    for (unsigned w = num_words - 1; w > 0; --w) {
+      out[w] = (out[w] << 4) | (out[w - 1] >> 28);
+    }
+    out[0] = (out[0] << 4) | digit;
+  }
+  return num_digits > 0;
+}
+
+// Parse a register name from the ISS (x05, w31, ACC, FLAGS1 etc.)
+static bool parse_reg_loc(const std::string &name, OtbnTraceItem::Loc *loc,
+                          unsigned *idx) {
+  unsigned num;
+  char rest;
+  if (sscanf(name.c_str(), "x%u%c", &num, &rest) == 1) {
+    *loc = OtbnTraceItem::Gpr;
+    *idx = num;
+    return true;
+  }
+  if (sscanf(name.c_str(), "w%u%c", &num, &rest) == 1) {
+    *loc = OtbnTraceItem::Wdr;
+    *idx = num;
+    return true;
+  }
+  if (sscanf(name.c_str(), "FLAGS%u%c", &num, &rest) == 1) {
+    *loc = OtbnTraceItem::Flags;
+    *idx = num;
+    return true;
   }
+  for (unsigned i = 0; i < kNumIsprs; ++i) {
+    if (name == OtbnTraceIsprName(i)) {
+      *loc = OtbnTraceItem::Ispr;
+      *idx = i;
+      return true;
+    }
+  }
+  return false;
+}
 
-  switch (hdr[0]) {
+bool OtbnIssTraceEntry::parse_header(const std::string &line) {
+  hdr_.fetch_err = false;
+  hdr_.pc = 0;
+  hdr_.insn = 0;
+  has_pc_ = false;
+
+  switch (line.empty() ? '\0' : line[0]) {
     case 'S':
-      return Stall;
+      hdr_.type = OtbnTraceHeader::Stall;
+      break;
     case 'E':
-      return Exec;
+      hdr_.type = OtbnTraceHeader::Exec;
+      break;
     case 'U':
-      return WipeInProgress;
+      hdr_.type = OtbnTraceHeader::WipeInProgress;
+      break;
     case 'V':
-      return WipeComplete;
+      hdr_.type = OtbnTraceHeader::WipeComplete;
+      break;
     default:
-      return Invalid;
+      hdr_.type = OtbnTraceHeader::None;
+      break;
+  }
+  trace_type_ = hdr_to_trace_type(hdr_.type);
+
+  if (trace_type_ != Stall && trace_type_ != Exec)
+    return true;
+
+  // An instruction header looks like "E PC: 0x00000010, insn: 0x00107db8" or
+  // (on a fetch error) "E PC: 0x00000010, insn: ??". The ISS also uses a bare
+  // "STALL" header for stall cycles, which doesn't give a PC.
+  unsigned pc, insn;
+  char qm[3];
+  if (sscanf(line.c_str() + 1, " PC: 0x%8x, insn: 0x%8x", &pc, &insn) == 2) {
+    hdr_.insn = insn;
+  } else if (sscanf(line.c_str() + 1, " PC: 0x%8x, insn: %2s", &pc, qm) ==
+                 2 &&
+             0 == strcmp(qm, "??")) {
+    hdr_.fetch_err = true;
+  } else if (trace_type_ == Stall) {
+    return true;
+  } else {
+    std::cerr << "Bad header line for ISS trace: `" << line << "'.\n";
+    return false;
   }
+
+  hdr_.pc = pc;
+  has_pc_ = true;
+  return true;
+}
+
+bool OtbnIssTraceEntry::parse_write(const std::string &line) {
+  size_t colon = line.find(": ", 2);
+  OtbnTraceItem::Loc loc;
+  unsigned idx, slot;
+  if (line.compare(0, 2, "> ") != 0 || colon == std::string::npos ||
+      !parse_reg_loc(line.substr(2, colon - 2), &loc, &idx) ||
+      !get_write_slot(loc, idx, &slot)) {
+    std::cerr << "OTBN trace body line from ISS does not have expected "
+                 "format. Saw: `"
+              << line << "'.\n";
+    return false;
+  }
+
+  std::string value = line.substr(colon + 2);
+  uint32_t data[kOtbnTraceWlenWords];
+  bool good_value;
+  if (loc == OtbnTraceItem::Flags) {
+    unsigned c, m, l, z;
+    good_value = (sscanf(value.c_str(), "{C: %u, M: %u, L: %u, Z: %u}", &c,
+                         &m, &l, &z) == 4) &&
+                 c <= 1 && m <= 1 && l <= 1 && z <= 1;
+    data[0] = c | (m << 1) | (l << 2) | (z << 3);
+  } else {
+    good_value = parse_hex_words(value, loc_num_words(loc), data);
+  }
+
+  if (!good_value) {
+    std::cerr << "OTBN trace body line from ISS has a bad value. Saw: `"
+              << line << "'.\n";
+    return false;
+  }
+
+  add_write(loc, idx, loc_num_words(loc), data);
+  return true;
 }
 
 bool OtbnIssTraceEntry::from_iss_trace(const std::vector<std::string> &lines) {
@@ -176,9 +420,10 @@ bool OtbnIssTraceEntry::from_iss_trace(const std::vector<std::string> &lines) {
   for (const std::string &line : lines) {
     switch (state) {
       case 0:
-        hdr_ = line;
-        trace_type_ = hdr_to_trace_type(hdr_);
-        state = (!line.empty() && line[0] == 'E') ? 1 : 2;
+        if (!parse_header(line)) {
+          return false;
+        }
+        state = (trace_type_ == Exec) ? 1 : 2;
         break;
 
       case 1:
@@ -190,8 +435,9 @@ bool OtbnIssTraceEntry::from_iss_trace(const std::vector<std::string> &lines) {
         // where ADDR is an 8-digit instruction address (in hex) and mnemonic
         // is the string mnemonic.
         if (!std::regex_match(line, match, re)) {
-          std::cerr << "Bad 'special' line for ISS trace with header `" << hdr_
-                    << "': `" << line << "'.\n";
+          std::cerr << "Bad 'special' line for ISS trace with header `";
+          hdr_.Print(std::cerr);
+          std::cerr << "': `" << line << "'.\n";
           return false;
         }
         assert(match.size() == 3);
@@ -206,12 +452,8 @@ bool OtbnIssTraceEntry::from_iss_trace(const std::vector<std::string> &lines) {
         // Ignore '!' lines (which are used to tell the simulation about
         // external register changes, not tracked by the RTL core simulation)
         bool is_bang = (line.size() > 0 && line[0] == '!');
-        if (!is_bang) {
-          OtbnTraceBodyLine parsed_line;
-          if (!parsed_line.fill_from_string("ISS", line)) {
-            return false;
-          }
-          writes_[parsed_line.get_loc()] = parsed_line;
+        if (!is_bang && !parse_write(line)) {
+          return false;
         }
         break;
       }
@@ -221,8 +463,9 @@ bool OtbnIssTraceEntry::from_iss_trace(const std::vector<std::string> &lines) {
   // We shouldn't be in state 1 here: that would mean an E line with no
   // follow-up '#' line.
   if (state == 1) {
-    std::cerr << "No 'special' line for ISS trace with header `" << hdr_
-              << "'.\n";
+    std::cerr << "No 'special' line for ISS trace with header `";
+    hdr_.Print(std::cerr);
+    std::cerr << "'.\n";
     return false;
   }
 
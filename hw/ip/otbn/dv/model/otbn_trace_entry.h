@@ -4,39 +4,13 @@
 #ifndef OPENTITAN_HW_IP_OTBN_DV_MODEL_OTBN_TRACE_ENTRY_H_
 #define OPENTITAN_HW_IP_OTBN_DV_MODEL_OTBN_TRACE_ENTRY_H_
 
-#include <map>
+#include <bitset>
+#include <cstdint>
+#include <iosfwd>
 #include <string>
 #include <vector>
 
-// This models a body line in an OTBN trace entry (type '<', '>', 'R' or 'W').
-// Each of these lines is of the format
-//
-//   TYPE ' ' LOC ': ' VALUE
-//
-// and we parse them accordingly here. The point is that we want to merge
-// successive writes to the same location and thus need to unpack things enough
-// to see them.
-class OtbnTraceBodyLine {
- public:
-  // Parse a line into this object, based on the format above. On success,
-  // return true. On failure, write an error message to stderr (using src to
-  // say where the line came from) and return false.
-  bool fill_from_string(const std::string &src, const std::string &line);
-
-  bool operator==(const OtbnTraceBodyLine &other) const;
-
-  // Return the location that is being read or written
-  const std::string &get_loc() const { return loc_; }
-
-  // Return the original string format for the entry
-  const std::string &get_string() const { return raw_; }
-
- private:
-  std::string raw_;
-  char type_;
-  std::string loc_;
-  std::string value_;
-};
+#include "otbn_trace_record.h"
 
 class OtbnTraceEntry {
  public:
@@ -48,11 +22,12 @@ class OtbnTraceEntry {
     WipeComplete,
   };
 
+  OtbnTraceEntry();
   virtual ~OtbnTraceEntry(){};
 
-  // Parse a trace entry from the RTL into this object. On an error, print a
-  // message to stderr and return false.
-  bool from_rtl_trace(const std::string &trace);
+  // Fill this object from a trace record from the RTL. We are only interested
+  // in the header and any register writes.
+  void from_rtl_trace(const OtbnTraceRecord &record);
 
   bool operator==(const OtbnTraceEntry &other) const;
   void print(const std::string &indent, std::ostream &os) const;
@@ -71,17 +46,32 @@ class OtbnTraceEntry {
   // True if this entry is "final" (Exec or WipeComplete)
   bool is_final() const;
 
+  // The number of distinct register locations that can be written: 32 GPRs,
+  // 32 WDRs, 9 ISPRs and 2 flag groups.
+  static const unsigned kNumWriteSlots = 32 + 32 + 9 + 2;
+
  protected:
-  static trace_type_t hdr_to_trace_type(const std::string &hdr);
+  // Record a write to a register (replacing any earlier write to the same
+  // location). num_words is the number of meaningful words in data.
+  void add_write(OtbnTraceItem::Loc loc, unsigned idx, unsigned num_words,
+                 const uint32_t *data);
 
   trace_type_t trace_type_;
-  std::string hdr_;
-  // The register writes for this trace entry, keyed by destination
-  std::map<std::string, OtbnTraceBodyLine> writes_;
+  OtbnTraceHeader hdr_;
+  // False if the header doesn't give a PC. This happens for stall entries
+  // from the ISS.
+  bool has_pc_;
+
+  // The register writes for this trace entry, indexed by a "write slot" that
+  // is calculated from the register's location (see otbn_trace_entry.cc).
+  std::bitset<kNumWriteSlots> written_;
+  uint32_t write_values_[kNumWriteSlots][kOtbnTraceWlenWords];
 };
 
 class OtbnIssTraceEntry : public OtbnTraceEntry {
  public:
+  // Parse a trace entry from the ISS into this object. On an error, print a
+  // message to stderr and return false.
   bool from_iss_trace(const std::vector<std::string> &lines);
 
   // Fields that are populated from the "special" line for ISS entries
@@ -91,6 +81,17 @@ class OtbnIssTraceEntry : public OtbnTraceEntry {
   };
 
   IssData data_;
+
+ private:
+  // Parse the header line from the ISS
+  bool parse_header(const std::string &line);
+
+  // Parse a register write line from the ISS. These are of the format
+  //
+  //   '> ' LOC ': ' VALUE
+  //
+  // where LOC and VALUE are formatted as for RTL trace output.
+  bool parse_write(const std::string &line);
 };
 
 #endif  // OPENTITAN_HW_IP_OTBN_DV_MODEL_OTBN_TRACE_ENTRY_H_
@@ -5,7 +5,7 @@
 '''Code to load instruction words into a simulator'''
 
 import struct
-from typing import Iterator, List, Optional, Tuple
+from typing import Dict, Iterator, List, Optional, Tuple
 
 from .constants import ErrBits
 from .isa import INSNS_FILE, OTBNInsn
@@ -83,9 +83,55 @@ def _decode_word(pc: int, word: int) -> OTBNInsn:
     return cls(word, op_vals)
 
 
+class DecodeCache:
+    '''A cache of decoded instructions, keyed by IMEM address
+
+    The simulator is given the whole of IMEM every time it is started (see
+    the load_i command in stepped.py), but the contents rarely change between
+    runs. Each entry remembers the validity bit and word that it was decoded
+    from, so a write to IMEM just causes the affected addresses to be decoded
+    again. Call invalidate() to drop every entry.
+
+    Sharing instruction objects between loads is safe because the only state
+    they carry is their (memoized) disassembly.
+
+    '''
+    def __init__(self) -> None:
+        self._entries = {}  # type: Dict[int, Tuple[bool, int, OTBNInsn]]
+
+    def decode_words(self,
+                     data: List[Tuple[bool, int]]) -> List[OTBNInsn]:
+        '''Decode instruction words, reusing cached decodings'''
+        ret = []
+        for idx, (vld, w32) in enumerate(data):
+            pc = 4 * idx
+            entry = self._entries.get(pc)
+            if entry is not None and entry[0] == vld and entry[1] == w32:
+                ret.append(entry[2])
+                continue
+
+            insn = _decode_word(pc, w32) if vld else EmptyInsn(pc)
+            self._entries[pc] = (vld, w32, insn)
+            ret.append(insn)
+        return ret
+
+    def invalidate(self) -> None:
+        '''Drop all cached decodings'''
+        self._entries.clear()
+
+
 def decode_words(base_addr: int,
-                 data: List[Tuple[bool, int]]) -> List[OTBNInsn]:
-    '''Decode instruction bytes as instructions'''
+                 data: List[Tuple[bool, int]],
+                 cache: Optional[DecodeCache] = None) -> List[OTBNInsn]:
+    '''Decode instruction bytes as instructions
+
+    If cache is not None, it is used to avoid decoding words that haven't
+    changed since the last call.
+
+    '''
+    if cache is not None:
+        return cache.decode_words(data)
+
     ret = []
     for idx, (vld, w32) in enumerate(data):
         pc = 4 * idx
@@ -93,7 +139,9 @@ def decode_words(base_addr: int,
     return ret
 
 
-def decode_file(base_addr: int, path: str) -> List[OTBNInsn]:
+def decode_file(base_addr: int,
+                path: str,
+                cache: Optional[DecodeCache] = None) -> List[OTBNInsn]:
     with open(path, 'rb') as handle:
         raw_bytes = handle.read()
 
@@ -113,4 +161,4 @@ def decode_file(base_addr: int, path: str) -> List[OTBNInsn]:
 
         data.append((vld == 1, u32))
 
-    return decode_words(base_addr, data)
+    return decode_words(base_addr, data, cache)
@@ -2,10 +2,11 @@
 # Licensed under the Apache License, Version 2.0, see LICENSE for details.
 # SPDX-License-Identifier: Apache-2.0
 
-from typing import Dict, Iterator, List, Optional, Tuple
+import inspect
+from typing import Dict, Iterator, List, Optional, Tuple, Type
 
 from .constants import ErrBits, Status
-from .decode import EmptyInsn
+from .decode import DecodeCache, EmptyInsn
 from .isa import OTBNInsn
 from .state import OTBNState, FsmState
 from .stats import ExecutionStats
@@ -22,11 +23,37 @@ LoopWarps = Dict[int, Dict[int, int]]
 # executed, together with a list of changes.
 StepRes = Tuple[Optional[OTBNInsn], List[Trace]]
 
+# A cache of whether each instruction class is "straight-line" (see
+# _is_straight_line).
+_STRAIGHT_LINE = {}  # type: Dict[Type[OTBNInsn], bool]
+
+
+def _is_straight_line(insn: OTBNInsn) -> bool:
+    '''Return true if insn can run as part of a basic block in step_block
+
+    This is true for instructions that have data, run in a single cycle and
+    don't affect control flow (except through the loop stack, which is handled
+    by OTBNState.post_insn).
+
+    '''
+    if not insn.has_bits:
+        return False
+
+    cls = type(insn)
+    ret = _STRAIGHT_LINE.get(cls)
+    if ret is None:
+        ret = not (cls.affects_control or
+                   cls.has_fetch_stall or
+                   inspect.isgeneratorfunction(cls.execute))
+        _STRAIGHT_LINE[cls] = ret
+    return ret
+
 
 class OTBNSim:
     def __init__(self) -> None:
         self.state = OTBNState()
         self.program = []  # type: List[OTBNInsn]
+        self.decode_cache = DecodeCache()
         self.loop_warps = {}  # type: LoopWarps
         self.stats = None  # type: Optional[ExecutionStats]
         self._execute_generator = None  # type: Optional[Iterator[None]]
@@ -36,6 +63,16 @@ class OTBNSim:
         self.program = program.copy()
         self.state.clear_imem_invalidation()
 
+    def invalidate_imem(self) -> None:
+        '''Mark all of IMEM as having invalid ECC checksums
+
+        This also drops any cached instruction decodings, so the next program
+        load decodes everything from scratch.
+
+        '''
+        self.decode_cache.invalidate()
+        self.state.invalidate_imem()
+
     def add_loop_warp(self, addr: int, from_cnt: int, to_cnt: int) -> None:
         '''Add a new loop warp to the simulation'''
         self.loop_warps.setdefault(addr, {})[from_cnt] = to_cnt
@@ -168,6 +205,57 @@ class OTBNSim:
 
         return stepper(verbose)
 
+    def step_block(self) -> int:
+        '''Run a straight-line block of instructions without tracing.
+
+        This is equivalent to calling step(verbose=False) repeatedly while
+        each fetched instruction is a single-cycle instruction that doesn't
+        affect control flow, but skips the per-cycle FSM dispatch and change
+        collection. If the simulation isn't in a state where that is safe
+        (statistics are being collected, a multi-cycle instruction is in
+        flight, there is an error to inject or an RND request in progress),
+        this runs a single cycle with step().
+
+        Returns the number of cycles run, which is always at least one.
+
+        '''
+        state = self.state
+        rnd = state.wsrs.RND
+        insn = self._next_insn
+        if (self.stats is not None or
+                state.get_fsm_state() != FsmState.EXEC or
+                self._execute_generator is not None or
+                state.injected_err_bits != 0 or
+                state.pending_halt or
+                rnd.pending_request or rnd.req_high or
+                insn is None or not _is_straight_line(insn)):
+            self.step(verbose=False)
+            return 1
+
+        cycles = 0
+        while True:
+            state.wsrs.URND.step()
+
+            # Since insn doesn't affect control, state.pre_insn() would be a
+            # no-op and we know that execute() won't return a generator.
+            insn.execute(state)
+            state.post_insn(self.loop_warps.get(state.pc, {}))
+            cycles += 1
+
+            if state.pending_halt:
+                state.stop()
+                state.commit(sim_stalled=False)
+                self._next_insn = None
+                break
+
+            state.commit(sim_stalled=False)
+            insn = self._fetch(state.pc)
+            self._next_insn = insn
+            if not _is_straight_line(insn):
+                break
+
+        return cycles
+
     def _step_idle(self, verbose: bool) -> StepRes:
         '''Step the simulation when OTBN is IDLE or LOCKED'''
         if self.state.pending_halt:
@@ -27,9 +27,15 @@ class StandaloneSim(OTBNSim):
         # ISS will stall at start until URND data is valid; immediately set it
         # valid when in free running mode as nothing else will.
         self.state.wsrs.URND.set_seed(_TEST_URND_DATA)
+        # Without a trace or statistics, nothing looks at the individual
+        # cycles of straight-line code, so we can run it a block at a time.
+        use_blocks = not verbose and self.stats is None
         while self.state.running():
-            self.step(verbose)
-            insn_count += 1
+            if use_blocks:
+                insn_count += self.step_block()
+            else:
+                self.step(verbose)
+                insn_count += 1
 
             # If an instruction requests RND data, make it available
             # immediately.
@@ -20,6 +20,14 @@ prefixed with "0x" if they are hexadecimal.
     step                 Run one instruction. Print trace information to
                          stdout.
 
+    step_n <max>         Run up to <max> cycles, stopping early after any
+                         cycle that ends with OTBN waiting for something from
+                         outside (an EDN request, a URND reseed, or not
+                         running at all) or that changes STATUS or sets
+                         WIPE_START. Rather than text, this writes a single
+                         binary frame to stdout (before the usual '.' line),
+                         described in _write_step_frame.
+
     load_elf <path>      Load the ELF file at <path>, replacing current
                          contents of DMEM and IMEM.
 
@@ -71,12 +79,21 @@ prefixed with "0x" if they are hexadecimal.
 '''
 
 import binascii
+import struct
 import sys
-from typing import List, Optional
+from typing import Dict, List, Optional, Tuple
 
 from sim.decode import decode_file
+from sim.ext_regs import TraceExtRegChange
 from sim.load_elf import load_elf
 from sim.sim import OTBNSim
+from sim.state import FsmState
+
+# The external registers that ISSWrapper mirrors, in the order of their bits in
+# the flags byte of a step_n cycle record.
+_MIRRORED_REGS = ['STATUS', 'INSN_CNT', 'ERR_BITS',
+                  'STOP_PC', 'RND_REQ', 'WIPE_START']
+_CYCLE_HAS_TRACE = 0x80
 
 
 def read_word(arg_name: str, word_data: str, bits: int) -> int:
@@ -133,10 +150,13 @@ def on_configure(sim: OTBNSim, args: List[str]) -> Optional[OTBNSim]:
     return None
 
 
-def on_step(sim: OTBNSim, args: List[str]) -> Optional[OTBNSim]:
-    '''Step one instruction'''
-    check_arg_count('step', 0, args)
+def _step_cycle(sim: OTBNSim) -> Tuple[List[str], List[TraceExtRegChange]]:
+    '''Step one cycle
 
+    Returns the lines of trace output for the cycle (empty if there is nothing
+    to trace) together with the changes to external registers.
+
+    '''
     pc = sim.state.pc
     assert 0 == pc & 3
 
@@ -156,10 +176,13 @@ def on_step(sim: OTBNSim, args: List[str]) -> Optional[OTBNSim]:
         hdr = None
 
     rtl_changes = []
+    ext_changes = []
     for c in changes:
         rt = c.rtl_trace()
         if rt is not None:
             rtl_changes.append(rt)
+        if isinstance(c, TraceExtRegChange):
+            ext_changes.append(c)
 
     # This is a bit of a hack. Very occasionally, we'll see traced changes when
     # there's not actually an instruction in flight. For example, this happens
@@ -170,11 +193,89 @@ def on_step(sim: OTBNSim, args: List[str]) -> Optional[OTBNSim]:
     if hdr is None and rtl_changes:
         hdr = 'STALL'
 
-    if hdr is not None:
-        print(hdr)
-        for rt in rtl_changes:
-            print(rt)
+    lines = [] if hdr is None else [hdr] + rtl_changes
+    return (lines, ext_changes)
+
 
+def on_step(sim: OTBNSim, args: List[str]) -> Optional[OTBNSim]:
+    '''Step one instruction'''
+    check_arg_count('step', 0, args)
+
+    lines, _ = _step_cycle(sim)
+    for line in lines:
+        print(line)
+
+    return None
+
+
+def _waits_for_outside(sim: OTBNSim) -> bool:
+    '''True if the next cycle might depend on input from the testbench'''
+    state = sim.state
+    if not state.running() or state.get_fsm_state() == FsmState.PRE_EXEC:
+        return True
+    rnd = state.wsrs.RND
+    return (rnd.pending_request or rnd.req_high or state.rnd_set_flag or
+            state.rnd_cdc_pending or state.urnd_cdc_pending)
+
+
+def _write_step_frame(cycles: List[Tuple[Dict[str, int], List[str]]]) -> None:
+    '''Write the response to step_n to stdout
+
+    All integers are little-endian. The frame starts with a u32 cycle count,
+    followed by a record for each cycle. A record starts with a flags byte.
+    Bit i of the flags is set if the register _MIRRORED_REGS[i] changed in the
+    cycle, in which case a u32 with its new value follows (in bit order). If
+    bit 7 is set, the cycle has trace output. A u16 line count follows, then
+    each line as a u16 length and its bytes. Lines that report changes to
+    external registers ("! otbn...") are left out, since the flags carry the
+    values ISSWrapper needs.
+
+    '''
+    frame = bytearray(struct.pack('<I', len(cycles)))
+    for updates, lines in cycles:
+        flags = 0
+        values = []
+        for idx, name in enumerate(_MIRRORED_REGS):
+            value = updates.get(name)
+            if value is not None:
+                flags |= 1 << idx
+                values.append(value)
+        if lines:
+            flags |= _CYCLE_HAS_TRACE
+        frame += struct.pack('<B{}I'.format(len(values)), flags, *values)
+        if lines:
+            frame += struct.pack('<H', len(lines))
+            for line in lines:
+                data = line.encode('utf-8')
+                frame += struct.pack('<H', len(data))
+                frame += data
+
+    sys.stdout.flush()
+    sys.stdout.buffer.write(frame)
+
+
+def on_step_n(sim: OTBNSim, args: List[str]) -> Optional[OTBNSim]:
+    '''Step until something the testbench needs to see, or a cycle limit'''
+    check_arg_count('step_n', 1, args)
+
+    max_cycles = read_word('max_cycles', args[0], 32)
+    if max_cycles == 0:
+        raise ValueError('step_n needs a positive cycle count.')
+
+    cycles = []  # type: List[Tuple[Dict[str, int], List[str]]]
+    while len(cycles) < max_cycles:
+        lines, ext_changes = _step_cycle(sim)
+        updates = {c.name: c.erc.new_value for c in ext_changes}
+        # Some entries (such as instruction headers) span several lines.
+        # Split them so that the lines match what on_step prints.
+        split = '\n'.join(lines).split('\n') if lines else []
+        cycles.append((updates,
+                       [line for line in split if not line.startswith('!')]))
+        if ('STATUS' in updates or updates.get('WIPE_START') or
+                _waits_for_outside(sim)):
+            break
+
+    _write_step_frame(cycles)
     return None
 
 
@@ -243,7 +344,7 @@ def on_load_i(sim: OTBNSim, args: List[str]) -> Optional[OTBNSim]:
     path = args[0]
 
     print('LOAD_I {!r}'.format(path))
-    sim.load_program(decode_file(0, path))
+    sim.load_program(decode_file(0, path, sim.decode_cache))
 
     return None
 
@@ -291,7 +392,11 @@ def on_reset(sim: OTBNSim, args: List[str]) -> Optional[OTBNSim]:
         raise ValueError('reset expects zero arguments. Got {}.'
                          .format(args))
 
-    return OTBNSim()
+    # Keep decoded instructions: cache entries are checked against the
+    # instruction words when the next program is loaded.
+    new_sim = OTBNSim()
+    new_sim.decode_cache = sim.decode_cache
+    return new_sim
 
 
 def on_edn_rnd_step(sim: OTBNSim, args: List[str]) -> Optional[OTBNSim]:
@@ -349,7 +454,7 @@ def on_edn_rnd_cdc_done(sim: OTBNSim, args: List[str]) -> Optional[OTBNSim]:
 def on_invalidate_imem(sim: OTBNSim, args: List[str]) -> Optional[OTBNSim]:
     check_arg_count('invalidate_imem', 0, args)
 
-    sim.state.invalidate_imem()
+    sim.invalidate_imem()
     return None
 
 
@@ -395,6 +500,7 @@ _HANDLERS = {
     'start': on_start,
     'configure': on_configure,
     'step': on_step,
+    'step_n': on_step_n,
     'load_elf': on_load_elf,
     'add_loop_warp': on_add_loop_warp,
     'clear_loop_warps': on_clear_loop_warps,
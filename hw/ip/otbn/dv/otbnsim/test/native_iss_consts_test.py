@@ -0,0 +1,140 @@
+# Copyright lowRISC contributors.
+# Licensed under the Apache License, Version 2.0, see LICENSE for details.
+# SPDX-License-Identifier: Apache-2.0
+
+'''Check the constants in the native ISS against their sources
+
+The native ISS (hw/ip/otbn/dv/model/otbn_iss.cc) has its own copies of the
+instruction encodings from insns.yml and of various constants from
+otbn.hjson and from this simulator. These tests parse otbn_iss.cc and check
+that the copies still match, so that the two models can't silently drift
+apart.
+
+'''
+
+import os
+import re
+from typing import Dict, Tuple
+
+from sim.constants import ErrBits, Status
+from sim.csr import CSRFile
+from sim.gpr import CallStackReg
+from sim.loop import LoopStack
+from sim.state import _WIPE_CYCLES
+from sim.wsr import WSRFile
+from shared.insn_yaml import load_insns_yaml
+from shared.mem_layout import get_memory_layout
+
+OTBN_ISS_CC = os.path.normpath(os.path.join(os.path.dirname(__file__),
+                                            '../../model/otbn_iss.cc'))
+
+
+def _read_source() -> str:
+    with open(OTBN_ISS_CC) as handle:
+        return handle.read()
+
+
+def _read_consts() -> Dict[str, int]:
+    '''Return the integer constants defined at the top of otbn_iss.cc'''
+    ret = {}
+    const_re = re.compile(r'^const (?:uint32_t|int|size_t) (k\w+) = '
+                          r'(0x[0-9a-f]+|\d+)u?(?: << (\d+))?;$',
+                          re.MULTILINE)
+    for match in const_re.finditer(_read_source()):
+        value = int(match.group(2), 0)
+        if match.group(3) is not None:
+            value <<= int(match.group(3))
+        ret[match.group(1)] = value
+    return ret
+
+
+def _read_insn_masks() -> Dict[str, Tuple[int, int]]:
+    '''Return the insn_masks table from otbn_iss.cc'''
+    src = _read_source()
+    start = src.index('const InsnMasks insn_masks[kNumOps] = {')
+    end = src.index('};', start)
+    entry_re = re.compile(r'\{"([a-z.]+)", (0x[0-9a-f]+), (0x[0-9a-f]+)\}')
+    ret = {}
+    for match in entry_re.finditer(src[start:end]):
+        assert match.group(1) not in ret
+        ret[match.group(1)] = (int(match.group(2), 0), int(match.group(3), 0))
+    return ret
+
+
+def _camel_to_upper_snake(name: str) -> str:
+    return re.sub(r'(?<!^)(?=[A-Z])', '_', name).upper()
+
+
+def test_insn_masks() -> None:
+    '''The encoding table matches insns.yml'''
+    expected = {}
+    for insn in load_insns_yaml().insns:
+        if insn.encoding is None:
+            continue
+        # Like InsnsFile, we only keep the bits that are known to be zero (or
+        # known to be one) for every encoding of the instruction.
+        m0, m1 = insn.encoding.get_masks()
+        expected[insn.mnemonic] = (m0 & ~m1, m1 & ~m0)
+
+    assert _read_insn_masks() == expected
+
+
+def test_mem_sizes() -> None:
+    consts = _read_consts()
+    layout = get_memory_layout()
+
+    assert consts['kImemSizeBytes'] == layout['IMEM'][1]
+    # DMEM is twice the size of the window that's visible over the bus (see
+    # dmem.py).
+    assert consts['kDmemSizeWords'] == 2 * layout['DMEM'][1] // 4
+
+
+def test_err_bits() -> None:
+    consts = _read_consts()
+    seen = 0
+    for name, value in consts.items():
+        if name.startswith('kErr'):
+            py_name = _camel_to_upper_snake(name[len('kErr'):])
+            assert value == ErrBits[py_name], name
+            seen += 1
+    assert seen > 0
+
+
+def test_status() -> None:
+    consts = _read_consts()
+    assert consts['kStatusIdle'] == Status.IDLE
+    assert consts['kStatusBusyExecute'] == Status.BUSY_EXECUTE
+    assert consts['kStatusLocked'] == Status.LOCKED
+
+
+def test_csrs() -> None:
+    '''The native ISS knows the same CSRs as this one'''
+    consts = _read_consts()
+    native = {consts['kCsrFg0'], consts['kCsrFg1'], consts['kCsrFlags'],
+              consts['kCsrRndPrefetch'], consts['kCsrRnd'], consts['kCsrUrnd']}
+    native.update(range(consts['kCsrMod0'], consts['kCsrMod7'] + 1))
+
+    csrs = CSRFile()
+    assert native == csrs._known_indices
+
+
+def test_wsrs() -> None:
+    '''The native ISS puts WSRs at the same indices as this one'''
+    consts = _read_consts()
+    wsrs = WSRFile()
+    seen = 0
+    for name, value in consts.items():
+        if name.startswith('kWsr'):
+            assert wsrs.check_idx(value), name
+            reg = wsrs._by_idx[value]
+            assert reg.name.lower() == name[len('kWsr'):].lower(), name
+            seen += 1
+    assert seen > 0
+    assert consts['kWsrKeyS1H'] == max(wsrs._by_idx)
+
+
+def test_other_consts() -> None:
+    consts = _read_consts()
+    assert consts['kWipeCycles'] == _WIPE_CYCLES
+    assert consts['kCallStackDepth'] == CallStackReg.stack_depth
+    assert consts['kLoopStackDepth'] == LoopStack.stack_depth
@@ -0,0 +1,176 @@
+// Copyright lowRISC contributors.
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+
+// A driver for the native ISS (OtbnIss), used by native_iss_test.py.
+//
+// Usage: native_iss_driver <dir> <max-cycles> <secure-wipe>
+//
+// This reads a test case from <dir> (see native_iss_test.py for the files
+// that it contains), runs it on the native ISS and writes a DMEM dump to
+// <dir>/dmem_native. Everything else is written to stdout in the format that
+// native_iss_test.py generates for the Python ISS, which drives that model
+// with exactly the same stimulus.
+
+#include <array>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <string>
+
+#include "otbn_iss.h"
+
+static const char *const kMirroredRegNames[kNumMirroredRegs] = {
+    "STATUS", "INSN_CNT", "ERR_BITS", "STOP_PC", "RND_REQ", "WIPE_START"};
+
+// Parse a 384-bit hex string (MSB first) into 32-bit words (LSB first)
+static std::array<uint32_t, 12> ParseKey(const std::string &hex) {
+  if (hex.size() > 96) {
+    throw std::runtime_error("Key too long: " + hex);
+  }
+  std::string padded = std::string(96 - hex.size(), '0') + hex;
+  std::array<uint32_t, 12> ret;
+  for (int i = 0; i < 12; ++i) {
+    ret[i] = strtoul(padded.substr(96 - 8 * (i + 1), 8).c_str(), nullptr, 16);
+  }
+  return ret;
+}
+
+static int Run(const std::string &dir, int max_cycles, bool secure_wipe) {
+  OtbnIss iss;
+  iss.load_i(dir + "/imem");
+  iss.load_d(dir + "/dmem");
+
+  std::ifstream warps(dir + "/loopwarps");
+  uint32_t addr, from_cnt, to_cnt;
+  while (warps >> addr >> from_cnt >> to_cnt) {
+    iss.add_loop_warp(addr, from_cnt, to_cnt);
+  }
+
+  std::ifstream keys(dir + "/keys");
+  std::string key_valid, key0, key1;
+  keys >> key_valid >> key0 >> key1;
+
+  std::map<int, std::string> events;
+  std::ifstream events_file(dir + "/events");
+  int event_cycle;
+  std::string event;
+  while (events_file >> event_cycle >> event) {
+    events[event_cycle] = event;
+  }
+
+  iss.start(secure_wipe);
+
+  // The number of RND requests so far and the number of cycles until we
+  // should signal that the RND data has crossed the CDC (-1 if there's no
+  // request in flight).
+  uint32_t rnd_reqs = 0;
+  int rnd_wait = -1;
+
+  for (int cycle = 0; cycle < max_cycles; ++cycle) {
+    if (cycle == 3) {
+      for (uint32_t i = 0; i < 8; ++i) {
+        iss.edn_urnd_step(0x1000u * cycle + 0x1234567u * (i + 1));
+      }
+    }
+    if (cycle == 5) {
+      iss.edn_urnd_cdc_done();
+      if (key_valid == "1") {
+        iss.set_keymgr_value(ParseKey(key0), ParseKey(key1), true);
+      }
+    }
+    if (rnd_wait == 0) {
+      iss.edn_rnd_cdc_done();
+      rnd_wait = -1;
+    } else if (rnd_wait > 0) {
+      --rnd_wait;
+    }
+
+    auto it = events.find(cycle);
+    if (it != events.end()) {
+      if (it->second == "imem") {
+        iss.invalidate_imem();
+      } else if (it->second == "dmem") {
+        iss.invalidate_dmem();
+      } else if (it->second == "esc") {
+        iss.send_lc_escalation();
+      }
+    }
+
+    OtbnIssCycle result;
+    iss.step(true, &result);
+
+    printf("%d [", cycle);
+    bool first = true;
+    for (int i = 0; i < kNumMirroredRegs; ++i) {
+      if ((result.updates >> i) & 1) {
+        printf("%s%s=%08x", first ? "" : " ", kMirroredRegNames[i],
+               result.values[i]);
+        first = false;
+      }
+    }
+    printf("]");
+    for (size_t i = 0; i < result.trace.size(); ++i) {
+      printf("%s%s", i ? " | " : " ", result.trace[i].c_str());
+    }
+    printf("\n");
+
+    if (((result.updates >> kMirRndReq) & 1) && result.values[kMirRndReq] &&
+        rnd_wait < 0) {
+      ++rnd_reqs;
+      for (uint32_t i = 0; i < 8; ++i) {
+        iss.edn_rnd_step(0x9e3779b9u * (rnd_reqs * 8 + i));
+      }
+      rnd_wait = 2;
+    }
+
+    // Stop when the operation has finished (when STATUS goes back to idle or
+    // to locked).
+    if (((result.updates >> kMirStatus) & 1) &&
+        (result.values[kMirStatus] == 0x00 ||
+         result.values[kMirStatus] == 0xff)) {
+      break;
+    }
+  }
+
+  iss.dump_d(dir + "/dmem_native");
+
+  printf("GPRS");
+  for (unsigned i = 0; i < 32; ++i) {
+    printf(" %08x", iss.peek_gpr(i));
+  }
+  printf("\nWDRS");
+  for (unsigned i = 0; i < 32; ++i) {
+    printf(" ");
+    const OtbnIss::u256_t &wdr = iss.peek_wdr(i);
+    for (int j = 7; j >= 0; --j) {
+      printf("%08x", wdr[j]);
+    }
+  }
+  printf("\nCALLSTACK");
+  for (uint32_t value : iss.get_call_stack()) {
+    printf(" %08x", value);
+  }
+  printf("\n");
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  if (argc != 4) {
+    std::cerr << "Usage: " << argv[0]
+              << " <dir> <max-cycles> <secure-wipe>\n";
+    return 2;
+  }
+
+  try {
+    return Run(argv[1], atoi(argv[2]), atoi(argv[3]) != 0);
+  } catch (const std::runtime_error &err) {
+    // The Python ISS fails in the same situations, so native_iss_test.py
+    // only checks that both models failed.
+    std::cerr << "ERROR: " << err.what() << "\n";
+    return 1;
+  }
+}
@@ -0,0 +1,419 @@
+# Copyright lowRISC contributors.
+# Licensed under the Apache License, Version 2.0, see LICENSE for details.
+# SPDX-License-Identifier: Apache-2.0
+
+'''Differential test of the native ISS against this one
+
+The native ISS (OtbnIss in hw/ip/otbn/dv/model/otbn_iss.cc) is a C++ port
+of this simulator, which ISSWrapper uses instead of a stepped.py subprocess
+when OTBN_ISS=native. This test builds a small driver for it
+(native_iss_driver.cc) with the host C++ compiler, then runs random programs
+on both models with identical stimulus from a simple testbench. It checks
+that the two generate the same trace lines and changes to external
+registers on every cycle, and that they end with the same registers, call
+stack and DMEM contents.
+
+Each test case is a directory containing:
+
+  imem, dmem:  IMEM and DMEM contents, in the format used by load_i and
+               load_d (a validity byte, then a 32-bit little-endian word)
+
+  loopwarps:   One "addr from_cnt to_cnt" line per loop warp
+
+  keys:        "valid key0 key1": the sideloaded keys (as hex)
+
+  events:      Optional "cycle event" lines, where event is imem or dmem
+               (invalidate the memory) or esc (lifecycle escalation)
+
+The programs are mostly made of valid instructions with operands chosen to
+keep them running for a while, but a few have things like bad addresses or
+CSR indices so that the error paths get exercised too.
+
+'''
+
+import os
+import random
+import shutil
+import struct
+import subprocess
+from typing import Dict, Optional
+
+import py
+import pytest
+
+import stepped
+from sim.sim import OTBNSim
+from shared.insn_yaml import InsnsFile, load_insns_yaml
+
+MODEL_DIR = os.path.normpath(os.path.join(os.path.dirname(__file__),
+                                          '../../model'))
+DRIVER_SRC = os.path.join(os.path.dirname(__file__), 'native_iss_driver.cc')
+
+# The number of random programs to run. Seeds with an odd number run with
+# secure wipe enabled.
+NUM_SEEDS = 128
+
+# The maximum number of cycles to simulate for each program
+MAX_CYCLES = 3000
+
+# The names of the external registers that the native ISS mirrors, in the
+# order used by OtbnIssCycle.
+MIRRORED_REGS = ['STATUS', 'INSN_CNT', 'ERR_BITS',
+                 'STOP_PC', 'RND_REQ', 'WIPE_START']
+
+# Base instructions that write a GPR given by bits 11:7 from registers given by
+# bits 19:15 and (for the register-register forms) 24:20.
+_ALU_RR = ['add', 'sub', 'sll', 'srl', 'sra', 'and', 'or', 'xor']
+_ALU_RI = ['addi', 'lui', 'slli', 'srli', 'srai', 'andi', 'ori', 'xori']
+
+# GPRs x2..x5 are set to small values at the start of each program, so that
+# they can be used for indirect WDR accesses, loop counts and the like.
+_SMALL_GPRS = [2, 3, 4, 5]
+
+
+def _set_bits(word: int, msb: int, lsb: int, value: int) -> int:
+    mask = ((1 << (msb - lsb + 1)) - 1) << lsb
+    return (word & ~mask) | ((value << lsb) & mask)
+
+
+class _ProgramGen:
+    '''Generates a random test case'''
+    def __init__(self, insns: InsnsFile, seed: int) -> None:
+        self.rng = random.Random(seed)
+        self.mnems = [insn.mnemonic
+                      for insn in insns.insns if insn.encoding is not None]
+        self.masks = {insn.mnemonic: insn.encoding.get_masks()
+                      for insn in insns.insns if insn.encoding is not None}
+        # How often to generate "bad" operands. Some programs get lots of them
+        # (and will usually stop with an error quickly) and others fewer.
+        self.err_rate = self.rng.choice([0.1, 0.3, 1.0])
+
+    def _chance(self, prob: float) -> bool:
+        return self.rng.random() < prob
+
+    def _gpr(self, allow_x1: bool) -> int:
+        # Avoid x1 (the call stack) and the small GPRs, apart from the odd
+        # push or pop of x1.
+        if allow_x1 and self._chance(0.01 * self.err_rate):
+            return 1
+        return self.rng.choice([0, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 31])
+
+    def _dmem_offset(self, bits: int) -> int:
+        if self._chance(0.05 * self.err_rate):
+            return self.rng.getrandbits(bits)
+        return 4 * self.rng.randrange(0, 512)
+
+    def _gen_word(self) -> int:
+        rng = self.rng
+        mnem = 'ecall' if self._chance(0.003) else rng.choice(self.mnems)
+        if mnem == 'ecall' and self._chance(0.7):
+            mnem = 'addi'
+
+        # Start with random bits that match the instruction's encoding
+        m0, m1 = self.masks[mnem]
+        word = (rng.getrandbits(32) & ~m0) | m1
+
+        # Now constrain some of the operands
+        if mnem in _ALU_RR or mnem in _ALU_RI:
+            word = _set_bits(word, 11, 7, self._gpr(True))
+            word = _set_bits(word, 19, 15, self._gpr(True))
+            if mnem in _ALU_RR:
+                word = _set_bits(word, 24, 20, self._gpr(True))
+
+        elif mnem == 'lw':
+            word = _set_bits(word, 19, 15, 0)
+            word = _set_bits(word, 11, 7, self._gpr(True))
+            word = _set_bits(word, 31, 20, self._dmem_offset(12))
+
+        elif mnem == 'sw':
+            word = _set_bits(word, 19, 15, 0)
+            word = _set_bits(word, 24, 20, self._gpr(True))
+            off = self._dmem_offset(12)
+            word = _set_bits(word, 31, 25, off >> 5)
+            word = _set_bits(word, 11, 7, off)
+
+        elif mnem in ['beq', 'bne']:
+            word = _set_bits(word, 19, 15, self._gpr(False))
+            word = _set_bits(word, 24, 20, self._gpr(False))
+            off = 4 * rng.randrange(-16, 32) & 0x1fff
+            word = _set_bits(word, 31, 31, off >> 12)
+            word = _set_bits(word, 7, 7, off >> 11)
+            word = _set_bits(word, 30, 25, off >> 5)
+            word = _set_bits(word, 11, 8, off >> 1)
+
+        elif mnem == 'jal':
+            word = _set_bits(word, 11, 7, rng.choice([0, 1, 1, 1, 6]))
+            off = 4 * rng.randrange(-8, 32) & 0x1fffff
+            word = _set_bits(word, 31, 31, off >> 20)
+            word = _set_bits(word, 19, 12, off >> 12)
+            word = _set_bits(word, 20, 20, off >> 11)
+            word = _set_bits(word, 30, 21, off >> 1)
+
+        elif mnem == 'jalr':
+            # Usually a return
+            bad = self.err_rate
+            word = _set_bits(word, 11, 7,
+                             rng.choice([1, 6]) if self._chance(0.2 * bad)
+                             else 0)
+            word = _set_bits(word, 19, 15,
+                             rng.choice([1, 1, 0, 6])
+                             if self._chance(0.3 * bad) else 1)
+            word = _set_bits(word, 31, 20,
+                             rng.getrandbits(12) if self._chance(0.1 * bad)
+                             else 0)
+
+        elif mnem in ['csrrs', 'csrrw']:
+            word = _set_bits(word, 11, 7, self._gpr(False))
+            word = _set_bits(word, 19, 15, self._gpr(False))
+            csr = rng.choice([0x7c0, 0x7c1, 0x7c8, 0x7d0, 0x7d3, 0x7d7,
+                              0x7d8, 0xfc0, 0xfc1])
+            if self._chance(0.1 * self.err_rate):
+                csr = rng.getrandbits(12)
+            word = _set_bits(word, 31, 20, csr)
+
+        elif mnem == 'loop':
+            word = _set_bits(word, 19, 15, rng.choice(_SMALL_GPRS + [0, 6]))
+            word = _set_bits(word, 31, 20, rng.randrange(0, 6))
+
+        elif mnem == 'loopi':
+            word = _set_bits(word, 19, 15, 0)
+            word = _set_bits(word, 11, 7, rng.randrange(0, 4))
+            word = _set_bits(word, 31, 20, rng.randrange(0, 6))
+
+        elif mnem in ['bn.lid', 'bn.sid']:
+            word = _set_bits(word, 19, 15,
+                             rng.choice([1, 2, 3])
+                             if self._chance(0.1 * self.err_rate) else 0)
+            word = _set_bits(word, 24, 20, rng.choice(_SMALL_GPRS + [0, 6]))
+            off = (rng.getrandbits(10) if self._chance(0.05 * self.err_rate)
+                   else rng.randrange(0, 64))
+            word = _set_bits(word, 31, 25, off)
+            word = _set_bits(word, 11, 9, off >> 7)
+            if self._chance(0.8):
+                # At most one of the increment bits
+                word = _set_bits(word, 8, 7, rng.choice([0, 1, 2]))
+
+        elif mnem == 'bn.movr':
+            word = _set_bits(word, 19, 15, rng.choice(_SMALL_GPRS + [0, 6]))
+            word = _set_bits(word, 24, 20, rng.choice(_SMALL_GPRS + [0, 6]))
+            if self._chance(0.8):
+                # At most one of the increment bits
+                inc_bit = 9 if self._chance(0.5) else 7
+                word = _set_bits(word, inc_bit, inc_bit, 0)
+
+        elif mnem in ['bn.wsrr', 'bn.wsrw']:
+            wsr = (rng.getrandbits(8) if self._chance(0.05 * self.err_rate)
+                   else rng.randrange(0, 8))
+            word = _set_bits(word, 27, 20, wsr)
+
+        return word & 0xffffffff
+
+    def gen(self, case_dir: str) -> None:
+        rng = self.rng
+        num_words = rng.choice([64, 256, 1024])
+
+        # Set the small GPRs, then fill the rest of IMEM with random
+        # instructions and end with an ECALL.
+        words = []
+        for gpr in _SMALL_GPRS:
+            addi = _set_bits(0x13, 11, 7, gpr)
+            words.append(_set_bits(addi, 31, 20, rng.randrange(0, 32)))
+        while len(words) < num_words - 1:
+            words.append(self._gen_word())
+        words.append(0x73)
+
+        with open(os.path.join(case_dir, 'imem'), 'wb') as handle:
+            for word in words:
+                valid = 0 if self._chance(0.003) else 1
+                handle.write(struct.pack('<BI', valid, word))
+
+        with open(os.path.join(case_dir, 'dmem'), 'wb') as handle:
+            for _ in range(1024):
+                valid = 0 if self._chance(0.01) else 1
+                value = rng.getrandbits(32) if valid else 0
+                handle.write(struct.pack('<BI', valid, value))
+
+        with open(os.path.join(case_dir, 'loopwarps'), 'w') as handle:
+            if self._chance(0.3):
+                for _ in range(rng.randrange(1, 4)):
+                    handle.write('{} {} {}\n'
+                                 .format(4 * rng.randrange(0, 64),
+                                         rng.randrange(0, 3),
+                                         rng.randrange(0, 4)))
+
+        with open(os.path.join(case_dir, 'keys'), 'w') as handle:
+            if self._chance(0.6):
+                handle.write('1 {:x} {:x}\n'
+                             .format(rng.getrandbits(384),
+                                     rng.getrandbits(384)))
+            else:
+                handle.write('0 0 0\n')
+
+        with open(os.path.join(case_dir, 'events'), 'w') as handle:
+            if self._chance(0.3):
+                handle.write('{} {}\n'
+                             .format(rng.randrange(6, 60),
+                                     rng.choice(['imem', 'dmem', 'esc'])))
+
+
+def _run_python(case_dir: str, secure_wipe: bool) -> str:
+    '''Run a test case on this simulator, returning its output
+
+    This drives the simulator through the same commands as ISSWrapper uses
+    (see stepped.py) and follows exactly the same policy as
+    native_iss_driver.cc, so the output should match the driver's output.
+
+    '''
+    def cmd(line: str) -> None:
+        assert stepped.on_input(sim, line) is None
+
+    sim = OTBNSim()
+    cmd('load_i ' + os.path.join(case_dir, 'imem'))
+    cmd('load_d ' + os.path.join(case_dir, 'dmem'))
+    with open(os.path.join(case_dir, 'loopwarps')) as handle:
+        for line in handle:
+            cmd('add_loop_warp ' + line)
+
+    with open(os.path.join(case_dir, 'keys')) as handle:
+        key_valid, key0, key1 = handle.read().split()
+
+    events = {}  # type: Dict[int, str]
+    with open(os.path.join(case_dir, 'events')) as handle:
+        for line in handle:
+            cycle, event = line.split()
+            events[int(cycle)] = event
+
+    cmd('configure {}'.format(int(secure_wipe)))
+    cmd('start')
+
+    out = []
+    rnd_reqs = 0
+    rnd_wait = -1
+    for cycle in range(MAX_CYCLES):
+        if cycle == 3:
+            for i in range(8):
+                urnd = (0x1000 * cycle + 0x1234567 * (i + 1)) & 0xffffffff
+                cmd('edn_urnd_step {:#x}'.format(urnd))
+        if cycle == 5:
+            cmd('edn_urnd_cdc_done')
+            if key_valid == '1':
+                cmd('set_keymgr_value 0x{} 0x{} 1'.format(key0, key1))
+        if rnd_wait == 0:
+            cmd('edn_rnd_cdc_done')
+            rnd_wait = -1
+        elif rnd_wait > 0:
+            rnd_wait -= 1
+
+        event = events.get(cycle)
+        if event == 'imem':
+            cmd('invalidate_imem')
+        elif event == 'dmem':
+            cmd('invalidate_dmem')
+        elif event == 'esc':
+            cmd('send_lc_escalation')
+
+        lines, ext_changes = stepped._step_cycle(sim)
+        updates = {c.name: c.erc.new_value for c in ext_changes}
+
+        # The native ISS doesn't generate the '!' lines for external register
+        # changes: ISSWrapper gets those from the updates mask instead.
+        trace = [line
+                 for line in '\n'.join(lines).split('\n') if lines
+                 if not line.startswith('!')]
+        upd_str = ' '.join('{}={:08x}'.format(name, updates[name])
+                           for name in MIRRORED_REGS if name in updates)
+        out.append('{} [{}]'.format(cycle, upd_str) +
+                   ''.join((' | ' if i else ' ') + line
+                           for i, line in enumerate(trace)))
+
+        if updates.get('RND_REQ') and rnd_wait < 0:
+            rnd_reqs += 1
+            for i in range(8):
+                rnd = (0x9e3779b9 * (rnd_reqs * 8 + i)) & 0xffffffff
+                cmd('edn_rnd_step {:#x}'.format(rnd))
+            rnd_wait = 2
+
+        if updates.get('STATUS') in [0x00, 0xff]:
+            break
+
+    cmd('dump_d ' + os.path.join(case_dir, 'dmem_python'))
+
+    out.append('GPRS' +
+               ''.join(' {:08x}'.format(r)
+                       for r in sim.state.gprs.peek_unsigned_values()))
+    out.append('WDRS' +
+               ''.join(' {:064x}'.format(r)
+                       for r in sim.state.wdrs.peek_unsigned_values()))
+    out.append('CALLSTACK' +
+               ''.join(' {:08x}'.format(v)
+                       for v in sim.state.peek_call_stack()))
+    return '\n'.join(out) + '\n'
+
+
+def _run_native(driver: str, case_dir: str, secure_wipe: bool) -> str:
+    '''Run a test case on the native ISS, returning its output'''
+    proc = subprocess.run([driver, case_dir, str(MAX_CYCLES),
+                           str(int(secure_wipe))],
+                          stdout=subprocess.PIPE, stderr=subprocess.PIPE,
+                          universal_newlines=True)
+    if proc.returncode == 1:
+        raise RuntimeError(proc.stderr)
+    assert proc.returncode == 0, proc.stderr
+    return proc.stdout
+
+
+@pytest.fixture(scope='module')
+def native_driver(tmpdir_factory: pytest.TempdirFactory) -> str:
+    '''Build native_iss_driver.cc, returning the path to the binary'''
+    cxx = os.environ.get('CXX', 'c++')
+    if shutil.which(cxx) is None:
+        pytest.skip('No C++ compiler ({}) to build the native ISS.'
+                    .format(cxx))
+
+    out = str(tmpdir_factory.mktemp('native_iss').join('native_iss_driver'))
+    subprocess.run([cxx, '-std=c++11', '-O2', '-I' + MODEL_DIR,
+                    '-o', out, DRIVER_SRC,
+                    os.path.join(MODEL_DIR, 'otbn_iss.cc')],
+                   check=True)
+    return out
+
+
+@pytest.fixture(scope='module')
+def insns() -> InsnsFile:
+    return load_insns_yaml()
+
+
+@pytest.mark.parametrize('seed', range(NUM_SEEDS))
+def test_native_iss(seed: int,
+                    native_driver: str,
+                    insns: InsnsFile,
+                    tmpdir: py.path.local) -> None:
+    case_dir = str(tmpdir)
+    _ProgramGen(insns, seed).gen(case_dir)
+    secure_wipe = bool(seed & 1)
+
+    # Some programs make the Python ISS fail (for example, by fetching past
+    # the end of the loaded program or by writing to a WSR that doesn't
+    # exist). The native ISS throws an exception in the same situations, so
+    # check that either both or neither of the models fail.
+    try:
+        py_out = _run_python(case_dir, secure_wipe)  # type: Optional[str]
+    except Exception:
+        py_out = None
+    try:
+        native_out = _run_native(native_driver,
+                                 case_dir, secure_wipe)  # type: Optional[str]
+    except RuntimeError:
+        native_out = None
+
+    if py_out is None or native_out is None:
+        assert py_out is None and native_out is None
+        return
+
+    assert native_out.split('\n') == py_out.split('\n')
+
+    with open(os.path.join(case_dir, 'dmem_python'), 'rb') as handle:
+        py_dmem = handle.read()
+    with open(os.path.join(case_dir, 'dmem_native'), 'rb') as handle:
+        native_dmem = handle.read()
+    assert native_dmem == py_dmem
@@ -3,65 +3,68 @@
 // SPDX-License-Identifier: Apache-2.0
 
 #include <cassert>
-#include <iomanip>
-#include <ios>
+#include <cstdio>
 #include <sstream>
 #include <stdexcept>
 #include <string>
 
 #include "log_trace_listener.h"
 
-LogTraceListener::LogTraceListener(const std::string &log_filename)
-    : trace_log(log_filename, std::fstream::out) {
+LogTraceListener::LogTraceListener(const std::string &log_filename,
+                                   Format format)
+    : trace_log(log_filename, format == Binary
+                                  ? std::fstream::out | std::fstream::binary
+                                  : std::fstream::out) {
   if (!trace_log.is_open()) {
     std::ostringstream oss;
     oss << "Could not open log file: " << log_filename;
     throw std::runtime_error(oss.str());
   }
+
+  if (format == Binary) {
+    binary_log.reset(new OtbnBinaryTraceLog(trace_log));
+  }
 }
 
-void LogTraceListener::AcceptTraceString(const std::string &trace,
+void LogTraceListener::AcceptTraceRecord(const OtbnTraceRecord &record,
                                          unsigned int cycle_count) {
   assert(trace_log.is_open());
 
-  // Split the trace up into a vector of strings, one per line
-  auto trace_lines = SplitTraceLines(trace);
+  if (binary_log) {
+    binary_log->Append(record, cycle_count);
+    return;
+  }
 
-  // Write out the lines from the trace
-  bool first_line = true;
-  for (auto &line : trace_lines) {
-    if (first_line) {
-      if (line.size() > 1) {
-        // It is expected the first line of any trace output is an 'E' or 'S'
-        // line (instruction execute or instruction stall)
-        bool is_e_or_s_line = line[0] == 'E' || line[0] == 'S';
+  // If there is an instruction header, the first line is an 'E' or 'S' line
+  // with the cycle count added after the type. Otherwise, output a special
+  // '!' line, only giving the cycle count.
+  const OtbnTraceHeader &insn = record.insn;
+  bool has_insn = insn.type != OtbnTraceHeader::None;
 
-        // Output the beginning of the first line adding a cycle count. A
-        // special '!' line, only giving the cycle count, is output if the first
-        // line isn't an 'E' or 'S' line.
-        std::ios old_state(nullptr);
-        old_state.copyfmt(trace_log);
-        trace_log << (is_e_or_s_line ? line[0] : '!') << " " << std::setw(9)
-                  << std::setfill('0') << cycle_count;
-        trace_log.copyfmt(old_state);
+  char count_buf[16];
+  int count_len = snprintf(count_buf, sizeof count_buf, "%09u", cycle_count);
 
-        if (is_e_or_s_line) {
-          // If this is an expected 'E' or 'S' line write the rest of it out
-          trace_log << line.substr(1) << "\n";
-        } else {
-          // Otherwise leave the '!' line on it's own and dump this line out
-          // indented.
-          trace_log << "\n    " << line << "\n";
-        }
-      } else {
-        trace_log << "ERR: Bad line at " << cycle_count
-                  << " line should be more than 1 character: " << line << "\n";
-      }
+  if (has_insn) {
+    trace_log << (insn.type == OtbnTraceHeader::Stall ? 'S' : 'E') << ' ';
+    trace_log.write(count_buf, count_len);
+    trace_log << ' ';
+    insn.PrintInsn(trace_log);
+    trace_log << "\n";
+  } else {
+    trace_log << "! ";
+    trace_log.write(count_buf, count_len);
+    trace_log << "\n";
+  }
 
-      first_line = false;
-    } else {
-      // All lines other than the first are indented.
-      trace_log << "    " << line << "\n";
-    }
+  // All lines other than the first are indented.
+  if (record.wipe.type != OtbnTraceHeader::None) {
+    trace_log << "    ";
+    record.wipe.Print(trace_log);
+    trace_log << "\n";
+  }
+  for (unsigned i = 0; i < record.num_items; ++i) {
+    trace_log << "    ";
+    record.items[i].Print(trace_log);
+    trace_log << "\n";
   }
 }
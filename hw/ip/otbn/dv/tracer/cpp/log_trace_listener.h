@@ -6,34 +6,47 @@
 #define OPENTITAN_HW_IP_OTBN_DV_TRACER_CPP_LOG_TRACE_LISTENER_H_
 
 #include <fstream>
+#include <memory>
 #include <string>
 
+#include "otbn_binary_trace_log.h"
 #include "otbn_trace_listener.h"
 
 /**
  * An OtbnTraceListener that dumps the trace to a log file, with some minimal
  * pretty printing.
  *
- * It examines the first line of any trace output, expecting it to be an 'E' or
- * 'S' (execute or stall) line. If this is the case it adds a cycle count
- * following the 'E' or 'S' and then dumps the trace. Lines that follow in the
- * 'E' or 'S' line in the same clock cycle are indented by four spaces.
+ * This is the only place where trace records get rendered as text. If a record
+ * has an instruction header, it is written as an 'E' or 'S' (execute or stall)
+ * line with a cycle count following the 'E' or 'S'. The other lines for the
+ * same clock cycle follow, indented by four spaces.
  *
- * If an 'E' or 'S' line isn't seen as the first line it prints a special '!'
- * line that gives the cycle count and dumps the rest of the trace indented by
- * four spaces.
+ * If a record has no instruction header it prints a special '!' line that
+ * gives the cycle count and dumps the rest of the record indented by four
+ * spaces.
+ *
+ * In binary mode, records are written with OtbnBinaryTraceLog instead. This is
+ * much smaller than the text format for long runs, and otbn_trace_log.py can
+ * convert it back to text.
  */
 class LogTraceListener : public OtbnTraceListener {
+ public:
+  enum Format {
+    Text,
+    Binary,
+  };
+
  private:
   std::ofstream trace_log;
+  std::unique_ptr<OtbnBinaryTraceLog> binary_log;
 
  public:
   /**
-   * Constructor that takes a log filename to write trace output to. It throws
-   * std::runtime_error if the file cannot be opened.
+   * Constructor that takes a log filename to write trace output to, in the
+   * given format. It throws std::runtime_error if the file cannot be opened.
    */
-  LogTraceListener(const std::string &log_filename);
-  void AcceptTraceString(const std::string &trace,
+  LogTraceListener(const std::string &log_filename, Format format = Text);
+  void AcceptTraceRecord(const OtbnTraceRecord &record,
                          unsigned int cycle_count) override;
 };
 
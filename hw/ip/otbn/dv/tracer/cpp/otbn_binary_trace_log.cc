@@ -0,0 +1,244 @@
+// Copyright lowRISC contributors.
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+
+#include "otbn_binary_trace_log.h"
+
+#include <cassert>
+
+// Magic numbers for the different parts of the file. See README.md for the
+// layout.
+static const char kFileMagic[8] = {'O', 'T', 'B', 'N', 'T', 'R', 'C', 'E'};
+static const uint32_t kFileVersion = 1;
+static const uint32_t kBlockMagic = 0x4b4c4254;  // "TBLK"
+static const uint32_t kIndexMagic = 0x58444954;  // "TIDX"
+
+// Bits in the flags byte at the start of each record
+static const uint8_t kFlagFetchErr = 1 << 2;
+static const uint8_t kFlagRepeatInsn = 1 << 5;
+
+// Bits in the descriptor byte at the start of each item
+static const uint8_t kDescBadMask = 1 << 5;
+static const uint8_t kDescNarrow = 1 << 6;
+
+OtbnBinaryTraceLog::OtbnBinaryTraceLog(std::ostream &os)
+    : os_(os), finished_(false), offset_(0) {
+  os_.write(kFileMagic, sizeof kFileMagic);
+  offset_ += sizeof kFileMagic;
+  WriteU32(kFileVersion);
+  WriteU32(kBlockRecords);
+
+  block_.num_records = 0;
+  payload_.reserve(1 << 16);
+}
+
+OtbnBinaryTraceLog::~OtbnBinaryTraceLog() {
+  if (!finished_) {
+    Finish();
+  }
+}
+
+void OtbnBinaryTraceLog::Append(const OtbnTraceRecord &record,
+                                unsigned int cycle_count) {
+  assert(!finished_);
+
+  if (block_.num_records == 0) {
+    StartBlock(cycle_count);
+  }
+
+  PutVarint(cycle_count - prev_cycle_);
+  prev_cycle_ = cycle_count;
+  block_.last_cycle = cycle_count;
+
+  // The flags byte gives the instruction header type in bits 0-1 and the
+  // wipe header type in bits 3-4.
+  const OtbnTraceHeader &insn = record.insn;
+  bool has_insn = insn.type != OtbnTraceHeader::None;
+  uint8_t flags = has_insn ? (uint8_t)insn.type : 0;
+  if (record.wipe.type != OtbnTraceHeader::None) {
+    flags |= (record.wipe.type - OtbnTraceHeader::WipeInProgress + 1) << 3;
+  }
+
+  bool repeat = false;
+  if (has_insn) {
+    if (insn.fetch_err) {
+      flags |= kFlagFetchErr;
+    }
+    // An instruction that stalls appears in several records in a row with the
+    // same PC and instruction word. Don't repeat them.
+    repeat = prev_insn_vld_ && insn.pc == prev_pc_ &&
+             (insn.fetch_err || insn.insn == prev_insn_);
+    if (repeat) {
+      flags |= kFlagRepeatInsn;
+    }
+    if (insn.pc < block_.min_pc) {
+      block_.min_pc = insn.pc;
+    }
+    if (insn.pc > block_.max_pc) {
+      block_.max_pc = insn.pc;
+    }
+  }
+  PutU8(flags);
+
+  if (has_insn && !repeat) {
+    // Zigzag-encode the change in PC, so that small backwards jumps are small
+    int32_t pc_delta = (int32_t)(insn.pc - prev_pc_);
+    PutVarint(((uint32_t)pc_delta << 1) ^ (uint32_t)(pc_delta >> 31));
+    if (!insn.fetch_err) {
+      PutU32(insn.insn);
+    }
+  }
+  if (has_insn) {
+    prev_pc_ = insn.pc;
+    if (!insn.fetch_err) {
+      prev_insn_ = insn.insn;
+    }
+    prev_insn_vld_ = !insn.fetch_err;
+  }
+
+  PutVarint(record.num_items);
+  for (unsigned i = 0; i < record.num_items; ++i) {
+    const OtbnTraceItem &item = record.items[i];
+    bool narrow = item.num_words == 1;
+
+    uint8_t desc = item.kind | (item.loc << 2);
+    if (item.bad_mask) {
+      desc |= kDescBadMask;
+    }
+    if (narrow) {
+      desc |= kDescNarrow;
+    }
+    PutU8(desc);
+
+    if (item.loc == OtbnTraceItem::Mem) {
+      PutVarint(item.addr);
+    } else {
+      PutU8(item.idx);
+      unsigned bit = 32 * item.loc + item.idx;
+      assert(bit < 128);
+      block_.regs[bit / 64] |= (uint64_t)1 << (bit % 64);
+    }
+
+    if (narrow) {
+      PutVarint(item.data[0]);
+    } else {
+      PutWords(item.data);
+    }
+    if (item.bad_mask) {
+      PutWords(item.mask);
+    }
+  }
+
+  if (++block_.num_records == kBlockRecords) {
+    FlushBlock();
+  }
+}
+
+void OtbnBinaryTraceLog::Finish() {
+  assert(!finished_);
+  FlushBlock();
+
+  // The index is a list of (offset, summary) pairs, one per block, followed
+  // by a trailer that gives the offset of the index.
+  uint64_t index_offset = offset_;
+  for (size_t i = 0; i < block_offsets_.size(); ++i) {
+    WriteU64(block_offsets_[i]);
+    WriteSummary(block_summaries_[i]);
+  }
+  WriteU64(index_offset);
+  WriteU32(block_offsets_.size());
+  WriteU32(kIndexMagic);
+
+  os_.flush();
+  finished_ = true;
+}
+
+void OtbnBinaryTraceLog::StartBlock(uint32_t cycle) {
+  block_.num_records = 0;
+  block_.first_cycle = cycle;
+  block_.last_cycle = cycle;
+  block_.min_pc = UINT32_MAX;
+  block_.max_pc = 0;
+  block_.regs[0] = 0;
+  block_.regs[1] = 0;
+
+  payload_.clear();
+  prev_cycle_ = cycle;
+  prev_pc_ = 0;
+  prev_insn_ = 0;
+  prev_insn_vld_ = false;
+}
+
+void OtbnBinaryTraceLog::FlushBlock() {
+  if (block_.num_records == 0) {
+    return;
+  }
+
+  block_offsets_.push_back(offset_);
+  block_summaries_.push_back(block_);
+
+  WriteU32(kBlockMagic);
+  WriteU32(payload_.size());
+  WriteSummary(block_);
+  os_.write((const char *)payload_.data(), payload_.size());
+  offset_ += payload_.size();
+
+  block_.num_records = 0;
+}
+
+void OtbnBinaryTraceLog::PutU32(uint32_t value) {
+  for (int i = 0; i < 4; ++i) {
+    payload_.push_back(value >> (8 * i));
+  }
+}
+
+void OtbnBinaryTraceLog::PutVarint(uint32_t value) {
+  // LEB128: 7 bits at a time, least significant first, with the top bit set
+  // on every byte but the last.
+  while (value >= 0x80) {
+    payload_.push_back((value & 0x7f) | 0x80);
+    value >>= 7;
+  }
+  payload_.push_back(value);
+}
+
+void OtbnBinaryTraceLog::PutWords(const uint32_t *words) {
+  // A byte with a bit set for each non-zero word, followed by those words.
+  // Wide values often have zeros in their upper words.
+  uint8_t nonzero = 0;
+  for (unsigned i = 0; i < kOtbnTraceWlenWords; ++i) {
+    if (words[i]) {
+      nonzero |= 1 << i;
+    }
+  }
+  PutU8(nonzero);
+  for (unsigned i = 0; i < kOtbnTraceWlenWords; ++i) {
+    if (words[i]) {
+      PutU32(words[i]);
+    }
+  }
+}
+
+void OtbnBinaryTraceLog::WriteSummary(const BlockSummary &summary) {
+  WriteU32(summary.num_records);
+  WriteU32(summary.first_cycle);
+  WriteU32(summary.last_cycle);
+  WriteU32(summary.min_pc);
+  WriteU32(summary.max_pc);
+  WriteU64(summary.regs[0]);
+  WriteU64(summary.regs[1]);
+}
+
+void OtbnBinaryTraceLog::WriteU32(uint32_t value) {
+  char buf[4];
+  for (int i = 0; i < 4; ++i) {
+    buf[i] = value >> (8 * i);
+  }
+  os_.write(buf, sizeof buf);
+  offset_ += sizeof buf;
+}
+
+void OtbnBinaryTraceLog::WriteU64(uint64_t value) {
+  WriteU32(value);
+  WriteU32(value >> 32);
+}
@@ -0,0 +1,87 @@
+// Copyright lowRISC contributors.
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef OPENTITAN_HW_IP_OTBN_DV_TRACER_CPP_OTBN_BINARY_TRACE_LOG_H_
+#define OPENTITAN_HW_IP_OTBN_DV_TRACER_CPP_OTBN_BINARY_TRACE_LOG_H_
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+#include "otbn_trace_record.h"
+
+/**
+ * Writes OTBN trace records to a compact, indexed binary log.
+ *
+ * Records are delta-encoded and grouped into blocks that can each be decoded
+ * on their own. Every block starts with a summary giving the range of cycles
+ * and PCs that it covers, together with a bitmap of the registers that it
+ * touches. When the log is finished, an index of the block summaries is
+ * written to the end of the file so that a reader can seek straight to the
+ * blocks it needs. The format is described in README.md and can be read with
+ * `otbn_trace_log.py`.
+ */
+class OtbnBinaryTraceLog {
+ public:
+  /**
+   * Start a log, writing the file header to os. The stream must have been
+   * opened in binary mode and must outlive this object.
+   */
+  explicit OtbnBinaryTraceLog(std::ostream &os);
+
+  /** Calls Finish() if it hasn't been called already. */
+  ~OtbnBinaryTraceLog();
+
+  /** Append a record for the given cycle. */
+  void Append(const OtbnTraceRecord &record, unsigned int cycle_count);
+
+  /** Flush the current block and write the index. */
+  void Finish();
+
+  // The maximum number of records in a block
+  static const uint32_t kBlockRecords = 4096;
+
+ private:
+  struct BlockSummary {
+    uint32_t num_records;
+    uint32_t first_cycle;
+    uint32_t last_cycle;
+    uint32_t min_pc;
+    uint32_t max_pc;
+    // Bit (32 * loc + idx) is set if the block reads or writes register idx
+    // at location loc (see OtbnTraceItem::Loc).
+    uint64_t regs[2];
+  };
+
+  void StartBlock(uint32_t cycle);
+  void FlushBlock();
+
+  void PutU8(uint8_t value) { payload_.push_back(value); }
+  void PutU32(uint32_t value);
+  void PutVarint(uint32_t value);
+  void PutWords(const uint32_t *words);
+
+  void WriteSummary(const BlockSummary &summary);
+  void WriteU32(uint32_t value);
+  void WriteU64(uint64_t value);
+
+  std::ostream &os_;
+  bool finished_;
+  // The number of bytes written to os_ so far
+  uint64_t offset_;
+
+  // The block that is being built up
+  BlockSummary block_;
+  std::vector<uint8_t> payload_;
+  uint32_t prev_cycle_;
+  uint32_t prev_pc_;
+  uint32_t prev_insn_;
+  bool prev_insn_vld_;
+
+  // Offsets and summaries of blocks that have been written, for the index
+  std::vector<uint64_t> block_offsets_;
+  std::vector<BlockSummary> block_summaries_;
+};
+
+#endif  // OPENTITAN_HW_IP_OTBN_DV_TRACER_CPP_OTBN_BINARY_TRACE_LOG_H_
@@ -5,43 +5,26 @@
 #ifndef OPENTITAN_HW_IP_OTBN_DV_TRACER_CPP_OTBN_TRACE_LISTENER_H_
 #define OPENTITAN_HW_IP_OTBN_DV_TRACER_CPP_OTBN_TRACE_LISTENER_H_
 
-#include <sstream>
-#include <string>
-#include <vector>
+#include "otbn_trace_record.h"
 
 /**
  * Base class for anything that wants to examine trace output from OTBN. The
- * simulation that hosts the tracer is responsible for setting up listeners and
- * routing the DPI `accept_otbn_trace_string` calls to them.
+ * simulation that hosts the tracer is responsible for setting up listeners.
+ * Trace records from the DPI calls in otbn_tracer.sv are routed to them by
+ * OtbnTraceSource.
  */
 class OtbnTraceListener {
  public:
   /**
-   * Helper function to split an OTBN trace output up into individual lines.
+   * Called to process an OTBN trace record, called a maximum of once per cycle
    *
-   * @param trace Trace output from OTBN
-   * @return A vector of lines from the trace
-   */
-  static std::vector<std::string> SplitTraceLines(const std::string &trace) {
-    std::stringstream trace_ss(trace);
-    std::string trace_line;
-
-    std::vector<std::string> trace_lines;
-
-    while (std::getline(trace_ss, trace_line, '\n')) {
-      trace_lines.push_back(trace_line);
-    }
-
-    return trace_lines;
-  }
-
-  /**
-   * Called to process an OTBN trace output, called a maximum of once per cycle
+   * The record is only valid for the duration of the call: a listener that
+   * needs it later must take a copy.
    *
-   * @param trace Trace output from OTBN
-   * @param cycle_count The cycle count associated with the trace output
+   * @param record Trace record from OTBN
+   * @param cycle_count The cycle count associated with the trace record
    */
-  virtual void AcceptTraceString(const std::string &trace,
+  virtual void AcceptTraceRecord(const OtbnTraceRecord &record,
                                  unsigned int cycle_count) = 0;
   virtual ~OtbnTraceListener() {}
 };
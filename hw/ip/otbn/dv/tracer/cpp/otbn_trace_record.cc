@@ -0,0 +1,147 @@
+// Copyright lowRISC contributors.
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+
+#include "otbn_trace_record.h"
+
+#include <cassert>
+#include <cstdio>
+#include <ostream>
+
+// Write a 32-bit value as 0x followed by 8 hex digits
+static void print_u32(std::ostream &os, uint32_t value) {
+  char buf[16];
+  int len = snprintf(buf, sizeof buf, "0x%08x", value);
+  os.write(buf, len);
+}
+
+void OtbnTracePrintWlen(std::ostream &os, const uint32_t *words) {
+  // "0x" followed by 8 groups of 8 hex digits, separated by '_'
+  char buf[2 + kOtbnTraceWlenWords * 9 + 1];
+  char *pos = buf;
+  *pos++ = '0';
+  *pos++ = 'x';
+  for (int i = kOtbnTraceWlenWords - 1; i >= 0; --i) {
+    pos += snprintf(pos, 9, "%08x", words[i]);
+    if (i != 0) {
+      *pos++ = '_';
+    }
+  }
+  os.write(buf, pos - buf);
+}
+
+const char *OtbnTraceIsprName(unsigned ispr) {
+  // Indexed by otbn_pkg::ispr_e. The key sideload ISPRs don't have a name in
+  // the trace.
+  static const char *const names[] = {"MOD", "RND", "ACC", "FLAGS", "URND"};
+  if (ispr >= sizeof names / sizeof names[0]) {
+    return "UNKNOWN_ISPR";
+  }
+  return names[ispr];
+}
+
+void OtbnTraceHeader::PrintInsn(std::ostream &os) const {
+  os << "PC: ";
+  print_u32(os, pc);
+  os << ", insn: ";
+  if (fetch_err) {
+    os << "??";
+  } else {
+    print_u32(os, insn);
+  }
+}
+
+void OtbnTraceHeader::Print(std::ostream &os) const {
+  switch (type) {
+    case Stall:
+    case Exec:
+      os << (type == Stall ? "S " : "E ");
+      PrintInsn(os);
+      break;
+    case WipeInProgress:
+      os << "U ";
+      break;
+    case WipeComplete:
+      os << "V ";
+      break;
+    default:
+      assert(0);
+  }
+}
+
+void OtbnTraceItem::Print(std::ostream &os) const {
+  switch (kind) {
+    case RegRead:
+      os << "< ";
+      break;
+    case RegWrite:
+      os << "> ";
+      break;
+    case MemRead:
+      os << "R ";
+      break;
+    case MemWrite:
+      os << "W ";
+      break;
+  }
+
+  char buf[64];
+  int len;
+  switch (loc) {
+    case Gpr:
+      len = snprintf(buf, sizeof buf, "x%02u: ", (unsigned)idx);
+      os.write(buf, len);
+      print_u32(os, data[0]);
+      break;
+
+    case Wdr:
+      len = snprintf(buf, sizeof buf, "w%02u: ", (unsigned)idx);
+      os.write(buf, len);
+      OtbnTracePrintWlen(os, data);
+      break;
+
+    case Ispr:
+      os << OtbnTraceIsprName(idx) << ": ";
+      OtbnTracePrintWlen(os, data);
+      break;
+
+    case Flags:
+      len = snprintf(buf, sizeof buf, "FLAGS%u: {C: %u, M: %u, L: %u, Z: %u}",
+                     (unsigned)idx, data[0] & 1, (data[0] >> 1) & 1,
+                     (data[0] >> 2) & 1, (data[0] >> 3) & 1);
+      os.write(buf, len);
+      break;
+
+    case Mem:
+      os << "[";
+      print_u32(os, addr);
+      os << "]: ";
+      if (bad_mask) {
+        os << "Mask ERR Mask: ";
+        OtbnTracePrintWlen(os, mask);
+        os << " Data: ";
+        OtbnTracePrintWlen(os, data);
+      } else if (num_words == 1) {
+        print_u32(os, data[0]);
+      } else {
+        OtbnTracePrintWlen(os, data);
+      }
+      break;
+  }
+}
+
+void OtbnTraceRecord::Clear() {
+  insn.type = OtbnTraceHeader::None;
+  wipe.type = OtbnTraceHeader::None;
+  num_items = 0;
+}
+
+bool OtbnTraceRecord::Empty() const {
+  return insn.type == OtbnTraceHeader::None &&
+         wipe.type == OtbnTraceHeader::None && num_items == 0;
+}
+
+OtbnTraceItem &OtbnTraceRecord::AddItem() {
+  assert(num_items < kMaxItems);
+  return items[num_items++];
+}
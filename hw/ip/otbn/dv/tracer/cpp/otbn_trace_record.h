@@ -0,0 +1,126 @@
+// Copyright lowRISC contributors.
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef OPENTITAN_HW_IP_OTBN_DV_TRACER_CPP_OTBN_TRACE_RECORD_H_
+#define OPENTITAN_HW_IP_OTBN_DV_TRACER_CPP_OTBN_TRACE_RECORD_H_
+
+#include <cstdint>
+#include <iosfwd>
+
+// The number of 32-bit words in a WLEN-bit value
+static const unsigned kOtbnTraceWlenWords = 8;
+
+// The header of a trace record: either an instruction stalling or executing,
+// or a step of the secure wipe.
+struct OtbnTraceHeader {
+  enum Type : uint8_t {
+    None,
+    Stall,
+    Exec,
+    WipeInProgress,
+    WipeComplete,
+  };
+
+  Type type;
+
+  // The remaining fields are only meaningful for Stall and Exec headers. If
+  // fetch_err is set, we saw an IMEM integrity error and insn is not valid.
+  bool fetch_err;
+  uint32_t pc;
+  uint32_t insn;
+
+  // Write the header line in the text format described in README.md (with no
+  // trailing newline).
+  void Print(std::ostream &os) const;
+
+  // Write the "PC: ..., insn: ..." part of a Stall or Exec header line.
+  void PrintInsn(std::ostream &os) const;
+};
+
+// A body item in a trace record: a register or memory read or write.
+struct OtbnTraceItem {
+  enum Kind : uint8_t {
+    RegRead,
+    RegWrite,
+    MemRead,
+    MemWrite,
+  };
+
+  // The location that is read or written. The numeric values must match the
+  // TraceLoc* parameters in otbn_tracer.sv.
+  enum Loc : uint8_t {
+    Gpr = 0,
+    Wdr = 1,
+    Ispr = 2,
+    Flags = 3,
+    Mem = 4,
+  };
+
+  Kind kind;
+  Loc loc;
+
+  // For Gpr and Wdr, the register index. For Ispr, the otbn_pkg::ispr_e
+  // value. For Flags, the flag group.
+  uint8_t idx;
+
+  // The number of meaningful words in data: 1 for GPRs, flags and 32-bit
+  // memory writes; kOtbnTraceWlenWords otherwise.
+  uint8_t num_words;
+
+  // True for a memory write whose mask was neither a full WLEN write nor a
+  // single aligned 32-bit word. In this case, mask holds the write mask.
+  bool bad_mask;
+
+  // For memory accesses, the byte address. For a 32-bit memory write, this
+  // is the address of the word that was written.
+  uint32_t addr;
+
+  // The value read or written, least significant word first. Flags are
+  // packed into the bottom four bits of data[0] (C, M, L, Z from LSB).
+  uint32_t data[kOtbnTraceWlenWords];
+  uint32_t mask[kOtbnTraceWlenWords];
+
+  // Write the line for this item in the text format described in README.md
+  // (with no trailing newline).
+  void Print(std::ostream &os) const;
+};
+
+// A trace record, describing everything traced by the RTL in a single cycle.
+//
+// This has a fixed size so that it can be filled in by DPI calls from the
+// tracer without any allocation.
+struct OtbnTraceRecord {
+  // An upper bound on the number of body items in one cycle (two reads and a
+  // write for each register file, a memory read and write, and a read and a
+  // write for each ISPR and flag group).
+  static const unsigned kMaxItems = 32;
+
+  // The instruction header (None, Stall or Exec)
+  OtbnTraceHeader insn;
+  // The secure wipe header (None, WipeInProgress or WipeComplete)
+  OtbnTraceHeader wipe;
+
+  unsigned num_items;
+  OtbnTraceItem items[kMaxItems];
+
+  // Clear the record, ready to trace a new cycle
+  void Clear();
+
+  // True if there is nothing in the record
+  bool Empty() const;
+
+  // Append an item, returning a reference to it. The caller must fill in
+  // every field.
+  OtbnTraceItem &AddItem();
+};
+
+// Write a WLEN-bit value (least significant word first) as a hex string with
+// the data split into 32-bit chunks separated with '_'.
+void OtbnTracePrintWlen(std::ostream &os, const uint32_t *words);
+
+// Return the name of an ISPR, as shown in the trace, given its
+// otbn_pkg::ispr_e value.
+const char *OtbnTraceIsprName(unsigned ispr);
+
+#endif  // OPENTITAN_HW_IP_OTBN_DV_TRACER_CPP_OTBN_TRACE_RECORD_H_
@@ -6,7 +6,9 @@
 
 #include <algorithm>
 #include <cassert>
+#include <cstring>
 #include <memory>
+#include <svdpi.h>
 
 static std::unique_ptr<OtbnTraceSource> trace_source;
 
@@ -27,15 +29,105 @@ void OtbnTraceSource::RemoveListener(const OtbnTraceListener *listener) {
   listeners_.erase(it);
 }
 
-void OtbnTraceSource::Broadcast(const std::string &trace,
+void OtbnTraceSource::Broadcast(const OtbnTraceRecord &record,
                                 unsigned cycle_count) {
   for (OtbnTraceListener *listener : listeners_) {
-    listener->AcceptTraceString(trace, cycle_count);
+    listener->AcceptTraceRecord(record, cycle_count);
   }
 }
 
-extern "C" void accept_otbn_trace_string(const char *trace,
-                                         unsigned int cycle_count) {
-  assert(trace != nullptr);
-  OtbnTraceSource::get().Broadcast(trace, cycle_count);
+// The functions below are exposed over DPI and called by otbn_tracer.sv to
+// fill in the record for the current cycle. See the imports there for their
+// SystemVerilog signatures.
+
+extern "C" void otbn_trace_insn(unsigned char stall, unsigned char fetch_err,
+                                unsigned int pc, unsigned int insn) {
+  OtbnTraceHeader &hdr = OtbnTraceSource::get().CurrentRecord().insn;
+  hdr.type = stall ? OtbnTraceHeader::Stall : OtbnTraceHeader::Exec;
+  hdr.fetch_err = fetch_err;
+  hdr.pc = pc;
+  hdr.insn = fetch_err ? 0 : insn;
+}
+
+extern "C" void otbn_trace_wipe(unsigned char done) {
+  OtbnTraceSource::get().CurrentRecord().wipe.type =
+      done ? OtbnTraceHeader::WipeComplete : OtbnTraceHeader::WipeInProgress;
+}
+
+extern "C" void otbn_trace_reg(unsigned char is_write, unsigned int loc,
+                               unsigned int idx, const svBitVecVal *data) {
+  assert(loc <= OtbnTraceItem::Flags);
+
+  OtbnTraceItem &item = OtbnTraceSource::get().CurrentRecord().AddItem();
+  item.kind = is_write ? OtbnTraceItem::RegWrite : OtbnTraceItem::RegRead;
+  item.loc = (OtbnTraceItem::Loc)loc;
+  item.idx = idx;
+  item.num_words =
+      (loc == OtbnTraceItem::Gpr || loc == OtbnTraceItem::Flags)
+          ? 1
+          : kOtbnTraceWlenWords;
+  item.bad_mask = false;
+  item.addr = 0;
+  memcpy(item.data, data, item.num_words * sizeof(uint32_t));
+}
+
+extern "C" void otbn_trace_mem_read(unsigned int addr,
+                                    const svBitVecVal *data) {
+  OtbnTraceItem &item = OtbnTraceSource::get().CurrentRecord().AddItem();
+  item.kind = OtbnTraceItem::MemRead;
+  item.loc = OtbnTraceItem::Mem;
+  item.idx = 0;
+  item.num_words = kOtbnTraceWlenWords;
+  item.bad_mask = false;
+  item.addr = addr;
+  memcpy(item.data, data, sizeof item.data);
+}
+
+extern "C" void otbn_trace_mem_write(unsigned int addr,
+                                     const svBitVecVal *data,
+                                     const svBitVecVal *mask) {
+  OtbnTraceItem &item = OtbnTraceSource::get().CurrentRecord().AddItem();
+  item.kind = OtbnTraceItem::MemWrite;
+  item.loc = OtbnTraceItem::Mem;
+  item.idx = 0;
+  item.bad_mask = false;
+
+  // A write is expected to be either a full WLEN write or a write to a single
+  // aligned 32-bit word. In the latter case, we just trace that word, giving
+  // its own address.
+  unsigned full_words = 0, set_word = 0;
+  bool partial = false;
+  for (unsigned i = 0; i < kOtbnTraceWlenWords; ++i) {
+    if (mask[i] == ~0u) {
+      ++full_words;
+      set_word = i;
+    } else if (mask[i] != 0) {
+      partial = true;
+    }
+  }
+
+  if (!partial && full_words == kOtbnTraceWlenWords) {
+    item.num_words = kOtbnTraceWlenWords;
+    item.addr = addr;
+    memcpy(item.data, data, sizeof item.data);
+  } else if (!partial && full_words == 1) {
+    item.num_words = 1;
+    item.addr = addr + 4 * set_word;
+    item.data[0] = data[set_word];
+  } else {
+    item.num_words = kOtbnTraceWlenWords;
+    item.bad_mask = true;
+    item.addr = addr;
+    memcpy(item.data, data, sizeof item.data);
+    memcpy(item.mask, mask, sizeof item.mask);
+  }
+}
+
+extern "C" void otbn_trace_end(unsigned int cycle_count) {
+  OtbnTraceSource &source = OtbnTraceSource::get();
+  OtbnTraceRecord &record = source.CurrentRecord();
+  if (!record.Empty()) {
+    source.Broadcast(record, cycle_count);
+  }
+  record.Clear();
 }
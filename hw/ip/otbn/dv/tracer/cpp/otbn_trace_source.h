@@ -7,15 +7,17 @@
 #include <vector>
 
 #include "otbn_trace_listener.h"
+#include "otbn_trace_record.h"
 
 // A source for simulation trace data.
 //
 // This is a singleton class, which will be constructed on the first call to
 // get() or the first trace data that comes back from the simulation.
 //
-// The object is in charge of taking trace data from the simulation (which is
-// sent by calling the accept_otbn_trace_string DPI function) and passing it
-// out to registered listeners.
+// The object is in charge of taking trace data from the simulation and passing
+// it out to registered listeners. The simulation fills in a trace record for
+// the current cycle with the otbn_trace_* DPI functions, then calls
+// otbn_trace_end to send it on.
 
 class OtbnTraceSource {
  public:
@@ -28,11 +30,17 @@ class OtbnTraceSource {
   // Remove a listener from the source
   void RemoveListener(const OtbnTraceListener *listener);
 
-  // Send a trace string to all listeners
-  void Broadcast(const std::string &trace, unsigned cycle_count);
+  // Send a trace record to all listeners
+  void Broadcast(const OtbnTraceRecord &record, unsigned cycle_count);
+
+  // The record for the current cycle, filled in by the DPI functions
+  OtbnTraceRecord &CurrentRecord() { return record_; }
 
  private:
+  OtbnTraceSource() { record_.Clear(); }
+
   std::vector<OtbnTraceListener *> listeners_;
+  OtbnTraceRecord record_;
 };
 
 #endif  // OPENTITAN_HW_IP_OTBN_DV_TRACER_CPP_OTBN_TRACE_SOURCE_H_
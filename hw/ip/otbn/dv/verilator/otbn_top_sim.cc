@@ -33,15 +33,18 @@ extern int otbn_core_get_stop_pc();
 /**
  * SimCtrlExtension that adds a '--otbn-trace-file' command line option. If set
  * it sets up a LogTraceListener that will dump out the trace to the given log
- * file
+ * file. The '--otbn-trace-format' option selects a text (the default) or
+ * binary log.
  */
 class OtbnTraceUtil : public SimCtrlExtension {
  private:
   std::unique_ptr<LogTraceListener> log_trace_listener_;
 
-  bool SetupTraceLog(const std::string &log_filename) {
+  bool SetupTraceLog(const std::string &log_filename,
+                     LogTraceListener::Format format) {
     try {
-      log_trace_listener_ = std::make_unique<LogTraceListener>(log_filename);
+      log_trace_listener_ =
+          std::make_unique<LogTraceListener>(log_filename, format);
       OtbnTraceSource::get().AddListener(log_trace_listener_.get());
       return true;
     } catch (const std::runtime_error &err) {
@@ -56,16 +59,23 @@ class OtbnTraceUtil : public SimCtrlExtension {
   void PrintHelp() {
     std::cout << "Trace log utilities:\n\n"
                  "--otbn-trace-file=FILE\n"
-                 "  Write OTBN trace log to FILE\n\n";
+                 "  Write OTBN trace log to FILE\n\n"
+                 "--otbn-trace-format=text|binary\n"
+                 "  Format for the OTBN trace log (default: text). Binary logs\n"
+                 "  can be read with hw/ip/otbn/util/otbn_trace_log.py\n\n";
   }
 
  public:
   virtual bool ParseCLIArguments(int argc, char **argv, bool &exit_app) {
     const struct option long_options[] = {
         {"otbn-trace-file", required_argument, nullptr, 'l'},
+        {"otbn-trace-format", required_argument, nullptr, 'f'},
         {"help", no_argument, nullptr, 'h'},
         {nullptr, no_argument, nullptr, 0}};
 
+    std::string log_filename;
+    LogTraceListener::Format format = LogTraceListener::Text;
+
     // Reset the command parsing index in-case other utils have already parsed
     // some arguments
     optind = 1;
@@ -80,16 +90,37 @@ class OtbnTraceUtil : public SimCtrlExtension {
         case 1:
           break;
         case 'l':
-          return SetupTraceLog(optarg);
+          log_filename = optarg;
+          break;
+        case 'f':
+          if (std::string(optarg) == "text") {
+            format = LogTraceListener::Text;
+          } else if (std::string(optarg) == "binary") {
+            format = LogTraceListener::Binary;
+          } else {
+            std::cerr << "ERROR: Unknown OTBN trace format: " << optarg
+                      << std::endl;
+            return false;
+          }
+          break;
         case 'h':
           PrintHelp();
           break;
       }
     }
 
+    if (!log_filename.empty()) {
+      return SetupTraceLog(log_filename, format);
+    }
+
     return true;
   }
 
+  // Tracing is driven by the trace source, not by the clock
+  unsigned long GetNextWakeup(unsigned long sim_time) override {
+    return kNoWakeup;
+  }
+
   ~OtbnTraceUtil() {
     if (log_trace_listener_)
       OtbnTraceSource::get().RemoveListener(log_trace_listener_.get());
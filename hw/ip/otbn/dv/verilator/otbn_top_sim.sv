@@ -310,7 +310,8 @@ module otbn_top_sim (
   otbn_core_model #(
     .MemScope        ( ".." ),
     .DesignScope     ( DesignScope ),
-    .SecWipeEn       ( SecWipeEn    )
+    .SecWipeEn       ( SecWipeEn    ),
+    .MemShadowEn     ( 1'b1         )
   ) u_otbn_core_model (
     .clk_i                 ( IO_CLK ),
     .clk_edn_i             ( IO_CLK ),
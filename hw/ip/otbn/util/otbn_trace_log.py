@@ -0,0 +1,413 @@
+#!/usr/bin/env python3
+# Copyright lowRISC contributors.
+# Licensed under the Apache License, Version 2.0, see LICENSE for details.
+# SPDX-License-Identifier: Apache-2.0
+
+'''Read a binary OTBN trace log and export (part of) it as text
+
+Binary trace logs are written by LogTraceListener (see
+hw/ip/otbn/dv/tracer/README.md for the format). They are split into blocks,
+each of which has a summary of the cycles, PCs and registers that it covers,
+so we only need to decode the blocks that can match the requested filters.
+
+The text output is in the same format as a text trace log.
+
+'''
+
+import argparse
+import struct
+import sys
+from typing import (BinaryIO, Iterator, List, NamedTuple, Optional, TextIO,
+                    Tuple)
+
+_FILE_MAGIC = b'OTBNTRCE'
+_FILE_VERSION = 1
+_BLOCK_MAGIC = 0x4b4c4254
+_INDEX_MAGIC = 0x58444954
+
+_FILE_HDR = struct.Struct('<8sII')
+_BLOCK_HDR = struct.Struct('<II')
+_SUMMARY = struct.Struct('<IIIIIQQ')
+_INDEX_ENTRY = struct.Struct('<Q')
+_TRAILER = struct.Struct('<QII')
+
+# Item kinds and locations (see OtbnTraceItem in otbn_trace_record.h)
+_KIND_PREFIXES = ['<', '>', 'R', 'W']
+_LOC_GPR, _LOC_WDR, _LOC_ISPR, _LOC_FLAGS, _LOC_MEM = range(5)
+
+# ISPR names, indexed by otbn_pkg::ispr_e
+_ISPR_NAMES = ['MOD', 'RND', 'ACC', 'FLAGS', 'URND']
+
+_WLEN_WORDS = 8
+
+
+class BlockSummary(NamedTuple):
+    offset: int
+    num_records: int
+    first_cycle: int
+    last_cycle: int
+    min_pc: int
+    max_pc: int
+    # Bit (32 * loc + idx) is set if the block touches that register
+    regs: int
+
+
+class Item(NamedTuple):
+    kind: int
+    loc: int
+    idx: int
+    addr: int
+    narrow: bool
+    data: List[int]
+    mask: Optional[List[int]]
+
+
+class Record(NamedTuple):
+    cycle: int
+    # 0: none; 1: stall; 2: execute
+    insn_type: int
+    fetch_err: bool
+    pc: int
+    insn: int
+    # 0: none; 1: wipe in progress; 2: wipe complete
+    wipe_type: int
+    items: List[Item]
+
+
+def _read_summary(offset: int, raw: bytes) -> BlockSummary:
+    (num_records, first_cycle, last_cycle,
+     min_pc, max_pc, regs_lo, regs_hi) = _SUMMARY.unpack(raw)
+    return BlockSummary(offset, num_records, first_cycle, last_cycle,
+                        min_pc, max_pc, regs_lo | (regs_hi << 64))
+
+
+def read_index(handle: BinaryIO) -> List[BlockSummary]:
+    '''Read the block summaries for a trace log
+
+    If the log has no index (because the simulation didn't finish cleanly),
+    scan the block headers instead.
+
+    '''
+    handle.seek(0)
+    magic, version, _ = _FILE_HDR.unpack(handle.read(_FILE_HDR.size))
+    if magic != _FILE_MAGIC:
+        raise ValueError('Not a binary OTBN trace log.')
+    if version != _FILE_VERSION:
+        raise ValueError('Unsupported trace log version: {}.'.format(version))
+
+    handle.seek(0, 2)
+    file_len = handle.tell()
+    if file_len >= _FILE_HDR.size + _TRAILER.size:
+        handle.seek(file_len - _TRAILER.size)
+        index_off, num_blocks, idx_magic = \
+            _TRAILER.unpack(handle.read(_TRAILER.size))
+        if idx_magic == _INDEX_MAGIC:
+            handle.seek(index_off)
+            entry_len = _INDEX_ENTRY.size + _SUMMARY.size
+            raw = handle.read(num_blocks * entry_len)
+            ret = []
+            for i in range(num_blocks):
+                base = i * entry_len
+                off, = _INDEX_ENTRY.unpack_from(raw, base)
+                ret.append(_read_summary(
+                    off, raw[base + _INDEX_ENTRY.size:base + entry_len]))
+            return ret
+
+    # No index: walk the blocks from the start of the file. Stop at the first
+    # block that is damaged or that was only partly written.
+    ret = []
+    offset = _FILE_HDR.size
+    handle.seek(offset)
+    while True:
+        hdr = handle.read(_BLOCK_HDR.size + _SUMMARY.size)
+        if len(hdr) < _BLOCK_HDR.size + _SUMMARY.size:
+            break
+        magic, payload_len = _BLOCK_HDR.unpack_from(hdr)
+        if magic != _BLOCK_MAGIC:
+            break
+        if offset + len(hdr) + payload_len > file_len:
+            break
+        ret.append(_read_summary(offset, hdr[_BLOCK_HDR.size:]))
+        offset += len(hdr) + payload_len
+        handle.seek(offset)
+    return ret
+
+
+class _Reader:
+    '''A cursor over the payload of a block'''
+    def __init__(self, data: bytes) -> None:
+        self.data = data
+        self.pos = 0
+
+    def u8(self) -> int:
+        ret = self.data[self.pos]
+        self.pos += 1
+        return ret
+
+    def u32(self) -> int:
+        ret = int.from_bytes(self.data[self.pos:self.pos + 4], 'little')
+        self.pos += 4
+        return ret
+
+    def varint(self) -> int:
+        ret = 0
+        shift = 0
+        while True:
+            byte = self.u8()
+            ret |= (byte & 0x7f) << shift
+            if not byte & 0x80:
+                return ret
+            shift += 7
+
+    def words(self) -> List[int]:
+        nonzero = self.u8()
+        return [self.u32() if (nonzero >> i) & 1 else 0
+                for i in range(_WLEN_WORDS)]
+
+
+def read_block(handle: BinaryIO, summary: BlockSummary) -> Iterator[Record]:
+    '''Decode the records in a block'''
+    handle.seek(summary.offset)
+    magic, payload_len = _BLOCK_HDR.unpack(handle.read(_BLOCK_HDR.size))
+    if magic != _BLOCK_MAGIC:
+        raise ValueError('Bad block magic at offset {}.'
+                         .format(summary.offset))
+    handle.seek(_SUMMARY.size, 1)
+    payload = handle.read(payload_len)
+    if len(payload) != payload_len:
+        raise ValueError('Truncated block at offset {}.'
+                         .format(summary.offset))
+    rdr = _Reader(payload)
+
+    cycle = summary.first_cycle
+    prev_pc = 0
+    prev_insn = 0
+    for _ in range(summary.num_records):
+        cycle = (cycle + rdr.varint()) & 0xffffffff
+        flags = rdr.u8()
+        insn_type = flags & 3
+        fetch_err = bool(flags & 4)
+        wipe_type = (flags >> 3) & 3
+        repeat = bool(flags & 32)
+
+        pc = insn = 0
+        if insn_type:
+            if repeat:
+                pc = prev_pc
+                insn = prev_insn
+            else:
+                zz = rdr.varint()
+                pc = (prev_pc + ((zz >> 1) ^ -(zz & 1))) & 0xffffffff
+                if not fetch_err:
+                    insn = rdr.u32()
+            prev_pc = pc
+            if not fetch_err:
+                prev_insn = insn
+
+        items = []
+        for _ in range(rdr.varint()):
+            desc = rdr.u8()
+            kind = desc & 3
+            loc = (desc >> 2) & 7
+            bad_mask = bool(desc & 32)
+            narrow = bool(desc & 64)
+            idx = addr = 0
+            if loc == _LOC_MEM:
+                addr = rdr.varint()
+            else:
+                idx = rdr.u8()
+            data = [rdr.varint()] if narrow else rdr.words()
+            mask = rdr.words() if bad_mask else None
+            items.append(Item(kind, loc, idx, addr, narrow, data, mask))
+
+        yield Record(cycle, insn_type, fetch_err, pc, insn, wipe_type, items)
+
+
+def _wlen_str(words: List[int]) -> str:
+    return '0x' + '_'.join('{:08x}'.format(w) for w in reversed(words))
+
+
+def item_to_str(item: Item) -> str:
+    '''Render an item as it would appear in a text trace log'''
+    pfx = _KIND_PREFIXES[item.kind]
+    if item.loc == _LOC_GPR:
+        return '{} x{:02}: {:#010x}'.format(pfx, item.idx, item.data[0])
+    if item.loc == _LOC_WDR:
+        return '{} w{:02}: {}'.format(pfx, item.idx, _wlen_str(item.data))
+    if item.loc == _LOC_ISPR:
+        name = (_ISPR_NAMES[item.idx]
+                if item.idx < len(_ISPR_NAMES) else 'UNKNOWN_ISPR')
+        return '{} {}: {}'.format(pfx, name, _wlen_str(item.data))
+    if item.loc == _LOC_FLAGS:
+        val = item.data[0]
+        return ('{} FLAGS{}: {{C: {}, M: {}, L: {}, Z: {}}}'
+                .format(pfx, item.idx, val & 1, (val >> 1) & 1,
+                        (val >> 2) & 1, (val >> 3) & 1))
+
+    assert item.loc == _LOC_MEM
+    if item.mask is not None:
+        value = ('Mask ERR Mask: {} Data: {}'
+                 .format(_wlen_str(item.mask), _wlen_str(item.data)))
+    elif item.narrow:
+        value = '{:#010x}'.format(item.data[0])
+    else:
+        value = _wlen_str(item.data)
+    return '{} [{:#010x}]: {}'.format(pfx, item.addr, value)
+
+
+def record_to_lines(rec: Record) -> List[str]:
+    '''Render a record as it would appear in a text trace log'''
+    if rec.insn_type:
+        insn = '??' if rec.fetch_err else '{:#010x}'.format(rec.insn)
+        lines = ['{} {:09} PC: {:#010x}, insn: {}'
+                 .format('S' if rec.insn_type == 1 else 'E',
+                         rec.cycle, rec.pc, insn)]
+    else:
+        lines = ['! {:09}'.format(rec.cycle)]
+
+    if rec.wipe_type:
+        lines.append('    U ' if rec.wipe_type == 1 else '    V ')
+    for item in rec.items:
+        lines.append('    ' + item_to_str(item))
+    return lines
+
+
+def parse_reg(name: str) -> int:
+    '''Parse a register name, returning its bit in BlockSummary.regs'''
+    if name in _ISPR_NAMES and name != 'FLAGS':
+        return 32 * _LOC_ISPR + _ISPR_NAMES.index(name)
+
+    for pfx, loc, count in [('FLAGS', _LOC_FLAGS, 2),
+                            ('x', _LOC_GPR, 32),
+                            ('w', _LOC_WDR, 32)]:
+        if name.startswith(pfx) and name[len(pfx):].isdigit():
+            idx = int(name[len(pfx):])
+            if idx < count:
+                return 32 * loc + idx
+
+    raise ValueError('Unknown register name: {!r}.'.format(name))
+
+
+def parse_pc_range(arg: str) -> Tuple[int, int]:
+    '''Parse a PC or an inclusive range of PCs (LO:HI)'''
+    lo, _, hi = arg.partition(':')
+    lo_val = int(lo, 0)
+    return (lo_val, int(hi, 0) if hi else lo_val)
+
+
+class Filter:
+    def __init__(self,
+                 start_cycle: Optional[int],
+                 end_cycle: Optional[int],
+                 pc_ranges: List[Tuple[int, int]],
+                 reg_bits: List[int]) -> None:
+        self.start_cycle = start_cycle
+        self.end_cycle = end_cycle
+        self.pc_ranges = pc_ranges
+        self.reg_mask = 0
+        for bit in reg_bits:
+            self.reg_mask |= 1 << bit
+
+    def _cycles_overlap(self, lo: int, hi: int) -> bool:
+        return ((self.start_cycle is None or hi >= self.start_cycle) and
+                (self.end_cycle is None or lo <= self.end_cycle))
+
+    def _pc_matches(self, lo: int, hi: int) -> bool:
+        return (not self.pc_ranges or
+                any(hi >= r_lo and lo <= r_hi
+                    for r_lo, r_hi in self.pc_ranges))
+
+    def block_may_match(self, blk: BlockSummary) -> bool:
+        return (self._cycles_overlap(blk.first_cycle, blk.last_cycle) and
+                (not self.pc_ranges or
+                 (blk.min_pc <= blk.max_pc and
+                  self._pc_matches(blk.min_pc, blk.max_pc))) and
+                (not self.reg_mask or bool(blk.regs & self.reg_mask)))
+
+    def record_matches(self, rec: Record) -> bool:
+        if not self._cycles_overlap(rec.cycle, rec.cycle):
+            return False
+        if self.pc_ranges and not (rec.insn_type and
+                                   self._pc_matches(rec.pc, rec.pc)):
+            return False
+        if self.reg_mask:
+            return any(item.loc != _LOC_MEM and
+                       (self.reg_mask >> (32 * item.loc + item.idx)) & 1
+                       for item in rec.items)
+        return True
+
+
+def dump(handle: BinaryIO, blocks: List[BlockSummary],
+         flt: Filter, out: TextIO) -> None:
+    for blk in blocks:
+        # Blocks are in cycle order, so we can stop at the end of the range
+        if flt.end_cycle is not None and blk.first_cycle > flt.end_cycle:
+            break
+        if not flt.block_may_match(blk):
+            continue
+        for rec in read_block(handle, blk):
+            if flt.record_matches(rec):
+                out.write('\n'.join(record_to_lines(rec)) + '\n')
+
+
+def main() -> int:
+    parser = argparse.ArgumentParser(
+        description='Export a binary OTBN trace log as text.')
+    parser.add_argument('log', help='The binary trace log to read.')
+    parser.add_argument('--start-cycle', type=int,
+                        help='Skip records before this cycle.')
+    parser.add_argument('--end-cycle', type=int,
+                        help='Skip records after this cycle.')
+    parser.add_argument('--pc', action='append', default=[],
+                        metavar='PC[:PC]',
+                        help=('Only show records for instructions at this PC '
+                              '(or in this inclusive range of PCs). Can be '
+                              'given more than once.'))
+    parser.add_argument('--reg', action='append', default=[],
+                        help=('Only show records that read or write this '
+                              'register (for example x5, w12, ACC or FLAGS0). '
+                              'Can be given more than once.'))
+    parser.add_argument('--index', action='store_true',
+                        help='Print the block index instead of records.')
+    parser.add_argument('-o', '--output', type=argparse.FileType('w'),
+                        default=sys.stdout,
+                        help='Where to write the output (default: stdout).')
+    args = parser.parse_args()
+
+    try:
+        pc_ranges = [parse_pc_range(arg) for arg in args.pc]
+        reg_bits = [parse_reg(arg) for arg in args.reg]
+    except ValueError as err:
+        print('Error: {}'.format(err), file=sys.stderr)
+        return 1
+
+    with open(args.log, 'rb') as handle:
+        try:
+            blocks = read_index(handle)
+        except ValueError as err:
+            print('Error reading {}: {}'.format(args.log, err),
+                  file=sys.stderr)
+            return 1
+
+        if args.index:
+            for blk in blocks:
+                args.output.write('offset {:#x}: {} records, cycles {}-{}, '
+                                  'PCs {:#010x}-{:#010x}\n'
+                                  .format(blk.offset, blk.num_records,
+                                          blk.first_cycle, blk.last_cycle,
+                                          blk.min_pc, blk.max_pc))
+            return 0
+
+        flt = Filter(args.start_cycle, args.end_cycle, pc_ranges, reg_bits)
+        try:
+            dump(handle, blocks, flt, args.output)
+        except ValueError as err:
+            print('Error reading {}: {}'.format(args.log, err),
+                  file=sys.stderr)
+            return 1
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -360,3 +360,370 @@ std::vector<uint8_t> scramble_decrypt_data(
 
   return data_dec;
 }
+
+// Allocation-free implementation. See scramble_model.h for a description of
+// the word format.
+
+namespace {
+// Lookup tables for the word-oriented implementation. These are derived from
+// the reference code (so they can't get out of sync) and built on first use.
+struct ScrTables {
+  ScrTables();
+
+  // PRINCE S-box and its inverse, applied to both nibbles of a byte
+  uint8_t prince_sbox[256];
+  uint8_t prince_sbox_inv[256];
+
+  // PRESENT S-box and its inverse, applied to both nibbles of a byte
+  uint8_t present_sbox[256];
+  uint8_t present_sbox_inv[256];
+
+  // The byte with its bits in reverse order
+  uint8_t bit_reverse[256];
+
+  // PRINCE M' layer, split by input byte. Since the layer is linear, M'(x) is
+  // the XOR of m_prime[i][byte i of x] for each i.
+  uint64_t m_prime[8][256];
+};
+
+ScrTables::ScrTables() {
+  for (unsigned b = 0; b < 256; ++b) {
+    unsigned lo = b & 0xf, hi = b >> 4;
+
+    prince_sbox[b] = ::prince_sbox(lo) | (::prince_sbox(hi) << 4);
+    prince_sbox_inv[b] = ::prince_sbox_inv(lo) | (::prince_sbox_inv(hi) << 4);
+    present_sbox[b] = PRESENT_SBOX4[lo] | (PRESENT_SBOX4[hi] << 4);
+    present_sbox_inv[b] = PRESENT_SBOX4_INV[lo] | (PRESENT_SBOX4_INV[hi] << 4);
+
+    bit_reverse[b] = 0;
+    for (unsigned j = 0; j < 8; ++j) {
+      bit_reverse[b] |= ((b >> j) & 1) << (7 - j);
+    }
+
+    for (unsigned i = 0; i < 8; ++i) {
+      m_prime[i][b] = prince_m_prime_layer((uint64_t)b << (8 * i));
+    }
+  }
+}
+}  // namespace
+
+static const ScrTables &get_scr_tables() {
+  static const ScrTables tables;
+  return tables;
+}
+
+// A mask for the bottom width bits of a 64-bit word
+static uint64_t width_mask(uint32_t width) {
+  assert(width <= 64);
+  return (width == 64) ? ~(uint64_t)0 : (((uint64_t)1 << width) - 1);
+}
+
+// Read width bits (at most 64) from vec, starting at bit_pos
+static uint64_t read_u64_bits(const uint64_t *vec, uint32_t bit_pos,
+                              uint32_t width) {
+  uint32_t word = bit_pos / 64;
+  uint32_t shift = bit_pos % 64;
+
+  uint64_t ret = vec[word] >> shift;
+  if (shift && (shift + width > 64)) {
+    ret |= vec[word + 1] << (64 - shift);
+  }
+  return ret & width_mask(width);
+}
+
+// OR the bottom width bits (at most 64) of bits into vec at bit_pos
+static void or_u64_bits(uint64_t *vec, uint32_t bit_pos, uint32_t width,
+                        uint64_t bits) {
+  uint32_t word = bit_pos / 64;
+  uint32_t shift = bit_pos % 64;
+
+  bits &= width_mask(width);
+  vec[word] |= bits << shift;
+  if (shift && (shift + width > 64)) {
+    vec[word + 1] |= bits >> (64 - shift);
+  }
+}
+
+// Zero any bits at or above bit_width in vec
+static void mask_u64_vec(uint64_t vec[kScrMaxWidthWords], uint32_t bit_width) {
+  assert(bit_width <= kScrMaxWidth);
+  for (uint32_t i = 0; i < kScrMaxWidthWords; ++i) {
+    if (bit_width <= 64 * i) {
+      vec[i] = 0;
+    } else if (bit_width < 64 * (i + 1)) {
+      vec[i] &= width_mask(bit_width % 64);
+    }
+  }
+}
+
+// Apply a byte-wide lookup table to each byte of in
+static uint64_t lookup_bytes(uint64_t in, const uint8_t table[256]) {
+  uint64_t out = 0;
+  for (unsigned i = 0; i < 8; ++i) {
+    out |= (uint64_t)table[(in >> (8 * i)) & 0xff] << (8 * i);
+  }
+  return out;
+}
+
+static uint64_t prince_m_prime_layer_u64(const ScrTables &tables, uint64_t in) {
+  uint64_t out = 0;
+  for (unsigned i = 0; i < 8; ++i) {
+    out ^= tables.m_prime[i][(in >> (8 * i)) & 0xff];
+  }
+  return out;
+}
+
+// PRINCE encryption with the new key schedule. This computes the same result
+// as prince_enc_dec_uint64(in, k0, k1, 0, num_half_rounds, 0).
+static uint64_t prince_enc_u64(const ScrTables &tables, uint64_t in,
+                               uint64_t k0, uint64_t k1, int num_half_rounds) {
+  uint64_t state = in ^ k0 ^ k1 ^ prince_round_constant(0);
+
+  for (int round = 1; round <= num_half_rounds; ++round) {
+    state = lookup_bytes(state, tables.prince_sbox);
+    state = prince_shift_rows(prince_m_prime_layer_u64(tables, state), 0);
+    state ^= ((round % 2 == 1) ? k0 : k1) ^ prince_round_constant(round);
+  }
+
+  state = lookup_bytes(state, tables.prince_sbox);
+  state = prince_m_prime_layer_u64(tables, state);
+  state = lookup_bytes(state, tables.prince_sbox_inv);
+
+  for (int round = 1; round <= num_half_rounds; ++round) {
+    int constant_idx = 10 - num_half_rounds + round;
+    state ^= (((num_half_rounds + round + 1) % 2 == 1) ? k0 : k1) ^
+             prince_round_constant(constant_idx);
+    state = prince_m_prime_layer_u64(tables, prince_shift_rows(state, 1));
+    state = lookup_bytes(state, tables.prince_sbox_inv);
+  }
+
+  return state ^ k1 ^ prince_round_constant(11) ^ prince_k0_to_k0_prime(k0);
+}
+
+// Word-oriented equivalent of scramble_sbox_layer
+static uint64_t scramble_sbox_layer_u64(uint64_t in, uint32_t bit_width,
+                                        const uint8_t sbox[256]) {
+  // Nibbles that are entirely below bit_width go through the SBOX. Any
+  // remaining bits are copied straight through.
+  uint64_t sbox_mask = width_mask(4 * (bit_width / 4));
+  return (lookup_bytes(in, sbox) & sbox_mask) | (in & ~sbox_mask);
+}
+
+// Word-oriented equivalent of scramble_flip_layer
+static uint64_t scramble_flip_layer_u64(const ScrTables &tables, uint64_t in,
+                                        uint32_t bit_width) {
+  uint64_t reversed = 0;
+  for (unsigned i = 0; i < 8; ++i) {
+    reversed |= (uint64_t)tables.bit_reverse[(in >> (8 * i)) & 0xff]
+                << (56 - 8 * i);
+  }
+  return reversed >> (64 - bit_width);
+}
+
+// Gather the even-numbered bits of in into the bottom 32 bits of the result
+static uint64_t gather_even_bits(uint64_t in) {
+  in &= 0x5555555555555555;
+  in = (in | (in >> 1)) & 0x3333333333333333;
+  in = (in | (in >> 2)) & 0x0f0f0f0f0f0f0f0f;
+  in = (in | (in >> 4)) & 0x00ff00ff00ff00ff;
+  in = (in | (in >> 8)) & 0x0000ffff0000ffff;
+  in = (in | (in >> 16)) & 0x00000000ffffffff;
+  return in;
+}
+
+// Spread the bottom 32 bits of in into the even-numbered bits of the result
+// (the inverse of gather_even_bits)
+static uint64_t scatter_even_bits(uint64_t in) {
+  in &= 0x00000000ffffffff;
+  in = (in | (in << 16)) & 0x0000ffff0000ffff;
+  in = (in | (in << 8)) & 0x00ff00ff00ff00ff;
+  in = (in | (in << 4)) & 0x0f0f0f0f0f0f0f0f;
+  in = (in | (in << 2)) & 0x3333333333333333;
+  in = (in | (in << 1)) & 0x5555555555555555;
+  return in;
+}
+
+// Word-oriented equivalent of scramble_perm_layer
+static uint64_t scramble_perm_layer_u64(uint64_t in, uint32_t bit_width,
+                                        bool invert) {
+  uint32_t half_width = bit_width / 2;
+  uint64_t half_mask = width_mask(half_width);
+
+  // Where bit_width isn't even, the final bit stays where it is
+  uint64_t out = (bit_width % 2) ? (in & ((uint64_t)1 << (bit_width - 1))) : 0;
+
+  if (invert) {
+    out |= scatter_even_bits(in & half_mask);
+    out |= scatter_even_bits((in >> half_width) & half_mask) << 1;
+  } else {
+    uint64_t pairs = in & width_mask(2 * half_width);
+    out |= gather_even_bits(pairs);
+    out |= gather_even_bits(pairs >> 1) << half_width;
+  }
+
+  return out;
+}
+
+// Word-oriented equivalent of scramble_subst_perm_enc (bit_width <= 64)
+static uint64_t scramble_subst_perm_enc_u64(const ScrTables &tables,
+                                            uint64_t in, uint64_t key,
+                                            uint32_t bit_width,
+                                            uint32_t num_rounds) {
+  uint64_t state = in;
+
+  for (uint32_t i = 0; i < num_rounds; ++i) {
+    state ^= key;
+
+    state = scramble_sbox_layer_u64(state, bit_width, tables.present_sbox);
+    state = scramble_flip_layer_u64(tables, state, bit_width);
+    state = scramble_perm_layer_u64(state, bit_width, false);
+  }
+
+  return state ^ key;
+}
+
+// Word-oriented equivalent of scramble_subst_perm_dec (bit_width <= 64)
+static uint64_t scramble_subst_perm_dec_u64(const ScrTables &tables,
+                                            uint64_t in, uint64_t key,
+                                            uint32_t bit_width,
+                                            uint32_t num_rounds) {
+  uint64_t state = in;
+
+  for (uint32_t i = 0; i < num_rounds; ++i) {
+    state ^= key;
+
+    state = scramble_perm_layer_u64(state, bit_width, true);
+    state = scramble_flip_layer_u64(tables, state, bit_width);
+    state = scramble_sbox_layer_u64(state, bit_width, tables.present_sbox_inv);
+  }
+
+  return state ^ key;
+}
+
+// Word-oriented equivalent of scramble_gen_keystream
+static void scramble_gen_keystream_u64(
+    const ScrTables &tables, uint64_t keystream[kScrMaxWidthWords],
+    uint32_t addr, uint32_t addr_width, const uint64_t nonce[kScrMaxWidthWords],
+    const uint64_t key[kScrKeyWords], uint32_t keystream_width,
+    int num_half_rounds, bool repeat_keystream) {
+  assert(addr_width <= 32);
+  assert(keystream_width <= kScrMaxWidth);
+
+  uint32_t num_blocks = (keystream_width + kPrinceWidth - 1) / kPrinceWidth;
+  uint32_t num_princes = repeat_keystream ? 1 : num_blocks;
+  uint32_t nonce_bits_per_prince = kPrinceWidth - addr_width;
+
+  // The key is stored little endian, so the top 64 bits are K0 and the bottom
+  // 64 bits are K1.
+  uint64_t k0 = key[1], k1 = key[0];
+
+  for (uint32_t i = 0; i < kScrMaxWidthWords; ++i) {
+    keystream[i] = 0;
+  }
+
+  for (uint32_t i = 0; i < num_princes; ++i) {
+    // Bottom addr_width bits of the IV are the address. The other bits are
+    // taken from the nonce, with each PRINCE instance using different bits.
+    uint64_t iv = (addr & width_mask(addr_width)) |
+                  (read_u64_bits(nonce, i * nonce_bits_per_prince,
+                                 nonce_bits_per_prince)
+                   << addr_width);
+
+    keystream[i] = prince_enc_u64(tables, iv, k0, k1, num_half_rounds);
+  }
+
+  if (repeat_keystream) {
+    for (uint32_t i = 1; i < num_blocks; ++i) {
+      keystream[i] = keystream[0];
+    }
+  }
+
+  mask_u64_vec(keystream, keystream_width);
+}
+
+// Word-oriented equivalent of scramble_subst_perm_full_width, working in place
+static void scramble_subst_perm_full_width_u64(
+    const ScrTables &tables, uint64_t data[kScrMaxWidthWords],
+    uint32_t bit_width, uint32_t subst_perm_width, bool enc) {
+  assert(bit_width <= kScrMaxWidth);
+  assert(0 < subst_perm_width && subst_perm_width <= 64);
+
+  uint64_t out[kScrMaxWidthWords] = {0};
+
+  for (uint32_t lo = 0; lo < bit_width; lo += subst_perm_width) {
+    // Where bit_width does not evenly divide into subst_perm_width the
+    // final block is smaller.
+    uint32_t block_width = std::min(subst_perm_width, bit_width - lo);
+
+    uint64_t block = read_u64_bits(data, lo, block_width);
+    block = enc ? scramble_subst_perm_enc_u64(tables, block, 0, block_width,
+                                              kNumDataSubstPermRounds)
+                : scramble_subst_perm_dec_u64(tables, block, 0, block_width,
+                                              kNumDataSubstPermRounds);
+    or_u64_bits(out, lo, block_width, block);
+  }
+
+  for (uint32_t i = 0; i < kScrMaxWidthWords; ++i) {
+    data[i] = out[i];
+  }
+}
+
+uint32_t scramble_addr_u64(uint32_t addr_in, uint32_t addr_width,
+                           const uint64_t nonce[kScrMaxWidthWords],
+                           uint32_t nonce_width) {
+  assert(addr_width <= 32);
+  assert(addr_width <= nonce_width && nonce_width <= kScrMaxWidth);
+
+  // Address is scrambled by using substitution/permutation layer with the top
+  // addr_width bits of the nonce used as a key.
+  uint64_t addr_key =
+      read_u64_bits(nonce, nonce_width - addr_width, addr_width);
+
+  return scramble_subst_perm_enc_u64(get_scr_tables(),
+                                     addr_in & width_mask(addr_width), addr_key,
+                                     addr_width, kNumAddrSubstPermRounds);
+}
+
+void scramble_encrypt_data_u64(uint64_t data[kScrMaxWidthWords],
+                               uint32_t data_width, uint32_t subst_perm_width,
+                               uint32_t addr, uint32_t addr_width,
+                               const uint64_t nonce[kScrMaxWidthWords],
+                               const uint64_t key[kScrKeyWords],
+                               bool repeat_keystream) {
+  const ScrTables &tables = get_scr_tables();
+
+  uint64_t keystream[kScrMaxWidthWords];
+  scramble_gen_keystream_u64(tables, keystream, addr, addr_width, nonce, key,
+                             data_width, kNumPrinceHalfRounds,
+                             repeat_keystream);
+
+  mask_u64_vec(data, data_width);
+  for (uint32_t i = 0; i < kScrMaxWidthWords; ++i) {
+    data[i] ^= keystream[i];
+  }
+
+  scramble_subst_perm_full_width_u64(tables, data, data_width,
+                                     subst_perm_width, true);
+}
+
+void scramble_decrypt_data_u64(uint64_t data[kScrMaxWidthWords],
+                               uint32_t data_width, uint32_t subst_perm_width,
+                               uint32_t addr, uint32_t addr_width,
+                               const uint64_t nonce[kScrMaxWidthWords],
+                               const uint64_t key[kScrKeyWords],
+                               bool repeat_keystream) {
+  const ScrTables &tables = get_scr_tables();
+
+  mask_u64_vec(data, data_width);
+  scramble_subst_perm_full_width_u64(tables, data, data_width,
+                                     subst_perm_width, false);
+
+  uint64_t keystream[kScrMaxWidthWords];
+  scramble_gen_keystream_u64(tables, keystream, addr, addr_width, nonce, key,
+                             data_width, kNumPrinceHalfRounds,
+                             repeat_keystream);
+
+  for (uint32_t i = 0; i < kScrMaxWidthWords; ++i) {
+    data[i] ^= keystream[i];
+  }
+}
@@ -68,4 +68,61 @@ std::vector<uint8_t> scramble_encrypt_data(
     uint32_t addr_width, const std::vector<uint8_t> &nonce,
     const std::vector<uint8_t> &key, bool repeat_keystream);
 
+// Allocation-free implementation of the scrambling model.
+//
+// The functions above are a straightforward, bit-at-a-time model and serve as
+// the reference. The functions below compute the same results but work on
+// 64-bit words (with table-driven PRINCE and substitution/permutation layers),
+// so are much faster. Wide values are passed as fixed-size arrays of 64-bit
+// words in little endian word order (bit i of a value is bit i % 64 of word i /
+// 64). Bits above the given widths are ignored on input and zero on output.
+
+// Maximum width of data and nonce values for the allocation-free functions
+const uint32_t kScrMaxWidth = 320;
+const uint32_t kScrMaxWidthWords = kScrMaxWidth / 64;
+// Number of 64-bit words in a (128-bit) scrambling key
+const uint32_t kScrKeyWords = 2;
+
+/** Scramble an address (see scramble_addr)
+ *
+ * @param addr_in      Address to scramble (at most 32 bits wide)
+ * @param addr_width   Width of the address in bits
+ * @param nonce        Scrambling nonce
+ * @param nonce_width  Width of scramble nonce in bits
+ * @return Scrambled address
+ */
+uint32_t scramble_addr_u64(uint32_t addr_in, uint32_t addr_width,
+                           const uint64_t nonce[kScrMaxWidthWords],
+                           uint32_t nonce_width);
+
+/** Decrypt scrambled data in place (see scramble_decrypt_data)
+ *
+ * @param data             Data to decrypt, overwritten with the result
+ * @param data_width       Width of data in bits
+ * @param subst_perm_width Width over which the substitution/permutation network
+ *                         is applied (at most 64)
+ * @param addr             Data address
+ * @param addr_width       Width of the address in bits
+ * @param nonce            Scrambling nonce
+ * @param key              Scrambling key
+ * @param repeat_keystream As for scramble_decrypt_data
+ */
+void scramble_decrypt_data_u64(uint64_t data[kScrMaxWidthWords],
+                               uint32_t data_width, uint32_t subst_perm_width,
+                               uint32_t addr, uint32_t addr_width,
+                               const uint64_t nonce[kScrMaxWidthWords],
+                               const uint64_t key[kScrKeyWords],
+                               bool repeat_keystream);
+
+/** Encrypt data in place (see scramble_encrypt_data)
+ *
+ * The arguments are as for scramble_decrypt_data_u64.
+ */
+void scramble_encrypt_data_u64(uint64_t data[kScrMaxWidthWords],
+                               uint32_t data_width, uint32_t subst_perm_width,
+                               uint32_t addr, uint32_t addr_width,
+                               const uint64_t nonce[kScrMaxWidthWords],
+                               const uint64_t key[kScrKeyWords],
+                               bool repeat_keystream);
+
 #endif  // OPENTITAN_HW_IP_PRIM_DV_PRIM_RAM_SCR_CPP_SCRAMBLE_MODEL_H_
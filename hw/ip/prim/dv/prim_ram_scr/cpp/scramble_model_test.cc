@@ -0,0 +1,161 @@
+// Copyright lowRISC contributors.
+// Licensed under the Apache License, Version 2.0, see LICENSE for details.
+// SPDX-License-Identifier: Apache-2.0
+
+// Differential test for the allocation-free scrambling functions, checking
+// them against the reference (byte vector) implementation over random keys,
+// nonces, addresses and data.
+//
+// This runs as a Bazel test:
+//
+//   bazel test //hw/ip/prim/dv/prim_ram_scr/cpp:scramble_model_test
+//
+// To run more iterations or pick a different seed, run the binary directly:
+//
+//   scramble_model_test [iterations] [seed]
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <stdint.h>
+#include <vector>
+
+#include "scramble_model.h"
+
+// Convert between little-endian byte vectors and 64-bit words
+static std::vector<uint8_t> words_to_bytes(const uint64_t *words,
+                                           uint32_t bit_width) {
+  std::vector<uint8_t> bytes((bit_width + 7) / 8);
+  for (uint32_t i = 0; i < bytes.size(); ++i) {
+    bytes[i] = (words[i / 8] >> (8 * (i % 8))) & 0xff;
+  }
+  return bytes;
+}
+
+static void bytes_to_words(uint64_t *words, uint32_t num_words,
+                           const std::vector<uint8_t> &bytes) {
+  for (uint32_t i = 0; i < num_words; ++i) {
+    words[i] = 0;
+  }
+  for (uint32_t i = 0; i < bytes.size(); ++i) {
+    words[i / 8] |= (uint64_t)bytes[i] << (8 * (i % 8));
+  }
+}
+
+// Zero the bits of vec above bit_width
+static void mask_bytes(std::vector<uint8_t> &vec, uint32_t bit_width) {
+  if (bit_width % 8) {
+    vec.back() &= (1 << (bit_width % 8)) - 1;
+  }
+}
+
+struct TestConfig {
+  uint32_t data_width;
+  uint32_t subst_perm_width;
+  bool repeat_keystream;
+};
+
+int main(int argc, char **argv) {
+  unsigned long iterations = (argc > 1) ? strtoul(argv[1], nullptr, 0) : 2000;
+  unsigned long seed = (argc > 2) ? strtoul(argv[2], nullptr, 0) : 1;
+
+  // Configurations used by ScrambledEcc32MemArea (39 bits per 32-bit word,
+  // possibly several words wide), plus some odd widths to exercise partial
+  // nibbles and blocks.
+  const TestConfig configs[] = {{39, 39, true},   {39, 39, false},
+                                {78, 39, true},   {78, 39, false},
+                                {312, 39, true},  {312, 39, false},
+                                {32, 32, false},  {64, 64, false},
+                                {136, 17, false}, {12, 3, true}};
+
+  std::mt19937_64 rng(seed);
+  unsigned long failures = 0;
+
+  for (unsigned long iter = 0; iter < iterations; ++iter) {
+    for (const TestConfig &cfg : configs) {
+      uint32_t num_princes = cfg.repeat_keystream
+                                 ? 1
+                                 : (cfg.data_width + kPrinceWidth - 1) /
+                                       kPrinceWidth;
+      uint32_t nonce_width = num_princes * kPrinceWidth;
+      uint32_t addr_width = 1 + rng() % 20;
+
+      uint64_t key[2] = {rng(), rng()};
+      uint64_t nonce[kScrMaxWidthWords], data[kScrMaxWidthWords];
+      for (uint32_t i = 0; i < kScrMaxWidthWords; ++i) {
+        nonce[i] = rng();
+        data[i] = rng();
+      }
+      uint32_t addr = rng() & ((1u << addr_width) - 1);
+
+      std::vector<uint8_t> key_vec = words_to_bytes(key, 128);
+      std::vector<uint8_t> nonce_vec = words_to_bytes(nonce, nonce_width);
+      std::vector<uint8_t> data_vec = words_to_bytes(data, cfg.data_width);
+      std::vector<uint8_t> addr_vec = words_to_bytes(
+          std::vector<uint64_t>{addr}.data(), addr_width);
+      mask_bytes(data_vec, cfg.data_width);
+      mask_bytes(addr_vec, addr_width);
+
+      // Address scrambling
+      std::vector<uint8_t> exp_addr =
+          scramble_addr(addr_vec, addr_width, nonce_vec, nonce_width);
+      uint64_t exp_addr_word;
+      bytes_to_words(&exp_addr_word, 1, exp_addr);
+      uint32_t got_addr =
+          scramble_addr_u64(addr, addr_width, nonce, nonce_width);
+
+      // Encryption
+      std::vector<uint8_t> exp_enc = scramble_encrypt_data(
+          data_vec, cfg.data_width, cfg.subst_perm_width, addr_vec,
+          addr_width, nonce_vec, key_vec, cfg.repeat_keystream);
+      uint64_t exp_enc_words[kScrMaxWidthWords];
+      bytes_to_words(exp_enc_words, kScrMaxWidthWords, exp_enc);
+
+      uint64_t got_enc_words[kScrMaxWidthWords];
+      std::copy(data, data + kScrMaxWidthWords, got_enc_words);
+      scramble_encrypt_data_u64(got_enc_words, cfg.data_width,
+                                cfg.subst_perm_width, addr, addr_width, nonce,
+                                key, cfg.repeat_keystream);
+
+      // Decryption (of the random data, rather than the encrypted value, so
+      // that this checks something different from the encryption above)
+      std::vector<uint8_t> exp_dec = scramble_decrypt_data(
+          data_vec, cfg.data_width, cfg.subst_perm_width, addr_vec,
+          addr_width, nonce_vec, key_vec, cfg.repeat_keystream);
+      uint64_t exp_dec_words[kScrMaxWidthWords];
+      bytes_to_words(exp_dec_words, kScrMaxWidthWords, exp_dec);
+
+      uint64_t got_dec_words[kScrMaxWidthWords];
+      std::copy(data, data + kScrMaxWidthWords, got_dec_words);
+      scramble_decrypt_data_u64(got_dec_words, cfg.data_width,
+                                cfg.subst_perm_width, addr, addr_width, nonce,
+                                key, cfg.repeat_keystream);
+
+      bool addr_ok = got_addr == exp_addr_word;
+      bool enc_ok = std::equal(got_enc_words, got_enc_words + kScrMaxWidthWords,
+                               exp_enc_words);
+      bool dec_ok = std::equal(got_dec_words, got_dec_words + kScrMaxWidthWords,
+                               exp_dec_words);
+
+      if (!(addr_ok && enc_ok && dec_ok)) {
+        std::cerr << "Mismatch at iteration " << iter << " (data_width "
+                  << cfg.data_width << ", subst_perm_width "
+                  << cfg.subst_perm_width << ", repeat_keystream "
+                  << cfg.repeat_keystream << ", addr_width " << addr_width
+                  << "):" << (addr_ok ? "" : " addr")
+                  << (enc_ok ? "" : " encrypt") << (dec_ok ? "" : " decrypt")
+                  << std::endl;
+        ++failures;
+      }
+    }
+  }
+
+  if (failures) {
+    std::cerr << failures << " mismatches found." << std::endl;
+    return 1;
+  }
+
+  std::cout << "All " << iterations << " iterations passed." << std::endl;
+  return 0;
+}
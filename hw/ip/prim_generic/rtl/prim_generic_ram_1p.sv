@@ -74,6 +74,17 @@ module prim_generic_ram_1p import prim_ram_1p_pkg::*; #(
     end
   end
 
+`ifndef SYNTHESIS
+  // Keep any host-side shadow copy of the memory up to date
+  always @(posedge clk_i) begin
+    if (req_i && write_i) begin
+      simutil_mark_dirty(int'(addr_i));
+    end
+  end
+`endif
+
+`define PRIM_UTIL_MEMLOAD_TRACK_WRITES
   `include "prim_util_memload.svh"
+`undef PRIM_UTIL_MEMLOAD_TRACK_WRITES
 `endif
 endmodule
@@ -102,6 +102,23 @@ module prim_generic_ram_2p import prim_ram_2p_pkg::*; #(
     end
   end
 
+`ifndef SYNTHESIS
+  // Keep any host-side shadow copy of the memory up to date
+  always @(posedge clk_a_i) begin
+    if (a_req_i && a_write_i) begin
+      simutil_mark_dirty(int'(a_addr_i));
+    end
+  end
+
+  always @(posedge clk_b_i) begin
+    if (b_req_i && b_write_i) begin
+      simutil_mark_dirty(int'(b_addr_i));
+    end
+  end
+`endif
+
+`define PRIM_UTIL_MEMLOAD_TRACK_WRITES
   `include "prim_util_memload.svh"
+`undef PRIM_UTIL_MEMLOAD_TRACK_WRITES
 `endif
 endmodule
@@ -12,8 +12,9 @@ module chip_sim_tb (
   logic cio_uart_rx_p2d, cio_uart_tx_d2p, cio_uart_tx_en_d2p;
 
   logic cio_spi_device_sck_p2d, cio_spi_device_csb_p2d;
+  logic [3:0] cio_spi_device_sd_p2d, cio_spi_device_sd_d2p, cio_spi_device_sd_en_d2p;
   logic cio_spi_device_sdi_p2d;
-  logic cio_spi_device_sdo_d2p, cio_spi_device_sdo_en_d2p;
+  logic [3:0] spi_sd_p2d, spi_sd_en_p2d;
 
   logic cio_usbdev_sense_p2d;
   logic cio_usbdev_se0_d2p;
@@ -42,9 +43,9 @@ module chip_sim_tb (
     // communication with SPI
     .cio_spi_device_sck_p2d_i(cio_spi_device_sck_p2d),
     .cio_spi_device_csb_p2d_i(cio_spi_device_csb_p2d),
-    .cio_spi_device_sdi_p2d_i(cio_spi_device_sdi_p2d),
-    .cio_spi_device_sdo_d2p_o(cio_spi_device_sdo_d2p),
-    .cio_spi_device_sdo_en_d2p_o(cio_spi_device_sdo_en_d2p),
+    .cio_spi_device_sd_p2d_i(cio_spi_device_sd_p2d),
+    .cio_spi_device_sd_d2p_o(cio_spi_device_sd_d2p),
+    .cio_spi_device_sd_en_d2p_o(cio_spi_device_sd_en_d2p),
 
     // communication with USB
     .cio_usbdev_sense_p2d_i(cio_usbdev_sense_p2d),
@@ -78,9 +79,23 @@ module chip_sim_tb (
   // The baud rate set to match FPGA implementation; the frequency is "artificial". Both baud rate
   // frequency must match the settings used in the on-chip software at
   // `sw/device/lib/arch/device_sim_verilator.c`.
+  //
+  // Define UARTTxBackdoor to skip the bit-serial transmission of UART output: the UART's TX FIFO
+  // is drained at one character per cycle and each character is handed straight to the UART DPI
+  // model. Software that polls the UART sees it go idle almost at once, so console output costs
+  // next to no simulated time. The TX pin toggles meaninglessly and the UART's tx_empty
+  // interrupt never fires, so tests of the UART itself need the default mode. This uses `force`,
+  // which needs Verilator 4.220 or later.
+`ifdef UARTTxBackdoor
+  localparam bit UartTxBackdoor = 1'b1;
+`else
+  localparam bit UartTxBackdoor = 1'b0;
+`endif
+
   uartdpi #(
     .BAUD('d7_200),
-    .FREQ('d500_000)
+    .FREQ('d500_000),
+    .RX_BACKDOOR(UartTxBackdoor)
   ) u_uart (
     .clk_i  (clk_i),
     .rst_ni (rst_ni),
@@ -88,6 +103,24 @@ module chip_sim_tb (
     .rx_i   (cio_uart_tx_d2p)
   );
 
+  `define UART0_CORE u_dut.top_earlgrey.u_uart0.uart_core
+
+  if (UartTxBackdoor) begin : gen_uart_tx_backdoor
+    // Pretend the transmitter is always idle, so the TX FIFO is popped on every cycle that the
+    // transmitter is enabled.
+    initial begin
+      force `UART0_CORE.tx_uart_idle = 1'b1;
+    end
+
+    always @(posedge `UART0_CORE.clk_i) begin
+      if (`UART0_CORE.tx_fifo_rready) begin
+        u_uart.backdoor_write(`UART0_CORE.tx_fifo_data);
+      end
+    end
+  end
+
+  `undef UART0_CORE
+
 `ifdef DMIDirectTAP
   // OpenOCD direct DMI TAP
   bind rv_dm dmidpi u_dmidpi (
@@ -130,10 +163,19 @@ module chip_sim_tb (
     .spi_device_sck_o     (cio_spi_device_sck_p2d),
     .spi_device_csb_o     (cio_spi_device_csb_p2d),
     .spi_device_sdi_o     (cio_spi_device_sdi_p2d),
-    .spi_device_sdo_i     (cio_spi_device_sdo_d2p),
-    .spi_device_sdo_en_i  (cio_spi_device_sdo_en_d2p)
+    .spi_device_sdo_i     (cio_spi_device_sd_d2p[1]),
+    .spi_device_sdo_en_i  (cio_spi_device_sd_en_d2p[1]),
+    .spi_device_sd_o      (spi_sd_p2d),
+    .spi_device_sd_en_o   (spi_sd_en_p2d),
+    .spi_device_sd_i      (cio_spi_device_sd_d2p),
+    .spi_device_sd_en_i   (cio_spi_device_sd_en_d2p)
   );
 
+  // The host drives SD0 in single lane mode, and any lines it enables in dual
+  // and quad mode. Undriven lines read as 0.
+  assign cio_spi_device_sd_p2d = {spi_sd_en_p2d[3:1] & spi_sd_p2d[3:1],
+                                  cio_spi_device_sdi_p2d};
+
   // USB DPI
   usbdpi u_usbdpi (
     .clk_i           (clk_i),
@@ -190,10 +232,16 @@ module chip_sim_tb (
     u_sw_test_status_if.sw_test_status_addr = `SIM_SRAM_IF.start_addr;
   end
 
+  // Write out the trace window (if the simulation is recording one) when the software test fails.
+  import "DPI-C" function void simutil_trace_trigger(input string reason);
+
   always @(posedge clk_i) begin
     if (u_sw_test_status_if.sw_test_done) begin
       $display("Verilator sim termination requested");
       $display("Your simulation wrote to 0x%h", u_sw_test_status_if.sw_test_status_addr);
+      if (!u_sw_test_status_if.sw_test_passed) begin
+        simutil_trace_trigger("SW test failure");
+      end
       dv_test_status_pkg::dv_test_status(u_sw_test_status_if.sw_test_passed);
       $finish;
     end
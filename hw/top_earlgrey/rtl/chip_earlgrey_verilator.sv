@@ -20,9 +20,9 @@ module chip_earlgrey_verilator (
   // communication with SPI
   input cio_spi_device_sck_p2d_i,
   input cio_spi_device_csb_p2d_i,
-  input cio_spi_device_sdi_p2d_i,
-  output logic cio_spi_device_sdo_d2p_o,
-  output logic cio_spi_device_sdo_en_d2p_o,
+  input [3:0] cio_spi_device_sd_p2d_i,
+  output logic [3:0] cio_spi_device_sd_d2p_o,
+  output logic [3:0] cio_spi_device_sd_en_d2p_o,
 
   // communication with USB
   input cio_usbdev_sense_p2d_i,
@@ -57,7 +57,10 @@ module chip_earlgrey_verilator (
     dio_in = '0;
     dio_in[DioSpiDeviceSck] = cio_spi_device_sck_p2d_i;
     dio_in[DioSpiDeviceCsb] = cio_spi_device_csb_p2d_i;
-    dio_in[DioSpiDeviceSd0] = cio_spi_device_sdi_p2d_i;
+    dio_in[DioSpiDeviceSd0] = cio_spi_device_sd_p2d_i[0];
+    dio_in[DioSpiDeviceSd1] = cio_spi_device_sd_p2d_i[1];
+    dio_in[DioSpiDeviceSd2] = cio_spi_device_sd_p2d_i[2];
+    dio_in[DioSpiDeviceSd3] = cio_spi_device_sd_p2d_i[3];
     dio_in[DioUsbdevUsbDp] = cio_usbdev_dp_p2d_i;
     dio_in[DioUsbdevUsbDn] = cio_usbdev_dn_p2d_i;
   end
@@ -87,8 +90,10 @@ module chip_earlgrey_verilator (
   assign cio_usbdev_dn_d2p_o = dio_out[DioUsbdevUsbDn];
   assign cio_usbdev_dn_en_d2p_o = dio_oe[DioUsbdevUsbDn];
 
-  assign cio_spi_device_sdo_d2p_o = dio_out[DioSpiDeviceSd1];
-  assign cio_spi_device_sdo_en_d2p_o = dio_oe[DioSpiDeviceSd1];
+  assign cio_spi_device_sd_d2p_o = {dio_out[DioSpiDeviceSd3], dio_out[DioSpiDeviceSd2],
+                                    dio_out[DioSpiDeviceSd1], dio_out[DioSpiDeviceSd0]};
+  assign cio_spi_device_sd_en_d2p_o = {dio_oe[DioSpiDeviceSd3], dio_oe[DioSpiDeviceSd2],
+                                       dio_oe[DioSpiDeviceSd1], dio_oe[DioSpiDeviceSd0]};
 
   logic [pinmux_reg_pkg::NMioPads-1:0] mio_in;
   logic [pinmux_reg_pkg::NMioPads-1:0] mio_out;
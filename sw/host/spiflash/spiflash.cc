@@ -34,6 +34,11 @@ FTDI Options:
 Verilator Options:
   [--verilator=filehandle] Enables Verilator mode with SPI filehandle.
   [--process-delay=microseconds] Frame transmission delay for frame processing.
+  [--verilator-packet] Send each frame as one SPI transaction. Requires the
+    simulation to be run with +SPIDPI_PACKET_spi0.
+  [--verilator-shm=socket] Enables Verilator mode, sending packet mode frames
+    through shared memory. Requires the simulation to be run with
+    +SPIDPI_SHM_spi0=socket.
 
 Protocol Options:
   [--erase-delay=microseconds] Frame transmission delay for flash erase.
@@ -176,11 +181,14 @@ bool ParseArgs(int argc, char **argv, SpiFlashOpts *options) {
       {"verilator", required_argument, nullptr, 's'},
       {"erase-delay", required_argument, nullptr, 'e'},
       {"process-delay", required_argument, nullptr, 'p'},
+      {"verilator-packet", no_argument, nullptr, 'k'},
+      {"verilator-shm", required_argument, nullptr, 'm'},
       {"help", no_argument, nullptr, 'h'},
       {nullptr, no_argument, nullptr, 0}};
 
   while (true) {
-    int c = getopt_long(argc, argv, "i:d:e:n:p:s:x:h?", long_options, nullptr);
+    int c = getopt_long(argc, argv, "i:d:e:km:n:p:s:x:h?", long_options,
+                        nullptr);
     if (c == -1) {
       // if only input file was given default to using FTDI
       if (!options->input.empty() &&
@@ -204,6 +212,14 @@ bool ParseArgs(int argc, char **argv, SpiFlashOpts *options) {
       case 'e':
         options->flash_erase_delay_us = std::stoi(optarg);
         break;
+      case 'k':
+        options->verilator_options.packet_mode = true;
+        break;
+      case 'm':
+        options->action = SpiFlashAction::kVerilator;
+        options->verilator_options.shm_socket = optarg;
+        options->verilator_options.packet_mode = true;
+        break;
       case 'n':
         options->action = SpiFlashAction::kFtdi;
         options->ftdi_options.device_serial_number = optarg;
@@ -4,6 +4,7 @@
 
 #include "sw/host/spiflash/verilator_spi_interface.h"
 
+#include <algorithm>
 #include <cstring>
 #include <fcntl.h>
 #include <iostream>
@@ -17,6 +18,10 @@ namespace opentitan {
 namespace spiflash {
 namespace {
 
+// Packet mode frame header, see hw/dv/dpi/spidpi/spidpi.h.
+constexpr uint8_t kPacketMagic = 'T';
+constexpr size_t kPacketHeaderSize = 16;
+
 /** Configure `fd` as a serial port with baud rate 9600. */
 bool SetTermOpts(int fd) {
   struct termios options;
@@ -62,9 +67,14 @@ VerilatorSpiInterface::~VerilatorSpiInterface() {
   if (fd_ != -1) {
     close(fd_);
   }
+  shm_ring_client_close(shm_);
 }
 
 bool VerilatorSpiInterface::Init() {
+  if (!options_.shm_socket.empty()) {
+    shm_ = shm_ring_client_connect(options_.shm_socket.c_str());
+    return shm_ != nullptr;
+  }
   fd_ = OpenDevice(options_.target);
   if (fd_ < 0) {
     return false;
@@ -72,15 +82,80 @@ bool VerilatorSpiInterface::Init() {
   return true;
 }
 
+bool VerilatorSpiInterface::SendPacketHeader(size_t size) {
+  // Single lane, SPI mode 0, no dummy cycles, nothing to read after the data
+  // (the reply comes back full duplex).
+  uint8_t hdr[kPacketHeaderSize] = {
+      kPacketMagic,
+      0,
+      static_cast<uint8_t>(options_.packet_clock_div),
+      static_cast<uint8_t>(options_.packet_clock_div >> 8),
+  };
+  for (int i = 0; i < 4; ++i) {
+    hdr[8 + i] = static_cast<uint8_t>(size >> (8 * i));
+  }
+  if (shm_ != nullptr) {
+    return shm_ring_client_write(shm_, hdr, sizeof(hdr));
+  }
+  size_t bytes_written = 0;
+  while (bytes_written != sizeof(hdr)) {
+    ssize_t write_size =
+        write(fd_, &hdr[bytes_written], sizeof(hdr) - bytes_written);
+    if (write_size == -1) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        std::cerr << "Failed to write header to spi interface, errno: "
+                  << strerror(errno) << std::endl;
+        return false;
+      }
+      continue;
+    }
+    bytes_written += write_size;
+  }
+  return true;
+}
+
+bool VerilatorSpiInterface::TransmitFrameShm(const uint8_t *tx, size_t size) {
+  rx_.resize(size);
+  if (!SendPacketHeader(size) || !shm_ring_client_write(shm_, tx, size)) {
+    std::cerr << "Simulation went away while sending frame" << std::endl;
+    return false;
+  }
+  size_t bytes_read = 0;
+  while (bytes_read != size) {
+    size_t read_size =
+        shm_ring_client_read(shm_, &rx_[bytes_read], size - bytes_read,
+                             /*timeout_ms=*/-1);
+    if (read_size == 0) {
+      std::cerr << "Simulation went away while receiving frame. Bytes read: "
+                << bytes_read << " expected: " << size << std::endl;
+      return false;
+    }
+    bytes_read += read_size;
+  }
+  usleep(options_.frame_process_delay_us);
+  return true;
+}
+
 bool VerilatorSpiInterface::TransmitFrame(const uint8_t *tx, size_t size) {
+  if (shm_ != nullptr) {
+    return TransmitFrameShm(tx, size);
+  }
+
   size_t bytes_written = 0;
   size_t bytes_read = 0;
+  // The simulation runs a transaction for every 4 bytes unless it is in packet
+  // mode, where the whole frame is one transaction.
+  size_t chunk_size = options_.packet_mode ? size : 4;
 
   rx_.resize(size);
 
+  if (options_.packet_mode && !SendPacketHeader(size)) {
+    return false;
+  }
+
   while (bytes_written != size || bytes_read != size) {
     if (bytes_written != size) {
-      ssize_t write_size = size - bytes_written >= 4 ? 4 : size - bytes_written;
+      ssize_t write_size = std::min(chunk_size, size - bytes_written);
       write_size = write(fd_, &tx[bytes_written], write_size);
       switch (write_size) {
         case -1:
@@ -98,7 +173,7 @@ bool VerilatorSpiInterface::TransmitFrame(const uint8_t *tx, size_t size) {
     }
 
     if (bytes_read != size) {
-      ssize_t read_size = size - bytes_read >= 4 ? 4 : size - bytes_read;
+      ssize_t read_size = std::min(chunk_size, size - bytes_read);
       read_size = read(fd_, &rx_[bytes_read], read_size);
       switch (read_size) {
         case -1:
@@ -8,6 +8,7 @@
 #include <string>
 #include <vector>
 
+#include "hw/dv/dpi/common/shm_ring/shm_ring.h"
 #include "sw/host/spiflash/spi_interface.h"
 
 namespace opentitan {
@@ -30,14 +31,27 @@ class VerilatorSpiInterface : public SpiInterface {
     /** Time to wait between frame transmitted and frame processing completed in
      *  microseconds. */
     int32_t frame_process_delay_us = 20000000;
+
+    /** Send each frame as a single packet mode transaction. The simulation
+     *  must be run with the `+SPIDPI_PACKET_spi0` plusarg. */
+    bool packet_mode = false;
+
+    /** Simulation clock cycles between SPI clock edges in packet mode. */
+    uint16_t packet_clock_div = 2;
+
+    /** Unix socket of the simulation's shared-memory rings. When set, it is
+     *  used instead of `target` and frames are sent in packet mode. The
+     *  simulation must be run with the `+SPIDPI_SHM_spi0=<socket>` plusarg. */
+    std::string shm_socket;
   };
 
   /** Constructs instance pointing to the `spi_filename` file path. */
   explicit VerilatorSpiInterface(Options options)
-      : options_(options), fd_(-1) {}
+      : options_(options), fd_(-1), shm_(nullptr) {}
 
   /**
-   * Closes the internal file handle used to communicate with the SPI device.
+   * Closes the internal file handle or shared-memory connection used to
+   * communicate with the SPI device.
    */
   ~VerilatorSpiInterface() override;
 
@@ -46,8 +60,15 @@ class VerilatorSpiInterface : public SpiInterface {
   bool CheckHash(const uint8_t *tx, size_t size) final;
 
  private:
+  /** Sends the packet mode header for a frame of `size` bytes. */
+  bool SendPacketHeader(size_t size);
+
+  /** Sends a frame and reads back its reply through the shared memory. */
+  bool TransmitFrameShm(const uint8_t *tx, size_t size);
+
   Options options_;
   int fd_;
+  shm_ring_client *shm_;
   std::vector<uint8_t> rx_;
 };
 
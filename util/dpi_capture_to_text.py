@@ -0,0 +1,396 @@
+#!/usr/bin/env python3
+# Copyright lowRISC contributors.
+# Licensed under the Apache License, Version 2.0, see LICENSE for details.
+# SPDX-License-Identifier: Apache-2.0
+r"""Convert a USB or SPI DPI monitor capture to the monitor's text log
+
+usbdpi and spidpi write a binary capture instead of a text log when run with
+the +USBDPI_CAPTURE_<name> or +SPIDPI_CAPTURE_<name> plusarg. This tool
+produces the text that the monitor would have logged. The capture type is
+detected from its header.
+
+USB captures are pcapng files with the USB 2.0 link type (see
+hw/dv/dpi/usbdpi/monitor_usb.c). SPI captures hold a record of each pin
+change (see hw/dv/dpi/spidpi/monitor_spi.c).
+"""
+
+import argparse
+import struct
+import sys
+from typing import BinaryIO, Iterator, List, Optional, TextIO, Tuple
+
+# USB
+
+DECODE_PID = [
+    "Rsvd", "OUT", "ACK", "DATA0", "PING", "SOF", "NYET", "DATA2", "SPLIT",
+    "IN", "NAK", "DATA1", "PRE/ERR", "SETUP", "STALL", "MDATA"
+]
+
+USB_PID_OUT = 0xe1
+USB_PID_IN = 0x69
+USB_PID_SOF = 0xa5
+USB_PID_SETUP = 0x2d
+USB_PID_DATA0 = 0xc3
+USB_PID_DATA1 = 0x4b
+
+# Bytes after the PID in the largest packet: an isochronous data packet with
+# 1023 bytes of data and a CRC16 (must match MON_BYTES_SIZE in monitor_usb.c)
+MON_BYTES_SIZE = 1023 + 2
+
+PCAPNG_SHB = 0x0a0d0d0a
+PCAPNG_IDB = 0x00000001
+PCAPNG_EPB = 0x00000006
+PCAPNG_BYTE_ORDER = 0x1a2b3c4d
+PCAPNG_OPT_COMMENT = 1
+PCAPNG_OPT_EPB_FLAGS = 2
+PCAPNG_FLAG_INBOUND = 1
+LINKTYPE_USB_2_0 = 288
+
+
+def crc5(value: int, nbits: int) -> int:
+    '''USB CRC5, as CRC5() in usb_crc.c'''
+    crc = 0x1f
+    for _ in range(nbits):
+        if (value ^ crc) & 1:
+            crc = (crc >> 1) ^ 0x14
+        else:
+            crc >>= 1
+        value >>= 1
+    return crc ^ 0x1f
+
+
+def crc16(data: bytes) -> int:
+    '''USB CRC16, as CRC16() in usb_crc.c'''
+    crc = 0xffff
+    for byte in data:
+        for _ in range(8):
+            if (byte ^ crc) & 1:
+                crc = (crc >> 1) ^ 0xa001
+            else:
+                crc >>= 1
+            byte >>= 1
+    return crc ^ 0xffff
+
+
+def pid_2data(pid: int, d0: int, d1: int) -> str:
+    comp_crc = crc5((d1 & 7) << 8 | d0, 11)
+    crcok = "OK" if comp_crc == d1 >> 3 else "BAD"
+    name = DECODE_PID[pid & 0xf]
+    if pid in (USB_PID_IN, USB_PID_OUT, USB_PID_SETUP):
+        return "{} {}.{} (CRC5 {:02x} {})".format(name, d0 & 0x7f,
+                                                 (d1 & 7) << 1 | d0 >> 7,
+                                                 d1 >> 3, crcok)
+    if pid == USB_PID_SOF:
+        return "SOF {:03x} (CRC5 {:02x} {})".format((d1 & 7) << 8 | d0,
+                                                   d1 >> 3, crcok)
+    if pid in (USB_PID_DATA0, USB_PID_DATA1):
+        return "{} {:02x}, {:02x} ({})".format(
+            name, d0, d1, "CRC16 BAD" if d0 | d1 else "NULL")
+    return "{} {:02x}, {:02x} (CRC5 {})".format(name, d0, d1, crcok)
+
+
+def read_pcapng(f: BinaryIO) -> Iterator[Tuple[int, int, bytes, bool]]:
+    '''Yield (sop, eop, packet, from_host) for each packet in the capture'''
+    endian = '<'
+    while True:
+        hdr = f.read(8)
+        if len(hdr) < 8:
+            return
+        if struct.unpack('<I', hdr[:4])[0] == PCAPNG_SHB:
+            magic = f.read(4)
+            endian = '<' if struct.unpack('<I', magic)[0] == \
+                PCAPNG_BYTE_ORDER else '>'
+            block_type, block_len = struct.unpack(endian + 'II', hdr)
+            body = magic + f.read(block_len - 12)
+        else:
+            block_type, block_len = struct.unpack(endian + 'II', hdr)
+            body = f.read(block_len - 8)
+        if len(body) != block_len - 8:
+            raise ValueError('truncated pcapng block')
+
+        if block_type == PCAPNG_IDB:
+            linktype = struct.unpack(endian + 'H', body[:2])[0]
+            if linktype != LINKTYPE_USB_2_0:
+                raise ValueError(
+                    'unexpected pcapng link type {}'.format(linktype))
+        if block_type != PCAPNG_EPB:
+            continue
+
+        _, ts_hi, ts_lo, caplen, _ = struct.unpack(endian + 'IIIII',
+                                                    body[:20])
+        sop = ts_hi << 32 | ts_lo
+        packet = body[20:20 + caplen]
+        pos = 20 + ((caplen + 3) & ~3)
+        from_host = True
+        eop = sop
+        while pos + 4 <= len(body) - 4:
+            code, length = struct.unpack(endian + 'HH', body[pos:pos + 4])
+            value = body[pos + 4:pos + 4 + length]
+            if code == 0:
+                break
+            if code == PCAPNG_OPT_EPB_FLAGS:
+                flags = struct.unpack(endian + 'I', value)[0]
+                from_host = (flags & 3) != PCAPNG_FLAG_INBOUND
+            elif code == PCAPNG_OPT_COMMENT:
+                words = value.decode('utf-8').split()
+                if len(words) == 2 and words[0] == 'eop':
+                    eop = int(words[1])
+            pos += 4 + ((length + 3) & ~3)
+        yield sop, eop, packet, from_host
+
+
+def usb_to_text(f: BinaryIO, out: TextIO, loglevel: int) -> None:
+    '''Write the packet logging of monitor_usb() for a pcapng capture'''
+    log = loglevel & 0x2
+    compact = loglevel & 0x1
+    lastpid = 0
+    for sop, eop, packet, from_host in read_pcapng(f):
+        who = 'H' if from_host else 'D'
+        span = "mon: {:8d} -- {:8d}: ({}) SOP, PID".format(sop, eop, who)
+        if packet:
+            lastpid = packet[0]
+        data = bytearray(packet[1:])
+        n = len(data)
+        if (log or compact) and packet and n > 0:
+            if compact and n == 2:
+                out.write("{} {}, EOP\n".format(
+                    span, pid_2data(lastpid, data[0], data[1])))
+                continue
+            if compact and n == 1:
+                out.write("{} {} {:02x} EOP\n".format(
+                    span, DECODE_PID[lastpid & 0xf], data[0]))
+                continue
+            if compact:
+                out.write("{} {}, EOP\n".format(span,
+                                                DECODE_PID[lastpid & 0xf]))
+            out.write("mon:     {}: ".format("h->d" if from_host else "d->h"))
+            comp_crc16 = crc16(bytes(data[:max(n - 2, 0)]))
+            pkt_crc16 = (data[n - 2] if n >= 2 else 0) | data[n - 1] << 8
+            text = True
+            for i in range(n):
+                if (i & 0xf) == 0xf:
+                    sep = "\nmon:           "
+                elif i + 1 == n:
+                    sep = ""
+                else:
+                    sep = ", "
+                out.write("{:02x}{}".format(data[i], sep))
+                if data[i] in (0x0d, 0x0a):
+                    data[i] = ord('_')
+                if data[i] == 0:
+                    data[i] = ord('?')
+                if i >= n - 2:
+                    data[i] = 0
+                elif data[i] < 32 or data[i] > 127:
+                    text = False
+            more = "..." if n == MON_BYTES_SIZE else ""
+            if comp_crc16 == pkt_crc16:
+                out.write("{} CRCOK\n".format(more))
+            else:
+                out.write("{}\nmon:           CRC16 {:04x} BAD expected "
+                          "{:04x}\n".format(more, pkt_crc16, comp_crc16))
+            if text and n > 2:
+                out.write("mon:          {}\n".format(
+                    data[:n - 2].decode('latin-1')))
+        elif compact:
+            out.write("{} {} EOP\n".format(span, DECODE_PID[lastpid & 0xf]))
+
+
+# SPI
+
+SPICAP_MODE_CHANGE = 0xffff
+
+# Bits in p2d and d2p, as in spidpi.h
+P2D_SCK = 0x1
+P2D_CSB = 0x2
+P2D_SDI = 0x4
+D2P_SDO = 0x2
+D2P_SDO_EN = 0x1
+
+MON_BUFLEN = 65
+
+BST_OLD_EN = 0x1
+BST_OLD = 0x2
+BST_NEW_EN = 0x4
+BST_NEW = 0x8
+
+VERT = [
+    " | ", "\\  ", " | ", "  /", "/  ", "|  ", "/  ", " / ", " | ", "\\  ",
+    " | ", "  /", "  \\", " \\ ", "  \\", "  |"
+]
+
+
+def vertical_bit(cur: int, old: int, mask: int, enmask: int) -> str:
+    if enmask:
+        cur_en = BST_NEW_EN if cur & enmask else 0
+        old_en = BST_OLD_EN if old & enmask else 0
+    else:
+        cur_en = BST_NEW_EN
+        old_en = BST_OLD_EN
+    cur = BST_NEW if cur & mask else 0
+    old = BST_OLD if old & mask else 0
+    return VERT[cur | old | cur_en | old_en]
+
+
+class SpiMonitor:
+    '''The logging of monitor_spi() in monitor_spi.c'''
+    def __init__(self, out: TextIO, mode: int, loglevel: int) -> None:
+        self.out = out
+        self.loglevel = loglevel
+        self.set_mode(mode)
+        self.msbfirst = True
+        self.prev_p2d = 0
+        self.prev_d2p = 0
+        self.bpos = 0
+        self.poff = 0
+        self.mobuf: List[int] = [0] * MON_BUFLEN
+        self.sobuf: List[int] = [0] * MON_BUFLEN
+
+    def set_mode(self, mode: int) -> None:
+        self.cpol = (mode & 2) >> 1
+        self.cpha = mode & 1
+
+    def log_signals(self, tick: int, p2d: int, d2p: int) -> None:
+        self.out.write("{:8d} SPI: ".format(tick))
+        self.out.write(vertical_bit(p2d, self.prev_p2d, P2D_CSB, 0) + "  ")
+        self.out.write(vertical_bit(p2d, self.prev_p2d, P2D_SCK, 0) + "  ")
+        self.out.write(vertical_bit(p2d, self.prev_p2d, P2D_SDI, 0) + "  ")
+        self.out.write(
+            vertical_bit(d2p, self.prev_d2p, D2P_SDO, D2P_SDO_EN) + "  ")
+
+    def log_packet(self) -> None:
+        self.out.write("H>D: ")
+        for i in range(self.poff):
+            self.out.write("{:02x} ".format(self.mobuf[i]))
+        self.out.write("D>H: ")
+        for i in range(self.poff):
+            self.out.write("{:02x} ".format(self.sobuf[i]))
+        self.out.write("\n")
+
+    def capture_bit(self, p2d: int, d2p: int) -> None:
+        sck = 1 if p2d & P2D_SCK else 0
+        if (self.cpol == self.cpha) != (sck == 0):
+            if (p2d & P2D_SDI) != (self.prev_p2d & P2D_SDI):
+                self.out.write("Check SDI tSU ")
+            if (d2p & D2P_SDO) != (self.prev_d2p & D2P_SDO):
+                self.out.write("Check SDO tSU ")
+            if p2d & P2D_SDI:
+                self.mobuf[self.poff] |= self.bpos
+            if d2p & D2P_SDO:
+                self.sobuf[self.poff] |= self.bpos
+            if self.msbfirst:
+                self.bpos >>= 1
+            else:
+                self.bpos = (self.bpos << 1) & 0xff
+            if self.bpos == 0:
+                self.bpos = 0x80 if self.msbfirst else 0x1
+                if self.poff < MON_BUFLEN - 1:
+                    self.poff += 1
+                self.mobuf[self.poff] = 0
+                self.sobuf[self.poff] = 0
+
+    def tick(self, tick: int, p2d: int, d2p: int) -> None:
+        logbits = self.loglevel & 0x1
+        logpkts = self.loglevel & 0x8
+        if tick == 1 and logbits:
+            self.out.write("              CSB SCK MO  MI\n")
+        if p2d == self.prev_p2d and d2p == self.prev_d2p and p2d & P2D_CSB:
+            return
+        if logbits:
+            self.log_signals(tick, p2d, d2p)
+        if not logpkts:
+            self.out.write("\n")
+        elif (p2d & P2D_CSB) and not (self.prev_p2d & P2D_CSB):
+            self.log_packet()
+            self.poff = 0
+        else:
+            csb = p2d & P2D_CSB
+            prev_csb = self.prev_p2d & P2D_CSB
+            if not csb and prev_csb:
+                self.poff = 0
+                self.mobuf[0] = 0
+                self.sobuf[0] = 0
+                self.bpos = 0x80 if self.msbfirst else 0x1
+            elif not csb and not prev_csb:
+                if (p2d & P2D_SCK) != (self.prev_p2d & P2D_SCK):
+                    self.capture_bit(p2d, d2p)
+            if logbits:
+                self.out.write("\n")
+        self.prev_p2d = p2d
+        self.prev_d2p = d2p
+
+
+def spi_to_text(f: BinaryIO, out: TextIO, loglevel: Optional[int]) -> None:
+    '''Replay a spidpi capture through the SPI monitor'''
+    hdr = f.read(8)
+    version, mode, cap_loglevel = struct.unpack('<HBB', hdr[4:])
+    if version != 1:
+        raise ValueError('unsupported SPI capture version {}'.format(version))
+    mon = SpiMonitor(out, mode, cap_loglevel if loglevel is None else loglevel)
+    # The monitor is called every tick, but only logs ticks without a change
+    # while CSB is low, so only those need to be filled in.
+    last = 0
+    p2d = 0
+    d2p = 0
+    while True:
+        rec = f.read(8)
+        if len(rec) < 8:
+            break
+        tick, rec_p2d, rec_d2p = struct.unpack('<IHH', rec)
+        if rec_p2d == SPICAP_MODE_CHANGE:
+            # Takes effect after the monitor has seen this tick
+            end = tick + 1
+        else:
+            end = tick
+        if not (p2d & P2D_CSB):
+            for t in range(last + 1, end):
+                mon.tick(t, p2d, d2p)
+        if rec_p2d == SPICAP_MODE_CHANGE:
+            mon.set_mode(rec_d2p)
+            last = max(last, tick)
+            continue
+        p2d = rec_p2d
+        d2p = rec_d2p
+        mon.tick(tick, p2d, d2p)
+        last = tick
+
+
+def main() -> int:
+    parser = argparse.ArgumentParser(
+        description=__doc__,
+        formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('capture',
+                        type=argparse.FileType('rb'),
+                        help='capture file written by usbdpi or spidpi')
+    parser.add_argument('-o',
+                        '--output',
+                        type=argparse.FileType('w'),
+                        default=sys.stdout,
+                        help='text output (default stdout)')
+    parser.add_argument('-l',
+                        '--loglevel',
+                        type=lambda x: int(x, 0),
+                        help='monitor LOG_LEVEL to format for (default 1 for '
+                        'USB, the simulation LOG_LEVEL for SPI)')
+    args = parser.parse_args()
+
+    magic = args.capture.read(4)
+    args.capture.seek(0)
+    try:
+        if magic == b'SPIC':
+            spi_to_text(args.capture, args.output, args.loglevel)
+        elif magic == struct.pack('<I', PCAPNG_SHB):
+            usb_to_text(args.capture, args.output,
+                        1 if args.loglevel is None else args.loglevel)
+        else:
+            print('{}: not a USB or SPI capture'.format(args.capture.name),
+                  file=sys.stderr)
+            return 1
+    except (ValueError, struct.error) as err:
+        print('{}: {}'.format(args.capture.name, err), file=sys.stderr)
+        return 1
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())